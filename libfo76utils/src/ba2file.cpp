@@ -4,13 +4,17 @@
 #include "ba2file.hpp"
 
 #include <new>
+#include <thread>
+#include <atomic>
 
 #include <sys/types.h>
 #include <sys/stat.h>
 #if defined(_WIN32) || defined(_WIN64)
 #  include <io.h>
+#  include <process.h>
 #else
 #  include <dirent.h>
+#  include <unistd.h>
 #endif
 
 inline std::uint64_t BA2File::hashFunction(const std::string_view& s)
@@ -461,6 +465,8 @@ void BA2File::loadArchivesFromDir(const char *pathName, size_t prefixLen)
 
   try
   {
+    if (indexCacheSources)
+      addIndexCacheSource(pathName);
     std::set< ArchiveDirListItem >  fileList;
     ArchiveDirListItem  f;
     std::string baseNameL;
@@ -571,6 +577,9 @@ void BA2File::loadArchivesFromDir(const char *pathName, size_t prefixLen)
     closedir(d);
     d = nullptr;
 #endif
+    // archives are sorted after loose files and sub-directories,
+    // and are indexed last
+    std::vector< std::string >  archiveNames;
     for (std::set< ArchiveDirListItem >::const_iterator
              i = fileList.end(); i != fileList.begin(); )
     {
@@ -586,12 +595,16 @@ void BA2File::loadArchivesFromDir(const char *pathName, size_t prefixLen)
       else if (i->fileSize == -1)
       {
         loadArchivesFromDir(fullName.c_str(), prefixLen);
+        continue;
       }
       else
       {
-        loadArchiveFile(fullName.c_str(), prefixLen);
+        archiveNames.push_back(fullName);
       }
+      if (indexCacheSources)
+        addIndexCacheSource(fullName.c_str());
     }
+    loadArchivesParallel(archiveNames, prefixLen);
   }
   catch (...)
   {
@@ -716,6 +729,8 @@ void BA2File::loadArchiveFile(const char *fileName, size_t prefixLen)
       delete bufp;
       return;
     }
+    archiveFiles.reserve(archiveFile + 1);
+    archiveFileNames.emplace_back(fileName);
     archiveFiles.push_back(bufp);
   }
   catch (...)
@@ -735,6 +750,593 @@ void BA2File::loadArchiveFile(const char *fileName, size_t prefixLen)
   }
 }
 
+struct BA2File::ArchiveLoadQueue
+{
+  const BA2File *parent;
+  const std::vector< std::string > *fileNames;
+  size_t  prefixLen;
+  std::atomic< size_t > nextArchive;
+  std::vector< BA2File * >    archiveIndexes;
+  std::vector< std::string >  errMsgs;
+};
+
+void BA2File::loadArchivesThread(ArchiveLoadQueue *q)
+{
+  size_t  n = q->fileNames->size();
+  size_t  i;
+  while ((i = q->nextArchive.fetch_add(1)) < n)
+  {
+    BA2File *p = nullptr;
+    try
+    {
+      p = new BA2File();
+      p->fileFilterFunction = q->parent->fileFilterFunction;
+      p->fileFilterFunctionData = q->parent->fileFilterFunctionData;
+      p->loadArchiveFile((*(q->fileNames))[i].c_str(), q->prefixLen);
+      q->archiveIndexes[i] = p;
+    }
+    catch (std::exception& e)
+    {
+      delete p;
+      q->errMsgs[i] = std::string(e.what());
+    }
+  }
+}
+
+void BA2File::mergeArchiveIndex(BA2File& r, bool applyFilter)
+{
+  // find the files of r that are not overridden by files already loaded
+  size_t  m2 = r.fileMapHashMask;
+  std::vector< unsigned int > archiveFileMap(r.archiveFiles.size(), 0U);
+  applyFilter = applyFilter && bool(fileFilterFunction);
+  for (size_t i = 0; i <= m2; i++)
+  {
+    FileInfo  *fd = r.fileMap[i];
+    if (!fd)
+      continue;
+    if ((applyFilter &&
+         !fileFilterFunction(fileFilterFunctionData, fd->fileName)) ||
+        findFile(fd->fileName))
+    {
+      r.fileMap[i] = nullptr;
+    }
+    else if (fd->archiveFile != 0xFFFFFFFFU)
+      archiveFileMap[fd->archiveFile] = 1U;
+  }
+  // archives with all files overridden are closed, similarly to
+  // loadArchiveFile()
+  archiveFiles.reserve(archiveFiles.size() + r.archiveFiles.size());
+  archiveFileNames.reserve(archiveFiles.size() + r.archiveFiles.size());
+  for (size_t i = 0; i < r.archiveFiles.size(); i++)
+  {
+    if (!archiveFileMap[i])
+    {
+      delete r.archiveFiles[i];
+      continue;
+    }
+    archiveFileMap[i] = (unsigned int) archiveFiles.size();
+    archiveFiles.push_back(r.archiveFiles[i]);
+    archiveFileNames.push_back(std::move(r.archiveFileNames[i]));
+  }
+  r.archiveFiles.clear();
+  r.archiveFileNames.clear();
+
+  for (size_t i = 0; i <= m2; i++)
+  {
+    FileInfo  *fd = r.fileMap[i];
+    if (!fd)
+      continue;
+    if (fd->archiveFile != 0xFFFFFFFFU)
+      fd->archiveFile = archiveFileMap[fd->archiveFile];
+    size_t  m = fileMapHashMask;
+    size_t  n = size_t(fd->hashValue & m);
+    while (fileMap[n])
+      n = (n + 1) & m;
+    fileMap[n] = fd;
+    fileMapFileCnt++;
+    if ((fileMapFileCnt * 3UL) > (m << 1)) [[unlikely]]
+      allocateFileMap();
+  }
+  fileInfoBufs.moveBuffers(r.fileInfoBufs);
+  fileNameBufs.moveBuffers(r.fileNameBufs);
+}
+
+void BA2File::loadArchivesParallel(
+    const std::vector< std::string >& fileNames, size_t prefixLen)
+{
+  size_t  threadCnt = size_t(loadThreadCnt);
+  if (loadThreadCnt <= 0)
+    threadCnt = size_t(std::thread::hardware_concurrency());
+  threadCnt = std::min< size_t >(std::min< size_t >(threadCnt, 16),
+                                 fileNames.size());
+  if (threadCnt <= 1)
+  {
+    for (size_t i = 0; i < fileNames.size(); i++)
+      loadArchiveFile(fileNames[i].c_str(), prefixLen);
+    return;
+  }
+
+  ArchiveLoadQueue  q;
+  q.parent = this;
+  q.fileNames = &fileNames;
+  q.prefixLen = prefixLen;
+  q.nextArchive = 0;
+  q.archiveIndexes.resize(fileNames.size(), nullptr);
+  q.errMsgs.resize(fileNames.size());
+  std::vector< std::thread * >  threads(threadCnt, nullptr);
+  for (size_t i = 0; i < threadCnt; i++)
+  {
+    try
+    {
+      threads[i] = new std::thread(loadArchivesThread, &q);
+    }
+    catch (...)
+    {
+      // the remaining archives are indexed by the threads already running
+      if (!i)
+        loadArchivesThread(&q);
+      break;
+    }
+  }
+  for (size_t i = 0; i < threadCnt; i++)
+  {
+    if (threads[i])
+    {
+      threads[i]->join();
+      delete threads[i];
+    }
+  }
+
+  try
+  {
+    for (size_t i = 0; i < fileNames.size(); i++)
+    {
+      if (!q.errMsgs[i].empty())
+        throw FO76UtilsError(1, q.errMsgs[i].c_str());
+      mergeArchiveIndex(*(q.archiveIndexes[i]));
+      delete q.archiveIndexes[i];
+      q.archiveIndexes[i] = nullptr;
+    }
+  }
+  catch (...)
+  {
+    for (size_t i = 0; i < q.archiveIndexes.size(); i++)
+      delete q.archiveIndexes[i];
+    throw;
+  }
+}
+
+bool BA2File::getFileStat(const char *pathName,
+                          std::int64_t& fileSize, std::int64_t& modTime)
+{
+#if defined(_WIN32) || defined(_WIN64)
+  struct __stat64 st;
+  if (_stat64(pathName, &st) != 0)
+    return false;
+  bool    isDir = ((st.st_mode & _S_IFMT) == _S_IFDIR);
+  modTime = std::int64_t(st.st_mtime);
+#else
+  struct stat st;
+  if (stat(pathName, &st) != 0)
+    return false;
+  bool    isDir = ((st.st_mode & S_IFMT) == S_IFDIR);
+#  if defined(__linux__)
+  modTime = std::int64_t(st.st_mtim.tv_sec) * 1000000000LL
+            + std::int64_t(st.st_mtim.tv_nsec);
+#  else
+  modTime = std::int64_t(st.st_mtime);
+#  endif
+#endif
+  fileSize = (isDir ? -1LL : std::int64_t(st.st_size));
+  return true;
+}
+
+void BA2File::addIndexCacheSource(const char *pathName)
+{
+  IndexCacheSource  tmp;
+  if (!FileBuffer::getFullPathName(tmp.pathName, pathName) ||
+      !getFileStat(pathName, tmp.fileSize, tmp.modTime))
+  {
+    throw FO76UtilsError("error reading file status of %s", pathName);
+  }
+  indexCacheSources->push_back(tmp);
+}
+
+// index cache file format:
+//   header (32 bytes):
+//      0 uint32_t  "BA2I"
+//      4 uint32_t  format version
+//      8 uint32_t  flags (bit 0: hash function uses the CRC32 instruction)
+//     12 uint32_t  key string offset
+//     16 uint32_t  key string length
+//     20 uint32_t  number of sources (directories, archives and loose files)
+//     24 uint32_t  number of archives
+//     28 uint32_t  number of files
+//   sources (24 bytes each):
+//      0 int64_t   file size, or -1 for directories
+//      8 int64_t   modification time
+//     16 uint32_t  path offset
+//     20 uint32_t  path length
+//   archives (8 bytes each):
+//      0 uint32_t  path offset
+//      4 uint32_t  path length
+//   files (40 bytes each):
+//      0 uint64_t  hash value
+//      8 uint64_t  data offset in the archive, or path offset for loose files
+//     16 uint32_t  packed size, or path length for loose files
+//     20 uint32_t  unpacked size
+//     24 int32_t   archive type
+//     28 uint32_t  archive index, 0xFFFFFFFF for loose files
+//     32 uint32_t  name offset
+//     36 uint32_t  name length
+//   string data (offsets are relative to the end of the tables, and all
+//   strings are null-terminated)
+
+static const std::uint32_t  indexCacheVersion = 1U;
+static const std::uint32_t  indexCacheFlags = (ENABLE_X86_64_SIMD ? 1U : 0U);
+
+static bool getIndexCacheString(
+    std::string_view& s, const FileBuffer& buf, size_t strDataOffs,
+    const unsigned char *p)
+{
+  std::uint64_t offs = strDataOffs + FileBuffer::readUInt32Fast(p);
+  size_t  len = FileBuffer::readUInt32Fast(p + 4);
+  if ((offs + len) >= buf.size() || buf[size_t(offs + len)] != 0)
+    return false;
+  s = std::string_view(reinterpret_cast< const char * >(buf.data() + offs),
+                       len);
+  return true;
+}
+
+bool BA2File::loadIndexCache(const char *cacheFileName,
+                             const std::string& keyName)
+{
+  FileBuffer  *cacheBuf = nullptr;
+  std::vector< FileBuffer * > archiveBufs;
+  FileInfo  *fileInfos = nullptr;
+  size_t  includedCnt = 0;
+  try
+  {
+    std::int64_t  fileSize, modTime;
+    if (!getFileStat(cacheFileName, fileSize, modTime) || fileSize < 32)
+      return false;
+    cacheBuf = new FileBuffer(cacheFileName);
+    const FileBuffer& buf = *cacheBuf;
+    const unsigned char *p = buf.data();
+    if (buf.size() < 32 || !FileBuffer::checkType(buf.readUInt32(0), "BA2I") ||
+        buf.readUInt32(4) != indexCacheVersion ||
+        buf.readUInt32(8) != indexCacheFlags)
+    {
+      delete cacheBuf;
+      return false;
+    }
+    size_t  sourceCnt = buf.readUInt32(20);
+    size_t  archiveCnt = buf.readUInt32(24);
+    size_t  fileCnt = buf.readUInt32(28);
+    size_t  archiveTableOffs = 32 + (sourceCnt * 24);
+    size_t  fileTableOffs = archiveTableOffs + (archiveCnt * 8);
+    size_t  strDataOffs = fileTableOffs + (fileCnt * 40);
+    std::string_view  s;
+    if (strDataOffs >= buf.size() ||
+        !getIndexCacheString(s, buf, strDataOffs, p + 12) || s != keyName)
+    {
+      delete cacheBuf;
+      return false;
+    }
+    // check if any of the directories, archives or loose files have changed
+    for (size_t i = 0; i < sourceCnt; i++)
+    {
+      const unsigned char *q = p + (32 + (i * 24));
+      if (!getIndexCacheString(s, buf, strDataOffs, q + 16) ||
+          !getFileStat(s.data(), fileSize, modTime) ||
+          fileSize != std::int64_t(FileBuffer::readUInt64Fast(q)) ||
+          modTime != std::int64_t(FileBuffer::readUInt64Fast(q + 8)))
+      {
+        delete cacheBuf;
+        return false;
+      }
+    }
+
+    // find the files that are not filtered out or already loaded
+    std::vector< unsigned char >  fileIncluded(fileCnt, 0);
+    std::vector< unsigned int > archiveFileMap(archiveCnt, 0U);
+    for (size_t i = 0; i < fileCnt; i++)
+    {
+      const unsigned char *q = p + (fileTableOffs + (i * 40));
+      std::uint32_t archiveFile = FileBuffer::readUInt32Fast(q + 28);
+      if (!getIndexCacheString(s, buf, strDataOffs, q + 32) ||
+          !(archiveFile < archiveCnt || archiveFile == 0xFFFFFFFFU))
+      {
+        throw FO76UtilsError("invalid BA2 index cache file");
+      }
+      if (fileFilterFunction && !fileFilterFunction(fileFilterFunctionData, s))
+        continue;
+      if (findFile(s))
+        continue;
+      fileIncluded[i] = 1;
+      includedCnt++;
+      if (archiveFile != 0xFFFFFFFFU)
+        archiveFileMap[archiveFile] = 1U;
+    }
+    if (!includedCnt)
+    {
+      delete cacheBuf;
+      return true;
+    }
+
+    // open archives
+    std::vector< std::string_view > archiveBufNames;
+    for (size_t i = 0; i < archiveCnt; i++)
+    {
+      if (!archiveFileMap[i])
+        continue;
+      if (!getIndexCacheString(s, buf, strDataOffs,
+                               p + (archiveTableOffs + (i * 8))))
+      {
+        throw FO76UtilsError("invalid BA2 index cache file");
+      }
+      archiveFileMap[i] = (unsigned int) archiveBufs.size();
+      archiveBufNames.push_back(s);
+      archiveBufs.push_back(nullptr);
+      archiveBufs.back() = new FileBuffer(s.data());
+    }
+
+    // check the data offsets before allocating the file table, which
+    // cannot be freed if the cache file turns out to be invalid
+    for (size_t i = 0; i < fileCnt; i++)
+    {
+      if (!fileIncluded[i])
+        continue;
+      const unsigned char *q = p + (fileTableOffs + (i * 40));
+      std::uint64_t dataOffs = FileBuffer::readUInt64Fast(q + 8);
+      std::uint32_t archiveFile = FileBuffer::readUInt32Fast(q + 28);
+      if (archiveFile != 0xFFFFFFFFU)
+      {
+        if (dataOffs >= archiveBufs[archiveFileMap[archiveFile]]->size())
+          throw FO76UtilsError("invalid BA2 index cache file");
+      }
+      else if (dataOffs >= (buf.size() - strDataOffs))
+      {
+        throw FO76UtilsError("invalid BA2 index cache file");
+      }
+    }
+
+    FileInfo  *fd = fileInfoBufs.allocateObjects< FileInfo >(includedCnt);
+    fileInfos = fd;
+    for (size_t i = 0; i < fileCnt; i++)
+    {
+      if (!fileIncluded[i])
+        continue;
+      const unsigned char *q = p + (fileTableOffs + (i * 40));
+      std::uint64_t dataOffs = FileBuffer::readUInt64Fast(q + 8);
+      std::uint32_t archiveFile = FileBuffer::readUInt32Fast(q + 28);
+      if (archiveFile != 0xFFFFFFFFU)
+      {
+        const FileBuffer& archiveBuf =
+            *(archiveBufs[archiveFileMap[archiveFile]]);
+        fd->fileData = archiveBuf.data() + dataOffs;
+        archiveFile = archiveFileMap[archiveFile]
+                      + (unsigned int) archiveFiles.size();
+      }
+      else
+      {
+        fd->fileData = buf.data() + (strDataOffs + dataOffs);
+      }
+      fd->packedSize = FileBuffer::readUInt32Fast(q + 16);
+      fd->unpackedSize = FileBuffer::readUInt32Fast(q + 20);
+      fd->archiveType = std::int32_t(FileBuffer::readUInt32Fast(q + 24));
+      fd->archiveFile = archiveFile;
+      fd->hashValue = FileBuffer::readUInt64Fast(q);
+      (void) getIndexCacheString(s, buf, strDataOffs, q + 32);
+      (void) new(&(fd->fileName)) std::string_view(s);
+      fd++;
+    }
+
+    // all data is valid, take ownership of the buffers
+    indexCacheFiles.reserve(indexCacheFiles.size() + 1);
+    archiveFiles.reserve(archiveFiles.size() + archiveBufs.size());
+    archiveFileNames.reserve(archiveFiles.size() + archiveBufs.size());
+    for (size_t i = 0; i < archiveBufs.size(); i++)
+      archiveFileNames.emplace_back(archiveBufNames[i]);
+    archiveFiles.insert(archiveFiles.end(),
+                        archiveBufs.begin(), archiveBufs.end());
+    indexCacheFiles.push_back(cacheBuf);
+  }
+  catch (...)
+  {
+    for (size_t i = 0; i < archiveBufs.size(); i++)
+      delete archiveBufs[i];
+    delete cacheBuf;
+    return false;
+  }
+
+  for (size_t i = 0; i < includedCnt; i++)
+  {
+    FileInfo  *fd = fileInfos + i;
+    size_t  m = fileMapHashMask;
+    size_t  n = size_t(fd->hashValue & m);
+    while (fileMap[n])
+      n = (n + 1) & m;
+    fileMap[n] = fd;
+    fileMapFileCnt++;
+    if ((fileMapFileCnt * 3UL) > (m << 1)) [[unlikely]]
+      allocateFileMap();
+  }
+  return true;
+}
+
+static std::uint32_t addIndexCacheString(std::string& strBuf,
+                                         const std::string_view& s)
+{
+  if (strBuf.length() > 0xFFFFFFFFUL)
+    errorMessage("BA2 index cache file is too large");
+  std::uint32_t offs = std::uint32_t(strBuf.length());
+  strBuf += s;
+  strBuf += '\0';
+  return offs;
+}
+
+void BA2File::writeIndexCache(
+    const char *cacheFileName, const std::string& keyName,
+    const std::vector< IndexCacheSource >& sources) const
+{
+  size_t  sourceCnt = sources.size();
+  size_t  archiveCnt = archiveFiles.size();
+  size_t  fileCnt = fileMapFileCnt;
+  size_t  archiveTableOffs = 32 + (sourceCnt * 24);
+  size_t  fileTableOffs = archiveTableOffs + (archiveCnt * 8);
+  std::vector< unsigned char >  outBuf(fileTableOffs + (fileCnt * 40), 0);
+  unsigned char *p = outBuf.data();
+  std::string strBuf;
+  std::string fullPath;
+  FileBuffer::writeUInt32Fast(p, 0x49324142U);          // "BA2I"
+  FileBuffer::writeUInt32Fast(p + 4, indexCacheVersion);
+  FileBuffer::writeUInt32Fast(p + 8, indexCacheFlags);
+  FileBuffer::writeUInt32Fast(p + 12, addIndexCacheString(strBuf, keyName));
+  FileBuffer::writeUInt32Fast(p + 16, std::uint32_t(keyName.length()));
+  FileBuffer::writeUInt32Fast(p + 20, std::uint32_t(sourceCnt));
+  FileBuffer::writeUInt32Fast(p + 24, std::uint32_t(archiveCnt));
+  FileBuffer::writeUInt32Fast(p + 28, std::uint32_t(fileCnt));
+  for (size_t i = 0; i < sourceCnt; i++)
+  {
+    unsigned char *q = p + (32 + (i * 24));
+    FileBuffer::writeUInt64Fast(q, std::uint64_t(sources[i].fileSize));
+    FileBuffer::writeUInt64Fast(q + 8, std::uint64_t(sources[i].modTime));
+    FileBuffer::writeUInt32Fast(
+        q + 16, addIndexCacheString(strBuf, sources[i].pathName));
+    FileBuffer::writeUInt32Fast(
+        q + 20, std::uint32_t(sources[i].pathName.length()));
+  }
+  for (size_t i = 0; i < archiveCnt; i++)
+  {
+    unsigned char *q = p + (archiveTableOffs + (i * 8));
+    if (!FileBuffer::getFullPathName(fullPath, archiveFileNames[i].c_str()))
+      errorMessage("error creating BA2 index cache file");
+    FileBuffer::writeUInt32Fast(q, addIndexCacheString(strBuf, fullPath));
+    FileBuffer::writeUInt32Fast(q + 4, std::uint32_t(fullPath.length()));
+  }
+  unsigned char *q = p + fileTableOffs;
+  for (size_t i = 0; i <= fileMapHashMask; i++)
+  {
+    const FileInfo  *fd = fileMap[i];
+    if (!fd)
+      continue;
+    std::uint64_t dataOffs;
+    std::uint32_t packedSize = fd->packedSize;
+    if (fd->archiveFile == 0xFFFFFFFFU)
+    {
+      // loose file: store the full path
+      if (!FileBuffer::getFullPathName(
+               fullPath, reinterpret_cast< const char * >(fd->fileData)))
+      {
+        errorMessage("error creating BA2 index cache file");
+      }
+      dataOffs = addIndexCacheString(strBuf, fullPath);
+      packedSize = std::uint32_t(fullPath.length());
+    }
+    else
+    {
+      dataOffs = std::uint64_t(fd->fileData
+                               - archiveFiles[fd->archiveFile]->data());
+    }
+    FileBuffer::writeUInt64Fast(q, fd->hashValue);
+    FileBuffer::writeUInt64Fast(q + 8, dataOffs);
+    FileBuffer::writeUInt32Fast(q + 16, packedSize);
+    FileBuffer::writeUInt32Fast(q + 20, fd->unpackedSize);
+    FileBuffer::writeUInt32Fast(q + 24, std::uint32_t(fd->archiveType));
+    FileBuffer::writeUInt32Fast(q + 28, fd->archiveFile);
+    FileBuffer::writeUInt32Fast(q + 32,
+                                addIndexCacheString(strBuf, fd->fileName));
+    FileBuffer::writeUInt32Fast(q + 36, std::uint32_t(fd->fileName.length()));
+    q = q + 40;
+  }
+
+  // write to a temporary file first, so that other processes never see
+  // an incomplete cache file
+  std::string tmpFileName;
+#if defined(_WIN32) || defined(_WIN64)
+  printToString(tmpFileName, "%s.%d.tmp", cacheFileName, int(_getpid()));
+#else
+  printToString(tmpFileName, "%s.%d.tmp", cacheFileName, int(getpid()));
+#endif
+  try
+  {
+    OutputFile  f(tmpFileName.c_str(), 0);
+    f.writeData(outBuf.data(), outBuf.size());
+    f.writeData(strBuf.c_str(), strBuf.length());
+  }
+  catch (...)
+  {
+    (void) std::remove(tmpFileName.c_str());
+    throw;
+  }
+#if defined(_WIN32) || defined(_WIN64)
+  (void) std::remove(cacheFileName);
+#endif
+  if (std::rename(tmpFileName.c_str(), cacheFileName) != 0)
+  {
+    (void) std::remove(tmpFileName.c_str());
+    errorMessage("error creating BA2 index cache file");
+  }
+}
+
+void BA2File::loadPath(const char *pathName)
+{
+  if (indexCachePath.empty())
+  {
+    loadArchiveFile(pathName, 0);
+    return;
+  }
+  std::string dataPath;
+  if (!pathName || *pathName == '\0')
+  {
+    if (!FileBuffer::getDefaultDataPath(dataPath))
+      errorMessage("empty input file name");
+    pathName = dataPath.c_str();
+  }
+  // the path as specified is also part of the key, because it determines
+  // the names of loose files
+  std::string keyName;
+  if (!FileBuffer::getFullPathName(keyName, pathName))
+  {
+    loadArchiveFile(pathName, 0);
+    return;
+  }
+  keyName += '\t';
+  keyName += pathName;
+  std::uint32_t h1 = hashFunctionUInt32(keyName.c_str(), keyName.length());
+  std::uint32_t h2 = 0xFFFFFFFFU;
+  for (size_t i = 0; i < keyName.length(); i++)
+    hashFunctionCRC32(h2, (unsigned char) keyName[i]);
+  std::string cacheFileName(indexCachePath);
+  printToString(cacheFileName, "/ba2idx_%08X%08X.bin",
+                (unsigned int) h1, (unsigned int) h2);
+  if (loadIndexCache(cacheFileName.c_str(), keyName))
+    return;
+
+  // create new index without filtering, and save it to the cache
+  std::vector< IndexCacheSource > sources;
+  BA2File tmp;
+  tmp.loadThreadCnt = loadThreadCnt;
+  tmp.indexCacheSources = &sources;
+  {
+    std::int64_t  fileSize, modTime;
+    if (getFileStat(pathName, fileSize, modTime) && fileSize >= 0)
+      tmp.addIndexCacheSource(pathName);
+  }
+  tmp.loadArchiveFile(pathName, 0);
+  tmp.indexCacheSources = nullptr;
+  try
+  {
+    tmp.writeIndexCache(cacheFileName.c_str(), keyName, sources);
+  }
+  catch (std::exception&)
+  {
+    // failing to write the cache is not an error
+  }
+  mergeArchiveIndex(tmp, true);
+}
+
 unsigned int BA2File::getBSAUnpackedSize(const unsigned char*& dataPtr,
                                          const FileInfo& fd) const
 {
@@ -762,15 +1364,33 @@ void BA2File::clear()
 {
   for (size_t i = 0; i < archiveFiles.size(); i++)
     delete archiveFiles[i];
+  for (size_t i = 0; i < indexCacheFiles.size(); i++)
+    delete indexCacheFiles[i];
   std::free(fileMap);
 }
 
+const char * BA2File::getDefaultIndexCachePath()
+{
+#ifdef BUILD_CE2UTILS
+  return std::getenv("CE2UTILS_BA2CACHE");
+#elif !defined(NIFSKOPE_VERSION)
+  return std::getenv("FO76UTILS_BA2CACHE");
+#else
+  return nullptr;
+#endif
+}
+
 BA2File::BA2File()
   : fileMap(nullptr),
     fileMapHashMask(0),
     fileMapFileCnt(0),
     fileFilterFunction(nullptr),
-    fileFilterFunctionData(nullptr)
+    fileFilterFunctionData(nullptr),
+    loadThreadCnt(0),
+    textureThreadCnt(1),
+    verifyChecksums(true),
+    indexCacheSources(nullptr),
+    sortedFileListValid(false)
 {
   allocateFileMap();
 }
@@ -782,12 +1402,17 @@ BA2File::BA2File(const char *pathName,
     fileMapHashMask(0),
     fileMapFileCnt(0),
     fileFilterFunction(fileFilterFunc),
-    fileFilterFunctionData(fileFilterFuncData)
+    fileFilterFunctionData(fileFilterFuncData),
+    loadThreadCnt(0),
+    textureThreadCnt(1),
+    verifyChecksums(true),
+    indexCacheSources(nullptr),
+    sortedFileListValid(false)
 {
   allocateFileMap();
   try
   {
-    loadArchiveFile(pathName, 0);
+    loadPath(pathName);
   }
   catch (...)
   {
@@ -803,7 +1428,20 @@ void BA2File::loadArchivePath(
 {
   fileFilterFunction = fileFilterFunc;
   fileFilterFunctionData = fileFilterFuncData;
-  loadArchiveFile(pathName, 0);
+  sortedFileListValid.store(false, std::memory_order_relaxed);
+  loadPath(pathName);
+}
+
+void BA2File::setIndexCachePath(const char *dirName)
+{
+  indexCachePath.clear();
+  if (dirName)
+    indexCachePath = dirName;
+  while (indexCachePath.length() > 1 &&
+         (indexCachePath.back() == '/' || indexCachePath.back() == '\\'))
+  {
+    indexCachePath.resize(indexCachePath.length() - 1);
+  }
 }
 
 BA2File::~BA2File()
@@ -817,6 +1455,25 @@ void BA2File::getFileList(
     void *fileFilterFuncData) const
 {
   fileList.clear();
+  if (!disableSorting)
+  {
+    const std::vector< const FileInfo * >&  sortedList = getSortedFileList();
+    if (!fileFilterFunc)
+    {
+      fileList.resize(sortedList.size());
+      for (size_t i = 0; i < sortedList.size(); i++)
+        fileList[i] = sortedList[i]->fileName;
+    }
+    else
+    {
+      for (const FileInfo *fd : sortedList)
+      {
+        if (fileFilterFunc(fileFilterFuncData, fd->fileName))
+          fileList.push_back(fd->fileName);
+      }
+    }
+    return;
+  }
   size_t  m = fileMapHashMask;
   if (!fileFilterFunc)
   {
@@ -842,8 +1499,74 @@ void BA2File::getFileList(
         fileList.push_back(s);
     }
   }
-  if (fileList.size() > 1 && !disableSorting)
-    std::sort(fileList.begin(), fileList.end());
+}
+
+void BA2File::createSortedFileList() const
+{
+  std::lock_guard< std::mutex > tmpLock(sortedFileListMutex);
+  if (sortedFileListValid.load(std::memory_order_relaxed))
+    return;
+  sortedFileList.clear();
+  extensionIndex.clear();
+  sortedFileList.reserve(fileMapFileCnt);
+  for (size_t i = 0; i <= fileMapHashMask; i++)
+  {
+    if (fileMap[i])
+      sortedFileList.push_back(fileMap[i]);
+  }
+  std::sort(sortedFileList.begin(), sortedFileList.end(),
+            [](const FileInfo *a, const FileInfo *b)
+            {
+              return (a->fileName < b->fileName);
+            });
+  // the stable sort keeps files with the same extension ordered by name
+  extensionIndex = sortedFileList;
+  std::stable_sort(extensionIndex.begin(), extensionIndex.end(),
+                   [](const FileInfo *a, const FileInfo *b)
+                   {
+                     return (getFileExtension(a->fileName)
+                             < getFileExtension(b->fileName));
+                   });
+  sortedFileListValid.store(true, std::memory_order_release);
+}
+
+void BA2File::findFiles(
+    std::vector< const FileInfo * >& fileList,
+    const std::string_view& prefix, const std::string_view& extension) const
+{
+  const std::vector< const FileInfo * >&  sortedList = getSortedFileList();
+  std::vector< const FileInfo * >::const_iterator i0 = sortedList.begin();
+  std::vector< const FileInfo * >::const_iterator i1 = sortedList.end();
+  if (!extension.empty())
+  {
+    struct CompareExtension
+    {
+      inline bool operator()(const FileInfo *a, const std::string_view& b) const
+      {
+        return (getFileExtension(a->fileName) < b);
+      }
+      inline bool operator()(const std::string_view& a, const FileInfo *b) const
+      {
+        return (a < getFileExtension(b->fileName));
+      }
+    };
+    std::pair< std::vector< const FileInfo * >::const_iterator,
+               std::vector< const FileInfo * >::const_iterator > r =
+        std::equal_range(extensionIndex.cbegin(), extensionIndex.cend(),
+                         extension, CompareExtension());
+    i0 = r.first;
+    i1 = r.second;
+  }
+  if (!prefix.empty())
+  {
+    i0 = std::lower_bound(i0, i1, prefix,
+                          [](const FileInfo *a, const std::string_view& b)
+                          {
+                            return (a->fileName < b);
+                          });
+  }
+  for ( ; i0 != i1 && (*i0)->fileName.starts_with(prefix); i0++)
+    fileList.push_back(*i0);
 }
 
 bool BA2File::scanFileList(
@@ -892,6 +1615,47 @@ std::int64_t BA2File::getFileSize(
   return std::int64_t(fd->unpackedSize);
 }
 
+struct BA2File::TextureChunkQueue
+{
+  const BA2File *p;
+  const FileInfo  *fd;
+  const unsigned char *fileBuf;
+  const unsigned char *chunks;          // chunk records (24 bytes each)
+  std::vector< unsigned char * >  outBufs;
+  std::atomic< size_t > nextChunk;
+  std::atomic< bool > errorFlag;
+  std::vector< std::string >  errMsgs;
+};
+
+// the number of additional threads currently used by all calls to
+// extractBA2Texture() for decompressing texture chunks
+static std::atomic< size_t >  textureChunkThreadCnt(0);
+
+void BA2File::extractChunksThread(TextureChunkQueue *q)
+{
+  size_t  n = q->outBufs.size();
+  size_t  i;
+  // chunks are stored in the order of mip levels, so the largest ones are
+  // started first
+  while (!q->errorFlag && (i = q->nextChunk.fetch_add(1)) < n)
+  {
+    try
+    {
+      const unsigned char *p = q->chunks + (i * 24);
+      std::uint64_t chunkOffset = FileBuffer::readUInt64Fast(p);
+      std::uint32_t chunkSizePacked = FileBuffer::readUInt32Fast(p + 8);
+      std::uint32_t chunkSizeUnpacked = FileBuffer::readUInt32Fast(p + 12);
+      q->p->extractBlock(q->outBufs[i], chunkSizeUnpacked, *(q->fd),
+                         q->fileBuf + chunkOffset, chunkSizePacked);
+    }
+    catch (std::exception& e)
+    {
+      q->errMsgs[i] = std::string(e.what());
+      q->errorFlag = true;
+    }
+  }
+}
+
 int BA2File::extractBA2Texture(
     void *bufPtr, unsigned char * (*allocFunc)(void *bufPtr, size_t nBytes),
     const FileInfo& fd, int mipOffset) const
@@ -932,6 +1696,68 @@ int BA2File::extractBA2Texture(
   buf = buf + 148;
 
   const unsigned char *fileBuf = archiveFiles[fd.archiveFile]->data();
+  if (textureThreadCnt != 1 && chunkCnt > 1 &&
+      fd.packedSize >= textureThreadMinSize)
+  {
+    TextureChunkQueue q;
+    q.p = this;
+    q.fd = &fd;
+    q.fileBuf = fileBuf;
+    q.chunks = p;
+    q.outBufs.resize(chunkCnt);
+    for (size_t i = 0; i < chunkCnt; i++)
+    {
+      q.outBufs[i] = buf;
+      buf = buf + FileBuffer::readUInt32Fast(p + (i * 24 + 12));
+    }
+    q.nextChunk = 0;
+    q.errorFlag = false;
+    q.errMsgs.resize(chunkCnt);
+    size_t  n = size_t(textureThreadCnt);
+    if (textureThreadCnt <= 0)
+      n = size_t(std::thread::hardware_concurrency());
+    n = std::max< size_t >(std::min< size_t >(std::min< size_t >(n, 64),
+                                              chunkCnt), 1);
+    // limit the total number of additional threads if textures are
+    // extracted by multiple threads concurrently
+    size_t  maxThreads =
+        std::max< size_t >(size_t(std::thread::hardware_concurrency()), 1);
+    size_t  prvThreads = textureChunkThreadCnt.fetch_add(n - 1);
+    size_t  threadsAllowed = 0;
+    if (prvThreads < maxThreads)
+      threadsAllowed = std::min(n - 1, maxThreads - prvThreads);
+    textureChunkThreadCnt.fetch_sub((n - 1) - threadsAllowed);
+    n = threadsAllowed + 1;
+    std::vector< std::thread * >  threads(n, nullptr);
+    for (size_t i = 1; i < n; i++)
+    {
+      try
+      {
+        threads[i] = new std::thread(extractChunksThread, &q);
+      }
+      catch (...)
+      {
+        break;
+      }
+    }
+    // the calling thread also decompresses chunks
+    extractChunksThread(&q);
+    for (size_t i = 0; i < n; i++)
+    {
+      if (threads[i])
+      {
+        threads[i]->join();
+        delete threads[i];
+      }
+    }
+    textureChunkThreadCnt.fetch_sub(n - 1);
+    for (size_t i = 0; i < q.errMsgs.size(); i++)
+    {
+      if (!q.errMsgs[i].empty())
+        throw FO76UtilsError(1, q.errMsgs[i].c_str());
+    }
+    return mipOffset;
+  }
   for ( ; chunkCnt-- > 0; p = p + 24)
   {
     std::uint64_t chunkOffset = FileBuffer::readUInt64Fast(p);
@@ -966,7 +1792,8 @@ void BA2File::extractBlock(
     if (fd.archiveType == 2)
       n = ZLibDecompressor::decompressLZ4Raw(buf, unpackedSize, p, packedSize);
     else
-      n = ZLibDecompressor::decompressData(buf, unpackedSize, p, packedSize);
+      n = ZLibDecompressor::decompressData(buf, unpackedSize, p, packedSize,
+                                           verifyChecksums);
     if (n != unpackedSize)
       errorMessage("invalid or corrupt compressed data in archive");
   }
@@ -1092,3 +1919,205 @@ void BA2File::extractFile(
     extractBlock(buf, unpackedSize, fd, p, packedSize);
 }
 
+void BA2File::extractBA2Texture(
+    void (*outputFunc)(void *p, const unsigned char *buf, size_t nBytes),
+    void *outputFuncData, const FileInfo& fd) const
+{
+  const unsigned char *p = fd.fileData;
+  size_t  chunkCnt = p[0];
+  unsigned int  height = FileBuffer::readUInt16Fast(p + 3);
+  unsigned int  width = FileBuffer::readUInt16Fast(p + 5);
+  int     mipCnt = p[7];
+  unsigned char dxgiFormat = p[8];
+  bool    isCubeMap = bool(p[9] & 1);
+  p = p + 11;
+  // write DDS header
+  unsigned char hdrBuf[148];
+  if (!FileBuffer::writeDDSHeader(hdrBuf, dxgiFormat,
+                                  int(width), int(height), mipCnt, isCubeMap))
+  {
+    throw FO76UtilsError("unsupported DXGI_FORMAT 0x%02X",
+                         (unsigned int) dxgiFormat);
+  }
+  outputFunc(outputFuncData, hdrBuf, 148);
+
+  const FileBuffer& fileBuf = *(archiveFiles[fd.archiveFile]);
+  UCharArray  buf;
+  for ( ; chunkCnt-- > 0; p = p + 24)
+  {
+    std::uint64_t chunkOffset = FileBuffer::readUInt64Fast(p);
+    std::uint32_t chunkSizePacked = FileBuffer::readUInt32Fast(p + 8);
+    std::uint32_t chunkSizeUnpacked = FileBuffer::readUInt32Fast(p + 12);
+    if (!chunkSizeUnpacked)
+      continue;
+    if (!chunkSizePacked)
+    {
+      if (chunkOffset >= fileBuf.size() ||
+          (chunkOffset + chunkSizeUnpacked) > fileBuf.size())
+      {
+        errorMessage("invalid packed data offset or size");
+      }
+      outputFunc(outputFuncData, fileBuf.data() + chunkOffset,
+                 chunkSizeUnpacked);
+      continue;
+    }
+    buf.reserve(chunkSizeUnpacked);
+    extractBlock(buf.data, chunkSizeUnpacked,
+                 fd, fileBuf.data() + chunkOffset, chunkSizePacked);
+    outputFunc(outputFuncData, buf.data, chunkSizeUnpacked);
+  }
+}
+
+void BA2File::writeOutputFile(void *p, const unsigned char *buf, size_t nBytes)
+{
+  reinterpret_cast< OutputFile * >(p)->writeData(buf, nBytes);
+}
+
+void BA2File::extractFile(
+    void (*outputFunc)(void *p, const unsigned char *buf, size_t nBytes),
+    void *outputFuncData, const FileInfo& fd) const
+{
+  int     archiveType = fd.archiveType;
+  if (archiveType < 0) [[unlikely]]
+  {
+    // loose file: write directly from the mapped input file
+    const char  *fileName = reinterpret_cast< const char * >(fd.fileData);
+    FileBuffer  f(fileName);
+    if (f.size() != fd.unpackedSize)
+    {
+      throw FO76UtilsError(
+                "BA2File: unexpected change to size of loose file %s",
+                fileName);
+    }
+    if (f.size()) [[likely]]
+      outputFunc(outputFuncData, f.data(), f.size());
+    return;
+  }
+  if (!((archiveType - 1) & ~1))
+  {
+    extractBA2Texture(outputFunc, outputFuncData, fd);
+    return;
+  }
+
+  const unsigned char *p = fd.fileData;
+  unsigned int  packedSize = fd.packedSize;
+  unsigned int  unpackedSize = fd.unpackedSize;
+  if (archiveType & 0x40000100)         // BSA with compression or full names
+  {
+    unpackedSize = getBSAUnpackedSize(p, fd);
+    if (packedSize) [[likely]]
+      packedSize = packedSize - (unsigned int) (p - fd.fileData);
+  }
+  if (!unpackedSize) [[unlikely]]
+    return;
+  const FileBuffer& fileBuf = *(archiveFiles[fd.archiveFile]);
+  std::uint64_t offs = std::uint64_t(p - fileBuf.data());
+  size_t  n = (!packedSize ? unpackedSize : packedSize);
+  if (offs >= fileBuf.size() || (offs + n) > fileBuf.size())
+    errorMessage("invalid packed data offset or size");
+  if (!packedSize)
+  {
+    outputFunc(outputFuncData, p, unpackedSize);
+    return;
+  }
+  n = ZLibDecompressor::decompressData(outputFunc, outputFuncData,
+                                       unpackedSize, p, packedSize,
+                                       verifyChecksums);
+  if (n != unpackedSize)
+    errorMessage("invalid or corrupt compressed data in archive");
+}
+
+void BA2File::extractFile(OutputFile& f, const FileInfo& fd) const
+{
+  extractFile(&writeOutputFile, &f, fd);
+}
+
+struct BA2File::ExtractQueue
+{
+  const BA2File *p;
+  std::vector< const FileInfo * > fileList;
+  void    (*outputFunc)(void *p, const FileInfo& fd, const UCharArray& buf);
+  void    *outputFuncData;
+  std::atomic< size_t > nextFile;
+  std::atomic< bool > errorFlag;
+  std::vector< std::string >  errMsgs;
+  static inline bool compareFiles(const FileInfo *a, const FileInfo *b)
+  {
+    if (a->archiveFile != b->archiveFile)
+      return (a->archiveFile < b->archiveFile);
+    return (std::uintptr_t(a->fileData) < std::uintptr_t(b->fileData));
+  }
+};
+
+void BA2File::extractFilesThread(ExtractQueue *q)
+{
+  UCharArray  buf;
+  size_t  n = q->fileList.size();
+  size_t  i;
+  while (!q->errorFlag && (i = q->nextFile.fetch_add(1)) < n)
+  {
+    try
+    {
+      const FileInfo& fd = *(q->fileList[i]);
+      q->p->extractFile(&buf, &UCharArray::allocFunc, fd);
+      q->outputFunc(q->outputFuncData, fd, buf);
+    }
+    catch (std::exception& e)
+    {
+      q->errMsgs[i] = std::string(e.what());
+      q->errorFlag = true;
+    }
+  }
+}
+
+void BA2File::extractFiles(
+    const std::vector< const FileInfo * >& fileList,
+    void (*outputFunc)(void *p, const FileInfo& fd, const UCharArray& buf),
+    void *outputFuncData, int threadCnt) const
+{
+  ExtractQueue  q;
+  q.p = this;
+  q.fileList = fileList;
+  q.outputFunc = outputFunc;
+  q.outputFuncData = outputFuncData;
+  q.nextFile = 0;
+  q.errorFlag = false;
+  q.errMsgs.resize(fileList.size());
+  // sort files for sequential reads from the archives
+  std::stable_sort(q.fileList.begin(), q.fileList.end(),
+                   ExtractQueue::compareFiles);
+
+  size_t  n = size_t(threadCnt);
+  if (threadCnt <= 0)
+    n = size_t(std::thread::hardware_concurrency());
+  n = std::max< size_t >(std::min< size_t >(std::min< size_t >(n, 64),
+                                            fileList.size()), 1);
+  std::vector< std::thread * >  threads(n, nullptr);
+  for (size_t i = 1; i < n; i++)
+  {
+    try
+    {
+      threads[i] = new std::thread(extractFilesThread, &q);
+    }
+    catch (...)
+    {
+      break;
+    }
+  }
+  // the calling thread also extracts files
+  extractFilesThread(&q);
+  for (size_t i = 0; i < n; i++)
+  {
+    if (threads[i])
+    {
+      threads[i]->join();
+      delete threads[i];
+    }
+  }
+  for (size_t i = 0; i < q.errMsgs.size(); i++)
+  {
+    if (!q.errMsgs[i].empty())
+      throw FO76UtilsError(1, q.errMsgs[i].c_str());
+  }
+}
+
@@ -5,6 +5,9 @@
 #include "common.hpp"
 #include "filebuf.hpp"
 
+#include <atomic>
+#include <mutex>
+
 class BA2File
 {
  public:
@@ -37,9 +40,42 @@ class BA2File
   std::vector< FileBuffer * >   archiveFiles;
   AllocBuffers  fileNameBufs;
   // User defined function that returns true if the path in 's'
-  // should be included.
+  // should be included. It may be called from multiple threads
+  // concurrently while archives are being indexed.
   bool    (*fileFilterFunction)(void *p, const std::string_view& s);
   void    *fileFilterFunctionData;
+  // maximum number of threads used for loading archive directories,
+  // 0 = use std::thread::hardware_concurrency()
+  int     loadThreadCnt;
+  struct ArchiveLoadQueue;
+  // full paths of the files in archiveFiles
+  std::vector< std::string >  archiveFileNames;
+  // maximum number of threads used for decompressing the chunks of a
+  // single texture, 1 = serial, 0 = use std::thread::hardware_concurrency()
+  int     textureThreadCnt;
+  // minimum total compressed size of a texture to be decompressed in parallel
+  static constexpr unsigned int textureThreadMinSize = 262144U;
+  // verify the Adler-32 checksum of ZLib compressed files
+  bool    verifyChecksums;
+  // directory for index cache files, or empty if caching is disabled
+  std::string indexCachePath;
+  // index cache files that names in fileMap may point to
+  std::vector< FileBuffer * > indexCacheFiles;
+  struct IndexCacheSource
+  {
+    std::string   pathName;
+    std::int64_t  fileSize;             // -1 for directories
+    std::int64_t  modTime;
+  };
+  // list of files and directories loaded, non-NULL if an index cache is
+  // being created
+  std::vector< IndexCacheSource > *indexCacheSources;
+  // all files sorted by name, created on first use by getSortedFileList()
+  mutable std::vector< const FileInfo * > sortedFileList;
+  // files sorted by extension first, and then by name
+  mutable std::vector< const FileInfo * > extensionIndex;
+  mutable std::atomic< bool > sortedFileListValid;
+  mutable std::mutex  sortedFileListMutex;
   static inline char fixNameCharacter(unsigned char c)
   {
     if (c >= 'A' && c <= 'Z')
@@ -66,8 +102,34 @@ class BA2File
   static size_t findPrefixLen(const char *pathName);
   void loadArchivesFromDir(const char *pathName, size_t prefixLen);
   void loadArchiveFile(const char *fileName, size_t prefixLen);
+  static void loadArchivesThread(ArchiveLoadQueue *q);
+  // add the files from r that are not already present, and take ownership
+  // of its archives and buffers
+  // if applyFilter is true, fileFilterFunction is also checked for each file
+  void mergeArchiveIndex(BA2File& r, bool applyFilter = false);
+  // index archives concurrently, and merge the results in the order
+  // of fileNames (earlier archives have higher precedence)
+  void loadArchivesParallel(const std::vector< std::string >& fileNames,
+                            size_t prefixLen);
+  static bool getFileStat(const char *pathName,
+                          std::int64_t& fileSize, std::int64_t& modTime);
+  void addIndexCacheSource(const char *pathName);
+  // returns false if the cache file is missing or out of date
+  bool loadIndexCache(const char *cacheFileName, const std::string& keyName);
+  void writeIndexCache(const char *cacheFileName, const std::string& keyName,
+                       const std::vector< IndexCacheSource >& sources) const;
+  // load pathName using the index cache if it is enabled
+  void loadPath(const char *pathName);
   unsigned int getBSAUnpackedSize(const unsigned char*& dataPtr,
                                   const FileInfo& fd) const;
+  static inline std::string_view getFileExtension(const std::string_view& s)
+  {
+    size_t  n = s.rfind('.');
+    if (n == std::string_view::npos || s.find('/', n) != std::string_view::npos)
+      return std::string_view();
+    return s.substr(n);
+  }
+  void createSortedFileList() const;
   [[noreturn]] static void findFileError(const std::string_view& fileName);
   void clear();
  public:
@@ -83,12 +145,57 @@ class BA2File
       bool (*fileFilterFunc)(void *p, const std::string_view& s) = nullptr,
       void *fileFilterFuncData = nullptr);
   virtual ~BA2File();
+  // set the number of threads to be used by loadArchivePath(), 1 = serial
+  // loading, 0 (default) = use the number of hardware threads
+  inline void setLoadThreadCount(int n)
+  {
+    loadThreadCnt = n;
+  }
+  // set the number of threads to be used for decompressing the chunks of
+  // DX10 textures concurrently by extractFile() and extractTexture(),
+  // 1 (default) = serial, 0 = use the number of hardware threads
+  // this only affects compressed textures with multiple chunks and a large
+  // enough total size
+  inline void setTextureThreadCount(int n)
+  {
+    textureThreadCnt = n;
+  }
+  // enable or disable (default: enabled) checksum verification for ZLib
+  // compressed files, disabling it is faster for trusted game archives
+  inline void setVerifyChecksums(bool n)
+  {
+    verifyChecksums = n;
+  }
+  // set the directory to be used by loadArchivePath() for storing merged
+  // archive indexes, which are reused while the size and modification time
+  // of the archives and loose files do not change
+  // an empty string or NULL (default) disables the index cache
+  void setIndexCachePath(const char *dirName);
+  // returns the value of the FO76UTILS_BA2CACHE environment variable, or
+  // NULL if it is not set, tools that use the index cache pass this to
+  // setIndexCachePath()
+  static const char *getDefaultIndexCachePath();
   // returns a list of null-terminated paths with optional sorting and filtering
   void getFileList(std::vector< std::string_view >& fileList,
                    bool disableSorting = false,
                    bool (*fileFilterFunc)(void *p,
                                           const std::string_view& s) = nullptr,
                    void *fileFilterFuncData = nullptr) const;
+  // returns all files sorted by name, the list is created on first use,
+  // and remains valid until more archives are loaded
+  inline const std::vector< const FileInfo * >& getSortedFileList() const
+  {
+    if (!sortedFileListValid.load(std::memory_order_acquire)) [[unlikely]]
+      createSortedFileList();
+    return sortedFileList;
+  }
+  // find files with a name beginning with prefix (e.g. "textures/shared/"),
+  // and optionally ending with extension (including the '.', e.g. ".dds"),
+  // in O(log N + k) time
+  // the results are appended to fileList in sorted order
+  void findFiles(std::vector< const FileInfo * >& fileList,
+                 const std::string_view& prefix,
+                 const std::string_view& extension = std::string_view()) const;
   // processing stops and true is returned if fileScanFunc() returns true
   bool scanFileList(bool (*fileScanFunc)(void *p, const FileInfo& fd),
                     void *fileScanFuncData = nullptr) const;
@@ -104,6 +211,14 @@ class BA2File
   void extractBlock(
       unsigned char *buf, size_t unpackedSize,
       const FileInfo& fd, const unsigned char *p, size_t packedSize) const;
+  struct TextureChunkQueue;
+  static void extractChunksThread(TextureChunkQueue *q);
+  struct ExtractQueue;
+  static void extractFilesThread(ExtractQueue *q);
+  void extractBA2Texture(
+      void (*outputFunc)(void *p, const unsigned char *buf, size_t nBytes),
+      void *outputFuncData, const FileInfo& fd) const;
+  static void writeOutputFile(void *p, const unsigned char *buf, size_t nBytes);
  public:
   struct UCharArray
   {
@@ -145,6 +260,26 @@ class BA2File
   void extractFile(void *bufPtr,
                    unsigned char * (*allocFunc)(void *bufPtr, size_t nBytes),
                    const FileInfo& fd) const;
+  // extract file by passing the unpacked data to outputFunc in one or more
+  // blocks, without storing the whole file in memory
+  // uncompressed data is passed directly from the archive or loose file,
+  // ZLib compressed files are decompressed in blocks of up to 256 KiB, and
+  // compressed textures one chunk at a time
+  void extractFile(
+      void (*outputFunc)(void *p, const unsigned char *buf, size_t nBytes),
+      void *outputFuncData, const FileInfo& fd) const;
+  // extract file to f using streaming extraction
+  void extractFile(OutputFile& f, const FileInfo& fd) const;
+  // extract all files in fileList using up to threadCnt threads (0 = use
+  // the number of hardware threads), in the order of archive and data offset
+  // outputFunc is called with the unpacked data of each file, possibly from
+  // multiple threads concurrently, and buf is only valid until it returns
+  // if any file fails to extract or outputFunc throws an exception, the
+  // remaining files are skipped and the first error is thrown
+  void extractFiles(const std::vector< const FileInfo * >& fileList,
+                    void (*outputFunc)(void *p, const FileInfo& fd,
+                                       const UCharArray& buf),
+                    void *outputFuncData = nullptr, int threadCnt = 0) const;
   inline size_t size() const
   {
     return fileMapFileCnt;
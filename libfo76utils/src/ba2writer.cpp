@@ -0,0 +1,649 @@
+
+#include "common.hpp"
+#include "filebuf.hpp"
+#include "zlib.hpp"
+#include "ba2writer.hpp"
+
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+#if defined(_WIN32) || defined(_WIN64)
+#  include <process.h>
+#else
+#  include <unistd.h>
+#endif
+
+struct BA2Writer::CompressJob
+{
+  const FileEntry *fileEntry;
+  // compressed or uncompressed data of each chunk (one for general archives)
+  std::vector< std::vector< unsigned char > > chunkData;
+  // packed size of each chunk, 0 if the chunk is stored uncompressed
+  std::vector< unsigned int > packedSizes;
+  std::vector< unsigned int > unpackedSizes;
+  bool    isDone;
+};
+
+struct BA2Writer::CompressQueue
+{
+  const BA2Writer *parent;
+  std::vector< CompressJob >  jobs;
+  size_t  nextJob;
+  size_t  jobsWritten;
+  // limit the number of compressed files kept in memory
+  size_t  maxJobsQueued;
+  bool    errorFlag;
+  std::string errorMessage;
+  std::mutex  queueMutex;
+  std::condition_variable queueCondVar;
+};
+
+void BA2Writer::addFileEntry(FileEntry& e)
+{
+  if (e.fileName.empty() || e.fileName.length() > 65535)
+    errorMessage("invalid file name length for BA2 archive");
+  std::string nameL;
+  for (char c : e.fileName)
+  {
+    if (c == '/')
+      c = '\\';
+    else if (c >= 'A' && c <= 'Z')
+      c = c + ('a' - 'A');
+    nameL += c;
+  }
+  if (fileNamesAdded.find(nameL) != fileNamesAdded.end())
+  {
+    throw FO76UtilsError("duplicate file name in archive: %s",
+                         e.fileName.c_str());
+  }
+  e.recordOffset = 0;
+  e.ddsFileSize = 0;
+  e.width = 0;
+  e.height = 0;
+  e.mipCnt = 0;
+  e.dxgiFormat = 0;
+  e.isCubeMap = false;
+  if (isTextureArchive)
+  {
+    if (!(nameL.ends_with(".dds") && nameL.length() > 4))
+    {
+      throw FO76UtilsError("%s: only DDS files can be added to DX10 archives",
+                           e.fileName.c_str());
+    }
+    // the texture format is needed to calculate the size of the records,
+    // only the header is read here, the file is extracted by writeArchive()
+    if (!e.ba2File)
+    {
+      getTextureInfo(e, e.fileData.data(), e.fileData.size(),
+                     e.fileData.size());
+    }
+    else
+    {
+      unsigned char hdrBuf[148];
+      size_t  hdrSize = readFileHeader(hdrBuf, 148, e);
+      std::int64_t  fileSize = e.ba2File->getFileSize(e.sourceName);
+      if (fileSize < 0)
+      {
+        throw FO76UtilsError("file not found in archive: %s",
+                             e.fileName.c_str());
+      }
+      getTextureInfo(e, hdrBuf, hdrSize, size_t(fileSize));
+    }
+  }
+  fileList.push_back(e);
+  fileNamesAdded.insert(nameL);
+}
+
+const unsigned char * BA2Writer::getFileData(
+    size_t& fileSize, BA2File::UCharArray& buf, const FileEntry& e)
+{
+  if (!e.ba2File)
+  {
+    fileSize = e.fileData.size();
+    return e.fileData.data();
+  }
+  const unsigned char *p = nullptr;
+  fileSize = e.ba2File->extractFile(p, buf, e.sourceName);
+  return p;
+}
+
+struct BA2Writer::FileHeaderBuffer
+{
+  unsigned char *buf;
+  size_t  bufSize;
+  size_t  bytesRead;
+};
+
+void BA2Writer::readFileHeaderFunc(void *p, const unsigned char *buf,
+                                   size_t nBytes)
+{
+  FileHeaderBuffer& h = *(reinterpret_cast< FileHeaderBuffer * >(p));
+  nBytes = std::min(nBytes, h.bufSize - h.bytesRead);
+  std::memcpy(h.buf + h.bytesRead, buf, nBytes);
+  h.bytesRead = h.bytesRead + nBytes;
+  // stop the extraction of the rest of the file
+  if (h.bytesRead >= h.bufSize)
+    throw h;
+}
+
+size_t BA2Writer::readFileHeader(unsigned char *buf, size_t bufSize,
+                                 const FileEntry& e)
+{
+  const BA2File::FileInfo *fd = e.ba2File->findFile(e.sourceName);
+  if (!fd)
+    throw FO76UtilsError("file not found in archive: %s", e.fileName.c_str());
+  FileHeaderBuffer  h;
+  h.buf = buf;
+  h.bufSize = bufSize;
+  h.bytesRead = 0;
+  try
+  {
+    // the data is passed to readFileHeaderFunc() in blocks, so that
+    // compressed files or texture chunks are not decompressed completely
+    e.ba2File->extractFile(&readFileHeaderFunc, &h, *fd);
+  }
+  catch (FileHeaderBuffer& tmp)
+  {
+    return tmp.bytesRead;
+  }
+  return h.bytesRead;
+}
+
+void BA2Writer::getTextureInfo(FileEntry& e, const unsigned char *buf,
+                               size_t bufSize, size_t fileSize)
+{
+  if (bufSize < 128 || FileBuffer::readUInt32Fast(buf) != 0x20534444)
+    throw FO76UtilsError("%s: invalid DDS file", e.fileName.c_str());
+  unsigned int  flags = FileBuffer::readUInt32Fast(buf + 8);
+  e.height = FileBuffer::readUInt32Fast(buf + 12);
+  e.width = FileBuffer::readUInt32Fast(buf + 16);
+  e.mipCnt = 1;
+  if (flags & 0x00020000)               // DDSD_MIPMAPCOUNT
+    e.mipCnt = std::max(FileBuffer::readUInt32Fast(buf + 28), std::uint32_t(1));
+  unsigned int  formatFlags = FileBuffer::readUInt32Fast(buf + 80);
+  unsigned int  fourCC = FileBuffer::readUInt32Fast(buf + 84);
+  e.isCubeMap = bool(FileBuffer::readUInt32Fast(buf + 112) & 0x0200);
+  size_t  dataOffset = 128;
+  unsigned int  dxgiFormat = 0;
+  if (formatFlags & 0x04)               // DDPF_FOURCC
+  {
+    switch (fourCC)
+    {
+      case 0x30315844:                  // "DX10"
+        if (bufSize < 148 || FileBuffer::readUInt32Fast(buf + 140) > 1U)
+        {
+          throw FO76UtilsError("%s: unsupported DDS format",
+                               e.fileName.c_str());
+        }
+        dxgiFormat = FileBuffer::readUInt32Fast(buf + 128);
+        if (FileBuffer::readUInt32Fast(buf + 136) & 0x04)
+          e.isCubeMap = true;
+        dataOffset = 148;
+        break;
+      case 0x31545844:                  // "DXT1"
+        dxgiFormat = 0x47;
+        break;
+      case 0x32545844:                  // "DXT2"
+      case 0x33545844:                  // "DXT3"
+        dxgiFormat = 0x4A;
+        break;
+      case 0x34545844:                  // "DXT4"
+      case 0x35545844:                  // "DXT5"
+        dxgiFormat = 0x4D;
+        break;
+      case 0x31495441:                  // "ATI1"
+      case 0x55344342:                  // "BC4U"
+        dxgiFormat = 0x50;
+        break;
+      case 0x53344342:                  // "BC4S"
+        dxgiFormat = 0x51;
+        break;
+      case 0x32495441:                  // "ATI2"
+      case 0x55354342:                  // "BC5U"
+        dxgiFormat = 0x53;
+        break;
+      case 0x53354342:                  // "BC5S"
+        dxgiFormat = 0x54;
+        break;
+    }
+  }
+  else if ((formatFlags & 0x40) && FileBuffer::readUInt32Fast(buf + 88) == 32)
+  {
+    // 32-bit RGB(A) formats
+    std::uint64_t rgMask = FileBuffer::readUInt64Fast(buf + 92);
+    std::uint64_t baMask = FileBuffer::readUInt64Fast(buf + 100);
+    if (!(formatFlags & 0x01))          // DDPF_ALPHAPIXELS
+      baMask = baMask & 0xFFFFFFFFULL;
+    if (rgMask == 0x0000FF00000000FFULL && baMask == 0xFF00000000FF0000ULL)
+      dxgiFormat = 0x1C;                // DXGI_FORMAT_R8G8B8A8_UNORM
+    else if (rgMask == 0x0000FF0000FF0000ULL && baMask == 0xFF000000000000FFULL)
+      dxgiFormat = 0x57;                // DXGI_FORMAT_B8G8R8A8_UNORM
+    else if (rgMask == 0x0000FF0000FF0000ULL && baMask == 0x00000000000000FFULL)
+      dxgiFormat = 0x58;                // DXGI_FORMAT_B8G8R8X8_UNORM
+  }
+  if (dxgiFormat >= 0x80U || !FileBuffer::dxgiFormatSizeTable[dxgiFormat])
+    throw FO76UtilsError("%s: unsupported DDS format", e.fileName.c_str());
+  if (e.width < 1U || e.width > 65535U || e.height < 1U || e.height > 65535U
+      || e.mipCnt > 16U)
+  {
+    throw FO76UtilsError("%s: invalid or unsupported texture dimensions",
+                         e.fileName.c_str());
+  }
+  e.dxgiFormat = (unsigned char) dxgiFormat;
+  unsigned int  blockSize = FileBuffer::dxgiFormatSizeTable[dxgiFormat];
+  bool    isCompressed = bool(blockSize & 0x80U);
+  blockSize = blockSize & 0x7FU;
+  size_t  mipSizes[16];
+  size_t  faceSize = 0;
+  for (unsigned int i = 0; i < e.mipCnt; i++)
+  {
+    size_t  w = std::max(e.width >> i, 1U);
+    size_t  h = std::max(e.height >> i, 1U);
+    if (isCompressed)
+    {
+      w = (w + 3) >> 2;
+      h = (h + 3) >> 2;
+    }
+    mipSizes[i] = w * h * blockSize;
+    faceSize = faceSize + mipSizes[i];
+  }
+  size_t  dataSize = faceSize * (!e.isCubeMap ? 1 : 6);
+  if (fileSize < (dataOffset + dataSize))
+    throw FO76UtilsError("%s: DDS file is shorter than expected",
+                         e.fileName.c_str());
+  e.ddsFileSize = fileSize;
+  e.chunks.clear();
+  TextureChunk  tmp;
+  tmp.dataOffset = dataOffset;
+  tmp.dataSize = dataSize;
+  tmp.mipStart = 0;
+  tmp.mipEnd = (unsigned short) (e.mipCnt - 1U);
+  if (!e.isCubeMap)
+  {
+    // mip levels of at least 64 KiB are stored in separate chunks, so that
+    // they can be skipped when loading the texture with a mip offset
+    for ( ; tmp.mipStart < tmp.mipEnd; tmp.mipStart++)
+    {
+      size_t  n = mipSizes[tmp.mipStart];
+      if (n < 65536)
+        break;
+      TextureChunk  c(tmp);
+      c.dataSize = n;
+      c.mipEnd = c.mipStart;
+      e.chunks.push_back(c);
+      tmp.dataOffset = tmp.dataOffset + n;
+      tmp.dataSize = tmp.dataSize - n;
+    }
+  }
+  e.chunks.push_back(tmp);
+}
+
+static inline unsigned char getHashNameCharacter(char c)
+{
+  if (c >= 'A' && c <= 'Z')
+    return (unsigned char) (c + ('a' - 'A'));
+  if (c == '/')
+    return (unsigned char) '\\';
+  return (unsigned char) c;
+}
+
+void BA2Writer::calculateNameHashes(unsigned char *p, const std::string& s)
+{
+  //  0 uint32_t  CRC32 of base name without extension
+  //  4 uint32_t  extension
+  //  8 uint32_t  CRC32 of directory name
+  size_t  n1 = s.find_last_of("/\\");
+  n1 = (n1 == std::string::npos ? 0 : (n1 + 1));
+  size_t  n2 = s.rfind('.');
+  if (n2 == std::string::npos || n2 < n1)
+    n2 = s.length();
+  std::uint32_t h = 0U;
+  for (size_t i = n1; i < n2; i++)
+    hashFunctionCRC32(h, getHashNameCharacter(s[i]));
+  FileBuffer::writeUInt32Fast(p, h);
+  std::uint32_t e = 0U;
+  for (size_t i = 0; i < 4 && (n2 + 1 + i) < s.length(); i++)
+  {
+    e = e | (std::uint32_t(getHashNameCharacter(s[n2 + 1 + i])) << (i << 3));
+  }
+  FileBuffer::writeUInt32Fast(p + 4, e);
+  h = 0U;
+  for (size_t i = 0; (i + 1) < n1; i++)
+    hashFunctionCRC32(h, getHashNameCharacter(s[i]));
+  FileBuffer::writeUInt32Fast(p + 8, h);
+}
+
+void BA2Writer::compressFile(CompressJob& job) const
+{
+  const FileEntry&  e = *(job.fileEntry);
+  BA2File::UCharArray buf;
+  size_t  fileSize = 0;
+  const unsigned char *p = getFileData(fileSize, buf, e);
+  std::vector< TextureChunk > tmpChunks;
+  const std::vector< TextureChunk > *chunks = &(e.chunks);
+  if (!isTextureArchive)
+  {
+    if (fileSize > 0xFFFFFFFFU)
+      throw FO76UtilsError("%s: file is too large", e.fileName.c_str());
+    tmpChunks.resize(1);
+    tmpChunks[0].dataOffset = 0;
+    tmpChunks[0].dataSize = fileSize;
+    chunks = &tmpChunks;
+  }
+  else if (fileSize != e.ddsFileSize)
+  {
+    throw FO76UtilsError("%s: file size has changed", e.fileName.c_str());
+  }
+  job.chunkData.resize(chunks->size());
+  job.packedSizes.resize(chunks->size());
+  job.unpackedSizes.resize(chunks->size());
+  for (size_t i = 0; i < chunks->size(); i++)
+  {
+    const unsigned char *inBuf = p + (*chunks)[i].dataOffset;
+    size_t  inBufSize = (*chunks)[i].dataSize;
+    std::vector< unsigned char >& outBuf = job.chunkData[i];
+    job.packedSizes[i] = 0;
+    job.unpackedSizes[i] = (unsigned int) inBufSize;
+    if (compressionMethod != compressionNone && inBufSize > 0)
+    {
+      if (compressionMethod == compressionZLib)
+        ZLibCompressor::compressData(outBuf, inBuf, inBufSize,
+                                     compressionLevel);
+      else if (isTextureArchive)
+        ZLibCompressor::compressLZ4Raw(outBuf, inBuf, inBufSize,
+                                       compressionLevel);
+      else
+        ZLibCompressor::compressLZ4(outBuf, inBuf, inBufSize,
+                                    compressionLevel);
+      if (outBuf.size() < inBufSize)
+      {
+        job.packedSizes[i] = (unsigned int) outBuf.size();
+        continue;
+      }
+      // store incompressible data uncompressed
+      outBuf.clear();
+    }
+    outBuf.insert(outBuf.end(), inBuf, inBuf + inBufSize);
+  }
+}
+
+void BA2Writer::compressThread(CompressQueue *q)
+{
+  while (true)
+  {
+    CompressJob *job;
+    {
+      std::unique_lock< std::mutex >  tmpLock(q->queueMutex);
+      q->queueCondVar.wait(tmpLock,
+                           [q]
+                           {
+                             return (q->errorFlag
+                                     || q->nextJob >= q->jobs.size()
+                                     || q->nextJob < (q->jobsWritten
+                                                      + q->maxJobsQueued));
+                           });
+      if (q->errorFlag || q->nextJob >= q->jobs.size())
+        break;
+      job = &(q->jobs[q->nextJob]);
+      q->nextJob++;
+    }
+    try
+    {
+      q->parent->compressFile(*job);
+    }
+    catch (std::exception& e)
+    {
+      std::lock_guard< std::mutex > tmpLock(q->queueMutex);
+      if (!q->errorFlag)
+      {
+        q->errorFlag = true;
+        q->errorMessage = e.what();
+      }
+    }
+    {
+      std::lock_guard< std::mutex > tmpLock(q->queueMutex);
+      job->isDone = true;
+    }
+    q->queueCondVar.notify_all();
+  }
+}
+
+BA2Writer::BA2Writer(const char *fileName, bool isTextures,
+                     int compressionType, int level)
+  : archiveFileName(fileName),
+    isTextureArchive(isTextures),
+    compressionMethod(compressionType),
+    compressionLevel(level),
+    threadCnt(0)
+{
+  if (compressionType < compressionNone || compressionType > compressionLZ4)
+    errorMessage("BA2Writer: invalid compression type");
+}
+
+BA2Writer::~BA2Writer()
+{
+}
+
+void BA2Writer::addFile(const BA2File& ba2File,
+                        const std::string_view& sourceName,
+                        const std::string_view& archivePath)
+{
+  FileEntry e;
+  e.fileName = (archivePath.empty() ? sourceName : archivePath);
+  e.ba2File = &ba2File;
+  e.sourceName = sourceName;
+  if (!ba2File.findFile(sourceName))
+  {
+    throw FO76UtilsError("file not found in archive: %s",
+                         e.fileName.c_str());
+  }
+  addFileEntry(e);
+}
+
+void BA2Writer::addFile(const std::string_view& archivePath,
+                        const unsigned char *buf, size_t bufSize)
+{
+  FileEntry e;
+  e.fileName = archivePath;
+  e.ba2File = nullptr;
+  e.fileData.assign(buf, buf + bufSize);
+  addFileEntry(e);
+}
+
+void BA2Writer::writeArchive()
+{
+  if (fileList.size() < 1)
+    errorMessage("no files to be added to the archive");
+  // BA2 version 1 (Fallout 4 and 76), 2 (Starfield general with LZ4 frames)
+  // or 3 (Starfield textures with LZ4 blocks)
+  unsigned int  archiveVersion = 1;
+  if (compressionMethod == compressionLZ4)
+    archiveVersion = (!isTextureArchive ? 2 : 3);
+  size_t  hdrSize = 24;
+  if (archiveVersion > 1)
+    hdrSize = (archiveVersion == 2 ? 32 : 36);
+  size_t  dataOffset = hdrSize;
+  for (FileEntry& e : fileList)
+  {
+    e.recordOffset = dataOffset;
+    dataOffset += (!isTextureArchive ? 36 : ((e.chunks.size() + 1) * 24));
+  }
+  std::vector< unsigned char >  hdrBuf(dataOffset, 0);
+  unsigned char *p = hdrBuf.data();
+  FileBuffer::writeUInt32Fast(p, 0x58445442);           // "BTDX"
+  FileBuffer::writeUInt32Fast(p + 4, archiveVersion);
+  FileBuffer::writeUInt32Fast(p + 8, (!isTextureArchive ? 0x4C524E47U    // GNRL
+                                                        : 0x30315844U)); // DX10
+  FileBuffer::writeUInt32Fast(p + 12, std::uint32_t(fileList.size()));
+  if (archiveVersion > 1)
+    FileBuffer::writeUInt32Fast(p + 24, 1);
+  if (archiveVersion > 2)
+    FileBuffer::writeUInt32Fast(p + 32, 3);             // LZ4 compression
+  for (const FileEntry& e : fileList)
+  {
+    p = hdrBuf.data() + e.recordOffset;
+    calculateNameHashes(p, e.fileName);
+    if (!isTextureArchive)
+    {
+      FileBuffer::writeUInt32Fast(p + 12, 0x00100100U); // flags
+      FileBuffer::writeUInt32Fast(p + 32, 0xBAADF00DU);
+      continue;
+    }
+    // 12 uint8_t   unknown, number of chunks, uint16_t chunk header size
+    FileBuffer::writeUInt32Fast(p + 12, std::uint32_t(e.chunks.size() << 8)
+                                        | 0x00180000U);
+    FileBuffer::writeUInt16Fast(p + 16, std::uint16_t(e.height));
+    FileBuffer::writeUInt16Fast(p + 18, std::uint16_t(e.width));
+    p[20] = (unsigned char) e.mipCnt;
+    p[21] = e.dxgiFormat;
+    FileBuffer::writeUInt16Fast(p + 22, std::uint16_t(0x0800 | e.isCubeMap));
+    for (size_t i = 0; i < e.chunks.size(); i++)
+    {
+      unsigned char *q = p + (i * 24 + 24);
+      FileBuffer::writeUInt32Fast(q + 12, std::uint32_t(e.chunks[i].dataSize));
+      FileBuffer::writeUInt16Fast(q + 16, e.chunks[i].mipStart);
+      FileBuffer::writeUInt16Fast(q + 18, e.chunks[i].mipEnd);
+      FileBuffer::writeUInt32Fast(q + 20, 0xBAADF00DU);
+    }
+  }
+
+  // write to a temporary file first, so that a partial archive is not left
+  // behind if compression fails
+  std::string tmpFileName;
+#if defined(_WIN32) || defined(_WIN64)
+  printToString(tmpFileName, "%s.%d.tmp",
+                archiveFileName.c_str(), int(_getpid()));
+#else
+  printToString(tmpFileName, "%s.%d.tmp",
+                archiveFileName.c_str(), int(getpid()));
+#endif
+  OutputFile  *f = new OutputFile(tmpFileName.c_str(), 65536);
+  CompressQueue q;
+  std::vector< std::thread * >  threads;
+  try
+  {
+    // the header and records are written again at the end
+    f->writeData(hdrBuf.data(), hdrBuf.size());
+    q.parent = this;
+    q.jobs.resize(fileList.size());
+    for (size_t i = 0; i < fileList.size(); i++)
+    {
+      q.jobs[i].fileEntry = &(fileList[i]);
+      q.jobs[i].isDone = false;
+    }
+    q.nextJob = 0;
+    q.jobsWritten = 0;
+    q.errorFlag = false;
+    int     n = threadCnt;
+    if (n < 1)
+      n = int(std::thread::hardware_concurrency());
+    n = std::min(std::max(n, 1), 64);
+    n = int(std::min(size_t(n), fileList.size()));
+    q.maxJobsQueued = size_t(n) * 4;
+    for (int i = 0; i < n; i++)
+      threads.push_back(new std::thread(compressThread, &q));
+    for (size_t i = 0; i < q.jobs.size(); i++)
+    {
+      CompressJob&  job = q.jobs[i];
+      {
+        std::unique_lock< std::mutex >  tmpLock(q.queueMutex);
+        q.queueCondVar.wait(tmpLock,
+                            [&q, &job]
+                            {
+                              return (q.errorFlag || job.isDone);
+                            });
+        if (q.errorFlag)
+          throw FO76UtilsError("%s", q.errorMessage.c_str());
+      }
+      // write the compressed data, and store its offset and size
+      p = hdrBuf.data() + job.fileEntry->recordOffset;
+      for (size_t j = 0; j < job.chunkData.size(); j++)
+      {
+        const std::vector< unsigned char >& buf = job.chunkData[j];
+        if (!isTextureArchive)
+        {
+          FileBuffer::writeUInt64Fast(p + 16, dataOffset);
+          FileBuffer::writeUInt32Fast(p + 24, job.packedSizes[j]);
+          FileBuffer::writeUInt32Fast(p + 28, job.unpackedSizes[j]);
+        }
+        else
+        {
+          unsigned char *chunkPtr = p + (j * 24 + 24);
+          FileBuffer::writeUInt64Fast(chunkPtr, dataOffset);
+          FileBuffer::writeUInt32Fast(chunkPtr + 8, job.packedSizes[j]);
+        }
+        f->writeData(buf.data(), buf.size());
+        dataOffset = dataOffset + buf.size();
+      }
+      job.chunkData.clear();
+      job.chunkData.shrink_to_fit();
+      {
+        std::lock_guard< std::mutex > tmpLock(q.queueMutex);
+        q.jobsWritten++;
+      }
+      q.queueCondVar.notify_all();
+    }
+    for (size_t i = 0; i < threads.size(); i++)
+    {
+      threads[i]->join();
+      delete threads[i];
+      threads[i] = nullptr;
+    }
+    // name table
+    FileBuffer::writeUInt64Fast(hdrBuf.data() + 16, dataOffset);
+    for (const FileEntry& e : fileList)
+    {
+      f->writeByte((unsigned char) (e.fileName.length() & 0xFF));
+      f->writeByte((unsigned char) (e.fileName.length() >> 8));
+      for (char c : e.fileName)
+        f->writeByte((unsigned char) (c != '/' ? c : '\\'));
+    }
+    f->flush();
+  }
+  catch (...)
+  {
+    {
+      std::lock_guard< std::mutex > tmpLock(q.queueMutex);
+      q.errorFlag = true;
+    }
+    q.queueCondVar.notify_all();
+    for (size_t i = 0; i < threads.size(); i++)
+    {
+      if (threads[i])
+      {
+        threads[i]->join();
+        delete threads[i];
+      }
+    }
+    delete f;
+    (void) std::remove(tmpFileName.c_str());
+    throw;
+  }
+  delete f;
+
+  // write the header and records with the offsets and sizes filled in
+  std::FILE *tmp = std::fopen(tmpFileName.c_str(), "r+b");
+  bool    writeError = !tmp;
+  if (tmp)
+  {
+    writeError = (std::fwrite(hdrBuf.data(), sizeof(unsigned char),
+                              hdrBuf.size(), tmp) != hdrBuf.size());
+    if (std::fclose(tmp) != 0)
+      writeError = true;
+  }
+  if (writeError)
+  {
+    (void) std::remove(tmpFileName.c_str());
+    errorMessage("error writing output file");
+  }
+#if defined(_WIN32) || defined(_WIN64)
+  (void) std::remove(archiveFileName.c_str());
+#endif
+  if (std::rename(tmpFileName.c_str(), archiveFileName.c_str()) != 0)
+  {
+    (void) std::remove(tmpFileName.c_str());
+    errorMessage("error creating output file");
+  }
+}
+
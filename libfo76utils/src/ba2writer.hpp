@@ -0,0 +1,105 @@
+
+#ifndef BA2WRITER_HPP_INCLUDED
+#define BA2WRITER_HPP_INCLUDED
+
+#include "common.hpp"
+#include "filebuf.hpp"
+#include "ba2file.hpp"
+
+// Creates Fallout 4 / 76 and Starfield format BA2 archives. Files are added
+// from a BA2File object (archives, directories or loose files) or from
+// memory, and are compressed on multiple threads by writeArchive().
+class BA2Writer
+{
+ public:
+  enum
+  {
+    compressionNone = 0,
+    compressionZLib = 1,
+    // LZ4 frames for general archives (version 2), and raw LZ4 blocks
+    // for textures (version 3, Starfield)
+    compressionLZ4 = 2
+  };
+ protected:
+  struct TextureChunk
+  {
+    size_t  dataOffset;                 // offset of the data in the DDS file
+    size_t  dataSize;
+    unsigned short  mipStart;
+    unsigned short  mipEnd;
+  };
+  struct FileEntry
+  {
+    std::string fileName;               // name stored in the archive
+    const BA2File *ba2File;             // source, or NULL for fileData
+    std::string_view  sourceName;       // name of the file in ba2File
+    std::vector< unsigned char >  fileData;
+    size_t  recordOffset;               // offset of the record in the archive
+    // texture information (DX10 archives only)
+    size_t  ddsFileSize;
+    unsigned int  width;
+    unsigned int  height;
+    unsigned int  mipCnt;
+    unsigned char dxgiFormat;
+    bool    isCubeMap;
+    std::vector< TextureChunk > chunks;
+  };
+  struct CompressJob;
+  struct CompressQueue;
+  std::string archiveFileName;
+  bool    isTextureArchive;
+  int     compressionMethod;
+  int     compressionLevel;
+  int     threadCnt;
+  std::vector< FileEntry >  fileList;
+  std::set< std::string >   fileNamesAdded;
+  void addFileEntry(FileEntry& e);
+  // returns a pointer to the data of the file in e, using buf if the file
+  // needs to be extracted
+  static const unsigned char *getFileData(
+      size_t& fileSize, BA2File::UCharArray& buf, const FileEntry& e);
+  struct FileHeaderBuffer;
+  static void readFileHeaderFunc(void *p, const unsigned char *buf,
+                                 size_t nBytes);
+  // copy up to bufSize bytes from the beginning of the file in e to buf,
+  // without extracting the rest of the file, and return the number of
+  // bytes read
+  static size_t readFileHeader(unsigned char *buf, size_t bufSize,
+                               const FileEntry& e);
+  // parse the DDS header in buf (bufSize bytes, up to 148 are used), and
+  // split the texture data (fileSize bytes in total) into chunks
+  static void getTextureInfo(FileEntry& e, const unsigned char *buf,
+                             size_t bufSize, size_t fileSize);
+  static void calculateNameHashes(unsigned char *p, const std::string& s);
+  void compressFile(CompressJob& job) const;
+  static void compressThread(CompressQueue *q);
+ public:
+  // isTextures = true creates a DX10 archive, otherwise general (GNRL)
+  // level is 0 (fastest) to 9 (best compression)
+  BA2Writer(const char *fileName, bool isTextures,
+            int compressionType = compressionZLib, int level = 6);
+  virtual ~BA2Writer();
+  // set the number of threads used by writeArchive(), 0 = use the number
+  // of hardware threads
+  inline void setThreadCount(int n)
+  {
+    threadCnt = n;
+  }
+  // add a file from ba2File, which must remain valid until writeArchive()
+  // is called, archivePath is the name to be stored in the archive, or the
+  // same as sourceName if empty
+  void addFile(const BA2File& ba2File, const std::string_view& sourceName,
+               const std::string_view& archivePath = std::string_view());
+  // add a file from memory, the data is copied
+  void addFile(const std::string_view& archivePath,
+               const unsigned char *buf, size_t bufSize);
+  inline size_t size() const
+  {
+    return fileList.size();
+  }
+  // compress all files, and write the archive
+  void writeArchive();
+};
+
+#endif
+
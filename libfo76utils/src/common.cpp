@@ -444,6 +444,27 @@ void AllocBuffers::clear()
   }
 }
 
+void AllocBuffers::moveBuffers(AllocBuffers& r)
+{
+  if (!r.lastBuf->prv || &r == this)
+    return;
+  if (lastBuf->prv)
+  {
+    // insert the buffers of r before the current one,
+    // so that its remaining space can still be used
+    DataBuf *p = r.lastBuf;
+    while (p->prv->prv)
+      p = p->prv;
+    p->prv = lastBuf->prv;
+    lastBuf->prv = r.lastBuf;
+  }
+  else
+  {
+    lastBuf = r.lastBuf;
+  }
+  r.lastBuf = const_cast< DataBuf * >(&emptyBuf);
+}
+
 #if ENABLE_X86_64_SIMD >= 1
 static inline XMM_UInt8 convert8CharsToXMMUInt16(const void *p)
 {
@@ -342,6 +342,9 @@ class AllocBuffers
   ~AllocBuffers();
   void *allocateSpace(size_t nBytes, size_t alignBytes = 16);
   void clear();
+  // take ownership of all buffers of r, which is left empty
+  // data previously allocated from r remains valid
+  void moveBuffers(AllocBuffers& r);
   template< typename T > inline T *allocateObject()
   {
     return reinterpret_cast< T * >(allocateSpace(sizeof(T), alignof(T)));
@@ -4,107 +4,256 @@
 #include "fp32vec8.hpp"
 
 #include <new>
+#include <atomic>
+#include <mutex>
+
+thread_local DDSTexture::DecodedBlockCache *
+    DDSTexture::decodedBlockCache = nullptr;
+
+// texture IDs are used as the upper 32 bits of block cache keys
+static std::atomic< std::uint32_t > nextTextureID(1U);
+
+// used when decoding mip levels on demand, selected by textureID
+static std::mutex mipLevelMutexes[16];
+
+namespace
+{
+  // frees the decoded block cache of the thread on exit
+  struct DecodedBlockCacheDeleter
+  {
+    void    *p;
+    DecodedBlockCacheDeleter()
+      : p(nullptr)
+    {
+    }
+    ~DecodedBlockCacheDeleter()
+    {
+      std::free(p);
+    }
+  };
+}
+
+static thread_local DecodedBlockCacheDeleter decodedBlockCacheDeleter;
+
+#if ENABLE_X86_64_SIMD >= 1
+static inline XMM_UInt8 shuffleBytes(XMM_UInt8 v, XMM_UInt8 m)
+{
+  typedef char  XMM_Char __attribute__ ((__vector_size__ (16)));
+  return std::bit_cast< XMM_UInt8 >(
+             __builtin_ia32_pshufb128(std::bit_cast< XMM_Char >(v),
+                                      std::bit_cast< XMM_Char >(m)));
+}
+
+// byte shuffle masks for converting 4 2-bit BC1 color indices to 4 pixels
+struct BC1ShuffleTable
+{
+  alignas(16) unsigned char m[256][16];
+  constexpr BC1ShuffleTable()
+    : m()
+  {
+    for (unsigned int i = 0; i < 256; i++)
+    {
+      for (unsigned int j = 0; j < 16; j++)
+        m[i][j] = (unsigned char) ((((i >> ((j >> 2) << 1)) & 3U) << 2)
+                                   | (j & 3U));
+    }
+  }
+};
+
+static constexpr BC1ShuffleTable  bc1ShuffleTable;
+
+static inline void decodeBC1Rows(std::uint32_t *dst, unsigned int w,
+                                 const std::uint32_t *c, std::uint32_t bc,
+                                 XMM_UInt8 a, bool haveAlpha)
+{
+  XMM_UInt8 palette;
+  std::memcpy(&palette, c, sizeof(XMM_UInt8));
+  XMM_UInt8 alphaMask = { 0x80, 0x80, 0x80, 0, 0x80, 0x80, 0x80, 1,
+                          0x80, 0x80, 0x80, 2, 0x80, 0x80, 0x80, 3 };
+  for (unsigned int i = 0; i < 4; i++, bc = bc >> 8)
+  {
+    XMM_UInt8 m;
+    std::memcpy(&m, bc1ShuffleTable.m[bc & 0xFFU], sizeof(XMM_UInt8));
+    XMM_UInt8 tmp = shuffleBytes(palette, m);
+    if (haveAlpha)
+    {
+      tmp |= shuffleBytes(a, alphaMask);
+      alphaMask += 4;
+    }
+    std::memcpy(dst + (i * w), &tmp, sizeof(XMM_UInt8));
+  }
+}
+
+// returns the 16 8-bit values of a BC3 alpha or BC4 block,
+// a = palette from decodeBC3Alpha(), ba = 48-bit indices
+static inline XMM_UInt8 decodeBC3AlphaValues(std::uint64_t a,
+                                             std::uint64_t ba)
+{
+  XMM_UInt64  tmp = { ba, a };
+  XMM_UInt8 b = std::bit_cast< XMM_UInt8 >(tmp);
+  // each 16-bit word contains the 3 index bits of one pixel,
+  // which are shifted to bits 8 to 10
+  XMM_UInt16  i0 = std::bit_cast< XMM_UInt16 >(
+                       shuffleBytes(b, XMM_UInt8{ 0, 1, 0, 1, 0, 1, 1, 2,
+                                                  1, 2, 1, 2, 2, 3, 2, 3 }));
+  XMM_UInt16  i1 = std::bit_cast< XMM_UInt16 >(
+                       shuffleBytes(b, XMM_UInt8{ 3, 4, 3, 4, 3, 4, 4, 5,
+                                                  4, 5, 4, 5, 5, 6, 5, 6 }));
+  const XMM_UInt16  m = { 256, 32, 4, 128, 16, 2, 64, 8 };
+  i0 = (((i0 * m) >> 8) & 7) | 8;
+  i1 = (((i1 * m) >> 8) & 7) | 8;
+  XMM_UInt8 n = std::bit_cast< XMM_UInt8 >(
+                    __builtin_ia32_packuswb128(
+                        std::bit_cast< XMM_Int16 >(i0),
+                        std::bit_cast< XMM_Int16 >(i1)));
+  // the palette is in bytes 8 to 15 of b
+  return shuffleBytes(b, n);
+}
+#endif
+
+template< size_t (*decodeFunction)(std::uint32_t *,
+                                   const unsigned char *, unsigned int) >
+size_t DDSTexture::decodeBlocks(
+    std::uint32_t *dst, const unsigned char *src, unsigned int w)
+{
+  size_t  n = 0;
+  for (unsigned int x = 0; x < w; x = x + 4)
+    n = n + decodeFunction(dst + x, src + n, w);
+  return n;
+}
 
 const DDSTexture::DXGIFormatInfo DDSTexture::dxgiFormatInfoTable[32] =
 {
   {                             //  0: DXGI_FORMAT_UNKNOWN = 0x00
+    (size_t (*)(std::uint32_t *, const unsigned char *, unsigned int)) 0,
     (size_t (*)(std::uint32_t *, const unsigned char *, unsigned int)) 0,
     "UNKNOWN", false, false, 0, 0
   },
   {                             //  1: DXGI_FORMAT_R16G16B16A16_FLOAT = 0x0A
-    &decodeLine_RGBA64F, "R16G16B16A16_FLOAT", false, true, 4, 8
+    &decodeLine_RGBA64F, &decodeLine_RGBA64F,
+    "R16G16B16A16_FLOAT", false, true, 4, 8
   },
   {                             //  2: DXGI_FORMAT_R8G8B8A8_UNORM = 0x1C
-    &decodeLine_RGBA, "R8G8B8A8_UNORM", false, false, 4, 4
+    &decodeLine_RGBA, &decodeLine_RGBA,
+    "R8G8B8A8_UNORM", false, false, 4, 4
   },
   {                             //  3: DXGI_FORMAT_R8G8B8A8_UNORM_SRGB = 0x1D
-    &decodeLine_RGBA, "R8G8B8A8_UNORM_SRGB", false, true, 4, 4
+    &decodeLine_RGBA, &decodeLine_RGBA,
+    "R8G8B8A8_UNORM_SRGB", false, true, 4, 4
   },
   {                             //  4: DXGI_FORMAT_R8G8_UNORM = 0x31
-    &decodeLine_R8G8, "R8G8_UNORM", false, false, 2, 2
+    &decodeLine_R8G8, &decodeLine_R8G8,
+    "R8G8_UNORM", false, false, 2, 2
   },
   {                             //  5: DXGI_FORMAT_R8_UNORM = 0x3D
-    &decodeLine_R8, "R8_UNORM", false, false, 1, 1
+    &decodeLine_R8, &decodeLine_R8,
+    "R8_UNORM", false, false, 1, 1
   },
   {                             //  6: DXGI_FORMAT_R8_UINT = 0x3E
-    &decodeLine_R8, "R8_UINT", false, false, 1, 1
+    &decodeLine_R8, &decodeLine_R8,
+    "R8_UINT", false, false, 1, 1
   },
   {                             //  7: DXGI_FORMAT_BC1_UNORM = 0x47
-    &decodeBlock_BC1, "BC1_UNORM", true, false, 4, 8
+    &decodeBlock_BC1, &decodeBlocks_BC1,
+    "BC1_UNORM", true, false, 4, 8
   },
   {                             //  8: DXGI_FORMAT_BC1_UNORM_SRGB = 0x48
-    &decodeBlock_BC1, "BC1_UNORM_SRGB", true, true, 4, 8
+    &decodeBlock_BC1, &decodeBlocks_BC1,
+    "BC1_UNORM_SRGB", true, true, 4, 8
   },
   {                             //  9: DXGI_FORMAT_BC2_UNORM = 0x4A
-    &decodeBlock_BC2, "BC2_UNORM", true, false, 4, 16
+    &decodeBlock_BC2, &decodeBlocks< decodeBlock_BC2 >,
+    "BC2_UNORM", true, false, 4, 16
   },
   {                             // 10: DXGI_FORMAT_BC2_UNORM_SRGB = 0x4B
-    &decodeBlock_BC2, "BC2_UNORM_SRGB", true, true, 4, 16
+    &decodeBlock_BC2, &decodeBlocks< decodeBlock_BC2 >,
+    "BC2_UNORM_SRGB", true, true, 4, 16
   },
   {                             // 11: DXGI_FORMAT_BC3_UNORM = 0x4D
-    &decodeBlock_BC3, "BC3_UNORM", true, false, 4, 16
+    &decodeBlock_BC3, &decodeBlocks_BC3,
+    "BC3_UNORM", true, false, 4, 16
   },
   {                             // 12: DXGI_FORMAT_BC3_UNORM_SRGB = 0x4E
-    &decodeBlock_BC3, "BC3_UNORM_SRGB", true, true, 4, 16
+    &decodeBlock_BC3, &decodeBlocks_BC3,
+    "BC3_UNORM_SRGB", true, true, 4, 16
   },
   {                             // 13: DXGI_FORMAT_BC4_UNORM = 0x50
-    &decodeBlock_BC4, "BC4_UNORM", true, false, 1, 8
+    &decodeBlock_BC4, &decodeBlocks_BC4,
+    "BC4_UNORM", true, false, 1, 8
   },
   {                             // 14: DXGI_FORMAT_BC4_SNORM = 0x51
-    &decodeBlock_BC4S, "BC4_SNORM", true, false, 1, 8
+    &decodeBlock_BC4S, &decodeBlocks_BC4S,
+    "BC4_SNORM", true, false, 1, 8
   },
   {                             // 15: DXGI_FORMAT_BC5_UNORM = 0x53
-    &decodeBlock_BC5, "BC5_UNORM", true, false, 2, 16
+    &decodeBlock_BC5, &decodeBlocks_BC5,
+    "BC5_UNORM", true, false, 2, 16
   },
   {                             // 16: DXGI_FORMAT_BC5_SNORM = 0x54
-    &decodeBlock_BC5S, "BC5_SNORM", true, false, 2, 16
+    &decodeBlock_BC5S, &decodeBlocks_BC5S,
+    "BC5_SNORM", true, false, 2, 16
   },
   {                             // 17: DXGI_FORMAT_B8G8R8A8_UNORM = 0x57
-    &decodeLine_BGRA, "B8G8R8A8_UNORM", false, false, 4, 4
+    &decodeLine_BGRA, &decodeLine_BGRA,
+    "B8G8R8A8_UNORM", false, false, 4, 4
   },
   {                             // 18: DXGI_FORMAT_B8G8R8X8_UNORM = 0x58
-    &decodeLine_BGR32, "B8G8R8X8_UNORM", false, false, 3, 4
+    &decodeLine_BGR32, &decodeLine_BGR32,
+    "B8G8R8X8_UNORM", false, false, 3, 4
   },
   {                             // 19: DXGI_FORMAT_B8G8R8A8_UNORM_SRGB = 0x5B
-    &decodeLine_BGRA, "B8G8R8A8_UNORM_SRGB", false, true, 4, 4
+    &decodeLine_BGRA, &decodeLine_BGRA,
+    "B8G8R8A8_UNORM_SRGB", false, true, 4, 4
   },
   {                             // 20: DXGI_FORMAT_B8G8R8X8_UNORM_SRGB = 0x5D
-    &decodeLine_BGR32, "B8G8R8X8_UNORM_SRGB", false, true, 3, 4
+    &decodeLine_BGR32, &decodeLine_BGR32,
+    "B8G8R8X8_UNORM_SRGB", false, true, 3, 4
   },
   {                             // 21: DXGI_FORMAT_BC6H_UF16 = 0x5F
-    &decodeBlock_BC6U, "BC6H_UF16", true, true, 4, 16
+    &decodeBlock_BC6U, &decodeBlocks< decodeBlock_BC6U >,
+    "BC6H_UF16", true, true, 4, 16
   },
   {                             // 22: DXGI_FORMAT_BC6H_SF16 = 0x60
-    &decodeBlock_BC6S, "BC6H_SF16", true, false, 4, 16
+    &decodeBlock_BC6S, &decodeBlocks< decodeBlock_BC6S >,
+    "BC6H_SF16", true, false, 4, 16
   },
   {                             // 23: DXGI_FORMAT_BC7_UNORM = 0x62
-    &decodeBlock_BC7, "BC7_UNORM", true, false, 4, 16
+    &decodeBlock_BC7, &decodeBlocks< decodeBlock_BC7 >,
+    "BC7_UNORM", true, false, 4, 16
   },
   {                             // 24: DXGI_FORMAT_BC7_UNORM_SRGB = 0x63
-    &decodeBlock_BC7, "BC7_UNORM_SRGB", true, true, 4, 16
+    &decodeBlock_BC7, &decodeBlocks< decodeBlock_BC7 >,
+    "BC7_UNORM_SRGB", true, true, 4, 16
   },
   // non-standard formats
   {                             // 25: FORMAT_R8G8B8X8_UNORM = 0x7A
-    &decodeLine_RGB32, "R8G8B8X8_UNORM", false, false, 3, 4
+    &decodeLine_RGB32, &decodeLine_RGB32,
+    "R8G8B8X8_UNORM", false, false, 3, 4
   },
   {                             // 26: FORMAT_R8G8B8X8_UNORM_SRGB = 0x7B
-    &decodeLine_RGB32, "R8G8B8X8_UNORM_SRGB", false, true, 3, 4
+    &decodeLine_RGB32, &decodeLine_RGB32,
+    "R8G8B8X8_UNORM_SRGB", false, true, 3, 4
   },
   {                             // 27: FORMAT_B8G8R8_UNORM = 0x7C
-    &decodeLine_BGR, "B8G8R8_UNORM", false, false, 3, 3
+    &decodeLine_BGR, &decodeLine_BGR,
+    "B8G8R8_UNORM", false, false, 3, 3
   },
   {                             // 28: FORMAT_B8G8R8_UNORM_SRGB = 0x7D
-    &decodeLine_BGR, "B8G8R8_UNORM_SRGB", false, true, 3, 3
+    &decodeLine_BGR, &decodeLine_BGR,
+    "B8G8R8_UNORM_SRGB", false, true, 3, 3
   },
   {                             // 29: FORMAT_R8G8B8_UNORM = 0x7E
-    &decodeLine_RGB, "R8G8B8_UNORM", false, false, 3, 3
+    &decodeLine_RGB, &decodeLine_RGB,
+    "R8G8B8_UNORM", false, false, 3, 3
   },
   {                             // 30: FORMAT_R8G8B8_UNORM_SRGB = 0x7F
-    &decodeLine_RGB, "R8G8B8_UNORM_SRGB", false, true, 3, 3
+    &decodeLine_RGB, &decodeLine_RGB,
+    "R8G8B8_UNORM_SRGB", false, true, 3, 3
   },
   // end of non-standard formats
   {                             // 31: DXGI_FORMAT_R9G9B9E5_SHAREDEXP = 0x43
-    &decodeLine_RGB9E5, "R9G9B9E5_SHAREDEXP", false, true, 3, 4
+    &decodeLine_RGB9E5, &decodeLine_RGB9E5,
+    "R9G9B9E5_SHAREDEXP", false, true, 3, 4
   }
 };
 
@@ -337,18 +486,229 @@ size_t DDSTexture::decodeBlock_BC6S(
   return 16;
 }
 
+// decode BC7 mode 6 block (single subset, 7-bit RGBA endpoints with unique
+// P-bits, 4-bit indices) without using detex
+static inline void decodeBC7Mode6(std::uint32_t *dst, const unsigned char *src,
+                                  unsigned int w)
+{
+  std::uint64_t d0 = FileBuffer::readUInt64Fast(src);
+  std::uint64_t d1 = FileBuffer::readUInt64Fast(src + 8);
+  std::uint16_t e0[4];
+  std::uint16_t e1[4];
+  for (int i = 0; i < 4; i++)
+  {
+    e0[i] = std::uint16_t(((d0 >> (i * 14 + 6)) & 0xFEU) | (d0 >> 63));
+    e1[i] = std::uint16_t(((d0 >> (i * 14 + 13)) & 0xFEU) | (d1 & 1U));
+  }
+  std::uint32_t palette[16];
+#if ENABLE_X86_64_SIMD >= 1
+  static const XMM_UInt16 weightTable[8] =
+  {
+    {  0,  0,  0,  0,  4,  4,  4,  4 }, {  9,  9,  9,  9, 13, 13, 13, 13 },
+    { 17, 17, 17, 17, 21, 21, 21, 21 }, { 26, 26, 26, 26, 30, 30, 30, 30 },
+    { 34, 34, 34, 34, 38, 38, 38, 38 }, { 43, 43, 43, 43, 47, 47, 47, 47 },
+    { 51, 51, 51, 51, 55, 55, 55, 55 }, { 60, 60, 60, 60, 64, 64, 64, 64 }
+  };
+  const XMM_UInt16  c0 = { e0[0], e0[1], e0[2], e0[3],
+                           e0[0], e0[1], e0[2], e0[3] };
+  const XMM_UInt16  c1 = { e1[0], e1[1], e1[2], e1[3],
+                           e1[0], e1[1], e1[2], e1[3] };
+  for (int i = 0; i < 8; i = i + 2)
+  {
+    XMM_UInt16  w0 = weightTable[i];
+    XMM_UInt16  w1 = weightTable[i + 1];
+    XMM_UInt16  tmp0 = ((c0 * (64 - w0)) + (c1 * w0) + 32) >> 6;
+    XMM_UInt16  tmp1 = ((c0 * (64 - w1)) + (c1 * w1) + 32) >> 6;
+    XMM_UInt8 tmp = std::bit_cast< XMM_UInt8 >(
+                        __builtin_ia32_packuswb128(
+                            std::bit_cast< XMM_Int16 >(tmp0),
+                            std::bit_cast< XMM_Int16 >(tmp1)));
+    std::memcpy(palette + (i << 1), &tmp, sizeof(XMM_UInt8));
+  }
+#else
+  static const unsigned char  weightTable[16] =
+  {
+    0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64
+  };
+  for (int i = 0; i < 16; i++)
+  {
+    std::uint32_t c = 0U;
+    for (int j = 0; j < 4; j++)
+    {
+      std::uint32_t tmp = ((std::uint32_t(64 - weightTable[i]) * e0[j])
+                           + (std::uint32_t(weightTable[i]) * e1[j]) + 32U)
+                          >> 6;
+      c = c | (tmp << (j << 3));
+    }
+    palette[i] = c;
+  }
+#endif
+  // the anchor index of pixel 0 has 3 bits, all other indices have 4 bits
+  d1 = d1 >> 1;
+  dst[0] = palette[d1 & 7];
+  d1 = d1 >> 3;
+  for (unsigned int i = 1; i < 16; i++, d1 = d1 >> 4)
+    dst[(i >> 2) * w + (i & 3)] = palette[d1 & 15];
+}
+
 size_t DDSTexture::decodeBlock_BC7(
     std::uint32_t *dst, const unsigned char *src, unsigned int w)
 {
+  // the mode is the number of trailing zero bits in the first byte
+  int     mode = std::countr_zero((unsigned int) src[0] | 0x0100U);
+  if (mode == 6) [[likely]]
+  {
+    decodeBC7Mode6(dst, src, w);
+    return 16;
+  }
   std::uint32_t tmp[16];
-  (void) detexDecompressBlockBPTC(
-             reinterpret_cast< const std::uint8_t * >(src), 0xFFFFFFFFU, 0U,
-             reinterpret_cast< std::uint8_t * >(&(tmp[0])));
+  if (!detexDecompressBlockBPTC(
+           reinterpret_cast< const std::uint8_t * >(src), 0xFFFFFFFFU, 0U,
+           reinterpret_cast< std::uint8_t * >(&(tmp[0]))))
+  {
+    // invalid blocks are decoded as transparent black
+    for (unsigned int i = 0; i < 16; i++)
+      tmp[i] = 0U;
+  }
   for (unsigned int i = 0; i < 16; i++)
     dst[(i >> 2) * w + (i & 3)] = tmp[i];
   return 16;
 }
 
+#if ENABLE_X86_64_SIMD >= 1
+static inline void decodeBC4Rows(std::uint32_t *dst, unsigned int w,
+                                 XMM_UInt8 r, XMM_UInt8 g, bool isBC5)
+{
+  XMM_UInt8 rMask = { 0, 0, 0, 0x80, 1, 1, 1, 0x80,
+                      2, 2, 2, 0x80, 3, 3, 3, 0x80 };
+  XMM_UInt8 gMask = { 0x80, 0, 0x80, 0x80, 0x80, 1, 0x80, 0x80,
+                      0x80, 2, 0x80, 0x80, 0x80, 3, 0x80, 0x80 };
+  if (isBC5)
+  {
+    rMask = XMM_UInt8{ 0, 0x80, 0x80, 0x80, 1, 0x80, 0x80, 0x80,
+                       2, 0x80, 0x80, 0x80, 3, 0x80, 0x80, 0x80 };
+  }
+  const XMM_UInt32  a = { 0xFF000000U, 0xFF000000U, 0xFF000000U, 0xFF000000U };
+  for (unsigned int i = 0; i < 4; i++)
+  {
+    XMM_UInt8 tmp = shuffleBytes(r, rMask) | std::bit_cast< XMM_UInt8 >(a);
+    if (isBC5)
+    {
+      tmp |= shuffleBytes(g, gMask);
+      gMask += 4;
+    }
+    rMask += 4;
+    std::memcpy(dst + (i * w), &tmp, sizeof(XMM_UInt8));
+  }
+}
+#endif
+
+size_t DDSTexture::decodeBlocks_BC1(
+    std::uint32_t *dst, const unsigned char *src, unsigned int w)
+{
+#if ENABLE_X86_64_SIMD >= 1
+  for (unsigned int x = 0; x < w; x = x + 4, src = src + 8)
+  {
+    std::uint32_t c[4];
+    std::uint32_t bc = decodeBC1Colors(c, src, 0xFF000000U);
+    decodeBC1Rows(dst + x, w, c, bc, XMM_UInt8{ }, false);
+  }
+  return (size_t(w) << 1);
+#else
+  return decodeBlocks< decodeBlock_BC1 >(dst, src, w);
+#endif
+}
+
+size_t DDSTexture::decodeBlocks_BC3(
+    std::uint32_t *dst, const unsigned char *src, unsigned int w)
+{
+#if ENABLE_X86_64_SIMD >= 1
+  for (unsigned int x = 0; x < w; x = x + 4, src = src + 16)
+  {
+    std::uint64_t a;
+    std::uint64_t ba = decodeBC3Alpha(a, src);
+    std::uint32_t c[4];
+    std::uint32_t bc = decodeBC1Colors(c, src + 8);
+    decodeBC1Rows(dst + x, w, c, bc, decodeBC3AlphaValues(a, ba), true);
+  }
+  return (size_t(w) << 2);
+#else
+  return decodeBlocks< decodeBlock_BC3 >(dst, src, w);
+#endif
+}
+
+size_t DDSTexture::decodeBlocks_BC4(
+    std::uint32_t *dst, const unsigned char *src, unsigned int w)
+{
+#if ENABLE_X86_64_SIMD >= 1
+  for (unsigned int x = 0; x < w; x = x + 4, src = src + 8)
+  {
+    std::uint64_t a;
+    std::uint64_t ba = decodeBC3Alpha(a, src);
+    XMM_UInt8 r = decodeBC3AlphaValues(a, ba);
+    decodeBC4Rows(dst + x, w, r, r, false);
+  }
+  return (size_t(w) << 1);
+#else
+  return decodeBlocks< decodeBlock_BC4 >(dst, src, w);
+#endif
+}
+
+size_t DDSTexture::decodeBlocks_BC4S(
+    std::uint32_t *dst, const unsigned char *src, unsigned int w)
+{
+#if ENABLE_X86_64_SIMD >= 1
+  for (unsigned int x = 0; x < w; x = x + 4, src = src + 8)
+  {
+    std::uint64_t a;
+    std::uint64_t ba = decodeBC3Alpha(a, src, true);
+    XMM_UInt8 r = decodeBC3AlphaValues(a, ba);
+    decodeBC4Rows(dst + x, w, r, r, false);
+  }
+  return (size_t(w) << 1);
+#else
+  return decodeBlocks< decodeBlock_BC4S >(dst, src, w);
+#endif
+}
+
+size_t DDSTexture::decodeBlocks_BC5(
+    std::uint32_t *dst, const unsigned char *src, unsigned int w)
+{
+#if ENABLE_X86_64_SIMD >= 1
+  for (unsigned int x = 0; x < w; x = x + 4, src = src + 16)
+  {
+    std::uint64_t a1;
+    std::uint64_t a2;
+    std::uint64_t ba1 = decodeBC3Alpha(a1, src);
+    std::uint64_t ba2 = decodeBC3Alpha(a2, src + 8);
+    decodeBC4Rows(dst + x, w, decodeBC3AlphaValues(a1, ba1),
+                  decodeBC3AlphaValues(a2, ba2), true);
+  }
+  return (size_t(w) << 2);
+#else
+  return decodeBlocks< decodeBlock_BC5 >(dst, src, w);
+#endif
+}
+
+size_t DDSTexture::decodeBlocks_BC5S(
+    std::uint32_t *dst, const unsigned char *src, unsigned int w)
+{
+#if ENABLE_X86_64_SIMD >= 1
+  for (unsigned int x = 0; x < w; x = x + 4, src = src + 16)
+  {
+    std::uint64_t a1;
+    std::uint64_t a2;
+    std::uint64_t ba1 = decodeBC3Alpha(a1, src, true);
+    std::uint64_t ba2 = decodeBC3Alpha(a2, src + 8, true);
+    decodeBC4Rows(dst + x, w, decodeBC3AlphaValues(a1, ba1),
+                  decodeBC3AlphaValues(a2, ba2), true);
+  }
+  return (size_t(w) << 2);
+#else
+  return decodeBlocks< decodeBlock_BC5S >(dst, src, w);
+#endif
+}
+
 static inline std::uint32_t bgraToRGBA(std::uint32_t c)
 {
   return ((c & 0xFF00FF00U)
@@ -479,79 +839,124 @@ size_t DDSTexture::decodeLine_RGB9E5(
   return (size_t(w) << 2);
 }
 
-void DDSTexture::loadTextureData(
-    const unsigned char *srcPtr, int n, bool isCompressed,
-    size_t (*decodeFunction)(std::uint32_t *,
-                             const unsigned char *, unsigned int))
+size_t DDSTexture::decodeMipLevel(
+    std::uint32_t *p, const unsigned char *srcPtr,
+    unsigned int w, unsigned int h, const DXGIFormatInfo& fmtInfo)
 {
-  size_t  dataOffs = size_t(n) * size_t(textureDataSize);
-  for (int i = 0; i < 19; i++)
+  size_t  (*decodeFunction)(std::uint32_t *, const unsigned char *,
+                            unsigned int) = fmtInfo.decodeFunction;
+  size_t  n = 0;
+  if (!fmtInfo.isCompressed)
   {
-    std::uint32_t *p = textureData[i] + dataOffs;
-    unsigned int  w = (xMaskMip0 >> (unsigned char) i) + 1U;
-    unsigned int  h = (yMaskMip0 >> (unsigned char) i) + 1U;
-    if (i <= int(maxMipLevel))
+    // uncompressed format
+    for (unsigned int y = 0; y < h; y++)
+      n = n + decodeFunction(p + (y * w), srcPtr + n, w);
+  }
+  else if (w < 4 || h < 4)
+  {
+    std::uint32_t tmpBuf[16];
+    for (unsigned int y = 0; y < h; y = y + 4)
     {
-      if (!isCompressed)
-      {
-        // uncompressed format
-        for (unsigned int y = 0; y < h; y++)
-          srcPtr = srcPtr + decodeFunction(p + (y * w), srcPtr, w);
-      }
-      else if (w < 4 || h < 4)
+      for (unsigned int x = 0; x < w; x = x + 4)
       {
-        std::uint32_t tmpBuf[16];
-        for (unsigned int y = 0; y < h; y = y + 4)
+        n = n + decodeFunction(tmpBuf, srcPtr + n, 4);
+        for (unsigned int j = 0; j < 16; j++)
         {
-          for (unsigned int x = 0; x < w; x = x + 4)
-          {
-            srcPtr = srcPtr + decodeFunction(tmpBuf, srcPtr, 4);
-            for (unsigned int j = 0; j < 16; j++)
-            {
-              if ((y + (j >> 2)) < h && (x + (j & 3)) < w)
-                p[(y + (j >> 2)) * w + (x + (j & 3))] = tmpBuf[j];
-            }
-          }
-        }
-      }
-      else
-      {
-        for (unsigned int y = 0; y < h; y = y + 4)
-        {
-          for (unsigned int x = 0; x < w; x = x + 4)
-            srcPtr = srcPtr + decodeFunction(p + (y * w + x), srcPtr, w);
+          if ((y + (j >> 2)) < h && (x + (j & 3)) < w)
+            p[(y + (j >> 2)) * w + (x + (j & 3))] = tmpBuf[j];
         }
       }
     }
-    else
+  }
+  else
+  {
+    for (unsigned int y = 0; y < h; y = y + 4)
+      n = n + fmtInfo.decodeRowFunction(p + (y * w), srcPtr + n, w);
+  }
+  return n;
+}
+
+void DDSTexture::generateMipLevel(
+    std::uint32_t *p, const std::uint32_t *p2, int m) const
+{
+  unsigned int  w = (xMaskMip0 >> (unsigned char) m) + 1U;
+  unsigned int  h = (yMaskMip0 >> (unsigned char) m) + 1U;
+  unsigned int  xMask = xMaskMip0 >> (unsigned char) (m - 1);
+  unsigned int  yMask = yMaskMip0 >> (unsigned char) (m - 1);
+  size_t  w2 = size_t(xMask + 1U);
+  for (unsigned int y = 0; y < h; y++)
+  {
+    size_t  offsY2 = size_t((y << 1) & yMask) * w2;
+    size_t  offsY2p1 = size_t(((y << 1) + 1U) & yMask) * w2;
+    for (unsigned int x = 0; x < w; x++)
     {
-      // generate missing mipmaps
-      const std::uint32_t *p2 =
-          textureData[i - 1] + (size_t(textureDataSize) * size_t(n));
-      unsigned int  xMask = xMaskMip0 >> (unsigned char) (i - 1);
-      unsigned int  yMask = yMaskMip0 >> (unsigned char) (i - 1);
-      size_t  w2 = size_t(xMask + 1U);
-      for (unsigned int y = 0; y < h; y++)
-      {
-        size_t  offsY2 = size_t((y << 1) & yMask) * w2;
-        size_t  offsY2p1 = size_t(((y << 1) + 1U) & yMask) * w2;
-        for (unsigned int x = 0; x < w; x++)
-        {
-          size_t  offsX2 = (x << 1) & xMask;
-          size_t  offsX2p1 = ((x << 1) + 1U) & xMask;
-          FloatVector4  c(p2 + (offsY2 + offsX2));
-          c += FloatVector4(p2 + (offsY2 + offsX2p1));
-          c += FloatVector4(p2 + (offsY2p1 + offsX2));
-          c += FloatVector4(p2 + (offsY2p1 + offsX2p1));
-          p[y * w + x] = std::uint32_t(c * 0.25f);
-        }
-      }
+      size_t  offsX2 = (x << 1) & xMask;
+      size_t  offsX2p1 = ((x << 1) + 1U) & xMask;
+      FloatVector4  c(p2 + (offsY2 + offsX2));
+      c += FloatVector4(p2 + (offsY2 + offsX2p1));
+      c += FloatVector4(p2 + (offsY2p1 + offsX2));
+      c += FloatVector4(p2 + (offsY2p1 + offsX2p1));
+      p[y * w + x] = std::uint32_t(c * 0.25f);
     }
   }
 }
 
-void DDSTexture::loadTexture(FileBuffer& buf, int mipOffset)
+void DDSTexture::loadTextureData(
+    const unsigned char *srcPtr, int n, const DXGIFormatInfo& fmtInfo,
+    int firstMipLevel)
+{
+  size_t  dataOffs = size_t(n) * size_t(textureDataSize);
+  for (int i = firstMipLevel; i < 19; i++)
+  {
+    std::uint32_t *p = textureData[i] + dataOffs;
+    unsigned int  w = (xMaskMip0 >> (unsigned char) i) + 1U;
+    unsigned int  h = (yMaskMip0 >> (unsigned char) i) + 1U;
+    if (i <= int(maxMipLevel))
+      srcPtr = srcPtr + decodeMipLevel(p, srcPtr, w, h, fmtInfo);
+    else                                // generate missing mipmaps
+      generateMipLevel(p, textureData[i - 1] + dataOffs, i);
+  }
+}
+
+void DDSTexture::loadTextureBlocks(
+    const unsigned char *srcPtr, int n, size_t blockSize,
+    size_t (*decodeFunction)(std::uint32_t *,
+                             const unsigned char *, unsigned int))
 {
+  size_t  blockCnt = 0;
+  for (int i = 0; i < 19; i++)
+  {
+    blockDataOffsets[i] = std::uint32_t(blockCnt);
+    if (i < n)
+    {
+      blockCnt = blockCnt + (size_t((xMaskMip0 >> (unsigned char) i) + 1U)
+                             * ((yMaskMip0 >> (unsigned char) i) + 1U) >> 4);
+    }
+  }
+  if (!blockData)
+  {
+    // not already copied for decoding mip levels on demand
+    blockDataSize = blockCnt * blockSize;
+    blockData =
+        reinterpret_cast< unsigned char * >(std::malloc(blockDataSize));
+    if (!blockData)
+      throw std::bad_alloc();
+    std::memcpy(blockData, srcPtr, blockDataSize);
+  }
+  blockMipCnt = (unsigned char) n;
+  blockBytes = (unsigned char) blockSize;
+  blockDecodeFunction = decodeFunction;
+}
+
+void DDSTexture::loadTexture(FileBuffer& buf, int mipOffset, int loadFlags)
+{
+  blockMipCnt = 0;
+  blockBytes = 0;
+  mipsOnDemand = false;
+  textureID = 0U;
+  blockData = nullptr;
+  blockDataSize = 0;
+  blockDecodeFunction = nullptr;
   buf.setPosition(0);
   if (buf.size() < 148 || !FileBuffer::checkType(buf.readUInt32(), "DDS "))
     errorMessage("unsupported texture file format");
@@ -724,7 +1129,49 @@ void DDSTexture::loadTexture(FileBuffer& buf, int mipOffset)
     dataOffsets[i] = bufSize;
     bufSize = bufSize + (size_t(xMask + 1U) * (yMask + 1U));
   }
+  if (maxTextureNum || mipOffset)
+    loadFlags = 0;
+  if (dxgiFormat == 0x0A)
+    loadFlags = loadFlags & ~loadMipsOnDemand;
+  if (!isCompressed)
+    loadFlags = loadFlags & ~loadBlocksCompressed;
+  if (loadFlags)
+    textureID = nextTextureID.fetch_add(1U, std::memory_order_relaxed);
+  if (loadFlags & loadMipsOnDemand)
+  {
+    // keep a copy of all stored mip levels
+    blockDataSize = sizeRequired - size_t(srcPtr - (buf.data() + dataOffs));
+    blockData =
+        reinterpret_cast< unsigned char * >(std::malloc(blockDataSize));
+    if (!blockData)
+      throw std::bad_alloc();
+    std::memcpy(blockData, srcPtr, blockDataSize);
+    mipsOnDemand = true;
+  }
+  if (loadFlags & loadBlocksCompressed)
+  {
+    // mip levels that are at least 4x4 in size are stored as BCn blocks,
+    // except for the last one if the missing mip levels are generated from it
+    unsigned int  n = 0;
+    while (n < maxMipLevel && ((xMaskMip0 >> n) & (yMaskMip0 >> n) & 2U))
+      n++;
+    if (n)
+    {
+      loadTextureBlocks(srcPtr, int(n), blockSize, decodeFunction);
+      srcPtr = srcPtr + (size_t(blockDataOffsets[n]) * blockSize);
+      size_t  offs = dataOffsets[n];
+      for (unsigned int i = 0; i < 19; i++)
+        dataOffsets[i] = (i < n ? 0 : (dataOffsets[i] - offs));
+      bufSize = bufSize - offs;
+    }
+  }
   textureDataSize = std::uint32_t(bufSize);
+  if (mipsOnDemand)
+  {
+    for (unsigned int i = 0; i < 19; i++)
+      textureData[i] = nullptr;
+    return;
+  }
   size_t  totalDataSize =
       bufSize * (size_t(maxTextureNum) + 1) * sizeof(std::uint32_t);
   std::uint32_t *textureDataBuf =
@@ -732,7 +1179,10 @@ void DDSTexture::loadTexture(FileBuffer& buf, int mipOffset)
   if (!textureDataBuf)
     throw std::bad_alloc();
   for (unsigned int i = 0; i < 19; i++)
-    textureData[i] = textureDataBuf + dataOffsets[i];
+  {
+    textureData[i] =
+        (i < blockMipCnt ? nullptr : (textureDataBuf + dataOffsets[i]));
+  }
   if (dxgiFormat == 0x0A) [[unlikely]]
   {                                     // DXGI_FORMAT_R16G16B16A16_FLOAT
     std::uint32_t scale = 16777216U;
@@ -749,8 +1199,8 @@ void DDSTexture::loadTexture(FileBuffer& buf, int mipOffset)
   }
   for (size_t i = 0; i <= maxTextureNum; i++)
   {
-    loadTextureData(srcPtr + (i * sizeRequired), int(i),
-                    isCompressed, decodeFunction);
+    loadTextureData(srcPtr + (i * sizeRequired), int(i), dxgiFmtInfo,
+                    int(blockMipCnt));
   }
   if (mipOffset > 0 && dataOffsets[1])
   {
@@ -772,6 +1222,85 @@ void DDSTexture::loadTexture(FileBuffer& buf, int mipOffset)
   }
 }
 
+const std::uint32_t * DDSTexture::decodeBlock(std::uint64_t key) const
+{
+  DecodedBlockCache *p = decodedBlockCache;
+  if (!p) [[unlikely]]
+  {
+    p = reinterpret_cast< DecodedBlockCache * >(
+            std::calloc(1, sizeof(DecodedBlockCache)));
+    if (!p)
+      throw std::bad_alloc();
+    decodedBlockCacheDeleter.p = p;
+    decodedBlockCache = p;
+  }
+  size_t  n = size_t((key * 0x9E3779B97F4A7C15ULL) >> 52);
+  if (p->keys[n] != key)
+  {
+    blockDecodeFunction(p->blocks[n],
+                        blockData + (size_t(key & 0xFFFFFFFFU) * blockBytes),
+                        4);
+    p->keys[n] = key;
+  }
+  return p->blocks[n];
+}
+
+const std::uint32_t * DDSTexture::loadMipLevel(int m) const
+{
+  if (!mipsOnDemand || m < int(blockMipCnt))
+    return textureData[m];
+  std::lock_guard< std::mutex > tmpLock(mipLevelMutexes[textureID & 15U]);
+  // only textureData[] is modified, and it is published atomically
+  return const_cast< DDSTexture * >(this)->loadMipLevelLocked(m);
+}
+
+std::uint32_t * DDSTexture::loadMipLevelLocked(int m)
+{
+  std::uint32_t *p = textureData[m];
+  if (p)
+    return p;
+  unsigned int  w = (xMaskMip0 >> (unsigned char) m) + 1U;
+  unsigned int  h = (yMaskMip0 >> (unsigned char) m) + 1U;
+  if (m > 0 && !((xMaskMip0 | yMaskMip0) >> (unsigned char) (m - 1)))
+  {
+    // all 1x1 mip levels share the same data
+    p = loadMipLevelLocked(m - 1);
+  }
+  else if (m > int(maxMipLevel))
+  {
+    const std::uint32_t *p2 = loadMipLevelLocked(m - 1);
+    p = reinterpret_cast< std::uint32_t * >(
+            std::malloc(size_t(w) * h * sizeof(std::uint32_t)));
+    if (!p)
+      throw std::bad_alloc();
+    generateMipLevel(p, p2, m);
+  }
+  else
+  {
+    const DXGIFormatInfo& fmtInfo =
+        dxgiFormatInfoTable[dxgiFormatMap[dxgiFormat]];
+    size_t  offs = 0;
+    for (int i = 0; i < m; i++)
+    {
+      unsigned int  w2 = (xMaskMip0 >> (unsigned char) i) + 1U;
+      unsigned int  h2 = (yMaskMip0 >> (unsigned char) i) + 1U;
+      if (fmtInfo.isCompressed)
+      {
+        w2 = (w2 + 3U) >> 2;
+        h2 = (h2 + 3U) >> 2;
+      }
+      offs = offs + (size_t(w2) * h2 * fmtInfo.blockSize);
+    }
+    p = reinterpret_cast< std::uint32_t * >(
+            std::malloc(size_t(w) * h * sizeof(std::uint32_t)));
+    if (!p)
+      throw std::bad_alloc();
+    (void) decodeMipLevel(p, blockData + offs, w, h, fmtInfo);
+  }
+  __atomic_store_n(&(textureData[m]), p, __ATOMIC_RELEASE);
+  return p;
+}
+
 inline FloatVector4 DDSTexture::getPixelB_2(
     const std::uint32_t *p1, const std::uint32_t *p2, int x0, int y0,
     float xf, float yf, unsigned int xMask, unsigned int yMask)
@@ -789,21 +1318,24 @@ inline FloatVector4 DDSTexture::getPixelB_2(
                       p1 + (y1 * w + x1), p2 + (y1 * w + x1), xf, yf);
 }
 
-DDSTexture::DDSTexture(const char *fileName, int mipOffset)
+DDSTexture::DDSTexture(const char *fileName, int mipOffset,
+                       int loadFlags)
 {
   FileBuffer  tmpBuf(fileName);
-  loadTexture(tmpBuf, mipOffset);
+  loadTexture(tmpBuf, mipOffset, loadFlags);
 }
 
-DDSTexture::DDSTexture(const unsigned char *buf, size_t bufSize, int mipOffset)
+DDSTexture::DDSTexture(const unsigned char *buf, size_t bufSize, int mipOffset,
+                       int loadFlags)
 {
   FileBuffer  tmpBuf(buf, bufSize);
-  loadTexture(tmpBuf, mipOffset);
+  loadTexture(tmpBuf, mipOffset, loadFlags);
 }
 
-DDSTexture::DDSTexture(FileBuffer& buf, int mipOffset)
+DDSTexture::DDSTexture(FileBuffer& buf, int mipOffset,
+                       int loadFlags)
 {
-  loadTexture(buf, mipOffset);
+  loadTexture(buf, mipOffset, loadFlags);
 }
 
 DDSTexture::DDSTexture(std::uint32_t c, bool srgbColor)
@@ -815,7 +1347,14 @@ DDSTexture::DDSTexture(std::uint32_t c, bool srgbColor)
     isSRGB(srgbColor),
     channelCnt(4),
     maxTextureNum(0),
-    dxgiFormat(0)
+    dxgiFormat(0),
+    blockMipCnt(0),
+    blockBytes(0),
+    mipsOnDemand(false),
+    textureID(0U),
+    blockData(nullptr),
+    blockDataSize(0),
+    blockDecodeFunction(nullptr)
 {
 #if ENABLE_X86_64_SIMD >= 2
   std::uintptr_t  tmp1 =
@@ -836,8 +1375,41 @@ DDSTexture::DDSTexture(std::uint32_t c, bool srgbColor)
 
 DDSTexture::~DDSTexture()
 {
-  if (textureDataSize)
-    std::free(textureData[0]);
+  if (mipsOnDemand)
+  {
+    for (int i = blockMipCnt; i < 19; i++)
+    {
+      if (textureData[i] && (!i || textureData[i] != textureData[i - 1]))
+        std::free(textureData[i]);
+    }
+  }
+  else if (textureDataSize)
+  {
+    std::free(textureData[blockMipCnt]);
+  }
+  if (blockData)
+    std::free(blockData);
+}
+
+size_t DDSTexture::getDataSize() const
+{
+  size_t  n = blockDataSize;
+  if (!mipsOnDemand)
+    return (n + (size() * sizeof(std::uint32_t)));
+  const std::uint32_t *prvLevel = nullptr;
+  for (int i = blockMipCnt; i < 19; i++)
+  {
+    const std::uint32_t *p = __atomic_load_n(&(textureData[i]),
+                                             __ATOMIC_ACQUIRE);
+    if (p && p != prvLevel)
+    {
+      n = n + (size_t((xMaskMip0 >> (unsigned char) i) + 1U)
+               * ((yMaskMip0 >> (unsigned char) i) + 1U)
+               * sizeof(std::uint32_t));
+    }
+    prvLevel = p;
+  }
+  return n;
 }
 
 FloatVector4 DDSTexture::getPixelB(float x, float y, int mipLevel) const
@@ -861,17 +1433,31 @@ FloatVector4 DDSTexture::getPixelT_2(float x, float y, float mipLevel,
   unsigned int  yMask = yMaskMip0;
   unsigned int  xMask2 = t.xMaskMip0;
   unsigned int  yMask2 = t.yMaskMip0;
-  if (!(xMask2 == xMask && yMask2 == yMask)) [[unlikely]]
+  if (!(xMask2 == xMask && yMask2 == yMask && m0 >= int(blockMipCnt) &&
+        m0 >= int(t.blockMipCnt))) [[unlikely]]
   {
+    // if 't' is half or double the size, the mip level of 't' with the
+    // same dimensions is used
+    int     t2MipOffset = 0;
     if (xMask2 == (xMask >> 1) && yMask2 == (yMask >> 1) && m0 > 0)
+      t2MipOffset = -1;
+    else if ((xMask2 >> 1) == xMask && (yMask2 >> 1) == yMask)
+      t2MipOffset = 1;
+    if (m0 < int(blockMipCnt) ||
+        (m0 + t2MipOffset) < int(t.blockMipCnt))
     {
-      t2--;
+      // BCn-resident textures are sampled separately
+      FloatVector4  tmp1(getPixelT(x, y, mipLevel));
+      FloatVector4  tmp2(t.getPixelT(x, y, mipLevel + float(t2MipOffset)));
+      tmp1[2] = tmp2[0];
+      tmp1[3] = tmp2[1];
+      return tmp1;
     }
-    else if ((xMask2 >> 1) == xMask && (yMask2 >> 1) == yMask)
+    if (t2MipOffset)
     {
-      t2++;
+      t2 = t2 + t2MipOffset;
     }
-    else
+    else if (!(xMask2 == xMask && yMask2 == yMask))
     {
       FloatVector4  tmp1(getPixelT(x, y, mipLevel));
       FloatVector4  tmp2(t.getPixelT(x, y, mipLevel));
@@ -880,6 +1466,18 @@ FloatVector4 DDSTexture::getPixelT_2(float x, float y, float mipLevel,
       return tmp1;
     }
   }
+  if (mipsOnDemand | t.mipsOnDemand) [[unlikely]]
+  {
+    // decode the mip levels used below if necessary
+    int     m1 = m0 + int(float(m0) != mipLevel);
+    const std::uint32_t * const *t2Mip0 = &(t.textureData[0]);
+    int     m2 = int(t2 - t2Mip0);
+    for (int i = m0; i <= m1; i++, m2++)
+    {
+      (void) getMipLevelData(i);
+      (void) t.getMipLevelData(m2);
+    }
+  }
   int     x0, y0;
   float   xf, yf;
   if (!convertTexCoord(x0, y0, xf, yf, xMask, yMask, x, y, m0)) [[unlikely]]
@@ -904,7 +1502,7 @@ FloatVector4 DDSTexture::getPixelT_N(float x, float y, float mipLevel) const
   unsigned int  xMask = xMaskMip0 >> (unsigned char) m0;
   unsigned int  yMask = yMaskMip0 >> (unsigned char) m0;
   if (!(xMask | yMask)) [[unlikely]]
-    return FloatVector4(textureData[m0]);
+    return FloatVector4(getMipLevelData(m0));
   x = x - 0.5f;
   y = y - 0.5f;
   float   xf = float(std::floor(x));
@@ -913,15 +1511,14 @@ FloatVector4 DDSTexture::getPixelT_N(float x, float y, float mipLevel) const
   int     y0 = int(yf);
   xf = x - xf;
   yf = y - yf;
-  FloatVector4  c0(getPixelB_Wrap(textureData[m0], x0, y0, xf, yf,
-                                  xMask, yMask));
+  FloatVector4  c0(getPixelB_WrapM(m0, x0, y0, xf, yf, xMask, yMask));
   float   mf = float(m0);
   if (mf != mipLevel) [[likely]]
   {
     mf = mipLevel - mf;
     getNextMipTexCoord(x0, y0, xf, yf);
-    FloatVector4  c1(getPixelB_Wrap(textureData[m0 + 1], x0, y0, xf, yf,
-                                    xMask >> 1, yMask >> 1));
+    FloatVector4  c1(getPixelB_WrapM(m0 + 1, x0, y0, xf, yf,
+                                     xMask >> 1, yMask >> 1));
     c0 = (c0 * (1.0f - mf)) + (c1 * mf);
   }
   return c0;
@@ -945,16 +1542,15 @@ FloatVector4 DDSTexture::getPixelTM(float x, float y, float mipLevel) const
   y = (!(int(yf) & 1) ? y : (1.0f - y));
   unsigned int  xMask, yMask;
   if (!convertTexCoord(x0, y0, xf, yf, xMask, yMask, x, y, m0)) [[unlikely]]
-    return FloatVector4(textureData[m0]);
-  FloatVector4  c0(getPixelB_Clamp(textureData[m0], x0, y0, xf, yf,
-                                   xMask, yMask));
+    return FloatVector4(getMipLevelData(m0));
+  FloatVector4  c0(getPixelB_ClampM(m0, x0, y0, xf, yf, xMask, yMask));
   float   mf = float(m0);
   if (mf != mipLevel) [[likely]]
   {
     mf = mipLevel - mf;
     getNextMipTexCoord(x0, y0, xf, yf);
-    FloatVector4  c1(getPixelB_Clamp(textureData[m0 + 1], x0, y0, xf, yf,
-                                     xMask >> 1, yMask >> 1));
+    FloatVector4  c1(getPixelB_ClampM(m0 + 1, x0, y0, xf, yf,
+                                      xMask >> 1, yMask >> 1));
     c0 = (c0 * (1.0f - mf)) + (c1 * mf);
   }
   return c0;
@@ -973,21 +1569,247 @@ FloatVector4 DDSTexture::getPixelTC(float x, float y, float mipLevel) const
   float   xf, yf;
   unsigned int  xMask, yMask;
   if (!convertTexCoord(x0, y0, xf, yf, xMask, yMask, x, y, m0)) [[unlikely]]
-    return FloatVector4(textureData[m0]);
-  FloatVector4  c0(getPixelB_Clamp(textureData[m0], x0, y0, xf, yf,
-                                   xMask, yMask));
+    return FloatVector4(getMipLevelData(m0));
+  FloatVector4  c0(getPixelB_ClampM(m0, x0, y0, xf, yf, xMask, yMask));
   float   mf = float(m0);
   if (mf != mipLevel) [[likely]]
   {
     mf = mipLevel - mf;
     getNextMipTexCoord(x0, y0, xf, yf);
-    FloatVector4  c1(getPixelB_Clamp(textureData[m0 + 1], x0, y0, xf, yf,
-                                     xMask >> 1, yMask >> 1));
+    FloatVector4  c1(getPixelB_ClampM(m0 + 1, x0, y0, xf, yf,
+                                      xMask >> 1, yMask >> 1));
     c0 = (c0 * (1.0f - mf)) + (c1 * mf);
   }
   return c0;
 }
 
+static inline void storeSample_x8(FloatVector8 *c, int i, FloatVector4 v)
+{
+  c[0][i] = v[0];
+  c[1][i] = v[1];
+  c[2][i] = v[2];
+  c[3][i] = v[3];
+}
+
+#if ENABLE_X86_64_SIMD >= 2
+static inline YMM_UInt32 gatherTexels(const std::uint32_t *p, YMM_Int32 offs)
+{
+#  if ENABLE_X86_64_SIMD >= 4
+  YMM_UInt32  tmp;
+  YMM_Int32   mask = { -1, -1, -1, -1, -1, -1, -1, -1 };
+  // the memory read by the gather is not an operand, so a memory clobber
+  // is needed to keep it ordered after the stores that decode the texture
+  __asm__ ("vpgatherdd %t1, (%3, %t2, 4), %t0"
+           : "=&x" (tmp), "+&x" (mask) : "x" (offs), "r" (p) : "memory");
+  return tmp;
+#  else
+  YMM_UInt32  tmp =
+  {
+    p[offs[0]], p[offs[1]], p[offs[2]], p[offs[3]],
+    p[offs[4]], p[offs[5]], p[offs[6]], p[offs[7]]
+  };
+  return tmp;
+#  endif
+}
+
+static inline FloatVector8 getTexelChannel(YMM_UInt32 c, int n)
+{
+  YMM_Int32 tmp = std::bit_cast< YMM_Int32 >((c >> (n << 3)) & 0xFFU);
+  return FloatVector8(__builtin_convertvector(tmp, YMM_Float));
+}
+#endif
+
+bool DDSTexture::getPixelB_x8(
+    FloatVector8 *c, const std::int32_t *m, FloatVector8 x, FloatVector8 y,
+    bool normalizedCoord) const
+{
+#if ENABLE_X86_64_SIMD >= 2
+  YMM_Int32 offs, xMask, yMask;
+  const std::uint32_t *basePtr;
+  int     mipLevel = m[0];
+  if (m[1] == mipLevel && m[2] == mipLevel && m[3] == mipLevel &&
+      m[4] == mipLevel && m[5] == mipLevel && m[6] == mipLevel &&
+      m[7] == mipLevel) [[likely]]
+  {
+    if (mipLevel < int(blockMipCnt)) [[unlikely]]
+      return false;
+    basePtr = getMipLevelData(mipLevel);
+    offs = YMM_Int32{ 0, 0, 0, 0, 0, 0, 0, 0 };
+    xMask = (offs + std::int32_t(xMaskMip0 >> (unsigned char) mipLevel));
+    yMask = (offs + std::int32_t(yMaskMip0 >> (unsigned char) mipLevel));
+  }
+  else
+  {
+    basePtr = textureData[blockMipCnt];
+    for (int i = 0; i < 8; i++)
+    {
+      mipLevel = m[i];
+      if (mipLevel < int(blockMipCnt)) [[unlikely]]
+        return false;
+      const std::uint32_t *p = textureData[mipLevel];
+      if (mipsOnDemand) [[unlikely]]
+      {
+        // separately allocated mip levels can only be gathered if all
+        // samples use the same one
+        return false;
+      }
+      offs[i] = std::int32_t(p - basePtr);
+      xMask[i] = std::int32_t(xMaskMip0 >> (unsigned char) mipLevel);
+      yMask[i] = std::int32_t(yMaskMip0 >> (unsigned char) mipLevel);
+    }
+  }
+  if (normalizedCoord)
+  {
+    x *= FloatVector8(__builtin_convertvector(xMask + 1, YMM_Float));
+    y *= FloatVector8(__builtin_convertvector(yMask + 1, YMM_Float));
+  }
+  FloatVector8  xf(x - 0.5f);
+  FloatVector8  yf(y - 0.5f);
+  FloatVector8  xi(xf);
+  FloatVector8  yi(yf);
+  xi.floorValues();
+  yi.floorValues();
+  xf -= xi;
+  yf -= yi;
+  YMM_Int32 x0 = __builtin_convertvector(xi.v, YMM_Int32);
+  YMM_Int32 y0 = __builtin_convertvector(yi.v, YMM_Int32);
+  YMM_Int32 x1 = (x0 + 1) & xMask;
+  YMM_Int32 y1 = (y0 + 1) & yMask;
+  x0 = x0 & xMask;
+  y0 = y0 & yMask;
+  y0 = offs + (y0 * (xMask + 1));
+  y1 = offs + (y1 * (xMask + 1));
+  YMM_UInt32  t0 = gatherTexels(basePtr, y0 + x0);
+  YMM_UInt32  t1 = gatherTexels(basePtr, y0 + x1);
+  YMM_UInt32  t2 = gatherTexels(basePtr, y1 + x0);
+  YMM_UInt32  t3 = gatherTexels(basePtr, y1 + x1);
+  for (int i = 0; i < 4; i++)
+  {
+    FloatVector8  v0(getTexelChannel(t0, i));
+    FloatVector8  v1(getTexelChannel(t1, i));
+    FloatVector8  v2(getTexelChannel(t2, i));
+    FloatVector8  v3(getTexelChannel(t3, i));
+    v1 -= v0;
+    v3 -= v2;
+    v1 *= xf;
+    v3 *= xf;
+    v0 += v1;
+    v0 += ((v2 + v3 - v0) * yf);
+    c[i] = v0;
+  }
+  return true;
+#else
+  (void) c;
+  (void) m;
+  (void) x;
+  (void) y;
+  (void) normalizedCoord;
+  return false;
+#endif
+}
+
+void DDSTexture::getPixelT_x8(
+    FloatVector8 *c, const FloatVector8& x, const FloatVector8& y,
+    const FloatVector8& mipLevel) const
+{
+  FloatVector8  mf(mipLevel);
+  mf.maxValues(FloatVector8(0.0f)).minValues(FloatVector8(18.0f));
+  FloatVector8  m0f(mf);
+  m0f.floorValues();
+  mf -= m0f;
+  std::int32_t  m0[8];
+  std::int32_t  m1[8];
+  m0f.convertToInt32(m0);
+  bool    haveNextMip = false;
+  for (int i = 0; i < 8; i++)
+  {
+    m1[i] = std::min(m0[i] + 1, 18);
+    haveNextMip = haveNextMip | (mf[i] != 0.0f);
+  }
+  if (getPixelB_x8(c, m0, x, y, true)) [[likely]]
+  {
+    if (!haveNextMip)
+      return;
+    FloatVector8  c1[4];
+    if (getPixelB_x8(c1, m1, x, y, true)) [[likely]]
+    {
+      for (int i = 0; i < 4; i++)
+        c[i] = (c[i] * (FloatVector8(1.0f) - mf)) + (c1[i] * mf);
+      return;
+    }
+  }
+  for (int i = 0; i < 8; i++)
+    storeSample_x8(c, i, getPixelT_Inline(x[i], y[i], mipLevel[i]));
+}
+
+void DDSTexture::getPixelT_2_x8(
+    FloatVector8 *c, const FloatVector8& x, const FloatVector8& y,
+    const FloatVector8& mipLevel, const DDSTexture& t) const
+{
+  // select the mip levels of 't' in the same way as getPixelT_2(): if 't'
+  // is half or double the size, the mip level with the same dimensions is
+  // used, also when either texture is BCn-resident
+  FloatVector8  mipLevel2(mipLevel);
+  mipLevel2.maxValues(FloatVector8(0.0f));
+  bool    sameSize = (t.xMaskMip0 == xMaskMip0 && t.yMaskMip0 == yMaskMip0);
+  bool    halfSize = (t.xMaskMip0 == (xMaskMip0 >> 1)
+                      && t.yMaskMip0 == (yMaskMip0 >> 1));
+  bool    doubleSize = ((t.xMaskMip0 >> 1) == xMaskMip0
+                        && (t.yMaskMip0 >> 1) == yMaskMip0);
+  if (halfSize || doubleSize)
+  {
+    for (int i = 0; i < 8; i++)
+    {
+      int     m0 = int(mipLevel2[i]);
+      if (sameSize && m0 >= int(blockMipCnt) && m0 >= int(t.blockMipCnt))
+        continue;
+      if (halfSize && m0 > 0)
+        mipLevel2[i] -= 1.0f;
+      else if (doubleSize)
+        mipLevel2[i] += 1.0f;
+    }
+  }
+  FloatVector8  tmp[4];
+  getPixelT_x8(c, x, y, mipLevel);
+  t.getPixelT_x8(tmp, x, y, mipLevel2);
+  c[2] = tmp[0];
+  c[3] = tmp[1];
+}
+
+void DDSTexture::getPixelT_N_x8(
+    FloatVector8 *c, const FloatVector8& x, const FloatVector8& y,
+    const FloatVector8& mipLevel) const
+{
+  FloatVector8  mf(mipLevel);
+  mf.maxValues(FloatVector8(0.0f)).minValues(FloatVector8(18.0f));
+  FloatVector8  m0f(mf);
+  m0f.floorValues();
+  mf -= m0f;
+  std::int32_t  m0[8];
+  std::int32_t  m1[8];
+  m0f.convertToInt32(m0);
+  bool    haveNextMip = false;
+  for (int i = 0; i < 8; i++)
+  {
+    m1[i] = std::min(m0[i] + 1, 18);
+    haveNextMip = haveNextMip | (mf[i] != 0.0f);
+  }
+  if (getPixelB_x8(c, m0, x, y, false)) [[likely]]
+  {
+    if (!haveNextMip)
+      return;
+    FloatVector8  c1[4];
+    if (getPixelB_x8(c1, m1, x * 0.5f, y * 0.5f, false)) [[likely]]
+    {
+      for (int i = 0; i < 4; i++)
+        c[i] = (c[i] * (FloatVector8(1.0f) - mf)) + (c1[i] * mf);
+      return;
+    }
+  }
+  for (int i = 0; i < 8; i++)
+    storeSample_x8(c, i, getPixelT_N(x[i], y[i], mipLevel[i]));
+}
+
 const unsigned char DDSTexture::cubeWrapTable[24] =
 {
   // value = new_face + mirror_U * 0x20 + mirror_V * 0x40 + swap_UV * 0x80
@@ -1137,6 +1959,16 @@ FloatVector4 DDSTexture::cubeMap(float x, float y, float z,
   return c0;
 }
 
+void DDSTexture::cubeMap_x8(
+    FloatVector8 *c, const FloatVector8& x, const FloatVector8& y,
+    const FloatVector8& z, const FloatVector8& mipLevel) const
+{
+  // samples near the edges of the faces need to be wrapped separately,
+  // so cube maps are sampled one texture coordinate at a time
+  for (int i = 0; i < 8; i++)
+    storeSample_x8(c, i, cubeMap(x[i], y[i], z[i], mipLevel[i]));
+}
+
 FloatVector4 DDSTexture::calculateAvgLevelFP16(
     const unsigned char *p, size_t nBytes)
 {
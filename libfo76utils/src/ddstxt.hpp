@@ -5,14 +5,20 @@
 #include "common.hpp"
 #include "filebuf.hpp"
 #include "fp32vec4.hpp"
+#include "fp32vec8.hpp"
 
 class DDSTexture
 {
  protected:
   struct DXGIFormatInfo
   {
+    // decodes a single 4x4 block, or a line of pixels if not compressed
     size_t  (*decodeFunction)(std::uint32_t *,
                               const unsigned char *, unsigned int);
+    // decodes a row of w / 4 blocks (w >= 4) to 4 lines of w pixels,
+    // or a line of pixels if not compressed
+    size_t  (*decodeRowFunction)(std::uint32_t *,
+                                 const unsigned char *, unsigned int);
     const char  *name;
     bool    isCompressed;
     bool    isSRGB;
@@ -31,7 +37,31 @@ class DDSTexture
   unsigned char channelCnt;
   unsigned char maxTextureNum;
   unsigned char dxgiFormat;             // 0 if constructed from a color
+  // BCn-resident textures: mip levels 0 to blockMipCnt - 1 are not decoded
+  // at load time, textureData[] is NULL for these, and the blocks are
+  // decoded on demand into a per-thread cache when sampled
+  unsigned char blockMipCnt;
+  unsigned char blockBytes;             // 8 or 16 bytes per 4x4 block
+  // if true, textureData[] is initially NULL for all mip levels that are not
+  // BCn-resident, and each level is decoded from the copy of the source data
+  // in blockData when it is first sampled
+  bool          mipsOnDemand;
+  std::uint32_t textureID;              // unique ID for the block cache
   std::uint32_t *textureData[19];
+  unsigned char *blockData;
+  size_t        blockDataSize;
+  // index of the first block of each mip level in blockData
+  std::uint32_t blockDataOffsets[19];
+  size_t  (*blockDecodeFunction)(std::uint32_t *,
+                                 const unsigned char *, unsigned int);
+  struct DecodedBlockCache
+  {
+    // (textureID << 32) | block index, 0 if the entry is not used
+    std::uint64_t keys[4096];
+    std::uint32_t blocks[4096][16];
+  };
+  // allocated on the first cache miss in each thread
+  static thread_local DecodedBlockCache *decodedBlockCache;
   static size_t decodeBlock_BC1(
       std::uint32_t *dst, const unsigned char *src, unsigned int w);
   static size_t decodeBlock_BC2(
@@ -52,6 +82,22 @@ class DDSTexture
       std::uint32_t *dst, const unsigned char *src, unsigned int w);
   static size_t decodeBlock_BC7(
       std::uint32_t *dst, const unsigned char *src, unsigned int w);
+  template< size_t (*decodeFunction)(std::uint32_t *,
+                                     const unsigned char *, unsigned int) >
+  static size_t decodeBlocks(
+      std::uint32_t *dst, const unsigned char *src, unsigned int w);
+  static size_t decodeBlocks_BC1(
+      std::uint32_t *dst, const unsigned char *src, unsigned int w);
+  static size_t decodeBlocks_BC3(
+      std::uint32_t *dst, const unsigned char *src, unsigned int w);
+  static size_t decodeBlocks_BC4(
+      std::uint32_t *dst, const unsigned char *src, unsigned int w);
+  static size_t decodeBlocks_BC4S(
+      std::uint32_t *dst, const unsigned char *src, unsigned int w);
+  static size_t decodeBlocks_BC5(
+      std::uint32_t *dst, const unsigned char *src, unsigned int w);
+  static size_t decodeBlocks_BC5S(
+      std::uint32_t *dst, const unsigned char *src, unsigned int w);
   static size_t decodeLine_RGB(
       std::uint32_t *dst, const unsigned char *src, unsigned int w);
   static size_t decodeLine_BGR(
@@ -72,11 +118,63 @@ class DDSTexture
       std::uint32_t *dst, const unsigned char *src, unsigned int w);
   static size_t decodeLine_RGB9E5(
       std::uint32_t *dst, const unsigned char *src, unsigned int w);
-  void loadTextureData(const unsigned char *srcPtr, int n, bool isCompressed,
-                       size_t (*decodeFunction)(std::uint32_t *,
-                                                const unsigned char *,
-                                                unsigned int));
-  void loadTexture(FileBuffer& buf, int mipOffset);
+  // decode stored mip level of size w * h, returns the number of bytes read
+  static size_t decodeMipLevel(std::uint32_t *p, const unsigned char *srcPtr,
+                               unsigned int w, unsigned int h,
+                               const DXGIFormatInfo& fmtInfo);
+  // generate mip level m from m - 1 with a 2x2 box filter
+  void generateMipLevel(std::uint32_t *p, const std::uint32_t *p2,
+                        int m) const;
+  void loadTextureData(const unsigned char *srcPtr, int n,
+                       const DXGIFormatInfo& fmtInfo, int firstMipLevel = 0);
+  void loadTextureBlocks(const unsigned char *srcPtr, int n, size_t blockSize,
+                         size_t (*decodeFunction)(std::uint32_t *,
+                                                  const unsigned char *,
+                                                  unsigned int));
+  void loadTexture(FileBuffer& buf, int mipOffset, int loadFlags);
+  const std::uint32_t *decodeBlock(std::uint64_t key) const;
+  // decode mip level m of a texture with mipsOnDemand set, and publish it
+  // in textureData[m], returns NULL if the level is BCn-resident
+  const std::uint32_t *loadMipLevel(int m) const;
+  std::uint32_t *loadMipLevelLocked(int m);
+  // returns the decoded data of a mip level that is not BCn-resident
+  inline const std::uint32_t *getMipLevelData(int m) const
+  {
+    const std::uint32_t *p = __atomic_load_n(&(textureData[m]),
+                                             __ATOMIC_ACQUIRE);
+    if (!p) [[unlikely]]
+      p = loadMipLevel(m);
+    return p;
+  }
+  // returns the decoded 4x4 block containing x, y (which must be in range)
+  // of a block compressed mip level, the pointer remains valid until the
+  // next block is decoded by the same thread
+  inline const std::uint32_t *getDecodedBlock(
+      unsigned int x, unsigned int y, int mipLevel) const;
+  inline const std::uint32_t& getPixelN_BC(
+      unsigned int x, unsigned int y, int mipLevel) const
+  {
+    return getDecodedBlock(x, y, mipLevel)[((y & 3U) << 2) | (x & 3U)];
+  }
+  inline FloatVector4 getPixelB_BC(
+      int x0, int y0, float xf, float yf,
+      unsigned int xMask, unsigned int yMask, int mipLevel,
+      bool clampCoord) const;
+  // bilinear filtering of mip level m, which may be block compressed
+  inline FloatVector4 getPixelB_WrapM(
+      int m, int x0, int y0, float xf, float yf,
+      unsigned int xMask, unsigned int yMask) const;
+  inline FloatVector4 getPixelB_ClampM(
+      int m, int x0, int y0, float xf, float yf,
+      unsigned int xMask, unsigned int yMask) const;
+  // bilinear filtering of 8 samples with wrapped texture coordinates at
+  // mip levels m[0] to m[7], x and y are multiplied by the width and height
+  // of the mip level if normalizedCoord is true, returns false if any of the
+  // mip levels is BCn-resident, or the samples cannot be gathered from the
+  // same buffer
+  bool getPixelB_x8(FloatVector8 *c, const std::int32_t *m,
+                    FloatVector8 x, FloatVector8 y,
+                    bool normalizedCoord) const;
   // X, Y coordinates are scaled to -0.5 to xMask + 0.5, -0.5 to yMask + 0.5
   inline bool convertTexCoord(
       int& x0, int& y0, float& xf, float& yf,
@@ -106,9 +204,17 @@ class DDSTexture
       const std::uint32_t *p, int x0, int y0, int n, size_t faceDataSize,
       float xf, float yf, unsigned int xMask);
  public:
-  DDSTexture(const char *fileName, int mipOffset = 0);
-  DDSTexture(const unsigned char *buf, size_t bufSize, int mipOffset = 0);
-  DDSTexture(FileBuffer& buf, int mipOffset = 0);
+  // flags for the loadFlags parameter of the constructors, which only apply
+  // to textures that are not arrays or cube maps:
+  //   loadBlocksCompressed: BC1 to BC7 formats are loaded as BCn-resident
+  //   loadMipsOnDemand: mip levels are decoded when first sampled (not
+  //   supported for the R16G16B16A16_FLOAT format)
+  static constexpr int  loadBlocksCompressed = 1;
+  static constexpr int  loadMipsOnDemand = 2;
+  DDSTexture(const char *fileName, int mipOffset = 0, int loadFlags = 0);
+  DDSTexture(const unsigned char *buf, size_t bufSize, int mipOffset = 0,
+             int loadFlags = 0);
+  DDSTexture(FileBuffer& buf, int mipOffset = 0, int loadFlags = 0);
   // create 1x1 texture of color c without allocating memory
   DDSTexture(std::uint32_t c, bool srgbColor = false);
   ~DDSTexture();
@@ -148,7 +254,17 @@ class DDSTexture
   {
     return dxgiFormatInfoTable[dxgiFormatMap[dxgiFormat]].name;
   }
+  inline bool isBlockCompressed() const
+  {
+    return bool(blockMipCnt);
+  }
+  inline bool isDecodedOnDemand() const
+  {
+    return mipsOnDemand;
+  }
   // get pointer to raw texture data and its total size
+  // (NULL and the size of the decoded mip levels if isBlockCompressed(),
+  // data() may also be NULL if isDecodedOnDemand())
   inline const std::uint32_t *data() const
   {
     return textureData[0];
@@ -157,20 +273,37 @@ class DDSTexture
   {
     return (size_t(textureDataSize) * (maxTextureNum + 1U));
   }
+  // total memory currently used by the texture data in bytes
+  size_t getDataSize() const;
+  // memory used by the texture data after all mip levels are decoded
+  inline size_t getMaxDataSize() const
+  {
+    return (size() * sizeof(std::uint32_t) + blockDataSize);
+  }
   // no interpolation, returns color in RGBA format (LSB = red, MSB = alpha)
   inline const std::uint32_t& getPixelN(int x, int y, int mipLevel) const
   {
     unsigned int  xMask = xMaskMip0 >> (unsigned char) mipLevel;
     unsigned int  yMask = yMaskMip0 >> (unsigned char) mipLevel;
-    return textureData[mipLevel][((unsigned int) y & yMask) * (xMask + 1U)
-                                 + ((unsigned int) x & xMask)];
+    if (mipLevel < int(blockMipCnt)) [[unlikely]]
+    {
+      return getPixelN_BC((unsigned int) x & xMask, (unsigned int) y & yMask,
+                          mipLevel);
+    }
+    return getMipLevelData(mipLevel)[((unsigned int) y & yMask) * (xMask + 1U)
+                                     + ((unsigned int) x & xMask)];
   }
   inline const std::uint32_t& getPixelN(int x, int y, int mipLevel, int n) const
   {
     unsigned int  xMask = xMaskMip0 >> (unsigned char) mipLevel;
     unsigned int  yMask = yMaskMip0 >> (unsigned char) mipLevel;
+    if (mipLevel < int(blockMipCnt)) [[unlikely]]
+    {
+      return getPixelN_BC((unsigned int) x & xMask, (unsigned int) y & yMask,
+                          mipLevel);
+    }
     const std::uint32_t *p =
-        textureData[mipLevel] + (size_t(textureDataSize) * size_t(n));
+        getMipLevelData(mipLevel) + (size_t(textureDataSize) * size_t(n));
     return p[((unsigned int) y & yMask) * (xMask + 1U)
              + ((unsigned int) x & xMask)];
   }
@@ -183,7 +316,9 @@ class DDSTexture
     unsigned int  yc = (unsigned int) y;
     xc = (!(xc & (xMask + 1U)) ? xc : ~xc) & xMask;
     yc = (!(yc & (yMask + 1U)) ? yc : ~yc) & yMask;
-    return textureData[mipLevel][yc * (xMask + 1U) + xc];
+    if (mipLevel < int(blockMipCnt)) [[unlikely]]
+      return getPixelN_BC(xc, yc, mipLevel);
+    return getMipLevelData(mipLevel)[yc * (xMask + 1U) + xc];
   }
   // getPixelN() with clamped texture coordinates
   inline const std::uint32_t& getPixelC(int x, int y, int mipLevel) const
@@ -192,7 +327,9 @@ class DDSTexture
     unsigned int  yMask = yMaskMip0 >> (unsigned char) mipLevel;
     x = (x > 0 ? (x < int(xMask) ? x : int(xMask)) : 0);
     y = (y > 0 ? (y < int(yMask) ? y : int(yMask)) : 0);
-    const std::uint32_t *p = textureData[mipLevel];
+    if (mipLevel < int(blockMipCnt)) [[unlikely]]
+      return getPixelN_BC((unsigned int) x, (unsigned int) y, mipLevel);
+    const std::uint32_t *p = getMipLevelData(mipLevel);
     return p[(unsigned int) y * (xMask + 1U) + (unsigned int) x];
   }
   // bilinear filtering (getPixelB/getPixelT use normalized texture coordinates)
@@ -222,6 +359,21 @@ class DDSTexture
   // y = -1.0 to 1.0: S to N
   // z = -1.0 to 1.0: bottom to top
   FloatVector4 cubeMap(float x, float y, float z, float mipLevel) const;
+  // the _x8 functions sample 8 texture coordinates at once, and store the
+  // results in structure of arrays format: c[0] to c[3] = red, green, blue
+  // and alpha channels of the 8 samples, in the same range as the single
+  // sample functions
+  void getPixelT_x8(FloatVector8 *c, const FloatVector8& x,
+                    const FloatVector8& y, const FloatVector8& mipLevel) const;
+  void getPixelT_2_x8(FloatVector8 *c, const FloatVector8& x,
+                      const FloatVector8& y, const FloatVector8& mipLevel,
+                      const DDSTexture& t) const;
+  void getPixelT_N_x8(FloatVector8 *c, const FloatVector8& x,
+                      const FloatVector8& y,
+                      const FloatVector8& mipLevel) const;
+  void cubeMap_x8(FloatVector8 *c, const FloatVector8& x,
+                  const FloatVector8& y, const FloatVector8& z,
+                  const FloatVector8& mipLevel) const;
   // Wrap cube map texture coordinates for seamless filtering (n = face number
   // from 0 to 5, xMask = face width - 1). If x and y are both out of range,
   // false is returned, and x, y and n are not changed (the sample should be
@@ -296,6 +448,76 @@ inline FloatVector4 DDSTexture::getPixelB_Clamp(
                       p + ((unsigned int) y1 * w + (unsigned int) x1), xf, yf);
 }
 
+inline const std::uint32_t * DDSTexture::getDecodedBlock(
+    unsigned int x, unsigned int y, int mipLevel) const
+{
+  // mip levels that are stored compressed are at least 4x4 in size
+  unsigned int  w = ((xMaskMip0 >> (unsigned char) mipLevel) + 1U) >> 2;
+  std::uint64_t key = (std::uint64_t(textureID) << 32)
+                      | (blockDataOffsets[mipLevel] + ((y >> 2) * w)
+                         + (x >> 2));
+  DecodedBlockCache *p = decodedBlockCache;
+  if (p) [[likely]]
+  {
+    size_t  n = size_t((key * 0x9E3779B97F4A7C15ULL) >> 52);
+    if (p->keys[n] == key) [[likely]]
+      return p->blocks[n];
+  }
+  return decodeBlock(key);
+}
+
+inline FloatVector4 DDSTexture::getPixelB_BC(
+    int x0, int y0, float xf, float yf,
+    unsigned int xMask, unsigned int yMask, int mipLevel,
+    bool clampCoord) const
+{
+  unsigned int  x0u, y0u, x1, y1;
+  if (!clampCoord)
+  {
+    x0u = (unsigned int) x0;
+    y0u = (unsigned int) y0;
+    x1 = (x0u + 1U) & xMask;
+    y1 = (y0u + 1U) & yMask;
+    x0u = x0u & xMask;
+    y0u = y0u & yMask;
+  }
+  else
+  {
+    x1 = (unsigned int) std::min< int >(std::max< int >(x0 + 1, 0),
+                                        int(xMask));
+    y1 = (unsigned int) std::min< int >(std::max< int >(y0 + 1, 0),
+                                        int(yMask));
+    x0u = (unsigned int) std::min< int >(std::max< int >(x0, 0), int(xMask));
+    y0u = (unsigned int) std::min< int >(std::max< int >(y0, 0), int(yMask));
+  }
+  // the decoded block is copied before the next one is looked up, the
+  // pixels are interpolated in the same way as by getPixelB_Wrap()
+  std::uint32_t c[4];
+  c[0] = getPixelN_BC(x0u, y0u, mipLevel);
+  c[1] = getPixelN_BC(x1, y0u, mipLevel);
+  c[2] = getPixelN_BC(x0u, y1, mipLevel);
+  c[3] = getPixelN_BC(x1, y1, mipLevel);
+  return FloatVector4(c, c + 1, c + 2, c + 3, xf, yf);
+}
+
+inline FloatVector4 DDSTexture::getPixelB_WrapM(
+    int m, int x0, int y0, float xf, float yf,
+    unsigned int xMask, unsigned int yMask) const
+{
+  if (m < int(blockMipCnt)) [[unlikely]]
+    return getPixelB_BC(x0, y0, xf, yf, xMask, yMask, m, false);
+  return getPixelB_Wrap(getMipLevelData(m), x0, y0, xf, yf, xMask, yMask);
+}
+
+inline FloatVector4 DDSTexture::getPixelB_ClampM(
+    int m, int x0, int y0, float xf, float yf,
+    unsigned int xMask, unsigned int yMask) const
+{
+  if (m < int(blockMipCnt)) [[unlikely]]
+    return getPixelB_BC(x0, y0, xf, yf, xMask, yMask, m, true);
+  return getPixelB_Clamp(getMipLevelData(m), x0, y0, xf, yf, xMask, yMask);
+}
+
 inline FloatVector4 DDSTexture::getPixelB_Inline(
     float x, float y, int mipLevel) const
 {
@@ -304,7 +526,7 @@ inline FloatVector4 DDSTexture::getPixelB_Inline(
   float   xf, yf;
   unsigned int  xMask, yMask;
   (void) convertTexCoord(x0, y0, xf, yf, xMask, yMask, x, y, mipLevel);
-  return getPixelB_Wrap(textureData[mipLevel], x0, y0, xf, yf, xMask, yMask);
+  return getPixelB_WrapM(mipLevel, x0, y0, xf, yf, xMask, yMask);
 }
 
 inline FloatVector4 DDSTexture::getPixelT_Inline(
@@ -316,16 +538,15 @@ inline FloatVector4 DDSTexture::getPixelT_Inline(
   float   xf, yf;
   unsigned int  xMask, yMask;
   if (!convertTexCoord(x0, y0, xf, yf, xMask, yMask, x, y, m0)) [[unlikely]]
-    return FloatVector4(textureData[m0]);
-  FloatVector4  c0(getPixelB_Wrap(textureData[m0], x0, y0, xf, yf,
-                                  xMask, yMask));
+    return FloatVector4(getMipLevelData(m0));
+  FloatVector4  c0(getPixelB_WrapM(m0, x0, y0, xf, yf, xMask, yMask));
   float   mf = float(m0);
   if (mf != mipLevel) [[likely]]
   {
     mf = mipLevel - mf;
     getNextMipTexCoord(x0, y0, xf, yf);
-    FloatVector4  c1(getPixelB_Wrap(textureData[m0 + 1], x0, y0, xf, yf,
-                                    xMask >> 1, yMask >> 1));
+    FloatVector4  c1(getPixelB_WrapM(m0 + 1, x0, y0, xf, yf,
+                                     xMask >> 1, yMask >> 1));
     c0 = (c0 * (1.0f - mf)) + (c1 * mf);
   }
   return c0;
@@ -344,7 +565,7 @@ inline FloatVector4 DDSTexture::getPixelBM_Inline(
   y = (!(int(yf) & 1) ? y : (1.0f - y));
   unsigned int  xMask, yMask;
   (void) convertTexCoord(x0, y0, xf, yf, xMask, yMask, x, y, mipLevel);
-  return getPixelB_Clamp(textureData[mipLevel], x0, y0, xf, yf, xMask, yMask);
+  return getPixelB_ClampM(mipLevel, x0, y0, xf, yf, xMask, yMask);
 }
 
 inline FloatVector4 DDSTexture::getPixelBC_Inline(
@@ -355,7 +576,7 @@ inline FloatVector4 DDSTexture::getPixelBC_Inline(
   float   xf, yf;
   unsigned int  xMask, yMask;
   (void) convertTexCoord(x0, y0, xf, yf, xMask, yMask, x, y, mipLevel);
-  return getPixelB_Clamp(textureData[mipLevel], x0, y0, xf, yf, xMask, yMask);
+  return getPixelB_ClampM(mipLevel, x0, y0, xf, yf, xMask, yMask);
 }
 
 inline bool DDSTexture::wrapCubeMapCoord(int& x, int& y, int& n, int xMask)
@@ -3,12 +3,22 @@
 #include "zlib.hpp"
 #include "esmfile.hpp"
 
+#include <thread>
+#include <atomic>
+#include <mutex>
+
+#if defined(_WIN32) || defined(_WIN64)
+#  include <process.h>
+#else
+#  include <unistd.h>
+#endif
+
 inline ESMFile::ESMRecord & ESMFile::insertFormID(unsigned int formID)
 {
   const std::uint32_t *p = pluginMap + (((formID >> 24) & 0xFFU) * 3U);
   if (formID < p[0] || formID > p[1])
     errorMessage("internal error: invalid form ID");
-  std::uint32_t&  n = formIDMap[(formID + p[2]) & 0xFFFFFFFFU];
+  std::uint32_t&  n = getFormIDMapElement(formID);
   if (n & 0x80000000U) [[likely]]
   {
     n = std::uint32_t(recordBufSize);
@@ -19,26 +29,54 @@ inline ESMFile::ESMRecord & ESMFile::insertFormID(unsigned int formID)
   return recordBuf[n];
 }
 
-const unsigned char * ESMFile::uncompressRecord(ESMRecord& r)
+const unsigned char * ESMFile::uncompressRecord(
+    std::shared_ptr< const std::vector< unsigned char > >& buf,
+    const ESMRecord& r) const
 {
-  if (r.formID == zlibBufRecord)
-    return zlibBuf.back().data();
+  RecordCacheShard& cache =
+      recordCache[((r.formID * 0x9E3779B1U) >> 28) % recordCacheShards];
+  {
+    std::lock_guard< std::mutex > tmpLock(cache.cacheMutex);
+    std::map< unsigned int, RecordCacheEntry >::iterator  i =
+        cache.records.find(r.formID);
+    if (i != cache.records.end())
+    {
+      // move to the end of the LRU list
+      RecordCacheEntry  *e = &(i->second);
+      if (e->nxt)
+      {
+        if (e->prv)
+          e->prv->nxt = e->nxt;
+        else
+          cache.firstRecord = e->nxt;
+        e->nxt->prv = e->prv;
+        e->prv = cache.lastRecord;
+        e->nxt = nullptr;
+        cache.lastRecord->nxt = e;
+        cache.lastRecord = e;
+      }
+      buf = e->buf;
+      return buf->data();
+    }
+  }
+
+  // decompress the record without holding the lock
   unsigned int  compressedSize;
   {
-    FileBuffer  buf(r.fileData + 4, 4);
-    compressedSize = buf.readUInt32();
+    FileBuffer  tmpBuf(getRecordData(r) + 4, 4);
+    compressedSize = tmpBuf.readUInt32();
   }
   if (compressedSize < 10)
     errorMessage("invalid compressed record size");
   unsigned int  offs = recordHdrSize;
-  FileBuffer  buf(r.fileData, compressedSize + offs);
+  FileBuffer  inBuf(getRecordData(r), compressedSize + offs);
   compressedSize = compressedSize - 4;
-  buf.setPosition(offs);
-  unsigned int  uncompressedSize = buf.readUInt32();
-  zlibBufRecord = 0xFFFFFFFFU;
-  zlibBuf.back().resize(size_t(offs) + uncompressedSize);
-  unsigned char *p = zlibBuf.back().data();
-  std::memcpy(p, buf.data(), offs);
+  inBuf.setPosition(offs);
+  unsigned int  uncompressedSize = inBuf.readUInt32();
+  std::shared_ptr< std::vector< unsigned char > > outBuf(
+      new std::vector< unsigned char >(size_t(offs) + uncompressedSize));
+  unsigned char *p = outBuf->data();
+  std::memcpy(p, inBuf.data(), offs);
   p[4] = (unsigned char) (uncompressedSize & 0xFF);
   p[5] = (unsigned char) ((uncompressedSize >> 8) & 0xFF);
   p[6] = (unsigned char) ((uncompressedSize >> 16) & 0xFF);
@@ -47,21 +85,70 @@ const unsigned char * ESMFile::uncompressRecord(ESMRecord& r)
   unsigned int  recordSize =
       (unsigned int) ZLibDecompressor::decompressData(
                          p + offs, uncompressedSize,
-                         buf.data() + (offs + 4), compressedSize);
+                         inBuf.data() + (offs + 4), compressedSize);
   if (recordSize != uncompressedSize)
     errorMessage("invalid compressed record size");
-  if (zlibBuf.size() < zlibBuf.capacity())
+  buf = outBuf;
+  if (!recordCacheSize.load(std::memory_order_relaxed))
+    return p;
+
+  std::lock_guard< std::mutex > tmpLock(cache.cacheMutex);
+  std::pair< std::map< unsigned int, RecordCacheEntry >::iterator, bool > i =
+      cache.records.try_emplace(r.formID);
+  if (!i.second)                // already added by another thread
+    return p;
+  RecordCacheEntry  *e = &(i.first->second);
+  e->buf = buf;
+  e->prv = cache.lastRecord;
+  e->nxt = nullptr;
+  e->formID = r.formID;
+  if (cache.lastRecord)
+    cache.lastRecord->nxt = e;
+  else
+    cache.firstRecord = e;
+  cache.lastRecord = e;
+  cache.dataSize = cache.dataSize + buf->size();
+  shrinkRecordCache(cache);
+  return p;
+}
+
+void ESMFile::shrinkRecordCache(RecordCacheShard& p) const
+{
+  size_t  maxDataSize =
+      recordCacheSize.load(std::memory_order_relaxed) / recordCacheShards;
+  // remove the least recently used records first, and the most recently
+  // used one only if it is larger than the limit by itself, the caller
+  // keeps a reference to its buffer
+  while (p.dataSize > maxDataSize && p.firstRecord != p.lastRecord)
   {
-    zlibBuf.emplace_back();
-    r.flags = r.flags & ~0x00040000U;
-    r.fileData = p;
+    RecordCacheEntry  *e = p.firstRecord;
+    p.firstRecord = e->nxt;
+    p.firstRecord->prv = nullptr;
+    p.dataSize = p.dataSize - e->buf->size();
+    p.records.erase(e->formID);
+  }
+  if (p.dataSize > maxDataSize && p.firstRecord)
+  {
+    p.dataSize = 0;
+    p.records.clear();
+    p.firstRecord = nullptr;
+    p.lastRecord = nullptr;
+  }
+}
+
+void ESMFile::setRecordCacheSize(size_t n)
+{
+  recordCacheSize.store(n, std::memory_order_relaxed);
+  for (size_t i = 0; i < recordCacheShards; i++)
+  {
+    std::lock_guard< std::mutex > tmpLock(recordCache[i].cacheMutex);
+    shrinkRecordCache(recordCache[i]);
   }
-  zlibBufRecord = r.formID;
-  return p;
 }
 
 unsigned int ESMFile::loadRecords(
-    size_t& groupCnt, FileBuffer& buf, size_t endPos, unsigned int parent)
+    size_t& groupCnt, FileBuffer& buf, size_t endPos, unsigned int parent,
+    std::uint32_t fileOffs)
 {
   ESMRecord *prv = nullptr;
   unsigned int  r = 0U;
@@ -69,7 +156,7 @@ unsigned int ESMFile::loadRecords(
   {
     if ((buf.getPosition() + recordHdrSize) > endPos)
       errorMessage("end of group in ESM input file");
-    const unsigned char *p = buf.getReadPtr();
+    std::uint32_t dataOffs = std::uint32_t(buf.getPosition()) + fileOffs;
     unsigned int  recordType = buf.readUInt32Fast();
     unsigned int  recordSize = buf.readUInt32Fast();
     unsigned int  flags = buf.readUInt32Fast();
@@ -83,7 +170,8 @@ unsigned int ESMFile::loadRecords(
       groupCnt++;
     }
     ESMRecord&  esmRecord = insertFormID(n);
-    if (!esmRecord.fileData) [[likely]]
+    std::uint32_t&  esmRecordOffs = recordDataOffs[&esmRecord - recordBuf];
+    if (esmRecordOffs == 0xFFFFFFFFU) [[likely]]
     {
       esmRecord.parent = parent;
       if (prv)
@@ -92,18 +180,19 @@ unsigned int ESMFile::loadRecords(
       if (!r)
         r = n;
     }
-    if (n != 0U || !esmRecord.fileData) [[likely]]
+    if (n != 0U || esmRecordOffs == 0xFFFFFFFFU) [[likely]]
     {
       esmRecord.type = recordType;
       esmRecord.flags = flags;
       esmRecord.formID = formID;
-      esmRecord.fileData = p;
+      esmRecordOffs = dataOffs;
     }
     if (FileBuffer::checkType(recordType, "GRUP"))
     {
       esmRecord.children =
           loadRecords(groupCnt, buf,
-                      buf.getPosition() + recordSize - recordHdrSize, n);
+                      buf.getPosition() + recordSize - recordHdrSize, n,
+                      fileOffs);
     }
     else if (recordSize > 0)
     {
@@ -115,323 +204,1276 @@ unsigned int ESMFile::loadRecords(
   return r;
 }
 
-ESMFile::ESMFile(const char *fileNames, bool enableZLibCache)
-  : recordHdrSize(0),
-    esmVersion(0),
-    esmFlags(0),
-    zlibBufRecord(0xFFFFFFFFU),
-    pluginMap(nullptr),
-    formIDMap(nullptr),
-    recordBuf(nullptr),
-    recordBufSize(0)
+void ESMFile::setFormIDMapOffsets()
 {
-  try
+  size_t  pageCnt = 0;
+  for (size_t i = 0; i < 0x0300; i = i + 3)
   {
-    pluginMap = new std::uint32_t[0x0300];
-    for (size_t i = 0; i < 0x0300; i = i + 3)
+    if (pluginMap[i] <= pluginMap[i + 1])
     {
-      pluginMap[i] = 0xFFFFFFFFU;       // minimum form ID
-      pluginMap[i + 1] = 0U;            // maximum form ID
-      pluginMap[i + 2] = 0U;            // formIDMap offset
+      pluginMap[i + 2] = std::uint32_t((pageCnt << formIDPageShift)
+                                       - (pluginMap[i] & ~formIDPageMask));
+      pageCnt = pageCnt + (pluginMap[i + 1] >> formIDPageShift) + 1
+                - (pluginMap[i] >> formIDPageShift);
     }
-    std::vector< std::string >  tmpFileNames;
-    std::string fileName;
-    for (size_t i = 0; fileNames[i] != '\0'; i++)
+  }
+  if (pageCnt >= (size_t(1) << (32 - formIDPageShift)))
+    errorMessage("too many form IDs in ESM input files");
+  formIDPageCnt = pageCnt;
+}
+
+void ESMFile::allocateRecordBuf(size_t recordCnt,
+                                std::vector< unsigned char >& pagesUsed)
+{
+  for (size_t i = 0x0180; i < 0x0300; i = i + 3)
+  {
+    if (pluginMap[i] <= pluginMap[i + 1])
     {
-      if (fileName.length() > 4)
-      {
-        if (fileNames[i] == ',' && fileNames[i - 4] == '.' &&
-            (fileNames[i - 3] == 'E' || fileNames[i - 3] == 'e') &&
-            (fileNames[i - 2] == 'S' || fileNames[i - 2] == 's') &&
-            (fileNames[i - 1] == 'M' || fileNames[i - 1] == 'm'))
-        {
-          tmpFileNames.push_back(fileName);
-          fileName.clear();
-          continue;
-        }
-      }
-      fileName += fileNames[i];
+      size_t  n = getFormIDPageNum(pluginMap[i]);
+      size_t  n2 = getFormIDPageNum(pluginMap[i + 1]);
+      for ( ; n <= n2; n++)
+        pagesUsed[n] = 1;
     }
-    if (!fileName.empty())
-      tmpFileNames.push_back(fileName);
-    if (tmpFileNames.size() < 1)
-      errorMessage("ESMFile: no input files");
-    esmFiles.resize(tmpFileNames.size(), nullptr);
-    for (size_t i = 0; i < tmpFileNames.size(); i++)
+  }
+  // the first page is shared by all unused pages
+  formIDPageTable = new std::uint32_t[formIDPageCnt];
+  formIDMapSize = size_t(1) << formIDPageShift;
+  for (size_t i = 0; i < formIDPageCnt; i++)
+  {
+    formIDPageTable[i] = 0U;
+    if (pagesUsed[i])
     {
-      const char  *fName = tmpFileNames[i].c_str();
-      esmFiles[i] = new FileBuffer(fName);
-      if (!FileBuffer::checkType(esmFiles[i]->readUInt32(), "TES4"))
-        throw FO76UtilsError("input file %s is not in ESM format", fName);
-      (void) esmFiles[i]->readUInt32();
-      esmFlags = esmFiles[i]->readUInt32();
-      if (esmFiles[i]->readUInt32() != 0U)
-        throw FO76UtilsError("%s: invalid ESM file header", fName);
-      (void) esmFiles[i]->readUInt32();
-      unsigned int  tmp = esmFiles[i]->readUInt16();
-      if (tmp < 0x1000)
-      {
-        recordHdrSize = 24;
-        esmVersion = tmp;
-      }
-      else if (tmp == 0x4548)           // "HE"
+      formIDPageTable[i] = std::uint32_t(formIDMapSize);
+      formIDMapSize = formIDMapSize + (size_t(1) << formIDPageShift);
+    }
+  }
+  formIDMap = new std::uint32_t[formIDMapSize];
+  memsetUInt32(formIDMap, 0xFFFFFFFFU, formIDMapSize);
+  recordBuf = new ESMRecord[recordCnt];
+  recordDataOffs = new std::uint32_t[recordCnt];
+  memsetUInt32(recordDataOffs, 0xFFFFFFFFU, recordCnt);
+}
+
+void ESMFile::loadRecordsSerial(const std::vector< std::string >& fileNames)
+{
+  size_t  recordCnt = 0;
+  size_t  groupCnt = 0;
+  std::vector< std::uint32_t >  formIDs;
+  for (size_t i = 0; i < esmFiles.size(); i++)
+  {
+    FileBuffer& buf = *(esmFiles[i]);
+    buf.setPosition(0);
+    while (buf.getPosition() < buf.size())
+    {
+      if ((buf.getPosition() + recordHdrSize) > buf.size())
+        throw FO76UtilsError("end of input file %s", fileNames[i].c_str());
+      unsigned int  recordType = buf.readUInt32Fast();
+      unsigned int  recordSize = buf.readUInt32Fast();
+      unsigned int  flags = buf.readUInt32Fast();
+      unsigned int  formID = buf.readUInt32Fast();
+      std::uint32_t n = std::uint32_t(formID);
+      // skip version control info
+      buf.setPosition(buf.getPosition() + (recordHdrSize - 16));
+      if (FileBuffer::checkType(recordType, "GRUP"))
       {
-        recordHdrSize = 20;
-        esmVersion = 0x00;
+        if (recordSize < recordHdrSize ||
+            (buf.getPosition() + (recordSize - recordHdrSize)) > buf.size())
+        {
+          throw FO76UtilsError("%s: invalid group size",
+                               fileNames[i].c_str());
+        }
+        n = std::uint32_t(0x80000000U | groupCnt);
+        groupCnt++;
       }
       else
       {
-        throw FO76UtilsError("%s: invalid ESM file header", fName);
-      }
-    }
-
-    size_t  compressedCnt = 0;
-    size_t  recordCnt = 0;
-    size_t  groupCnt = 0;
-    for (size_t i = 0; i < esmFiles.size(); i++)
-    {
-      FileBuffer& buf = *(esmFiles[i]);
-      buf.setPosition(0);
-      while (buf.getPosition() < buf.size())
-      {
-        if ((buf.getPosition() + recordHdrSize) > buf.size())
-          throw FO76UtilsError("end of input file %s", tmpFileNames[i].c_str());
-        unsigned int  recordType = buf.readUInt32Fast();
-        unsigned int  recordSize = buf.readUInt32Fast();
-        unsigned int  flags = buf.readUInt32Fast();
-        unsigned int  formID = buf.readUInt32Fast();
-        std::uint32_t n = std::uint32_t(formID);
-        // skip version control info
-        buf.setPosition(buf.getPosition() + (recordHdrSize - 16));
-        if (FileBuffer::checkType(recordType, "GRUP"))
+        if (formID > 0x0FFFFFFFU && ((formID + 0x03000000U) & 0xFE000000U))
         {
-          if (recordSize < recordHdrSize ||
-              (buf.getPosition() + (recordSize - recordHdrSize)) > buf.size())
-          {
-            throw FO76UtilsError("%s: invalid group size",
-                                 tmpFileNames[i].c_str());
-          }
-          n = std::uint32_t(0x80000000U | groupCnt);
-          groupCnt++;
+          throw FO76UtilsError("%s: invalid form ID",
+                               fileNames[i].c_str());
         }
-        else
+        if ((recordSize < 10 && (flags & 0x00040000) != 0) ||
+            (buf.getPosition() + recordSize) > buf.size())
         {
-          if (formID > 0x0FFFFFFFU && ((formID + 0x03000000U) & 0xFE000000U))
-          {
-            throw FO76UtilsError("%s: invalid form ID",
-                                 tmpFileNames[i].c_str());
-          }
-          if ((recordSize < 10 && (flags & 0x00040000) != 0) ||
-              (buf.getPosition() + recordSize) > buf.size())
-          {
-            throw FO76UtilsError("%s: invalid record size",
-                                 tmpFileNames[i].c_str());
-          }
-          recordCnt++;
-          if (flags & 0x00040000)
-            compressedCnt++;
-          buf.setPosition(buf.getPosition() + recordSize);
+          throw FO76UtilsError("%s: invalid record size",
+                               fileNames[i].c_str());
         }
-        std::uint32_t *p = pluginMap + (((n >> 24) & 0xFFU) * 3U);
-        p[0] = std::min(p[0], n);
-        p[1] = std::max(p[1], n);
-      }
-    }
-    size_t  formIDMapSize = 0;
-    for (size_t i = 0; i < 0x0300; i = i + 3)
-    {
-      if (pluginMap[i] <= pluginMap[i + 1])
-      {
-        pluginMap[i + 2] = std::uint32_t(formIDMapSize - pluginMap[i]);
-        formIDMapSize = formIDMapSize + size_t(pluginMap[i + 1]) + 1 - size_t(pluginMap[i]);
-      }
-    }
-    formIDMap = new std::uint32_t[formIDMapSize];
-    memsetUInt32(formIDMap, 0xFFFFFFFFU, formIDMapSize);
-    recordBuf = new ESMRecord[recordCnt + groupCnt];
-    if (compressedCnt)
-    {
-      if (!enableZLibCache)
-        compressedCnt = 1;
-      zlibBuf.reserve(compressedCnt);
-      zlibBuf.emplace_back();
-    }
-
-    groupCnt = 0;
-    for (size_t i = 0; i < esmFiles.size(); i++)
-    {
-      FileBuffer& buf = *(esmFiles[i]);
-      buf.setPosition(0);
-      unsigned int  n = loadRecords(groupCnt, buf, buf.size(), 0U);
-      ESMRecord *r = findRecord(0U);
-      if (n != 0U && r && r->next != n)
-      {
-        while (r->next)
-          r = findRecord(r->next);
-        r->next = n;
+        recordCnt++;
+        formIDs.push_back(n);
+        buf.setPosition(buf.getPosition() + recordSize);
       }
+      std::uint32_t *p = pluginMap + (((n >> 24) & 0xFFU) * 3U);
+      p[0] = std::min(p[0], n);
+      p[1] = std::max(p[1], n);
     }
   }
-  catch (...)
+  setFormIDMapOffsets();
   {
-    for (size_t i = 0; i < esmFiles.size(); i++)
-    {
-      if (esmFiles[i])
-        delete esmFiles[i];
-    }
-    delete[] recordBuf;
-    delete[] formIDMap;
-    delete[] pluginMap;
-    throw;
+    std::vector< unsigned char >  pagesUsed(formIDPageCnt, 0);
+    for (size_t i = 0; i < formIDs.size(); i++)
+      pagesUsed[getFormIDPageNum(formIDs[i])] = 1;
+    std::vector< std::uint32_t >().swap(formIDs);
+    allocateRecordBuf(recordCnt + groupCnt, pagesUsed);
   }
-}
 
-ESMFile::~ESMFile()
-{
+  groupCnt = 0;
   for (size_t i = 0; i < esmFiles.size(); i++)
   {
-    if (esmFiles[i])
-      delete esmFiles[i];
+    FileBuffer& buf = *(esmFiles[i]);
+    buf.setPosition(0);
+    unsigned int  n =
+        loadRecords(groupCnt, buf, buf.size(), 0U, esmFileOffsets[i]);
+    ESMRecord *r = findRecord(0U);
+    if (n != 0U && r && r->next != n)
+    {
+      while (r->next)
+        r = findRecord(r->next);
+      r->next = n;
+    }
   }
-  delete[] recordBuf;
-  delete[] formIDMap;
-  delete[] pluginMap;
 }
 
-const ESMFile::ESMRecord& ESMFile::getRecord(unsigned int formID) const
-{
-  const ESMRecord *r = findRecord(formID);
-  if (!r)
-    errorMessage("invalid form ID");
-  return *r;
-}
+// The record tree is built in parallel in four passes over tasks that are
+// either a range of complete records and groups, or the start or end of a
+// large group that is split into further tasks:
+//   0: count records and groups, and find the range of form IDs
+//   1: claim the formIDMap element of each record with the lowest index
+//      in file order (atomic minimum)
+//   2: find the records that are duplicates of a form ID already claimed
+//   3: store records at the same recordBuf index as loadRecords() would,
+//      and link them within the task
+// Finally, tasks are linked to their parent groups, and the data of duplicate
+// records is updated in file order. The result is identical to serial loading.
 
-ESMFile::ESMField::ESMField(ESMFile& f, const ESMRecord& r)
-  : FileBuffer(),
-    type(0),
-    dataRemaining(0)
+struct ESMFile::RecordLoadTask
 {
-  if (r.type == 0x50555247)             // "GRUP"
-    return;
-  if (r.flags & 0x00040000)             // compressed record
-    fileBuf = f.uncompressRecord(*(f.findRecord(r.formID)));
-  else
-    fileBuf = r.fileData;
-  fileBufSize = f.recordHdrSize;
-  filePos = 4;
-  dataRemaining = readUInt32Fast();
-}
+  struct RecordInfo
+  {
+    std::uint32_t formID;
+    std::uint32_t recordNum;    // index relative to recordBase
+    size_t  filePos;
+  };
+  size_t  fileNum;
+  size_t  startPos;
+  size_t  endPos;
+  // 0: range of records and groups, 1: start of group at startPos,
+  // 2: end of group
+  int     taskType;
+  unsigned int  parent;
+  size_t  recordCnt;            // number of records and groups
+  size_t  groupCnt;
+  // number of records and groups, groups and duplicate records
+  // in all previous tasks
+  size_t  recordBase;
+  size_t  groupBase;
+  size_t  dupBase;
+  // all records in the task that are not groups
+  std::vector< RecordInfo > records;
+  // records with a form ID that already exists at a lower index
+  std::vector< RecordInfo > duplicates;
+  // first new record or group on the top level of the range, and the
+  // first one that is not 0 as returned by loadRecords()
+  unsigned int  firstRecord;
+  unsigned int  firstNonZero;
+  ESMRecord *lastRecord;
+  std::string errMsg;
+  RecordLoadTask(size_t fileNum_, size_t startPos_, size_t endPos_, int t)
+    : fileNum(fileNum_),
+      startPos(startPos_),
+      endPos(endPos_),
+      taskType(t),
+      parent(0U),
+      recordCnt(t == 1 ? 1 : 0),
+      groupCnt(t == 1 ? 1 : 0),
+      recordBase(0),
+      groupBase(0),
+      dupBase(0),
+      firstRecord(0U),
+      firstNonZero(0U),
+      lastRecord(nullptr)
+  {
+  }
+};
 
-ESMFile::ESMField::ESMField(ESMFile& f, unsigned int formID)
-  : FileBuffer(),
-    type(0),
-    dataRemaining(0)
+struct ESMFile::RecordLoadQueue
 {
-  const ESMRecord *r = f.findRecord(formID);
-  if (!r)
-    errorMessage("invalid form ID");
-  if (r->type == 0x50555247)            // "GRUP"
-    return;
-  if (r->flags & 0x00040000)            // compressed record
-    fileBuf = f.uncompressRecord(*(const_cast< ESMRecord * >(r)));
-  else
-    fileBuf = r->fileData;
-  fileBufSize = f.recordHdrSize;
-  filePos = 4;
-  dataRemaining = readUInt32Fast();
-}
+  const std::vector< std::string > *fileNames;
+  std::vector< RecordLoadTask > tasks;
+  std::atomic< size_t > nextTask;
+  std::mutex  pluginMapMutex;
+};
 
-ESMFile::ESMField::ESMField(const ESMRecord& r, const ESMFile& f)
-  : FileBuffer(r.fileData, f.recordHdrSize, 8),
-    type(0),
-    dataRemaining(FileBuffer::readUInt32Fast(r.fileData + 4))
+void ESMFile::splitRecordLoadTasks(RecordLoadQueue& q, size_t fileNum,
+                                   size_t startPos, size_t endPos,
+                                   size_t maxSize)
 {
-  if (r.type == 0x50555247 || (r.flags & 0x00040000)) [[unlikely]]
+  const FileBuffer& buf = *(esmFiles[fileNum]);
+  size_t  rangeStart = startPos;
+  size_t  pos = startPos;
+  // invalid data is left to the range tasks for reporting errors
+  while ((pos + recordHdrSize) <= endPos)
   {
-    // "GRUP" or compressed record
-    dataRemaining = 0;
+    bool    isGroup =
+        FileBuffer::checkType(FileBuffer::readUInt32Fast(buf.data() + pos),
+                              "GRUP");
+    size_t  n = FileBuffer::readUInt32Fast(buf.data() + (pos + 4));
+    if (!isGroup)
+      n = n + recordHdrSize;
+    else if (n < recordHdrSize)
+      break;
+    if (n > (endPos - pos))
+      break;
+    if (isGroup && n > maxSize)
+    {
+      if (pos > rangeStart)
+        q.tasks.emplace_back(fileNum, rangeStart, pos, 0);
+      q.tasks.emplace_back(fileNum, pos, pos + n, 1);
+      splitRecordLoadTasks(q, fileNum, pos + recordHdrSize, pos + n, maxSize);
+      q.tasks.emplace_back(fileNum, pos, pos + n, 2);
+      rangeStart = pos + n;
+    }
+    pos = pos + n;
+    if ((pos - rangeStart) >= maxSize)
+    {
+      q.tasks.emplace_back(fileNum, rangeStart, pos, 0);
+      rangeStart = pos;
+    }
   }
+  if (endPos > rangeStart)
+    q.tasks.emplace_back(fileNum, rangeStart, endPos, 0);
 }
 
-bool ESMFile::ESMField::next()
+void ESMFile::countRecordLoadTask(RecordLoadQueue& q, RecordLoadTask& t)
 {
-  fileBuf = fileBuf + fileBufSize;
-  fileBufSize = dataRemaining;
-  filePos = 0;
-  if (!dataRemaining)
-    return false;
-  if (dataRemaining < 6)
-    errorMessage("end of record data");
-  type = readUInt32Fast();
-  size_t  n = readUInt16Fast();
-  if (type == 0x58585858) [[unlikely]]          // "XXXX"
+  const char  *fileName = (*(q.fileNames))[t.fileNum].c_str();
+  FileBuffer  buf(esmFiles[t.fileNum]->data(), esmFiles[t.fileNum]->size());
+  std::uint32_t formIDMin[256];
+  std::uint32_t formIDMax[256];
+  for (size_t i = 0; i < 256; i++)
   {
-    if (n == 4) [[likely]]
+    formIDMin[i] = 0xFFFFFFFFU;
+    formIDMax[i] = 0U;
+  }
+  buf.setPosition(t.startPos);
+  while (buf.getPosition() < t.endPos)
+  {
+    if ((buf.getPosition() + recordHdrSize) > buf.size())
+      throw FO76UtilsError("end of input file %s", fileName);
+    size_t  filePos = buf.getPosition();
+    unsigned int  recordType = buf.readUInt32Fast();
+    unsigned int  recordSize = buf.readUInt32Fast();
+    unsigned int  flags = buf.readUInt32Fast();
+    unsigned int  formID = buf.readUInt32Fast();
+    // skip version control info
+    buf.setPosition(buf.getPosition() + (recordHdrSize - 16));
+    if (FileBuffer::checkType(recordType, "GRUP"))
     {
-      if (dataRemaining < 16)
-        errorMessage("end of record data");
-      n = readUInt32Fast();
-      type = readUInt32Fast();
-      (void) readUInt16Fast();
+      if (recordSize < recordHdrSize ||
+          (buf.getPosition() + (recordSize - recordHdrSize)) > buf.size())
+      {
+        throw FO76UtilsError("%s: invalid group size", fileName);
+      }
+      t.groupCnt++;
+    }
+    else
+    {
+      if (formID > 0x0FFFFFFFU && ((formID + 0x03000000U) & 0xFE000000U))
+        throw FO76UtilsError("%s: invalid form ID", fileName);
+      if ((recordSize < 10 && (flags & 0x00040000) != 0) ||
+          (buf.getPosition() + recordSize) > buf.size())
+      {
+        throw FO76UtilsError("%s: invalid record size", fileName);
+      }
+      buf.setPosition(buf.getPosition() + recordSize);
+      t.records.emplace_back();
+      t.records.back().formID = formID;
+      t.records.back().recordNum = std::uint32_t(t.recordCnt);
+      t.records.back().filePos = filePos;
+      formIDMin[formID >> 24] = std::min(formIDMin[formID >> 24], formID);
+      formIDMax[formID >> 24] = std::max(formIDMax[formID >> 24], formID);
+    }
+    t.recordCnt++;
+  }
+  std::lock_guard< std::mutex > tmpLock(q.pluginMapMutex);
+  for (size_t i = 0; i < 256; i++)
+  {
+    if (formIDMin[i] <= formIDMax[i])
+    {
+      std::uint32_t *p = pluginMap + (i * 3);
+      p[0] = std::min(p[0], formIDMin[i]);
+      p[1] = std::max(p[1], formIDMax[i]);
     }
   }
-  if ((filePos + n) > dataRemaining)
-    errorMessage("end of record data");
-  dataRemaining = dataRemaining - (unsigned int) (filePos + n);
-  fileBuf = fileBuf + filePos;
-  fileBufSize = n;
-  filePos = 0;
-  return true;
 }
 
-ESMFile::CDBRecord::CDBRecord(ESMField& f)
-  : FileBuffer(f.data(), f.size(), 0),
-    stringTableSize(0U),
-    stringTable(nullptr)
+void ESMFile::claimRecordLoadTask(RecordLoadTask& t)
 {
-  if (f.size() >= 16) [[likely]]
+  for (const auto& r : t.records)
   {
-    dataRemaining = (unsigned int) (f.size() - 16);
-    type = FileBuffer::readUInt32Fast(f.data());
-    fileBuf = f.data() + 8;
-    fileBufSize = FileBuffer::readUInt32Fast(f.data() + 4);
-    if (type == 0x48544542U && fileBufSize == 8)        // "BETH"
+    std::atomic_ref< std::uint32_t >  n(getFormIDMapElement(r.formID));
+    std::uint32_t recordNum = std::uint32_t(t.recordBase + r.recordNum);
+    std::uint32_t tmp = n.load(std::memory_order_relaxed);
+    while (recordNum < tmp &&
+           !n.compare_exchange_weak(tmp, recordNum, std::memory_order_relaxed))
     {
-      if (FileBuffer::readUInt32Fast(f.data() + 8) == 4U) [[likely]]
-      {
-        recordsRemaining = FileBuffer::readUInt32Fast(f.data() + 12);
-        recordsRemaining -= (unsigned int) (recordsRemaining > 0U);
-        return;
-      }
     }
   }
-  fileBufSize = 0;
-  type = 0U;
-  recordsRemaining = 0U;
-  dataRemaining = 0U;
 }
 
-bool ESMFile::CDBRecord::next()
+void ESMFile::findDuplicateRecords(RecordLoadTask& t)
 {
-  fileBuf = fileBuf + fileBufSize;
-  fileBufSize = dataRemaining;
-  filePos = 0;
-  if (!recordsRemaining)
-    return false;
-  recordsRemaining--;
-  if (dataRemaining < 8U)
-    errorMessage("unexpected end of CDB data");
-  type = readUInt32Fast();
-  size_t  n = readUInt32Fast();
-  if (n > (dataRemaining - 8U))
-    errorMessage("unexpected end of CDB data");
-  dataRemaining = dataRemaining - (unsigned int) (n + 8);
-  fileBuf = fileBuf + 8;
-  fileBufSize = n;
-  filePos = 0;
-  if (type == 0x54525453U) [[unlikely]]         // "STRT"
+  for (const auto& r : t.records)
   {
-    for ( ; n > 0; n--)
+    if (getFormIDMapElement(r.formID)
+        != std::uint32_t(t.recordBase + r.recordNum))
+    {
+      t.duplicates.push_back(r);
+    }
+  }
+  // the list of all records is no longer needed
+  std::vector< RecordLoadTask::RecordInfo >().swap(t.records);
+}
+
+unsigned int ESMFile::loadRecordLoadTask(
+    RecordLoadTask& t, FileBuffer& buf, size_t endPos, unsigned int parent,
+    ESMRecord*& prv, unsigned int *firstRecord,
+    size_t& recordNum, size_t& groupNum, size_t& dupNum)
+{
+  unsigned int  r = 0U;
+  while (buf.getPosition() < endPos)
+  {
+    if ((buf.getPosition() + recordHdrSize) > endPos)
+      errorMessage("end of group in ESM input file");
+    std::uint32_t dataOffs =
+        std::uint32_t(buf.getPosition()) + esmFileOffsets[t.fileNum];
+    unsigned int  recordType = buf.readUInt32Fast();
+    unsigned int  recordSize = buf.readUInt32Fast();
+    unsigned int  flags = buf.readUInt32Fast();
+    unsigned int  formID = buf.readUInt32Fast();
+    unsigned int  n = formID;
+    // skip version control info
+    buf.setPosition(buf.getPosition() + (recordHdrSize - 16));
+    if (recordNum >= t.recordCnt)
+      errorMessage("internal error: invalid record index");
+    size_t  i = recordNum++;
+    bool    isGroup = FileBuffer::checkType(recordType, "GRUP");
+    if (isGroup)
+    {
+      n = (unsigned int) (t.groupBase + groupNum) | 0x80000000U;
+      groupNum++;
+    }
+    else if (dupNum < t.duplicates.size() &&
+             t.duplicates[dupNum].recordNum == i)
+    {
+      // the data of duplicate records is updated later in file order
+      dupNum++;
+      if (recordSize < 6 || (buf.getPosition() + recordSize) > endPos)
+        errorMessage("invalid ESM record size");
+      buf.setPosition(buf.getPosition() + recordSize);
+      continue;
+    }
+    i = t.recordBase + i - (t.dupBase + dupNum);
+    getFormIDMapElement(n) = std::uint32_t(i);
+    ESMRecord&  esmRecord = recordBuf[i];
+    esmRecord.parent = parent;
+    if (prv)
+      prv->next = n;
+    else if (firstRecord)
+      *firstRecord = n;
+    prv = &esmRecord;
+    if (!r)
+      r = n;
+    esmRecord.type = recordType;
+    esmRecord.flags = flags;
+    esmRecord.formID = formID;
+    recordDataOffs[i] = dataOffs;
+    if (isGroup)
+    {
+      size_t  groupEndPos = buf.getPosition() + recordSize - recordHdrSize;
+      if (recordSize < recordHdrSize || groupEndPos > endPos)
+        errorMessage("invalid group size in ESM input file");
+      ESMRecord *prvChild = nullptr;
+      esmRecord.children =
+          loadRecordLoadTask(t, buf, groupEndPos, n, prvChild, nullptr,
+                             recordNum, groupNum, dupNum);
+    }
+    else if (recordSize > 0)
+    {
+      if (recordSize < 6 || (buf.getPosition() + recordSize) > endPos)
+        errorMessage("invalid ESM record size");
+      buf.setPosition(buf.getPosition() + recordSize);
+    }
+  }
+  return r;
+}
+
+void ESMFile::loadRecordsThread(ESMFile *p, RecordLoadQueue *q, int phase)
+{
+  size_t  n = q->tasks.size();
+  size_t  i;
+  while ((i = q->nextTask.fetch_add(1)) < n)
+  {
+    RecordLoadTask& t = q->tasks[i];
+    if (t.taskType != 0)
+      continue;
+    try
+    {
+      switch (phase)
+      {
+        case 0:
+          p->countRecordLoadTask(*q, t);
+          break;
+        case 1:
+          p->claimRecordLoadTask(t);
+          break;
+        case 2:
+          p->findDuplicateRecords(t);
+          break;
+        default:
+          {
+            const FileBuffer& f = *(p->esmFiles[t.fileNum]);
+            FileBuffer  buf(f.data(), f.size());
+            buf.setPosition(t.startPos);
+            size_t  recordNum = 0;
+            size_t  groupNum = 0;
+            size_t  dupNum = 0;
+            t.firstNonZero =
+                p->loadRecordLoadTask(t, buf, t.endPos, t.parent,
+                                      t.lastRecord, &(t.firstRecord),
+                                      recordNum, groupNum, dupNum);
+            if (recordNum != t.recordCnt)
+              errorMessage("internal error: invalid record count");
+          }
+          break;
+      }
+    }
+    catch (std::exception& e)
+    {
+      t.errMsg = std::string(e.what());
+    }
+  }
+}
+
+void ESMFile::loadRecordsParallel(
+    const std::vector< std::string >& fileNames, size_t threadCnt)
+{
+  RecordLoadQueue q;
+  q.fileNames = &fileNames;
+  {
+    size_t  totalSize = 0;
+    for (size_t i = 0; i < esmFiles.size(); i++)
+      totalSize = totalSize + esmFiles[i]->size();
+    size_t  maxSize = std::max< size_t >(totalSize / (threadCnt * 32), 65536);
+    for (size_t i = 0; i < esmFiles.size(); i++)
+      splitRecordLoadTasks(q, i, 0, esmFiles[i]->size(), maxSize);
+  }
+
+  std::vector< std::thread * >  threads(threadCnt, nullptr);
+  for (int phase = 0; phase < 4; phase++)
+  {
+    q.nextTask = 0;
+    for (size_t i = 0; i < threadCnt; i++)
+    {
+      try
+      {
+        threads[i] = new std::thread(loadRecordsThread, this, &q, phase);
+      }
+      catch (...)
+      {
+        // the remaining tasks are processed by the threads already running
+        if (!i)
+          loadRecordsThread(this, &q, phase);
+        break;
+      }
+    }
+    for (size_t i = 0; i < threadCnt; i++)
+    {
+      if (threads[i])
+      {
+        threads[i]->join();
+        delete threads[i];
+        threads[i] = nullptr;
+      }
+    }
+    for (size_t i = 0; i < q.tasks.size(); i++)
+    {
+      if (!q.tasks[i].errMsg.empty())
+        throw FO76UtilsError(1, q.tasks[i].errMsg.c_str());
+    }
+
+    if (phase == 0)
+    {
+      // calculate the start index of each task, and the form IDs of groups
+      size_t  recordCnt = 0;
+      size_t  groupCnt = 0;
+      std::vector< unsigned int > parentGroups(1, 0U);
+      for (auto& t : q.tasks)
+      {
+        t.recordBase = recordCnt;
+        t.groupBase = groupCnt;
+        recordCnt = recordCnt + t.recordCnt;
+        groupCnt = groupCnt + t.groupCnt;
+        if (t.taskType == 2)
+        {
+          parentGroups.pop_back();
+          continue;
+        }
+        t.parent = parentGroups.back();
+        if (t.taskType == 1)
+          parentGroups.push_back((unsigned int) t.groupBase | 0x80000000U);
+      }
+      if (recordCnt > 0x7FFFFFFFU || groupCnt > 0x7FFFFFFFU)
+        errorMessage("too many records in ESM input files");
+      // groups are numbered from 0x80000000 in file order
+      for (size_t i = 0; i < groupCnt; i = (i | 0x00FFFFFF) + 1)
+      {
+        std::uint32_t *p = pluginMap + ((0x80 + (i >> 24)) * 3U);
+        p[0] = std::min(p[0], std::uint32_t(0x80000000U | i));
+        p[1] = std::max(p[1], std::uint32_t(0x80000000U | std::min(
+                                                 i | 0x00FFFFFF,
+                                                 groupCnt - 1)));
+      }
+      setFormIDMapOffsets();
+      std::vector< unsigned char >  pagesUsed(formIDPageCnt, 0);
+      for (const auto& t : q.tasks)
+      {
+        for (const auto& r : t.records)
+          pagesUsed[getFormIDPageNum(r.formID)] = 1;
+      }
+      allocateRecordBuf(recordCnt, pagesUsed);
+      recordBufSize = recordCnt;
+    }
+    else if (phase == 2)
+    {
+      size_t  dupCnt = 0;
+      for (auto& t : q.tasks)
+      {
+        t.dupBase = dupCnt;
+        dupCnt = dupCnt + t.duplicates.size();
+      }
+      recordBufSize = recordBufSize - dupCnt;
+    }
+  }
+
+  // link the records of each task to the parent group, and set the children
+  // of the groups that have been split into multiple tasks
+  struct RecordLoadGroup
+  {
+    unsigned int  formID;
+    ESMRecord     *r;
+    ESMRecord     *prv;
+    unsigned int  firstNonZero;
+  };
+  std::vector< RecordLoadGroup >  parentGroups;
+  for (size_t i = 0; i < q.tasks.size(); i++)
+  {
+    RecordLoadTask& t = q.tasks[i];
+    if (!i || t.fileNum != q.tasks[i - 1].fileNum)
+      parentGroups.assign(1, RecordLoadGroup{ 0U, nullptr, nullptr, 0U });
+    RecordLoadGroup&  g = parentGroups.back();
+    if (t.taskType == 0)
+    {
+      if (t.lastRecord)
+      {
+        if (g.prv)
+          g.prv->next = t.firstRecord;
+        g.prv = t.lastRecord;
+        if (!g.firstNonZero)
+          g.firstNonZero = t.firstNonZero;
+      }
+    }
+    else if (t.taskType == 1)
+    {
+      unsigned int  n = (unsigned int) t.groupBase | 0x80000000U;
+      size_t  recordNum = t.recordBase - t.dupBase;
+      getFormIDMapElement(n) = std::uint32_t(recordNum);
+      const unsigned char *p = esmFiles[t.fileNum]->data() + t.startPos;
+      ESMRecord&  esmRecord = recordBuf[recordNum];
+      esmRecord.parent = g.formID;
+      if (g.prv)
+        g.prv->next = n;
+      g.prv = &esmRecord;
+      if (!g.firstNonZero)
+        g.firstNonZero = n;
+      esmRecord.type = FileBuffer::readUInt32Fast(p);
+      esmRecord.flags = FileBuffer::readUInt32Fast(p + 8);
+      esmRecord.formID = FileBuffer::readUInt32Fast(p + 12);
+      recordDataOffs[recordNum] =
+          std::uint32_t(t.startPos) + esmFileOffsets[t.fileNum];
+      parentGroups.push_back(RecordLoadGroup{ n, &esmRecord, nullptr, 0U });
+    }
+    else
+    {
+      g.r->children = g.firstNonZero;
+      parentGroups.pop_back();
+    }
+    if ((i + 1) < q.tasks.size() && q.tasks[i + 1].fileNum == t.fileNum)
+      continue;
+    // end of file
+    unsigned int  n = parentGroups.front().firstNonZero;
+    ESMRecord *r = findRecord(0U);
+    if (n != 0U && r && r->next != n)
+    {
+      while (r->next)
+        r = findRecord(r->next);
+      r->next = n;
+    }
+  }
+
+  // update the data of records that are overridden by later files
+  for (const auto& t : q.tasks)
+  {
+    for (const auto& d : t.duplicates)
+    {
+      if (!d.formID)
+        continue;
+      ESMRecord&  esmRecord = *(findRecord(d.formID));
+      const unsigned char *p = esmFiles[t.fileNum]->data() + d.filePos;
+      esmRecord.type = FileBuffer::readUInt32Fast(p);
+      esmRecord.flags = FileBuffer::readUInt32Fast(p + 8);
+      esmRecord.formID = d.formID;
+      recordDataOffs[&esmRecord - recordBuf] =
+          std::uint32_t(d.filePos) + esmFileOffsets[t.fileNum];
+    }
+  }
+}
+
+// index cache file format:
+//   header (48 bytes):
+//      0 uint32_t  "ESMI"
+//      4 uint32_t  format version
+//      8 uint32_t  record header size
+//     12 uint32_t  ESM version
+//     16 uint32_t  ESM flags
+//     20 uint32_t  number of ESM files
+//     24 uint64_t  number of records and groups (recordBufSize)
+//     32 uint32_t  number of form ID map pages (formIDPageCnt)
+//     36 uint32_t  size of formIDMap (formIDMapSize)
+//     40 uint32_t  key string length
+//     44 uint32_t  reserved
+//   ESM files (24 bytes each):
+//      0 uint64_t  file size
+//      8 int64_t   modification time
+//     16 uint32_t  CRC32 of the TES4 record
+//     20 uint32_t  reserved
+//   pluginMap (0x0300 * 4 bytes)
+//   formIDPageTable, padded to a multiple of 8 bytes
+//   formIDMap
+//   recordBuf (24 bytes per record, see ESMFile::ESMRecord)
+//   recordDataOffs, padded to a multiple of 8 bytes
+//   key string (null-terminated)
+// all values are in the native byte order, so that the form ID map and
+// records can be used directly from the mapped file
+
+static const std::uint32_t  indexCacheVersion = 2U;
+
+static const char *getDefaultIndexCachePath()
+{
+#ifdef BUILD_CE2UTILS
+  return std::getenv("CE2UTILS_ESMCACHE");
+#elif !defined(NIFSKOPE_VERSION)
+  return std::getenv("FO76UTILS_ESMCACHE");
+#else
+  return nullptr;
+#endif
+}
+
+static bool getIndexCacheFileInfo(unsigned char *p, const FileBuffer& buf,
+                                  unsigned int recordHdrSize)
+{
+  std::int64_t  modTime = 0;
+  if (!buf.getFileModTime(modTime))
+    return false;
+  size_t  n = recordHdrSize;
+  if (buf.size() >= 8)
+    n = n + buf.readUInt32(4);
+  n = std::min(n, buf.size());
+  std::uint32_t h = 0xFFFFFFFFU;
+  for (size_t i = 0; i < n; i++)
+    hashFunctionCRC32(h, buf.data()[i]);
+  FileBuffer::writeUInt64Fast(p, std::uint64_t(buf.size()));
+  FileBuffer::writeUInt64Fast(p + 8, std::uint64_t(modTime));
+  FileBuffer::writeUInt32Fast(p + 16, h);
+  FileBuffer::writeUInt32Fast(p + 20, 0U);
+  return true;
+}
+
+bool ESMFile::loadIndexCache(const char *cacheFileName,
+                             const std::string& keyName)
+{
+  FileBuffer  *cacheBuf = nullptr;
+  try
+  {
+    cacheBuf = new FileBuffer(cacheFileName);
+    const FileBuffer& buf = *cacheBuf;
+    const unsigned char *p = buf.data();
+    size_t  fileCnt = esmFiles.size();
+    if (buf.size() < 48 || !FileBuffer::checkType(buf.readUInt32(0), "ESMI") ||
+        buf.readUInt32(4) != indexCacheVersion ||
+        buf.readUInt32(8) != recordHdrSize ||
+        buf.readUInt32(12) != esmVersion || buf.readUInt32(16) != esmFlags ||
+        buf.readUInt32(20) != fileCnt ||
+        buf.readUInt32(40) != keyName.length())
+    {
+      delete cacheBuf;
+      return false;
+    }
+    std::uint64_t recordCnt = FileBuffer::readUInt64Fast(p + 24);
+    std::uint64_t pageCnt = FileBuffer::readUInt32Fast(p + 32);
+    std::uint64_t mapSize = FileBuffer::readUInt32Fast(p + 36);
+    std::uint64_t pluginMapOffs = 48 + (std::uint64_t(fileCnt) * 24);
+    std::uint64_t pageTableOffs = pluginMapOffs + (0x0300 * 4);
+    std::uint64_t formIDMapOffs =
+        pageTableOffs + (((pageCnt * 4) + 7) & ~(std::uint64_t(7)));
+    std::uint64_t recordsOffs = formIDMapOffs + (mapSize * 4);
+    std::uint64_t dataOffsOffs = recordsOffs + (recordCnt * sizeof(ESMRecord));
+    std::uint64_t keyNameOffs =
+        dataOffsOffs + (((recordCnt * 4) + 7) & ~(std::uint64_t(7)));
+    if (recordCnt > 0x80000000U || (mapSize & formIDPageMask) || !mapSize ||
+        (keyNameOffs + keyName.length() + 1) != buf.size() ||
+        std::memcmp(p + keyNameOffs, keyName.c_str(), keyName.length() + 1))
+    {
+      delete cacheBuf;
+      return false;
+    }
+    // check if any of the ESM files have changed
+    for (size_t i = 0; i < fileCnt; i++)
+    {
+      unsigned char tmp[24];
+      if (!getIndexCacheFileInfo(tmp, *(esmFiles[i]), recordHdrSize) ||
+          std::memcmp(p + (48 + (i * 24)), tmp, 24) != 0)
+      {
+        delete cacheBuf;
+        return false;
+      }
+    }
+
+    const unsigned char *q = p + pluginMapOffs;
+    std::uint64_t n = 0;
+    for (size_t i = 0; i < 0x0300; i = i + 3, q = q + 12)
+    {
+      std::uint32_t formIDMin = FileBuffer::readUInt32Fast(q);
+      std::uint32_t formIDMax = FileBuffer::readUInt32Fast(q + 4);
+      if (formIDMin > formIDMax)
+        continue;
+      if (((formIDMin ^ formIDMax) & 0xFF000000U) ||
+          (formIDMin >> 24) != (i / 3) ||
+          std::uint32_t((n << formIDPageShift)
+                        - (formIDMin & ~formIDPageMask))
+          != FileBuffer::readUInt32Fast(q + 8))
+      {
+        throw FO76UtilsError("invalid ESM index cache file");
+      }
+      n = n + (formIDMax >> formIDPageShift) + 1
+          - (formIDMin >> formIDPageShift);
+    }
+    if (n != pageCnt)
+      errorMessage("invalid ESM index cache file");
+    const std::uint32_t *tmpPageTable =
+        reinterpret_cast< const std::uint32_t * >(p + pageTableOffs);
+    for (size_t i = 0; i < pageCnt; i++)
+    {
+      if ((tmpPageTable[i] & formIDPageMask) || tmpPageTable[i] >= mapSize)
+        errorMessage("invalid ESM index cache file");
+    }
+    const std::uint32_t *tmpFormIDMap =
+        reinterpret_cast< const std::uint32_t * >(p + formIDMapOffs);
+    for (size_t i = 0; i < mapSize; i++)
+    {
+      if (!(tmpFormIDMap[i] < recordCnt || (tmpFormIDMap[i] & 0x80000000U)))
+        errorMessage("invalid ESM index cache file");
+    }
+    const std::uint32_t *tmpDataOffs =
+        reinterpret_cast< const std::uint32_t * >(p + dataOffsOffs);
+    for (size_t i = 0; i < recordCnt; i++)
+    {
+      std::uint32_t offs = tmpDataOffs[i];
+      if (offs == 0xFFFFFFFFU)
+        continue;
+      size_t  fileNum = fileCnt - 1;
+      while (offs < esmFileOffsets[fileNum])
+        fileNum--;
+      if ((size_t(offs - esmFileOffsets[fileNum]) + recordHdrSize)
+          > esmFiles[fileNum]->size())
+      {
+        errorMessage("invalid ESM index cache file");
+      }
+    }
+
+    // all data is valid
+    for (size_t i = 0; i < 0x0300; i++)
+      pluginMap[i] = FileBuffer::readUInt32Fast(p + (pluginMapOffs + (i * 4)));
+    formIDPageTable = const_cast< std::uint32_t * >(tmpPageTable);
+    formIDMap = const_cast< std::uint32_t * >(tmpFormIDMap);
+    recordBuf = const_cast< ESMRecord * >(
+                    reinterpret_cast< const ESMRecord * >(p + recordsOffs));
+    recordDataOffs = const_cast< std::uint32_t * >(tmpDataOffs);
+    recordBufSize = size_t(recordCnt);
+    formIDPageCnt = size_t(pageCnt);
+    formIDMapSize = size_t(mapSize);
+    indexCacheFile = cacheBuf;
+  }
+  catch (...)
+  {
+    delete cacheBuf;
+    return false;
+  }
+  return true;
+}
+
+void ESMFile::writeIndexCache(const char *cacheFileName,
+                              const std::string& keyName) const
+{
+  size_t  fileCnt = esmFiles.size();
+  std::vector< unsigned char >  outBuf(48 + (fileCnt * 24) + (0x0300 * 4), 0);
+  unsigned char *p = outBuf.data();
+  FileBuffer::writeUInt32Fast(p, 0x494D5345U);          // "ESMI"
+  FileBuffer::writeUInt32Fast(p + 4, indexCacheVersion);
+  FileBuffer::writeUInt32Fast(p + 8, recordHdrSize);
+  FileBuffer::writeUInt32Fast(p + 12, esmVersion);
+  FileBuffer::writeUInt32Fast(p + 16, esmFlags);
+  FileBuffer::writeUInt32Fast(p + 20, std::uint32_t(fileCnt));
+  FileBuffer::writeUInt64Fast(p + 24, std::uint64_t(recordBufSize));
+  FileBuffer::writeUInt32Fast(p + 32, std::uint32_t(formIDPageCnt));
+  FileBuffer::writeUInt32Fast(p + 36, std::uint32_t(formIDMapSize));
+  FileBuffer::writeUInt32Fast(p + 40, std::uint32_t(keyName.length()));
+  for (size_t i = 0; i < fileCnt; i++)
+  {
+    if (!getIndexCacheFileInfo(p + (48 + (i * 24)), *(esmFiles[i]),
+                               recordHdrSize))
+    {
+      errorMessage("error creating ESM index cache file");
+    }
+  }
+  for (size_t i = 0; i < 0x0300; i++)
+    FileBuffer::writeUInt32Fast(p + (48 + (fileCnt * 24) + (i * 4)),
+                                pluginMap[i]);
+
+  // write to a temporary file first, so that other processes never see
+  // an incomplete cache file
+  std::string tmpFileName;
+#if defined(_WIN32) || defined(_WIN64)
+  printToString(tmpFileName, "%s.%d.tmp", cacheFileName, int(_getpid()));
+#else
+  printToString(tmpFileName, "%s.%d.tmp", cacheFileName, int(getpid()));
+#endif
+  try
+  {
+    OutputFile  f(tmpFileName.c_str(), 65536);
+    f.writeData(outBuf.data(), outBuf.size());
+    f.writeData(formIDPageTable, formIDPageCnt * 4);
+    if (formIDPageCnt & 1)
+      f.writeData(outBuf.data() + 44, 4);       // padding (zero bytes)
+    f.writeData(formIDMap, formIDMapSize * 4);
+    f.writeData(recordBuf, recordBufSize * sizeof(ESMRecord));
+    f.writeData(recordDataOffs, recordBufSize * 4);
+    if (recordBufSize & 1)
+      f.writeData(outBuf.data() + 44, 4);
+    f.writeData(keyName.c_str(), keyName.length() + 1);
+  }
+  catch (...)
+  {
+    (void) std::remove(tmpFileName.c_str());
+    throw;
+  }
+#if defined(_WIN32) || defined(_WIN64)
+  (void) std::remove(cacheFileName);
+#endif
+  if (std::rename(tmpFileName.c_str(), cacheFileName) != 0)
+  {
+    (void) std::remove(tmpFileName.c_str());
+    errorMessage("error creating ESM index cache file");
+  }
+}
+
+ESMFile::ESMFile(const char *fileNames, int threadCnt)
+  : recordHdrSize(0),
+    esmVersion(0),
+    esmFlags(0),
+    pluginMap(nullptr),
+    formIDPageTable(nullptr),
+    formIDMap(nullptr),
+    recordBuf(nullptr),
+    recordDataOffs(nullptr),
+    recordBufSize(0),
+    formIDPageCnt(0),
+    formIDMapSize(0),
+    indexCacheFile(nullptr),
+    recordCacheSize(0x04000000),
+    typeIndexesBuilt(false),
+    edidIndexBuilt(false)
+{
+  try
+  {
+    pluginMap = new std::uint32_t[0x0300];
+    for (size_t i = 0; i < 0x0300; i = i + 3)
+    {
+      pluginMap[i] = 0xFFFFFFFFU;       // minimum form ID
+      pluginMap[i + 1] = 0U;            // maximum form ID
+      pluginMap[i + 2] = 0U;            // form ID map offset
+    }
+    std::vector< std::string >  tmpFileNames;
+    std::string fileName;
+    for (size_t i = 0; fileNames[i] != '\0'; i++)
+    {
+      if (fileName.length() > 4)
+      {
+        if (fileNames[i] == ',' && fileNames[i - 4] == '.' &&
+            (fileNames[i - 3] == 'E' || fileNames[i - 3] == 'e') &&
+            (fileNames[i - 2] == 'S' || fileNames[i - 2] == 's') &&
+            (fileNames[i - 1] == 'M' || fileNames[i - 1] == 'm'))
+        {
+          tmpFileNames.push_back(fileName);
+          fileName.clear();
+          continue;
+        }
+      }
+      fileName += fileNames[i];
+    }
+    if (!fileName.empty())
+      tmpFileNames.push_back(fileName);
+    if (tmpFileNames.size() < 1)
+      errorMessage("ESMFile: no input files");
+    esmFiles.resize(tmpFileNames.size(), nullptr);
+    for (size_t i = 0; i < tmpFileNames.size(); i++)
+    {
+      const char  *fName = tmpFileNames[i].c_str();
+      esmFiles[i] = new FileBuffer(fName);
+      if (!FileBuffer::checkType(esmFiles[i]->readUInt32(), "TES4"))
+        throw FO76UtilsError("input file %s is not in ESM format", fName);
+      (void) esmFiles[i]->readUInt32();
+      esmFlags = esmFiles[i]->readUInt32();
+      if (esmFiles[i]->readUInt32() != 0U)
+        throw FO76UtilsError("%s: invalid ESM file header", fName);
+      (void) esmFiles[i]->readUInt32();
+      unsigned int  tmp = esmFiles[i]->readUInt16();
+      if (tmp < 0x1000)
+      {
+        recordHdrSize = 24;
+        esmVersion = tmp;
+      }
+      else if (tmp == 0x4548)           // "HE"
+      {
+        recordHdrSize = 20;
+        esmVersion = 0x00;
+      }
+      else
+      {
+        throw FO76UtilsError("%s: invalid ESM file header", fName);
+      }
+    }
+    // record data is located by 32-bit offsets
+    esmFileOffsets.resize(esmFiles.size());
+    size_t  totalSize = 0;
+    for (size_t i = 0; i < esmFiles.size(); i++)
+    {
+      esmFileOffsets[i] = std::uint32_t(totalSize);
+      totalSize = totalSize + esmFiles[i]->size();
+      if (totalSize > 0xFFFFFFFFU)
+        errorMessage("ESMFile: total size of input files must be < 4 GB");
+    }
+
+    // the full paths of the ESM files are the key of the index cache
+    std::string cacheFileName;
+    std::string keyName;
+    const char  *cachePath = getDefaultIndexCachePath();
+    if (cachePath && *cachePath)
+    {
+      std::string fullPath;
+      for (size_t i = 0; i < tmpFileNames.size(); i++)
+      {
+        if (i)
+          keyName += '\n';
+        const char  *fName = tmpFileNames[i].c_str();
+        if (FileBuffer::getFullPathName(fullPath, fName))
+          fName = fullPath.c_str();
+        keyName += fName;
+      }
+      std::uint32_t h1 = hashFunctionUInt32(keyName.c_str(), keyName.length());
+      std::uint32_t h2 = 0xFFFFFFFFU;
+      for (size_t i = 0; i < keyName.length(); i++)
+        hashFunctionCRC32(h2, (unsigned char) keyName[i]);
+      cacheFileName = cachePath;
+      while (cacheFileName.length() > 1 &&
+             (cacheFileName.back() == '/' || cacheFileName.back() == '\\'))
+      {
+        cacheFileName.resize(cacheFileName.length() - 1);
+      }
+      printToString(cacheFileName, "/esmidx_%08X%08X.bin",
+                    (unsigned int) h1, (unsigned int) h2);
+      if (loadIndexCache(cacheFileName.c_str(), keyName))
+        return;
+    }
+
+    size_t  n = size_t(threadCnt);
+    if (threadCnt <= 0)
+      n = size_t(std::thread::hardware_concurrency());
+    n = std::min< size_t >(n, 64);
+    if (n > 1 && totalSize >= recordLoadMinSize)
+      loadRecordsParallel(tmpFileNames, n);
+    else
+      loadRecordsSerial(tmpFileNames);
+
+    if (!cacheFileName.empty())
+    {
+      try
+      {
+        writeIndexCache(cacheFileName.c_str(), keyName);
+      }
+      catch (std::exception&)
+      {
+        // failing to write the cache is not an error
+      }
+    }
+  }
+  catch (...)
+  {
+    for (size_t i = 0; i < esmFiles.size(); i++)
+    {
+      if (esmFiles[i])
+        delete esmFiles[i];
+    }
+    if (!indexCacheFile)
+    {
+      delete[] recordDataOffs;
+      delete[] recordBuf;
+      delete[] formIDMap;
+      delete[] formIDPageTable;
+    }
+    delete indexCacheFile;
+    delete[] pluginMap;
+    throw;
+  }
+}
+
+ESMFile::~ESMFile()
+{
+  for (size_t i = 0; i < esmFiles.size(); i++)
+  {
+    if (esmFiles[i])
+      delete esmFiles[i];
+  }
+  if (!indexCacheFile)
+  {
+    delete[] recordDataOffs;
+    delete[] recordBuf;
+    delete[] formIDMap;
+    delete[] formIDPageTable;
+  }
+  delete indexCacheFile;
+  delete[] pluginMap;
+}
+
+const ESMFile::ESMRecord& ESMFile::getRecord(unsigned int formID) const
+{
+  const ESMRecord *r = findRecord(formID);
+  if (!r)
+    errorMessage("invalid form ID");
+  return *r;
+}
+
+ESMFile::ESMField::ESMField(const ESMFile& f, const ESMRecord& r)
+  : FileBuffer(),
+    type(0),
+    dataRemaining(0)
+{
+  if (r.type == 0x50555247)             // "GRUP"
+    return;
+  if (r.flags & 0x00040000)             // compressed record
+    fileBuf = f.uncompressRecord(zlibBuf, r);
+  else
+    fileBuf = f.getRecordData(r);
+  fileBufSize = f.recordHdrSize;
+  filePos = 4;
+  dataRemaining = readUInt32Fast();
+}
+
+ESMFile::ESMField::ESMField(const ESMFile& f, unsigned int formID)
+  : ESMField(f, f.getRecord(formID))
+{
+}
+
+bool ESMFile::ESMField::next()
+{
+  fileBuf = fileBuf + fileBufSize;
+  fileBufSize = dataRemaining;
+  filePos = 0;
+  if (!dataRemaining)
+    return false;
+  if (dataRemaining < 6)
+    errorMessage("end of record data");
+  type = readUInt32Fast();
+  size_t  n = readUInt16Fast();
+  if (type == 0x58585858) [[unlikely]]          // "XXXX"
+  {
+    if (n == 4) [[likely]]
+    {
+      if (dataRemaining < 16)
+        errorMessage("end of record data");
+      n = readUInt32Fast();
+      type = readUInt32Fast();
+      (void) readUInt16Fast();
+    }
+  }
+  if ((filePos + n) > dataRemaining)
+    errorMessage("end of record data");
+  dataRemaining = dataRemaining - (unsigned int) (filePos + n);
+  fileBuf = fileBuf + filePos;
+  fileBufSize = n;
+  filePos = 0;
+  return true;
+}
+
+ESMFile::FieldIterator::FieldIterator(
+    const ESMFile& f, const ESMRecord& r, FieldOffsetCache *fieldCache)
+  : recordData(nullptr),
+    fieldData(nullptr),
+    recordSize(0U),
+    nextOffs(0U),
+    fieldSize(0U),
+    cache(nullptr),
+    cacheIndex(0),
+    type(0U)
+{
+  if (r.type == 0x50555247)             // "GRUP"
+    return;
+  const unsigned char *p;
+  if (r.flags & 0x00040000)             // compressed record
+    p = f.uncompressRecord(zlibBuf, r);
+  else
+    p = f.getRecordData(r);
+  recordSize = FileBuffer::readUInt32Fast(p + 4);
+  recordData = p + f.recordHdrSize;
+  fieldData = recordData;
+  if (!fieldCache)
+    return;
+  if (fieldCache->recordIndex.size() != f.recordBufSize) [[unlikely]]
+  {
+    fieldCache->clear();
+    fieldCache->recordIndex.resize(f.recordBufSize, 0U);
+  }
+  std::uint32_t&  n = fieldCache->recordIndex[&r - f.recordBuf];
+  if (!n)
+  {
+    std::vector< FieldOffsetCache::FieldLocation >& v =
+        fieldCache->fieldLocations;
+    size_t  startIndex = v.size();
+    if (startIndex >= fieldCache->maxFields)
+      return;
+    unsigned int  offs = 0U;
+    try
+    {
+      while (next())
+      {
+        v.push_back(FieldOffsetCache::FieldLocation{ type, offs });
+        offs = nextOffs;
+      }
+      v.push_back(FieldOffsetCache::FieldLocation{ 0U, recordSize });
+    }
+    catch (...)
+    {
+      v.resize(startIndex);
+      throw;
+    }
+    nextOffs = 0U;
+    fieldData = recordData;
+    fieldSize = 0U;
+    n = std::uint32_t(startIndex + 1);
+  }
+  cache = fieldCache;
+  cacheIndex = n - 1U;
+}
+
+bool ESMFile::FieldIterator::nextLarge()
+{
+  const unsigned char *p = recordData + nextOffs;
+  fieldSize = FileBuffer::readUInt16Fast(p + 4);
+  nextOffs = nextOffs + 6U;
+  if (fieldSize == 4U) [[likely]]
+  {
+    if ((nextOffs + 10U) > recordSize)
+      errorMessage("end of record data");
+    fieldSize = FileBuffer::readUInt32Fast(p + 6);
+    type = FileBuffer::readUInt32Fast(p + 10);
+    nextOffs = nextOffs + 10U;
+  }
+  if (fieldSize > (recordSize - nextOffs))
+    errorMessage("end of record data");
+  fieldData = recordData + nextOffs;
+  nextOffs = nextOffs + fieldSize;
+  return true;
+}
+
+bool ESMFile::FieldIterator::find(unsigned int fieldType)
+{
+  if (!cache)
+  {
+    while (next())
+    {
+      if (type == fieldType)
+        return true;
+    }
+    return false;
+  }
+  const FieldOffsetCache::FieldLocation *p =
+      cache->fieldLocations.data() + cacheIndex;
+  for ( ; p->offset < recordSize; p++)
+  {
+    if (p->type == fieldType && p->offset >= nextOffs)
+      break;
+  }
+  nextOffs = p->offset;
+  return next();
+}
+
+ESMFile::CDBRecord::CDBRecord(ESMField& f)
+  : FileBuffer(f.data(), f.size(), 0),
+    stringTableSize(0U),
+    stringTable(nullptr)
+{
+  if (f.size() >= 16) [[likely]]
+  {
+    dataRemaining = (unsigned int) (f.size() - 16);
+    type = FileBuffer::readUInt32Fast(f.data());
+    fileBuf = f.data() + 8;
+    fileBufSize = FileBuffer::readUInt32Fast(f.data() + 4);
+    if (type == 0x48544542U && fileBufSize == 8)        // "BETH"
+    {
+      if (FileBuffer::readUInt32Fast(f.data() + 8) == 4U) [[likely]]
+      {
+        recordsRemaining = FileBuffer::readUInt32Fast(f.data() + 12);
+        recordsRemaining -= (unsigned int) (recordsRemaining > 0U);
+        return;
+      }
+    }
+  }
+  fileBufSize = 0;
+  type = 0U;
+  recordsRemaining = 0U;
+  dataRemaining = 0U;
+}
+
+bool ESMFile::CDBRecord::next()
+{
+  fileBuf = fileBuf + fileBufSize;
+  fileBufSize = dataRemaining;
+  filePos = 0;
+  if (!recordsRemaining)
+    return false;
+  recordsRemaining--;
+  if (dataRemaining < 8U)
+    errorMessage("unexpected end of CDB data");
+  type = readUInt32Fast();
+  size_t  n = readUInt32Fast();
+  if (n > (dataRemaining - 8U))
+    errorMessage("unexpected end of CDB data");
+  dataRemaining = dataRemaining - (unsigned int) (n + 8);
+  fileBuf = fileBuf + 8;
+  fileBufSize = n;
+  filePos = 0;
+  if (type == 0x54525453U) [[unlikely]]         // "STRT"
+  {
+    for ( ; n > 0; n--)
     {
       if (!fileBuf[n - 1])
       {
@@ -449,7 +1491,7 @@ unsigned short ESMFile::getRecordTimestamp(unsigned int formID) const
   const ESMRecord *r = findRecord(formID);
   if (!r)
     errorMessage("invalid form ID");
-  const unsigned char *p = r->fileData;
+  const unsigned char *p = getRecordData(*r);
   return (((unsigned short) p[17] << 8) | p[16]);
 }
 
@@ -458,13 +1500,14 @@ unsigned short ESMFile::getRecordUserID(unsigned int formID) const
   const ESMRecord *r = findRecord(formID);
   if (!r)
     errorMessage("invalid form ID");
-  const unsigned char *p = r->fileData;
+  const unsigned char *p = getRecordData(*r);
   return (((unsigned short) p[19] << 8) | p[18]);
 }
 
 void ESMFile::getVersionControlInfo(ESMVCInfo& f, const ESMRecord& r) const
 {
-  unsigned int  tmp = ((unsigned int) r.fileData[17] << 8) | r.fileData[16];
+  const unsigned char *p = getRecordData(r);
+  unsigned int  tmp = ((unsigned int) p[17] << 8) | p[16];
   f.day = tmp & 0x1F;
   if (esmVersion < 0x80)
   {
@@ -481,8 +1524,8 @@ void ESMFile::getVersionControlInfo(ESMVCInfo& f, const ESMRecord& r) const
     f.month = (tmp >> 5) & 0x0F;
     f.year = 2000U + (tmp >> 9);
   }
-  f.userID1 = r.fileData[18];
-  f.userID2 = r.fileData[19];
+  f.userID1 = p[18];
+  f.userID2 = p[19];
   if (f.userID2 != 0 && (esmVersion >= 0xC0 && tmp >= 0x26C0))  // June 2019
   {
     // Fallout 76 uses 16-bit user IDs since mid-2019
@@ -496,8 +1539,774 @@ void ESMFile::getVersionControlInfo(ESMVCInfo& f, const ESMRecord& r) const
   }
   else
   {
-    f.formVersion = ((unsigned int) r.fileData[21] << 8) | r.fileData[20];
-    f.vcInfo2 = ((unsigned int) r.fileData[23] << 8) | r.fileData[22];
+    f.formVersion = ((unsigned int) p[21] << 8) | p[20];
+    f.vcInfo2 = ((unsigned int) p[23] << 8) | p[22];
+  }
+}
+
+struct ESMFile::IndexBuildTask
+{
+  size_t  startNum;             // range of indices in recordBuf
+  size_t  endNum;
+  bool    buildTypeIndexes;
+  bool    buildEDIDIndex;
+  std::vector< char > edidNameBuf;
+  std::vector< EDIDIndexEntry > edids;
+  // (type << 32) | form ID, sorted
+  std::vector< unsigned long long > records;
+  // (cell << 32) | form ID of REFR and ACHR records, sorted
+  std::vector< unsigned long long > cellRefs;
+  std::vector< std::pair< unsigned long long, unsigned int > > exteriorCells;
+  std::string errMsg;
+};
+
+struct ESMFile::IndexBuildQueue
+{
+  std::vector< IndexBuildTask > tasks;
+  std::atomic< size_t > nextTask;
+};
+
+unsigned int ESMFile::hashEDID(const char *s, size_t len)
+{
+  // FNV-1a hash of the editor ID converted to lower case
+  std::uint32_t h = 0x811C9DC5U;
+  for (size_t i = 0; i < len; i++)
+  {
+    unsigned char c = (unsigned char) s[i];
+    if (c >= 'A' && c <= 'Z')
+      c = c + ('a' - 'A');
+    h = (h ^ c) * 0x01000193U;
+  }
+  return h;
+}
+
+static inline bool compareEDIDs(const char *s1, const char *s2, size_t len)
+{
+  for (size_t i = 0; i < len; i++)
+  {
+    unsigned char c1 = (unsigned char) s1[i];
+    unsigned char c2 = (unsigned char) s2[i];
+    if (c1 >= 'A' && c1 <= 'Z')
+      c1 = c1 + ('a' - 'A');
+    if (c2 >= 'A' && c2 <= 'Z')
+      c2 = c2 + ('a' - 'A');
+    if (c1 != c2)
+      return false;
+  }
+  return true;
+}
+
+// merge the sorted ranges of v that start at the elements of bounds,
+// the last element of bounds is the end of the last range
+static void mergeSortedRanges(std::vector< unsigned long long >& v,
+                              std::vector< size_t >& bounds)
+{
+  while (bounds.size() > 2)
+  {
+    size_t  j = 0;
+    for (size_t i = 0; (i + 1) < bounds.size(); i = i + 2, j++)
+    {
+      if ((i + 2) < bounds.size())
+      {
+        std::inplace_merge(v.begin() + bounds[i], v.begin() + bounds[i + 1],
+                           v.begin() + bounds[i + 2]);
+      }
+      bounds[j] = bounds[i];
+    }
+    bounds[j] = bounds.back();
+    bounds.resize(j + 1);
+  }
+}
+
+void ESMFile::buildIndexTask(IndexBuildTask& t) const
+{
+  for (size_t i = t.startNum; i < t.endNum; i++)
+  {
+    const ESMRecord&  r = recordBuf[i];
+    if (recordDataOffs[i] == 0xFFFFFFFFU || r == "GRUP")
+      continue;
+    const ESMRecord *p = findRecord(r.parent);
+    if (!(p && *p == "GRUP"))
+      p = nullptr;
+    bool    isExteriorCell = false;
+    if (t.buildTypeIndexes)
+    {
+      t.records.push_back(((unsigned long long) r.type << 32) | r.formID);
+      if (r == "REFR" || r == "ACHR")
+      {
+        // cell children (6), persistent (8) and temporary (9) children
+        if (p && (p->formID == 6U || p->formID == 8U || p->formID == 9U))
+        {
+          t.cellRefs.push_back(((unsigned long long) p->flags << 32)
+                               | r.formID);
+        }
+      }
+      isExteriorCell = (r == "CELL" && p && p->formID == 5U);
+    }
+    // the fields are only read if they are needed
+    if (!(t.buildEDIDIndex || isExteriorCell))
+      continue;
+    if (r == "LAND" || r == "NAVM")
+      continue;                         // these do not have editor IDs
+    ESMField  f(*this, r);
+    if (!f.next())
+      continue;
+    if (f == "EDID" && t.buildEDIDIndex)
+    {
+      size_t  len = 0;
+      const char  *s = reinterpret_cast< const char * >(f.data());
+      while (len < f.size() && s[len] != '\0')
+        len++;
+      if (len > 0)
+      {
+        EDIDIndexEntry  e;
+        e.formID = r.formID;
+        e.nameOffs = (unsigned int) t.edidNameBuf.size();
+        e.nameLen = (unsigned int) len;
+        e.hashValue = hashEDID(s, len);
+        t.edidNameBuf.insert(t.edidNameBuf.end(), s, s + len);
+        t.edids.push_back(e);
+      }
+    }
+    if (!isExteriorCell)
+      continue;
+    // exterior cell, find the world of the parent block
+    unsigned int  worldID = 0U;
+    while (p && *p == "GRUP")
+    {
+      if (p->formID == 1U)
+      {
+        worldID = p->flags;
+        break;
+      }
+      p = findRecord(p->parent);
+    }
+    do
+    {
+      if (f == "XCLC" && f.size() >= 8)
+      {
+        unsigned int  x = f.readUInt32Fast() & 0xFFFFU;
+        unsigned int  y = f.readUInt32Fast() & 0xFFFFU;
+        t.exteriorCells.emplace_back(((unsigned long long) worldID << 32)
+                                     | (y << 16) | x, r.formID);
+        break;
+      }
+    }
+    while (f.next());
+  }
+  std::sort(t.records.begin(), t.records.end());
+  std::sort(t.cellRefs.begin(), t.cellRefs.end());
+}
+
+void ESMFile::buildIndexesThread(const ESMFile *p, IndexBuildQueue *q)
+{
+  size_t  n = q->tasks.size();
+  size_t  i;
+  while ((i = q->nextTask.fetch_add(1)) < n)
+  {
+    IndexBuildTask& t = q->tasks[i];
+    try
+    {
+      p->buildIndexTask(t);
+    }
+    catch (std::exception& e)
+    {
+      t.errMsg = std::string(e.what());
+    }
+  }
+}
+
+void ESMFile::buildIndexes(int threadCnt, bool buildEDIDIndex)
+{
+  bool    buildTypeIndexes = !typeIndexesBuilt;
+  buildEDIDIndex = buildEDIDIndex && !edidIndexBuilt;
+  if (!(buildTypeIndexes || buildEDIDIndex))
+    return;
+  size_t  threadsUsed = size_t(threadCnt);
+  if (threadCnt <= 0)
+    threadsUsed = size_t(std::thread::hardware_concurrency());
+  threadsUsed = std::min< size_t >(std::max< size_t >(threadsUsed, 1), 64);
+  IndexBuildQueue q;
+  size_t  taskSize =
+      std::max< size_t >(recordBufSize / (threadsUsed * 16), 4096);
+  for (size_t i = 0; i < recordBufSize; i = i + taskSize)
+  {
+    q.tasks.emplace_back();
+    q.tasks.back().startNum = i;
+    q.tasks.back().endNum = std::min(i + taskSize, recordBufSize);
+    q.tasks.back().buildTypeIndexes = buildTypeIndexes;
+    q.tasks.back().buildEDIDIndex = buildEDIDIndex;
+  }
+  q.nextTask = 0;
+  threadsUsed = std::min(threadsUsed, q.tasks.size());
+  if (threadsUsed <= 1)
+  {
+    buildIndexesThread(this, &q);
+  }
+  else
+  {
+    std::vector< std::thread * >  threads(threadsUsed, nullptr);
+    for (size_t i = 0; i < threadsUsed; i++)
+    {
+      try
+      {
+        threads[i] = new std::thread(buildIndexesThread, this, &q);
+      }
+      catch (...)
+      {
+        // the remaining tasks are processed by the threads already running
+        if (!i)
+          buildIndexesThread(this, &q);
+        break;
+      }
+    }
+    for (size_t i = 0; i < threadsUsed; i++)
+    {
+      if (threads[i])
+      {
+        threads[i]->join();
+        delete threads[i];
+      }
+    }
+  }
+  for (size_t i = 0; i < q.tasks.size(); i++)
+  {
+    if (!q.tasks[i].errMsg.empty())
+      throw FO76UtilsError(1, q.tasks[i].errMsg.c_str());
+  }
+
+  if (buildEDIDIndex)
+    buildEDIDHashTable(q);
+  if (buildTypeIndexes)
+    buildTypeIndexTables(q);
+}
+
+void ESMFile::buildEDIDHashTable(IndexBuildQueue& q)
+{
+  for (auto& t : q.tasks)
+  {
+    size_t  nameOffs = edidNameBuf.size();
+    if ((nameOffs + t.edidNameBuf.size()) > 0xFFFFFFFFU)
+      errorMessage("ESMFile: editor ID index is too large");
+    edidNameBuf.insert(edidNameBuf.end(),
+                       t.edidNameBuf.begin(), t.edidNameBuf.end());
+    for (const auto& e : t.edids)
+    {
+      edidIndex.push_back(e);
+      edidIndex.back().nameOffs = e.nameOffs + (unsigned int) nameOffs;
+    }
+    std::vector< char >().swap(t.edidNameBuf);
+    std::vector< EDIDIndexEntry >().swap(t.edids);
+  }
+  std::sort(edidIndex.begin(), edidIndex.end(),
+            [](const EDIDIndexEntry& a, const EDIDIndexEntry& b)
+            {
+              return (a.formID < b.formID);
+            });
+  if (edidIndex.size() > 0)
+  {
+    size_t  m = std::bit_ceil(edidIndex.size() * 2) - 1;
+    edidHashTable.resize(m + 1, 0U);
+    for (size_t i = 0; i < edidIndex.size(); i++)
+    {
+      const EDIDIndexEntry& e = edidIndex[i];
+      const char  *s = edidNameBuf.data() + e.nameOffs;
+      for (size_t h = e.hashValue & m; true; h = (h + 1) & m)
+      {
+        if (!edidHashTable[h])
+        {
+          edidHashTable[h] = std::uint32_t(i + 1);
+          break;
+        }
+        // keep the lowest form ID if the editor ID is not unique
+        const EDIDIndexEntry& e2 = edidIndex[edidHashTable[h] - 1];
+        if (e2.hashValue == e.hashValue && e2.nameLen == e.nameLen &&
+            compareEDIDs(edidNameBuf.data() + e2.nameOffs, s, e.nameLen))
+        {
+          break;
+        }
+      }
+    }
+  }
+
+  edidIndexBuilt = true;
+}
+
+void ESMFile::buildTypeIndexTables(IndexBuildQueue& q)
+{
+  // record types and cell references
+  for (int i = 0; i < 2; i++)
+  {
+    std::vector< unsigned long long > v;
+    std::vector< size_t > bounds(1, 0);
+    for (auto& t : q.tasks)
+    {
+      std::vector< unsigned long long >&  tmp =
+          (i == 0 ? t.records : t.cellRefs);
+      if (tmp.empty())
+        continue;
+      v.insert(v.end(), tmp.begin(), tmp.end());
+      bounds.push_back(v.size());
+      std::vector< unsigned long long >().swap(tmp);
+    }
+    mergeSortedRanges(v, bounds);
+    std::vector< unsigned int >&  indexBuf =
+        (i == 0 ? typeIndexBuf : cellRefIndexBuf);
+    std::map< unsigned int, std::pair< size_t, size_t > >& indexMap =
+        (i == 0 ? typeIndexMap : cellRefIndexMap);
+    indexBuf.resize(v.size());
+    for (size_t j = 0; j < v.size(); )
+    {
+      unsigned int  k = (unsigned int) (v[j] >> 32);
+      size_t  j0 = j;
+      for ( ; j < v.size() && (unsigned int) (v[j] >> 32) == k; j++)
+        indexBuf[j] = (unsigned int) (v[j] & 0xFFFFFFFFU);
+      indexMap.emplace_hint(indexMap.end(), k,
+                            std::pair< size_t, size_t >(j0, j));
+    }
+  }
+
+  // exterior cell grid
+  for (const auto& t : q.tasks)
+  {
+    for (const auto& c : t.exteriorCells)
+    {
+      std::map< unsigned long long, unsigned int >::iterator  j =
+          exteriorCellMap.insert(c).first;
+      j->second = std::min(j->second, c.second);
+    }
+  }
+  typeIndexesBuilt = true;
+}
+
+unsigned int ESMFile::findEDID(std::string_view s) const
+{
+  if (edidHashTable.empty())
+    return 0U;
+  unsigned int  h = hashEDID(s.data(), s.length());
+  size_t  m = edidHashTable.size() - 1;
+  for (size_t i = h & m; edidHashTable[i]; i = (i + 1) & m)
+  {
+    const EDIDIndexEntry& e = edidIndex[edidHashTable[i] - 1];
+    if (e.hashValue == h && e.nameLen == s.length() &&
+        compareEDIDs(edidNameBuf.data() + e.nameOffs, s.data(), s.length()))
+    {
+      return e.formID;
+    }
+  }
+  return 0U;
+}
+
+std::string_view ESMFile::getEDID(unsigned int formID) const
+{
+  std::vector< EDIDIndexEntry >::const_iterator i =
+      std::lower_bound(edidIndex.begin(), edidIndex.end(), formID,
+                       [](const EDIDIndexEntry& e, unsigned int n)
+                       {
+                         return (e.formID < n);
+                       });
+  if (i == edidIndex.end() || i->formID != formID)
+    return std::string_view();
+  return std::string_view(edidNameBuf.data() + i->nameOffs, i->nameLen);
+}
+
+std::span< const unsigned int > ESMFile::getRecordsByType(
+    unsigned int type) const
+{
+  std::map< unsigned int, std::pair< size_t, size_t > >::const_iterator i =
+      typeIndexMap.find(type);
+  if (i == typeIndexMap.end())
+    return std::span< const unsigned int >();
+  return std::span< const unsigned int >(
+             typeIndexBuf.data() + i->second.first,
+             i->second.second - i->second.first);
+}
+
+std::span< const unsigned int > ESMFile::getCellReferences(
+    unsigned int cellFormID) const
+{
+  std::map< unsigned int, std::pair< size_t, size_t > >::const_iterator i =
+      cellRefIndexMap.find(cellFormID);
+  if (i == cellRefIndexMap.end())
+    return std::span< const unsigned int >();
+  return std::span< const unsigned int >(
+             cellRefIndexBuf.data() + i->second.first,
+             i->second.second - i->second.first);
+}
+
+unsigned int ESMFile::findExteriorCell(
+    unsigned int worldFormID, int x, int y) const
+{
+  std::map< unsigned long long, unsigned int >::const_iterator  i =
+      exteriorCellMap.find(((unsigned long long) worldFormID << 32)
+                           | ((unsigned int) (y & 0xFFFF) << 16)
+                           | (unsigned int) (x & 0xFFFF));
+  if (i == exteriorCellMap.end())
+    return 0U;
+  return i->second;
+}
+
+struct ESMFile::ReferenceGridTask
+{
+  size_t  startNum;             // range of indices in the form ID list
+  size_t  endNum;
+  std::vector< ReferenceBounds >  refs;
+  std::string errMsg;
+};
+
+struct ESMFile::ReferenceGridQueue
+{
+  const std::vector< unsigned int > *formIDs;
+  std::vector< ReferenceGridTask >  tasks;
+  std::atomic< size_t > nextTask;
+};
+
+inline int ESMFile::getReferenceGridCoord(float x)
+{
+  int     n = int(std::floor(x * (1.0f / referenceGridCellSize)));
+  return std::min(std::max(n, -32768), 32767);
+}
+
+void ESMFile::getReferenceBounds(
+    ReferenceBounds& b, const ESMRecord& r,
+    std::map< unsigned int, float >& baseRadius) const
+{
+  unsigned int  baseFormID = 0U;
+  float   x = 0.0f;
+  float   y = 0.0f;
+  float   z = 0.0f;
+  float   scale = 1.0f;
+  float   decalScale = 1.0f;
+  float   primitiveRadius = 0.0f;
+  {
+    FieldIterator f(*this, r);
+    while (f.next())
+    {
+      if (f == "NAME" && f.size() >= 4)
+      {
+        baseFormID = f.getUInt32(0);
+      }
+      else if (f == "DATA" && f.size() >= 12)
+      {
+        x = f.getFloat(0);
+        y = f.getFloat(4);
+        z = f.getFloat(8);
+      }
+      else if (f == "XSCL" && f.size() >= 4)
+      {
+        scale = float(std::fabs(f.getFloat(0)));
+      }
+      else if (f == "XPDD" && f.size() >= 8)
+      {
+        float   scaleX = float(std::fabs(f.getFloat(0)));
+        float   scaleZ = float(std::fabs(f.getFloat(4)));
+        decalScale = std::max(std::max(scaleX, scaleZ), 1.0f);
+      }
+      else if (f == "XPRM" && f.size() >= 12)
+      {
+        float   bx = f.getFloat(0);
+        float   by = f.getFloat(4);
+        float   bz = f.getFloat(8);
+        primitiveRadius = float(std::sqrt(bx * bx + by * by + bz * bz));
+      }
+    }
+  }
+  std::map< unsigned int, float >::iterator i = baseRadius.find(baseFormID);
+  if (i == baseRadius.end())
+  {
+    // use a large default radius if the base object has no bounds,
+    // or is a decal that is also extended by the depth search range
+    float   radius = 8192.0f;
+    const ESMRecord *p = findRecord(baseFormID);
+    if (p && !(*p == "GRUP" || *p == "TXST"))
+    {
+      FieldIterator f(*this, *p);
+      while (f.find("OBND"))
+      {
+        if (f.size() >= 12)
+        {
+          float   tmp[6];
+          for (int j = 0; j < 6; j++)
+            tmp[j] = float(uint16ToSigned(f.getUInt16(size_t(j) * 2)));
+          float   bx = std::max(std::fabs(tmp[0]), std::fabs(tmp[3]));
+          float   by = std::max(std::fabs(tmp[1]), std::fabs(tmp[4]));
+          float   bz = std::max(std::fabs(tmp[2]), std::fabs(tmp[5]));
+          radius = float(std::sqrt(bx * bx + by * by + bz * bz));
+          break;
+        }
+      }
+    }
+    i = baseRadius.emplace(baseFormID, radius).first;
+  }
+  float   radius = std::max(i->second * decalScale, primitiveRadius) * scale;
+  // invalid data is replaced with bounds that include everything
+  if (!(radius < 1000000.0f))
+    radius = 1000000.0f;
+  if (!(std::fabs(x) < 10000000.0f && std::fabs(y) < 10000000.0f &&
+        std::fabs(z) < 10000000.0f))
+  {
+    x = 0.0f;
+    y = 0.0f;
+    z = 0.0f;
+    radius = 10000000.0f;
+  }
+  radius = radius + 16.0f;
+  b.formID = r.formID;
+  b.x0 = x - radius;
+  b.y0 = y - radius;
+  b.z0 = z - radius;
+  b.x1 = x + radius;
+  b.y1 = y + radius;
+  b.z1 = z + radius;
+}
+
+void ESMFile::buildReferenceGridThread(const ESMFile *p, ReferenceGridQueue *q)
+{
+  size_t  n = q->tasks.size();
+  size_t  i;
+  while ((i = q->nextTask.fetch_add(1)) < n)
+  {
+    ReferenceGridTask&  t = q->tasks[i];
+    try
+    {
+      std::map< unsigned int, float > baseRadius;
+      t.refs.resize(t.endNum - t.startNum);
+      for (size_t j = t.startNum; j < t.endNum; j++)
+      {
+        const ESMRecord&  r = p->getRecord((*(q->formIDs))[j]);
+        p->getReferenceBounds(t.refs[j - t.startNum], r, baseRadius);
+      }
+    }
+    catch (std::exception& e)
+    {
+      t.errMsg = std::string(e.what());
+    }
+  }
+}
+
+void ESMFile::buildReferenceGrid(unsigned int worldFormID, int threadCnt)
+{
+  if (referenceGrids.find(worldFormID) != referenceGrids.end())
+    return;
+  buildIndexes(threadCnt, false);
+  std::vector< unsigned int > formIDs;
+  for (unsigned int cellFormID : getRecordsByType("CELL"))
+  {
+    const ESMRecord *r = findRecord(cellFormID);
+    const ESMRecord *p = (r ? findRecord(r->parent) : nullptr);
+    // the parent of exterior cells is a sub-block (5) in a block (4),
+    // persistent cells are in the world children group (1)
+    while (p && *p == "GRUP" && (p->formID == 4U || p->formID == 5U))
+      p = findRecord(p->parent);
+    if (!(p && *p == "GRUP" && p->formID == 1U && p->flags == worldFormID))
+      continue;
+    std::span< const unsigned int > refs = getCellReferences(cellFormID);
+    formIDs.insert(formIDs.end(), refs.begin(), refs.end());
+  }
+  if (formIDs.size() > 0x7FFFFFFF)
+    errorMessage("ESMFile: too many references in world");
+
+  size_t  threadsUsed = size_t(threadCnt);
+  if (threadCnt <= 0)
+    threadsUsed = size_t(std::thread::hardware_concurrency());
+  threadsUsed = std::min< size_t >(std::max< size_t >(threadsUsed, 1), 64);
+  ReferenceGridQueue  q;
+  q.formIDs = &formIDs;
+  for (size_t i = 0; i < formIDs.size(); i = i + 4096)
+  {
+    q.tasks.emplace_back();
+    q.tasks.back().startNum = i;
+    q.tasks.back().endNum = std::min< size_t >(i + 4096, formIDs.size());
+  }
+  q.nextTask = 0;
+  threadsUsed = std::min(threadsUsed, q.tasks.size());
+  if (threadsUsed <= 1)
+  {
+    buildReferenceGridThread(this, &q);
+  }
+  else
+  {
+    std::vector< std::thread * >  threads(threadsUsed, nullptr);
+    for (size_t i = 0; i < threadsUsed; i++)
+    {
+      try
+      {
+        threads[i] = new std::thread(buildReferenceGridThread, this, &q);
+      }
+      catch (...)
+      {
+        // the remaining tasks are processed by the threads already running
+        if (!i)
+          buildReferenceGridThread(this, &q);
+        break;
+      }
+    }
+    for (size_t i = 0; i < threadsUsed; i++)
+    {
+      if (threads[i])
+      {
+        threads[i]->join();
+        delete threads[i];
+      }
+    }
+  }
+  for (size_t i = 0; i < q.tasks.size(); i++)
+  {
+    if (!q.tasks[i].errMsg.empty())
+      throw FO76UtilsError(1, q.tasks[i].errMsg.c_str());
+  }
+
+  ReferenceGrid&  g = referenceGrids[worldFormID];
+  g.xMin = 32767;
+  g.yMin = 32767;
+  g.xMax = -32768;
+  g.yMax = -32768;
+  g.bounds.formID = worldFormID;
+  g.bounds.x0 = 1.0e8f;
+  g.bounds.y0 = 1.0e8f;
+  g.bounds.z0 = 1.0e8f;
+  g.bounds.x1 = -1.0e8f;
+  g.bounds.y1 = -1.0e8f;
+  g.bounds.z1 = -1.0e8f;
+  // (grid cell << 32) | index of reference
+  std::vector< unsigned long long > tmp;
+  for (auto& t : q.tasks)
+  {
+    for (const auto& b : t.refs)
+    {
+      std::uint32_t n = std::uint32_t(g.refs.size());
+      g.refs.push_back(b);
+      g.bounds.x0 = std::min(g.bounds.x0, b.x0);
+      g.bounds.y0 = std::min(g.bounds.y0, b.y0);
+      g.bounds.z0 = std::min(g.bounds.z0, b.z0);
+      g.bounds.x1 = std::max(g.bounds.x1, b.x1);
+      g.bounds.y1 = std::max(g.bounds.y1, b.y1);
+      g.bounds.z1 = std::max(g.bounds.z1, b.z1);
+      int     x0 = getReferenceGridCoord(b.x0);
+      int     y0 = getReferenceGridCoord(b.y0);
+      int     x1 = getReferenceGridCoord(b.x1);
+      int     y1 = getReferenceGridCoord(b.y1);
+      if ((x1 - x0) >= referenceGridMaxCells ||
+          (y1 - y0) >= referenceGridMaxCells)
+      {
+        g.largeRefs.push_back(n);
+        continue;
+      }
+      g.xMin = std::min(g.xMin, x0);
+      g.yMin = std::min(g.yMin, y0);
+      g.xMax = std::max(g.xMax, x1);
+      g.yMax = std::max(g.yMax, y1);
+      for (int y = y0; y <= y1; y++)
+      {
+        for (int x = x0; x <= x1; x++)
+        {
+          unsigned long long  k = ((unsigned int) (y & 0xFFFF) << 16)
+                                  | (unsigned int) (x & 0xFFFF);
+          tmp.push_back((k << 32) | n);
+        }
+      }
+    }
+    std::vector< ReferenceBounds >().swap(t.refs);
+  }
+  std::sort(tmp.begin(), tmp.end());
+  g.cellRefs.resize(tmp.size());
+  for (size_t i = 0; i < tmp.size(); )
+  {
+    unsigned int  k = (unsigned int) (tmp[i] >> 32);
+    size_t  i0 = i;
+    for ( ; i < tmp.size() && (unsigned int) (tmp[i] >> 32) == k; i++)
+      g.cellRefs[i] = std::uint32_t(tmp[i] & 0xFFFFFFFFU);
+    g.cells.emplace_hint(g.cells.end(), k, std::pair< size_t, size_t >(i0, i));
+  }
+}
+
+const ESMFile::ReferenceBounds * ESMFile::getReferenceGridBounds(
+    unsigned int worldFormID) const
+{
+  std::map< unsigned int, ReferenceGrid >::const_iterator i =
+      referenceGrids.find(worldFormID);
+  if (i == referenceGrids.end() || i->second.refs.empty())
+    return nullptr;
+  return &(i->second.bounds);
+}
+
+void ESMFile::findReferences(
+    std::vector< unsigned int >& refs, unsigned int worldFormID,
+    float x0, float y0, float x1, float y1) const
+{
+  std::map< unsigned int, ReferenceGrid >::const_iterator i =
+      referenceGrids.find(worldFormID);
+  if (i == referenceGrids.end() || !(x0 <= x1 && y0 <= y1))
+    return;
+  const ReferenceGrid&  g = i->second;
+  for (std::uint32_t n : g.largeRefs)
+  {
+    const ReferenceBounds&  b = g.refs[n];
+    if (!(b.x1 < x0 || b.x0 > x1 || b.y1 < y0 || b.y0 > y1))
+      refs.push_back(b.formID);
+  }
+  int     gx0 = std::max(getReferenceGridCoord(x0), g.xMin);
+  int     gy0 = std::max(getReferenceGridCoord(y0), g.yMin);
+  int     gx1 = std::min(getReferenceGridCoord(x1), g.xMax);
+  int     gy1 = std::min(getReferenceGridCoord(y1), g.yMax);
+  if (gx0 > gx1 || gy0 > gy1)
+    return;
+  std::map< unsigned int, std::pair< size_t, size_t > >::const_iterator j;
+  bool    searchAllCells =
+      ((size_t(gx1 - gx0) + 1) * (size_t(gy1 - gy0) + 1) > g.cells.size());
+  int     x = gx0;
+  int     y = gy0;
+  if (searchAllCells)
+    j = g.cells.begin();
+  while (true)
+  {
+    if (searchAllCells)
+    {
+      if (j == g.cells.end())
+        break;
+      x = int(std::int16_t(j->first & 0xFFFFU));
+      y = int(std::int16_t(j->first >> 16));
+      if (x < gx0 || x > gx1 || y < gy0 || y > gy1)
+      {
+        j++;
+        continue;
+      }
+    }
+    else
+    {
+      if (x > gx1)
+      {
+        x = gx0;
+        y++;
+      }
+      if (y > gy1)
+        break;
+      j = g.cells.find(((unsigned int) (y & 0xFFFF) << 16)
+                       | (unsigned int) (x & 0xFFFF));
+      if (j == g.cells.end())
+      {
+        x++;
+        continue;
+      }
+    }
+    for (size_t k = j->second.first; k < j->second.second; k++)
+    {
+      const ReferenceBounds&  b = g.refs[g.cellRefs[k]];
+      if (b.x1 < x0 || b.x0 > x1 || b.y1 < y0 || b.y0 > y1)
+        continue;
+      // references in multiple grid cells are only added once, at the
+      // first grid cell that is within the search area
+      if (std::max(getReferenceGridCoord(b.x0), gx0) != x ||
+          std::max(getReferenceGridCoord(b.y0), gy0) != y)
+      {
+        continue;
+      }
+      refs.push_back(b.formID);
+    }
+    if (searchAllCells)
+      j++;
+    else
+      x++;
   }
 }
 
@@ -5,6 +5,11 @@
 #include "common.hpp"
 #include "filebuf.hpp"
 
+#include <memory>
+#include <atomic>
+#include <mutex>
+#include <span>
+
 class ESMFile
 {
  public:
@@ -16,10 +21,11 @@ class ESMFile
     unsigned int  parent;       // form ID of parent group or record
     unsigned int  children;     // form ID of first child record or group
     unsigned int  next;         // form ID of next record in this group
-    const unsigned char *fileData;      // pointer to record in file buffer
+    // the location of the record data is stored separately,
+    // see ESMFile::getRecordData()
     ESMRecord()
       : type(0xFFFFFFFFU), flags(0), formID(0U), parent(0),
-        children(0), next(0), fileData(nullptr)
+        children(0), next(0)
     {
     }
     inline bool operator==(const char *s) const
@@ -29,20 +35,102 @@ class ESMFile
   };
   class ESMField : public FileBuffer
   {
+   protected:
+    // decompressed record data, if the record is compressed
+    std::shared_ptr< const std::vector< unsigned char > > zlibBuf;
    public:
     unsigned int  type;
     unsigned int  dataRemaining;
-    ESMField(ESMFile& f, const ESMRecord& r);
-    ESMField(ESMFile& f, unsigned int formID);
-    // constructor that accepts a const ESMFile,
-    // but does not support compressed records
-    ESMField(const ESMRecord& r, const ESMFile& f);
+    // these constructors are thread-safe, compressed records are
+    // decompressed to a buffer that remains valid while the field exists
+    ESMField(const ESMFile& f, const ESMRecord& r);
+    ESMField(const ESMFile& f, unsigned int formID);
+    inline ESMField(const ESMRecord& r, const ESMFile& f)
+      : ESMField(f, r)
+    {
+    }
     bool next();
     inline bool operator==(const char *s) const
     {
       return FileBuffer::checkType(type, s);
     }
   };
+  // cache of the type and offset of all fields of recently used records
+  // of a single ESMFile, not thread-safe: each thread needs to use a
+  // separate instance
+  class FieldOffsetCache
+  {
+   protected:
+    struct FieldLocation
+    {
+      unsigned int  type;
+      // offset of the field header (or XXXX) relative to the record data,
+      // or the record size at the end of the fields of each record
+      unsigned int  offset;
+    };
+    // index + 1 in fieldLocations of the first field of each element of
+    // ESMFile::recordBuf, or 0 if the record is not cached yet
+    std::vector< std::uint32_t >  recordIndex;
+    std::vector< FieldLocation >  fieldLocations;
+    // once maxFields is reached, no more records are added to the cache
+    size_t  maxFields;
+    friend class ESMFile;
+   public:
+    FieldOffsetCache(size_t n = 0x00100000)
+      : maxFields(std::min< size_t >(n, 0x7FFFFFFF))
+    {
+    }
+    inline void clear()
+    {
+      std::vector< std::uint32_t >().swap(recordIndex);
+      std::vector< FieldLocation >().swap(fieldLocations);
+    }
+  };
+  // lightweight alternative to ESMField that does not copy any data,
+  // fields can be looked up by type using an optional FieldOffsetCache
+  class FieldIterator
+  {
+   protected:
+    std::shared_ptr< const std::vector< unsigned char > > zlibBuf;
+    const unsigned char *recordData;    // start of fields
+    const unsigned char *fieldData;
+    unsigned int  recordSize;
+    unsigned int  nextOffs;             // offset of next field header
+    unsigned int  fieldSize;
+    FieldOffsetCache  *cache;
+    size_t  cacheIndex;                 // first field in the cache
+    bool nextLarge();
+   public:
+    unsigned int  type;
+    FieldIterator(const ESMFile& f, const ESMRecord& r,
+                  FieldOffsetCache *cache = nullptr);
+    // returns false at the end of the record
+    inline bool next();
+    // find the next field of the specified type, returns false if there is
+    // none, the search starts from the current position
+    bool find(unsigned int fieldType);
+    inline bool find(const char *s)
+    {
+      return find(FileBuffer::readUInt32Fast(s));
+    }
+    inline bool operator==(const char *s) const
+    {
+      return FileBuffer::checkType(type, s);
+    }
+    inline const unsigned char *data() const
+    {
+      return fieldData;
+    }
+    inline size_t size() const
+    {
+      return fieldSize;
+    }
+    // typed accessors, offs is relative to the start of the field data
+    inline unsigned char getUInt8(size_t offs) const;
+    inline std::uint16_t getUInt16(size_t offs) const;
+    inline std::uint32_t getUInt32(size_t offs) const;
+    inline float getFloat(size_t offs) const;
+  };
   class CDBRecord : public FileBuffer
   {
    public:
@@ -64,6 +152,16 @@ class ESMFile
       return (stringTable + offs);
     }
   };
+  struct ReferenceBounds
+  {
+    unsigned int  formID;
+    float   x0;
+    float   y0;
+    float   z0;
+    float   x1;
+    float   y1;
+    float   z1;
+  };
   struct ESMVCInfo
   {
     unsigned int  year;
@@ -91,21 +189,176 @@ class ESMFile
   // > 0xFF: Starfield
   unsigned int  esmVersion;
   unsigned int  esmFlags;       // 0x80: localized strings
-  unsigned int  zlibBufRecord;
+  // minimum and maximum form ID, and offset to add to the form ID for
+  // each of the 256 plugins, and 128 more for the group numbers
   std::uint32_t *pluginMap;
+  // two level form ID map: formIDPageTable contains the offset in formIDMap
+  // of each page of 1024 form IDs, pages without records all share the
+  // first page of formIDMap, which is empty
+  std::uint32_t *formIDPageTable;
   std::uint32_t *formIDMap;
   ESMRecord     *recordBuf;
+  // offset of the data of each element of recordBuf, assuming that the ESM
+  // files are concatenated, or 0xFFFFFFFF if there is no data
+  std::uint32_t *recordDataOffs;
   size_t        recordBufSize;
-  std::vector< std::vector< unsigned char > > zlibBuf;
+  size_t        formIDPageCnt;  // number of elements in formIDPageTable
+  size_t        formIDMapSize;  // number of elements in formIDMap
+  static constexpr unsigned int formIDPageShift = 10;
+  static constexpr std::uint32_t formIDPageMask = 0x03FFU;
+  // index cache file that the form ID maps and records point into,
+  // or NULL if the record tree was built from the ESM files
+  FileBuffer    *indexCacheFile;
+  // cache of decompressed records, split into shards by form ID, each with
+  // a separate lock, LRU list and 1/recordCacheShards of the size limit
+  struct RecordCacheEntry
+  {
+    std::shared_ptr< const std::vector< unsigned char > > buf;
+    RecordCacheEntry  *prv;
+    RecordCacheEntry  *nxt;
+    unsigned int  formID;
+  };
+  struct RecordCacheShard
+  {
+    std::mutex  cacheMutex;
+    std::map< unsigned int, RecordCacheEntry >  records;
+    RecordCacheEntry  *firstRecord;     // least recently used
+    RecordCacheEntry  *lastRecord;
+    size_t  dataSize;
+    RecordCacheShard()
+      : firstRecord(nullptr),
+        lastRecord(nullptr),
+        dataSize(0)
+    {
+    }
+  };
+  static constexpr size_t recordCacheShards = 16;
+  mutable RecordCacheShard  recordCache[recordCacheShards];
+  // can be changed by setRecordCacheSize() while records are being read
+  std::atomic< size_t > recordCacheSize;
   std::vector< FileBuffer * > esmFiles;
+  // start offset of each ESM file in recordDataOffs
+  std::vector< std::uint32_t >  esmFileOffsets;
+  // minimum total size of the input files to be loaded in parallel
+  static constexpr size_t recordLoadMinSize = 0x00400000;
+  // for building the record tree in parallel, the input files are split
+  // into ranges of records and the headers of large groups, see esmfile.cpp
+  struct RecordLoadTask;
+  struct RecordLoadQueue;
+  inline size_t getFormIDPageNum(unsigned int formID) const
+  {
+    const std::uint32_t *p = pluginMap + (((formID >> 24) & 0xFFU) * 3U);
+    return size_t(((formID + p[2]) & 0xFFFFFFFFU) >> formIDPageShift);
+  }
+  inline std::uint32_t& getFormIDMapElement(unsigned int formID)
+  {
+    const std::uint32_t *p = pluginMap + (((formID >> 24) & 0xFFU) * 3U);
+    std::uint32_t n = (formID + p[2]) & 0xFFFFFFFFU;
+    return formIDMap[formIDPageTable[n >> formIDPageShift]
+                     + (n & formIDPageMask)];
+  }
   inline ESMRecord& insertFormID(unsigned int formID);
-  const unsigned char *uncompressRecord(ESMRecord& r);
+  const unsigned char *uncompressRecord(
+      std::shared_ptr< const std::vector< unsigned char > >& buf,
+      const ESMRecord& r) const;
+  void shrinkRecordCache(RecordCacheShard& p) const;
+  // calculate the page offsets in pluginMap and formIDPageCnt
+  void setFormIDMapOffsets();
+  // pagesUsed[n] is non-zero if page n of the form ID map contains any
+  // records, all pages of group numbers are assumed to be used
+  void allocateRecordBuf(size_t recordCnt,
+                         std::vector< unsigned char >& pagesUsed);
   unsigned int loadRecords(size_t& groupCnt, FileBuffer& buf, size_t endPos,
-                           unsigned int parent);
+                           unsigned int parent, std::uint32_t fileOffs);
+  void loadRecordsSerial(const std::vector< std::string >& fileNames);
+  void loadRecordsParallel(const std::vector< std::string >& fileNames,
+                           size_t threadCnt);
+  void splitRecordLoadTasks(RecordLoadQueue& q, size_t fileNum,
+                            size_t startPos, size_t endPos, size_t maxSize);
+  void countRecordLoadTask(RecordLoadQueue& q, RecordLoadTask& t);
+  void claimRecordLoadTask(RecordLoadTask& t);
+  void findDuplicateRecords(RecordLoadTask& t);
+  unsigned int loadRecordLoadTask(RecordLoadTask& t, FileBuffer& buf,
+                                  size_t endPos, unsigned int parent,
+                                  ESMRecord*& prv, unsigned int *firstRecord,
+                                  size_t& recordNum, size_t& groupNum,
+                                  size_t& dupNum);
+  static void loadRecordsThread(ESMFile *p, RecordLoadQueue *q, int phase);
+  // the record tree can be saved to and loaded from a cache file in the
+  // directory set by the FO76UTILS_ESMCACHE environment variable, the file
+  // is valid while the size, modification time and TES4 header of the ESM
+  // files do not change
+  bool loadIndexCache(const char *cacheFileName, const std::string& keyName);
+  void writeIndexCache(const char *cacheFileName,
+                       const std::string& keyName) const;
+  // secondary indexes, these are empty until buildIndexes() is called
+  struct EDIDIndexEntry
+  {
+    unsigned int  formID;
+    unsigned int  nameOffs;     // offset of the editor ID in edidNameBuf
+    unsigned int  nameLen;
+    unsigned int  hashValue;
+  };
+  bool          typeIndexesBuilt;       // record type and cell indexes
+  bool          edidIndexBuilt;
+  std::vector< char > edidNameBuf;
+  std::vector< EDIDIndexEntry > edidIndex;      // sorted by form ID
+  // open addressing hash table of edidIndex positions + 1, 0 = empty
+  std::vector< std::uint32_t >  edidHashTable;
+  // form IDs of records sorted by type, and the range for each type
+  std::vector< unsigned int > typeIndexBuf;
+  std::map< unsigned int, std::pair< size_t, size_t > > typeIndexMap;
+  // form IDs of REFR and ACHR records sorted by parent cell
+  std::vector< unsigned int > cellRefIndexBuf;
+  std::map< unsigned int, std::pair< size_t, size_t > > cellRefIndexMap;
+  // (world << 32) | ((y & 0xFFFF) << 16) | (x & 0xFFFF) -> exterior cell
+  std::map< unsigned long long, unsigned int >  exteriorCellMap;
+  struct IndexBuildTask;
+  struct IndexBuildQueue;
+  void buildIndexTask(IndexBuildTask& t) const;
+  // merge the results of the tasks in q into the indexes
+  void buildEDIDHashTable(IndexBuildQueue& q);
+  void buildTypeIndexTables(IndexBuildQueue& q);
+  static void buildIndexesThread(const ESMFile *p, IndexBuildQueue *q);
+  static unsigned int hashEDID(const char *s, size_t len);
+  // spatial index of the references in a world, on a grid of exterior cells
+  struct ReferenceGrid
+  {
+    std::vector< ReferenceBounds >  refs;
+    // indices into refs for each grid cell, and references that are too
+    // large to be stored in the grid
+    std::vector< std::uint32_t >  cellRefs;
+    std::vector< std::uint32_t >  largeRefs;
+    // ((y & 0xFFFF) << 16) | (x & 0xFFFF) -> range of cellRefs
+    std::map< unsigned int, std::pair< size_t, size_t > > cells;
+    int     xMin;
+    int     yMin;
+    int     xMax;
+    int     yMax;
+    ReferenceBounds bounds;     // bounds of all references
+  };
+  // grid cell size, and the maximum size of references stored in the grid
+  static constexpr float referenceGridCellSize = 4096.0f;
+  static constexpr int referenceGridMaxCells = 16;
+  // returns the grid cell of a coordinate, clamped to the 16-bit range
+  static inline int getReferenceGridCoord(float x);
+  std::map< unsigned int, ReferenceGrid > referenceGrids;
+  struct ReferenceGridTask;
+  struct ReferenceGridQueue;
+  void getReferenceBounds(ReferenceBounds& b, const ESMRecord& r,
+                          std::map< unsigned int, float >& baseRadius) const;
+  static void buildReferenceGridThread(const ESMFile *p,
+                                       ReferenceGridQueue *q);
  public:
   // fileNames can be a single ESM file, or a comma separated list
-  ESMFile(const char *fileNames, bool enableZLibCache = false);
+  // threadCnt is the number of threads to be used for building the record
+  // tree, 1 = serial loading, 0 = use the number of hardware threads
+  ESMFile(const char *fileNames, int threadCnt = 0);
   virtual ~ESMFile();
+  // set the maximum total size of decompressed records to be cached
+  // (default: 64 MiB), 0 disables caching
+  // this is safe to call while other threads are reading records
+  void setRecordCacheSize(size_t n);
   const ESMRecord& getRecord(unsigned int formID) const;
   // returns NULL if the record does not exist
   inline const ESMRecord *findRecord(unsigned int formID) const
@@ -113,7 +366,9 @@ class ESMFile
     const std::uint32_t *p = pluginMap + (((formID >> 24) & 0xFFU) * 3U);
     if (formID < p[0] || formID > p[1]) [[unlikely]]
       return nullptr;
-    std::uint32_t n = formIDMap[(formID + p[2]) & 0xFFFFFFFFU];
+    std::uint32_t n = (formID + p[2]) & 0xFFFFFFFFU;
+    n = formIDMap[formIDPageTable[n >> formIDPageShift]
+                  + (n & formIDPageMask)];
     if (n & 0x80000000U) [[unlikely]]
       return nullptr;
     return recordBuf + n;
@@ -130,6 +385,23 @@ class ESMFile
   {
     return findRecord(formID);
   }
+  // returns a pointer to the record header in the file buffer
+  inline const unsigned char *getRecordData(const ESMRecord& r) const
+  {
+    std::uint32_t offs = recordDataOffs[&r - recordBuf];
+    if (offs == 0xFFFFFFFFU) [[unlikely]]
+      return nullptr;
+    size_t  i = esmFileOffsets.size() - 1;
+    while (offs < esmFileOffsets[i])
+      i--;
+    return esmFiles[i]->data() + (offs - esmFileOffsets[i]);
+  }
+  // returns the offset of the record, assuming that the ESM files are
+  // concatenated
+  inline size_t getRecordFileOffset(const ESMRecord& r) const
+  {
+    return recordDataOffs[&r - recordBuf];
+  }
   // encoding is (year - 2000) * 512 + (month * 32) + day for FO4 and newer
   unsigned short getRecordTimestamp(unsigned int formID) const;
   unsigned short getRecordUserID(unsigned int formID) const;
@@ -137,7 +409,7 @@ class ESMFile
   {
     if (!esmVersion)
       return 0;
-    return FileBuffer::readUInt16Fast(r.fileData + 20);
+    return FileBuffer::readUInt16Fast(getRecordData(r) + 20);
   }
   inline unsigned int getESMVersion() const
   {
@@ -156,7 +428,100 @@ class ESMFile
     return bool(esmFlags & 0x80);
   }
   void getVersionControlInfo(ESMVCInfo& f, const ESMRecord& r) const;
+  // build the editor ID, record type and cell reference indexes using
+  // threadCnt threads (0 = the number of hardware threads), this does
+  // nothing if the indexes have already been built
+  // if buildEDIDIndex is false, the editor ID index is not built, which
+  // avoids decompressing and parsing most of the records
+  void buildIndexes(int threadCnt = 0, bool buildEDIDIndex = true);
+  // returns the form ID of the record with the specified editor ID (case
+  // insensitive, the lowest form ID if there are multiple matches),
+  // or 0 if there is no such record
+  unsigned int findEDID(std::string_view s) const;
+  // returns the editor ID of a record, or an empty string
+  std::string_view getEDID(unsigned int formID) const;
+  // returns the sorted form IDs of all records of the specified type
+  std::span< const unsigned int > getRecordsByType(unsigned int type) const;
+  inline std::span< const unsigned int > getRecordsByType(
+      const char *type) const
+  {
+    return getRecordsByType(FileBuffer::readUInt32Fast(type));
+  }
+  // returns the sorted form IDs of all REFR and ACHR records in the
+  // persistent and temporary children of a cell
+  std::span< const unsigned int > getCellReferences(
+      unsigned int cellFormID) const;
+  // returns the form ID of the exterior cell at grid position x, y
+  // in a worldspace, or 0 if the cell does not exist
+  unsigned int findExteriorCell(unsigned int worldFormID, int x, int y) const;
+  // build a spatial index of the REFR and ACHR records in the exterior and
+  // persistent cells of a world, using the position and scale of each
+  // reference and the bounds (OBND) of the base object, this also builds
+  // the indexes above if needed, and does nothing if the world is already
+  // indexed
+  void buildReferenceGrid(unsigned int worldFormID, int threadCnt = 0);
+  // returns the bounds of all references in the spatial index of a world,
+  // or NULL if the index has not been built or the world has no references
+  const ReferenceBounds *getReferenceGridBounds(
+      unsigned int worldFormID) const;
+  // append to refs the form IDs of the references in a world with bounds
+  // that intersect the rectangle x0, y0 to x1, y1, in no particular order
+  void findReferences(std::vector< unsigned int >& refs,
+                      unsigned int worldFormID,
+                      float x0, float y0, float x1, float y1) const;
 };
 
+inline bool ESMFile::FieldIterator::next()
+{
+  if ((nextOffs + 6U) > recordSize) [[unlikely]]
+  {
+    if (nextOffs < recordSize)
+      errorMessage("end of record data");
+    type = 0U;
+    fieldData = recordData + recordSize;
+    fieldSize = 0U;
+    return false;
+  }
+  const unsigned char *p = recordData + nextOffs;
+  type = FileBuffer::readUInt32Fast(p);
+  if (type == 0x58585858U) [[unlikely]]         // "XXXX"
+    return nextLarge();
+  fieldSize = FileBuffer::readUInt16Fast(p + 4);
+  nextOffs = nextOffs + 6U;
+  if (fieldSize > (recordSize - nextOffs)) [[unlikely]]
+    errorMessage("end of record data");
+  fieldData = p + 6;
+  nextOffs = nextOffs + fieldSize;
+  return true;
+}
+
+inline unsigned char ESMFile::FieldIterator::getUInt8(size_t offs) const
+{
+  if (offs >= fieldSize) [[unlikely]]
+    errorMessage("end of field data");
+  return fieldData[offs];
+}
+
+inline std::uint16_t ESMFile::FieldIterator::getUInt16(size_t offs) const
+{
+  if ((offs + 2) > fieldSize) [[unlikely]]
+    errorMessage("end of field data");
+  return FileBuffer::readUInt16Fast(fieldData + offs);
+}
+
+inline std::uint32_t ESMFile::FieldIterator::getUInt32(size_t offs) const
+{
+  if ((offs + 4) > fieldSize) [[unlikely]]
+    errorMessage("end of field data");
+  return FileBuffer::readUInt32Fast(fieldData + offs);
+}
+
+inline float ESMFile::FieldIterator::getFloat(size_t offs) const
+{
+  if ((offs + 4) > fieldSize) [[unlikely]]
+    errorMessage("end of field data");
+  return FileBuffer::readFloat(fieldData + offs);
+}
+
 #endif
 
@@ -77,7 +77,14 @@ float FileBuffer::readFloat()
 {
   if ((filePos + 4) > fileBufSize)
     errorMessage("end of input file");
-  std::uint32_t tmp = readUInt32Fast();
+  float   tmp = readFloat(fileBuf + filePos);
+  filePos = filePos + 4;
+  return tmp;
+}
+
+float FileBuffer::readFloat(const void *p)
+{
+  std::uint32_t tmp = readUInt32Fast(p);
 #if defined(__i386__) || defined(__x86_64__) || defined(__x86_64)
   if (!((tmp + 0x00800000U) & 0x7F000000U))
     return 0.0f;
@@ -362,6 +369,44 @@ bool FileBuffer::getDefaultDataPath(std::string& dataPath)
   return (dataPath.length() > 0);
 }
 
+bool FileBuffer::getFullPathName(std::string& fullPath, const char *pathName)
+{
+#if defined(_WIN32) || defined(_WIN64)
+  char    *s = _fullpath(nullptr, pathName, 0);
+#else
+  char    *s = realpath(pathName, nullptr);
+#endif
+  if (!s)
+    return false;
+  fullPath = s;
+  std::free(s);
+  return true;
+}
+
+bool FileBuffer::getFileModTime(std::int64_t& modTime) const
+{
+  if (std::intptr_t(fileStream) < 0L)
+    return false;
+#if defined(_WIN32) || defined(_WIN64)
+  FILETIME  t;
+  if (!GetFileTime(HANDLE(fileStream), nullptr, nullptr, &t))
+    return false;
+  modTime = std::int64_t((std::uint64_t(t.dwHighDateTime) << 32)
+                         | std::uint64_t(t.dwLowDateTime));
+#else
+  struct stat st;
+  if (fstat(int(fileStream), &st) != 0)
+    return false;
+#  if defined(__linux__)
+  modTime = std::int64_t(st.st_mtim.tv_sec) * 1000000000LL
+            + std::int64_t(st.st_mtim.tv_nsec);
+#  else
+  modTime = std::int64_t(st.st_mtime);
+#  endif
+#endif
+  return true;
+}
+
 std::uintptr_t FileBuffer::openFileInDataPath(const char *fileName)
 {
   if (!fileName)
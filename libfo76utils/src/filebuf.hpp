@@ -50,6 +50,8 @@ class FileBuffer
   static inline std::uint16_t readUInt16Fast(const void *p);
   static inline std::uint32_t readUInt32Fast(const void *p);
   static inline std::uint64_t readUInt64Fast(const void *p);
+  // returns 0.0 if the value is denormal, infinite or NaN
+  static float readFloat(const void *p);
   static inline void writeUInt16Fast(void *p, std::uint16_t n);
   static inline void writeUInt32Fast(void *p, std::uint32_t n);
   static inline void writeUInt64Fast(void *p, std::uint64_t n);
@@ -104,6 +106,11 @@ class FileBuffer
   }
   virtual ~FileBuffer();
   static bool getDefaultDataPath(std::string& dataPath);
+  // get the absolute path of a file or directory, returns false on error
+  static bool getFullPathName(std::string& fullPath, const char *pathName);
+  // get the modification time of the file that is mapped to the buffer,
+  // returns false if the buffer was not loaded from a file
+  bool getFileModTime(std::int64_t& modTime) const;
  protected:
   // on Windows: returns HANDLE from CreateFile()
   // on other systems: returns int from open()
@@ -517,13 +517,13 @@ bool MapImage::getREFRRecord(REFRRecord& r, unsigned int formID)
     if (p && *p == "DOOR")
     {
       r.isDoor = true;
-      ESMFile::ESMField f2(*p, esmFile);
-      while (f2.next())
+      ESMFile::FieldIterator  f2(esmFile, *p, &fieldOffsetCache);
+      while (f2.find("FNAM"))
       {
-        if (f2 == "FNAM" && f2.size() >= 1)
+        if (f2.size() >= 1)
         {
           // ignore doors with the minimal use flag
-          r.isDoor = !(f2.front() & 0x08);
+          r.isDoor = !(f2.getUInt8(0) & 0x08);
           break;
         }
       }
@@ -616,101 +616,107 @@ void MapImage::drawIcon(size_t n, float x, float y, float z)
   }
 }
 
+void MapImage::findMarkers(std::set< REFRRecord >& objectsFound,
+                           const ESMFile::ESMRecord& r)
+{
+  bool    matchFlag = (formIDs.find(r.formID) != formIDs.end());
+  ESMFile::ESMField f(r, esmFile);
+  while (f.next())
+  {
+    if (f == "NAME" && f.size() >= 4)
+    {
+      unsigned int  n = f.readUInt32Fast();
+      if (formIDs.find(n) != formIDs.end())
+        matchFlag = true;
+    }
+    else if (f == "XTEL") [[unlikely]]
+    {
+      if (f.size() >= 4)
+      {
+        REFRRecord  refr;
+        if (getREFRRecord(refr, r.formID))
+          setInteriorCellOffset(refr);
+      }
+    }
+  }
+  if (matchFlag)
+  {
+    REFRRecord  refr;
+    if (getREFRRecord(refr, r.formID))
+      objectsFound.insert(refr);
+  }
+}
+
 void MapImage::findMarkers(unsigned int worldID)
 {
   worldFormID = worldID;
   isInteriorMap = false;
   std::set< REFRRecord >  objectsFound;
   const ESMFile::ESMRecord  *r = esmFile.findRecord(worldID);
-  if (worldID)
+  if (worldID && r && *r == "CELL")
   {
-    if (r && *r == "CELL")
+    ESMFile::ESMField f(esmFile, *r);
+    while (f.next())
     {
-      ESMFile::ESMField f(esmFile, *r);
-      while (f.next())
-      {
-        if (f == "DATA" && f.size() >= 1)
-          isInteriorMap = bool(f.readUInt8Fast() & 0x01);
-      }
+      if (f == "DATA" && f.size() >= 1)
+        isInteriorMap = bool(f.readUInt8Fast() & 0x01);
     }
-    if (isInteriorMap)
-    {
-      if (!(r && r->next))
-        r = nullptr;
-      else
-        r = esmFile.findRecord(r->next);
-      if (!(r && *r == "GRUP" && r->formID >= 6U && r->children))
-        r = nullptr;
-      else
-        r = esmFile.findRecord(r->children);
-    }
-    else
+  }
+  // only the record type and cell reference indexes are used
+  esmFile.buildIndexes(0, false);
+  if (isInteriorMap)
+  {
+    for (unsigned int formID : esmFile.getCellReferences(worldID))
     {
-      r = esmFile.findRecord(0U);
+      if ((r = esmFile.findRecord(formID)) != nullptr)
+        findMarkers(objectsFound, *r);
     }
   }
-  while (r)
+  else
   {
-    bool    searchChildRecords = bool(r->children);
-    if (*r == "REFR" || *r == "ACHR") [[likely]]
+    for (unsigned int formID : esmFile.getRecordsByType("LCTN"))
     {
-      bool    matchFlag = (formIDs.find(r->formID) != formIDs.end());
-      ESMFile::ESMField f(*r, esmFile);
-      while (f.next())
+      if ((r = esmFile.findRecord(formID)) != nullptr)
+        findDisabledMarkers(*r);
+    }
+    // search all REFR and ACHR records except those in topic children,
+    // visible distant children, and the children of other worlds that
+    // are not child worlds of worldID
+    std::map< const ESMFile::ESMRecord *, bool >  groupsSearched;
+    for (int i = 0; i < 2; i++)
+    {
+      for (unsigned int formID :
+           esmFile.getRecordsByType(i == 0 ? "REFR" : "ACHR"))
       {
-        if (f == "NAME" && f.size() >= 4)
-        {
-          unsigned int  n = f.readUInt32Fast();
-          if (formIDs.find(n) != formIDs.end())
-            matchFlag = true;
-        }
-        else if (f == "XTEL") [[unlikely]]
+        r = esmFile.findRecord(formID);
+        if (!r)
+          continue;
+        bool    searchRecord = true;
+        const ESMFile::ESMRecord  *p = r;
+        while (searchRecord && p->parent &&
+               (p = esmFile.findRecord(p->parent)) != nullptr)
         {
-          if (f.size() >= 4)
+          if (!(*p == "GRUP"))
+            continue;
+          if (p->formID == 7 || p->formID >= 10)
+          {
+            searchRecord = false;
+          }
+          else if (worldID != 0U && p->formID == 1 && p->flags != worldID)
           {
-            REFRRecord  refr;
-            if (getREFRRecord(refr, r->formID))
-              setInteriorCellOffset(refr);
+            std::map< const ESMFile::ESMRecord *, bool >::iterator  j =
+                groupsSearched.find(p);
+            if (j == groupsSearched.end())
+            {
+              j = groupsSearched.emplace(p, checkParentWorld(*p)).first;
+            }
+            searchRecord = j->second;
           }
         }
-      }
-      if (matchFlag)
-      {
-        REFRRecord  refr;
-        if (getREFRRecord(refr, r->formID))
-          objectsFound.insert(refr);
+        if (searchRecord)
+          findMarkers(objectsFound, *r);
       }
     }
-    else if (*r == "GRUP")
-    {
-      if (r->formID == 7 || r->formID >= 10 ||
-          (worldID != 0U && r->formID == 1 && r->flags != worldID))
-      {
-        searchChildRecords = (r->formID == 1 && checkParentWorld(*r));
-      }
-    }
-    else if (*r == "LCTN")
-    {
-      findDisabledMarkers(*r);
-    }
-    else if (*r == "CELL" && isInteriorMap)
-    {
-      break;
-    }
-    unsigned int  nextFormID = 0U;
-    if (searchChildRecords)
-    {
-      nextFormID = r->children;
-    }
-    else
-    {
-      while (!r->next && r->parent)
-        r = &(esmFile.getRecord(r->parent));
-      nextFormID = r->next;
-    }
-    if (!nextFormID)
-      break;
-    r = esmFile.findRecord(nextFormID);
   }
   for (unsigned char p = 0; p <= 15; p++)
   {
@@ -56,6 +56,8 @@ class MapImage
     }
   };
   ESMFile&  esmFile;
+  // for looking up the flags of the base objects of doors
+  ESMFile::FieldOffsetCache fieldOffsetCache;
   std::vector< MarkerDef >  markerDefs;
   std::uint32_t *buf;
   size_t  imageWidth;
@@ -85,6 +87,9 @@ class MapImage
   void setWorldCellOffsets(unsigned int formID, float x, float y, float z);
   void setInteriorCellOffset(const REFRRecord& refr);
   void findDisabledMarkers(const ESMFile::ESMRecord& r);
+  // check if REFR or ACHR record r is a marker or a door to an interior cell
+  void findMarkers(std::set< REFRRecord >& objectsFound,
+                   const ESMFile::ESMRecord& r);
  public:
   MapImage(ESMFile& esmFiles, const char *listFileName,
            std::uint32_t *outBufRGBA, int w, int h,
@@ -93,6 +98,7 @@ class MapImage
   const ESMFile::ESMRecord *getParentCell(unsigned int formID) const;
   bool getREFRRecord(REFRRecord& r, unsigned int formID);
   void drawIcon(size_t n, float x, float y, float z);
+  // builds the indexes of esmFile if they have not been built yet
   void findMarkers(unsigned int worldID = 0U);
 };
 
@@ -3,6 +3,11 @@
 #include "ba2file.hpp"
 #include "stringdb.hpp"
 
+static const char *stringsSuffixTable[3] =
+{
+  ".strings", ".dlstrings", ".ilstrings"
+};
+
 bool StringDB::archiveFilterFunction(void *p, const std::string_view& s)
 {
   std::vector< std::string >& fileNames =
@@ -15,24 +20,112 @@ bool StringDB::archiveFilterFunction(void *p, const std::string_view& s)
   return false;
 }
 
+void StringDB::loadStringsFile(StringsFile& f, int fileType) const
+{
+  std::lock_guard< std::mutex > tmpLock(loadMutex);
+  if (f.isLoaded.load(std::memory_order_acquire))
+    return;
+  if (!f.fileName.empty() && ba2File)
+  {
+    std::vector< std::uint64_t >  stringIDs;
+    try
+    {
+      f.fileSize = ba2File->extractFile(f.fileData, f.buf, f.fileName);
+      FileBuffer  buf(f.fileData, f.fileSize, 0);
+      size_t  stringCnt = buf.readUInt32();
+      size_t  dataSize = buf.readUInt32();
+      if (f.fileSize < dataSize || ((f.fileSize - dataSize) >> 3) <= stringCnt)
+        errorMessage("invalid strings file");
+      size_t  dataOffs = (stringCnt << 3) + 8;
+      stringIDs.resize(stringCnt);
+      for (size_t i = 0; i < stringCnt; i++)
+      {
+        std::uint64_t id = buf.readUInt32Fast();
+        size_t  offs = dataOffs + buf.readUInt32Fast();
+        if (offs >= f.fileSize || (fileType != 0 && (offs + 4) > f.fileSize))
+          errorMessage("invalid offset in strings file");
+        stringIDs[i] = (id << 32) | std::uint64_t(i);
+      }
+    }
+    catch (FO76UtilsError& e)
+    {
+      f.fileData = nullptr;
+      f.fileSize = 0;
+      f.buf.clear();
+      // the .strings file is loaded by loadFile(), which reports the error
+      if (fileType == 0)
+        throw;
+      // errors in files loaded on demand are reported only once, and the
+      // file is then ignored
+      std::fprintf(stderr, "warning: %.*s: %s\n",
+                   int(f.fileName.length()), f.fileName.data(), e.what());
+      f.isLoaded.store(true, std::memory_order_release);
+      return;
+    }
+    std::sort(stringIDs.begin(), stringIDs.end());
+    for (size_t i = 1; i < stringIDs.size(); i++)
+    {
+      // the last definition of the string is used
+      if ((stringIDs[i] >> 32) == (stringIDs[i - 1] >> 32))
+      {
+        std::fprintf(stderr, "warning: string 0x%08X redefined\n",
+                     (unsigned int) (stringIDs[i] >> 32));
+      }
+    }
+    f.stringIDs.swap(stringIDs);
+  }
+  f.isLoaded.store(true, std::memory_order_release);
+}
+
+void StringDB::convertString(std::string& s, std::string_view t)
+{
+  for (char c : t)
+  {
+    if ((unsigned char) c >= 0x20)
+      s += c;
+    else if (c == 0x0A)
+      s += "<br>";
+    else if (c != 0x0D)
+      s += ' ';
+  }
+}
+
 StringDB::StringDB()
-  : FileBuffer((unsigned char *) 0, 0)
+  : ba2File(nullptr),
+    archiveFile(nullptr)
 {
 }
 
 StringDB::~StringDB()
 {
+  delete archiveFile;
 }
 
 void StringDB::clear()
 {
-  strings.clear();
+  for (int k = 0; k < 3; k++)
+  {
+    StringsFile&  f = stringsFiles[k];
+    f.fileName = std::string_view();
+    f.fileData = nullptr;
+    f.fileSize = 0;
+    f.buf.clear();
+    std::vector< std::uint64_t >().swap(f.stringIDs);
+    f.isLoaded.store(false, std::memory_order_relaxed);
+  }
+  ba2File = nullptr;
+  if (archiveFile)
+  {
+    delete archiveFile;
+    archiveFile = nullptr;
+  }
 }
 
 bool StringDB::loadFile(const BA2File& ba2File, const char *stringsPrefix)
 {
-  strings.clear();
-  std::vector< std::string >  fileNames;
+  if (&ba2File != archiveFile)
+    clear();
+  this->ba2File = &ba2File;
   std::string tmpName;
   if (!stringsPrefix)
 #ifdef BUILD_CE2UTILS
@@ -40,87 +133,37 @@ bool StringDB::loadFile(const BA2File& ba2File, const char *stringsPrefix)
 #else
     stringsPrefix = "strings/seventysix_en";
 #endif
+  std::vector< std::string >  fileNames;
   for (int k = 0; k < 3; k++)
   {
-    static const char *stringsSuffixTable[3] =
-    {
-      ".strings", ".dlstrings", ".ilstrings"
-    };
     tmpName = stringsPrefix;
     tmpName += stringsSuffixTable[k];
     fileNames.push_back(tmpName);
   }
-  BA2File::UCharArray buf;
+  // a single unsorted pass over the file list is enough to find the names
   std::vector< std::string_view > namesFound;
-  ba2File.getFileList(namesFound, true);
+  ba2File.getFileList(namesFound, true, &archiveFilterFunction, &fileNames);
   for (int k = 0; k < 3; k++)
   {
-    std::string_view  fileName;
     for (size_t i = 0; i < namesFound.size(); i++)
     {
       if (namesFound[i].find(fileNames[k]) != std::string_view::npos)
       {
-        fileName = namesFound[i];
+        stringsFiles[k].fileName = namesFound[i];
         break;
       }
     }
-    if (fileName.empty())
-      continue;
-    ba2File.extractFile(buf, fileName);
-    fileBuf = buf.data;
-    fileBufSize = buf.size;
-    filePos = 0;
-    size_t  stringCnt = readUInt32();
-    size_t  dataSize = readUInt32();
-    if (fileBufSize < dataSize || ((fileBufSize - dataSize) >> 3) <= stringCnt)
-      errorMessage("invalid strings file");
-    size_t  dataOffs = (stringCnt << 3) + 8;
-    std::string s;
-    for (size_t i = 0; i < stringCnt; i++)
-    {
-      unsigned int  id = readUInt32();
-      size_t  offs = dataOffs + readUInt32();
-      if (offs >= fileBufSize)
-        errorMessage("invalid offset in strings file");
-      size_t  savedPos = filePos;
-      filePos = offs;
-      s.clear();
-      size_t  len = fileBufSize - filePos;
-      if (k != 0)
-        len = readUInt32();
-      for ( ; len > 0; len--)
-      {
-        unsigned char c = readUInt8();
-        if (!c)
-          break;
-        if (c >= 0x20)
-          s += char(c);
-        else if (c == 0x0A)
-          s += "<br>";
-        else if (c != 0x0D)
-          s += ' ';
-      }
-      filePos = savedPos;
-      if (strings.find(id) == strings.end())
-      {
-        strings.insert(std::pair< unsigned int, std::string >(id, s));
-      }
-      else
-      {
-        std::fprintf(stderr, "warning: string 0x%08X redefined\n", id);
-        strings[id] = s;
-      }
-    }
-    fileBuf = (unsigned char *) 0;
-    fileBufSize = 0;
-    filePos = 0;
   }
-  return (!strings.empty());
+  // the .strings file is always needed, and is loaded immediately
+  loadStringsFile(stringsFiles[0], 0);
+  return (!stringsFiles[0].stringIDs.empty() ||
+          !stringsFiles[1].fileName.empty() ||
+          !stringsFiles[2].fileName.empty());
 }
 
 bool StringDB::loadFile(const char *archivePath, const char *stringsPrefix)
 {
-  strings.clear();
+  clear();
   std::vector< std::string >  fileNames;
   std::string tmpName;
   if (!stringsPrefix)
@@ -131,38 +174,73 @@ bool StringDB::loadFile(const char *archivePath, const char *stringsPrefix)
 #endif
   for (int k = 0; k < 3; k++)
   {
-    static const char *stringsSuffixTable[3] =
-    {
-      ".strings", ".dlstrings", ".ilstrings"
-    };
     tmpName = stringsPrefix;
     tmpName += stringsSuffixTable[k];
     fileNames.push_back(tmpName);
   }
-  BA2File ba2File(archivePath, &archiveFilterFunction, &fileNames);
-  return loadFile(ba2File, stringsPrefix);
+  archiveFile = new BA2File(archivePath, &archiveFilterFunction, &fileNames);
+  return loadFile(*archiveFile, stringsPrefix);
+}
+
+bool StringDB::findString(std::string_view& s, unsigned int id) const
+{
+  s = std::string_view();
+  for (int k = 0; k < 3; k++)
+  {
+    StringsFile&  f = stringsFiles[k];
+    if (!f.isLoaded.load(std::memory_order_acquire)) [[unlikely]]
+      loadStringsFile(f, k);
+    // find the last element with this ID
+    std::vector< std::uint64_t >::const_iterator  i =
+        std::upper_bound(f.stringIDs.begin(), f.stringIDs.end(),
+                         (std::uint64_t(id) << 32) | 0xFFFFFFFFU);
+    if (i == f.stringIDs.begin() || (*(i - 1) >> 32) != id)
+      continue;
+    size_t  n = size_t(*(i - 1) & 0xFFFFFFFFU);
+    size_t  offs = (f.stringIDs.size() << 3) + 8
+                   + FileBuffer::readUInt32Fast(f.fileData + (n * 8 + 12));
+    size_t  len = f.fileSize - offs;
+    if (k != 0)
+    {
+      len = std::min< size_t >(FileBuffer::readUInt32Fast(f.fileData + offs),
+                               len - 4);
+      offs = offs + 4;
+    }
+    const char  *p = reinterpret_cast< const char * >(f.fileData + offs);
+    s = std::string_view(p, len);
+    s = s.substr(0, s.find('\0'));
+    return true;
+  }
+  return false;
 }
 
 bool StringDB::findString(std::string& s, unsigned int id) const
 {
   s.clear();
-  std::map< unsigned int, std::string >::const_iterator i = strings.find(id);
-  if (i == strings.end())
+  std::string_view  t;
+  if (!findString(t, id))
     return false;
-  s = i->second;
+  convertString(s, t);
   return true;
 }
 
-std::string StringDB::operator[](size_t id) const
+void StringDB::appendString(std::string& s, unsigned int id) const
 {
-  std::map< unsigned int, std::string >::const_iterator i =
-    strings.find((unsigned int) id);
-  if (i == strings.end())
+  std::string_view  t;
+  if (!findString(t, id))
   {
     char    tmp[16];
-    (void) std::snprintf(tmp, 16, "[0x%08x]", (unsigned int) id);
-    return std::string(tmp);
+    (void) std::snprintf(tmp, 16, "[0x%08x]", id);
+    s += tmp;
+    return;
   }
-  return std::string(i->second);
+  convertString(s, t);
+}
+
+std::string StringDB::operator[](size_t id) const
+{
+  std::string s;
+  appendString(s, (unsigned int) id);
+  return s;
 }
 
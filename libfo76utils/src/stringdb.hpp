@@ -6,18 +6,60 @@
 #include "filebuf.hpp"
 #include "ba2file.hpp"
 
-class StringDB : public FileBuffer
+#include <atomic>
+#include <mutex>
+
+// The .strings file is loaded by loadFile(), .dlstrings and .ilstrings are
+// only loaded when a string is not found in the files already loaded.
+// If one of the latter two files is invalid, a warning is printed, and the
+// file is ignored.
+// Strings are not copied, the raw string tables are used directly from the
+// archive (if uncompressed) or from the extracted file data.
+
+class StringDB
 {
  protected:
-  std::map< unsigned int, std::string > strings;
+  struct StringsFile
+  {
+    std::string_view  fileName;         // empty if the file does not exist
+    const unsigned char *fileData;
+    size_t  fileSize;
+    // file data if it is compressed or a loose file
+    BA2File::UCharArray buf;
+    // (string ID << 32) | index in the directory, sorted
+    std::vector< std::uint64_t >  stringIDs;
+    std::atomic< bool > isLoaded;
+    StringsFile()
+      : fileData(nullptr),
+        fileSize(0),
+        isLoaded(false)
+    {
+    }
+  };
+  // the archive containing the strings files, archiveFile is owned by
+  // StringDB if the strings were loaded with an archive path
+  const BA2File *ba2File;
+  BA2File *archiveFile;
+  mutable StringsFile stringsFiles[3];
+  mutable std::mutex  loadMutex;
   static bool archiveFilterFunction(void *p, const std::string_view& s);
+  void loadStringsFile(StringsFile& f, int fileType) const;
+  static void convertString(std::string& s, std::string_view t);
  public:
   StringDB();
   virtual ~StringDB();
   void clear();
+  // ba2File must remain valid until clear() or the destructor is called
   bool loadFile(const BA2File& ba2File, const char *stringsPrefix);
   bool loadFile(const char *archivePath, const char *stringsPrefix);
+  // returns the raw string data without any conversion, it remains valid
+  // until the strings are cleared, this function is thread-safe
+  bool findString(std::string_view& s, unsigned int id) const;
+  // find string with line breaks converted to <br>, and other control
+  // characters to spaces
   bool findString(std::string& s, unsigned int id) const;
+  // append converted string to s, or [0xNNNNNNNN] if id is not found
+  void appendString(std::string& s, unsigned int id) const;
   std::string operator[](size_t id) const;
 };
 
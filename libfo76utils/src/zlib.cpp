@@ -1,8 +1,28 @@
 
 #include "common.hpp"
+#include "filebuf.hpp"
 #include "zlib.hpp"
 #include "fp32vec4.hpp"
 
+// base length | (extra bits << 12) for length codes 257 to 285
+static const std::uint16_t  zlibLengthCodeTable[29] =
+{
+  0x0003, 0x0004, 0x0005, 0x0006, 0x0007, 0x0008, 0x0009, 0x000A,
+  0x100B, 0x100D, 0x100F, 0x1011, 0x2013, 0x2017, 0x201B, 0x201F,
+  0x3023, 0x302B, 0x3033, 0x303B, 0x4043, 0x4053, 0x4063, 0x4073,
+  0x5083, 0x50A3, 0x50C3, 0x50E3, 0x0102
+};
+
+// extra bits | (base distance << 8) for distance codes 0 to 29
+static const std::uint32_t  zlibDistanceCodeTable[30] =
+{
+  0x00000100, 0x00000200, 0x00000300, 0x00000400, 0x00000501, 0x00000701,
+  0x00000902, 0x00000D02, 0x00001103, 0x00001903, 0x00002104, 0x00003104,
+  0x00004105, 0x00006105, 0x00008106, 0x0000C106, 0x00010107, 0x00018107,
+  0x00020108, 0x00030108, 0x00040109, 0x00060109, 0x0008010A, 0x000C010A,
+  0x0010010B, 0x0018010B, 0x0020010C, 0x0030010C, 0x0040010D, 0x0060010D
+};
+
 std::uint32_t ZLibDecompressor::readU32LE()
 {
   std::uint32_t w = readU16LE();
@@ -111,82 +131,30 @@ size_t ZLibDecompressor::decompressLZ4(unsigned char *buf,
   (void) readU8();                      // header checksum
 
   unsigned char *wp = buf;
-  size_t  bytesLeft = uncompressedSize;
+  unsigned char *bufEnd = buf + uncompressedSize;
   while (true)
   {
     size_t  blockSize = readU32LE();
     if (!blockSize)                     // EndMark
       break;
-    if (blockSize & 0x80000000U)        // uncompressed block
+    bool    isCompressed = !(blockSize & 0x80000000U);
+    blockSize = blockSize & 0x7FFFFFFF;
+    if (blockSize > size_t(inBufEnd - inPtr))
+      errorMessage("invalid or corrupt LZ4 compressed data");
+    if (!isCompressed)                  // uncompressed block
     {
-      blockSize = blockSize & 0x7FFFFFFF;
-      if (blockSize > bytesLeft)
+      if (blockSize > size_t(bufEnd - wp))
       {
         errorMessage("uncompressed LZ4 data larger than output buffer");
       }
-      bytesLeft = bytesLeft - blockSize;
-      for ( ; blockSize; wp++, blockSize--)
-        *wp = readU8();
-      if (flags & 0x10)
-      {
-        (void) readU32LE();             // block checksum
-      }
-      continue;
+      std::memcpy(wp, inPtr, blockSize);
+      wp = wp + blockSize;
     }
-    while (blockSize)                   // compressed block
+    else                                // compressed block
     {
-      unsigned char t = readU8();       // token
-      blockSize--;
-      size_t  litLen = t >> 4;
-      if (litLen == 15)
-      {
-        unsigned char c;
-        do
-        {
-          if (!(blockSize--))
-            errorMessage("invalid or corrupt LZ4 compressed data");
-          c = readU8();
-          litLen = litLen + c;
-        }
-        while (c == 0xFF);
-      }
-      if (litLen > blockSize)
-        errorMessage("invalid or corrupt LZ4 compressed data");
-      if (litLen > bytesLeft)
-        errorMessage("uncompressed LZ4 data larger than output buffer");
-      blockSize = blockSize - litLen;
-      bytesLeft = bytesLeft - litLen;
-      for ( ; litLen; wp++, litLen--)
-        *wp = readU8();
-      size_t  lzLen = t & 0x0F;
-      if (!blockSize && !lzLen)
-        break;
-      if (blockSize < 2)
-        errorMessage("invalid or corrupt LZ4 compressed data");
-      blockSize = blockSize - 2;
-      size_t  offs = readU16LE();
-      if (offs < 1 || offs > size_t(wp - buf))
-        errorMessage("invalid or corrupt LZ4 compressed data");
-      if (lzLen == 15)
-      {
-        unsigned char c;
-        do
-        {
-          if (!(blockSize--))
-            errorMessage("invalid or corrupt LZ4 compressed data");
-          c = readU8();
-          lzLen = lzLen + c;
-        }
-        while (c == 0xFF);
-      }
-      lzLen = lzLen + 4;
-      if (lzLen > bytesLeft)
-        errorMessage("uncompressed LZ4 data larger than output buffer");
-      bytesLeft = bytesLeft - lzLen;
-      const unsigned char *rp = wp - offs;
-      for ( ; lzLen; rp++, wp++, lzLen--)
-        *wp = *rp;
+      wp = decompressLZ4Block(wp, buf, bufEnd, inPtr, inPtr + blockSize);
     }
+    inPtr = inPtr + blockSize;
     if (flags & 0x10)
     {
       (void) readU32LE();               // block checksum
@@ -197,8 +165,7 @@ size_t ZLibDecompressor::decompressLZ4(unsigned char *buf,
   {
     (void) readU32LE();                 // content checksum
   }
-  if (bytesLeft)
-    uncompressedSize = uncompressedSize - bytesLeft;
+  uncompressedSize = size_t(wp - buf);
   if ((flags & 0x08) != 0 && uncompressedSize != contentSize)
     errorMessage("invalid or corrupt LZ4 compressed data");
 
@@ -217,10 +184,14 @@ unsigned long long ZLibDecompressor::huffmanInit(
     unsigned char *lenTbl = reinterpret_cast< unsigned char * >(huffTableL);
     for (size_t i = 0; i < 288; i++)
       lenTbl[i] = (i < 144 ? 8 : (i < 256 ? 9 : (i < 280 ? 7 : 8)));
+    if (fastDecodeEnabled)
+      huffmanBuildFastTable(fastTableL, lenTbl, 288, false);
     huffmanBuildDecodeTable(huffTableL, lenTbl, 288);
     lenTbl = reinterpret_cast< unsigned char * >(huffTableD);
     for (size_t i = 0; i < 32; i++)
       lenTbl[i] = 5;
+    if (fastDecodeEnabled)
+      huffmanBuildFastTable(fastTableD, lenTbl, 32, true);
     huffmanBuildDecodeTable(huffTableD, lenTbl, 32);
     return sr;
   }
@@ -275,6 +246,8 @@ unsigned long long ZLibDecompressor::huffmanInit(
           rleLen = (unsigned char) readBitsRR(sr, 7) + 10;
       }
     }
+    if (fastDecodeEnabled)
+      huffmanBuildFastTable((!t ? fastTableL : fastTableD), lenTbl, n, bool(t));
     huffmanBuildDecodeTable((!t ? huffTableL : huffTableD), lenTbl, n);
   }
   return sr;
@@ -347,6 +320,86 @@ void ZLibDecompressor::huffmanBuildDecodeTable(
   }
 }
 
+void ZLibDecompressor::huffmanBuildFastTable(
+    std::uint32_t *fastTable, const unsigned char *lenTbl, size_t lenTblSize,
+    bool isDistanceTable)
+{
+  unsigned int  tableBits =
+      (!isDistanceTable ? fastTableBitsL : fastTableBitsD);
+  size_t  tableSize = size_t(1) << tableBits;
+  for (size_t i = 0; i < tableSize; i++)
+    fastTable[i] = 0U;
+  // calculate the first canonical code for each length
+  unsigned int  nextCode[17];
+  for (size_t i = 0; i < 17; i++)
+    nextCode[i] = 0U;
+  for (size_t i = 0; i < lenTblSize; i++)
+    nextCode[lenTbl[i] & 15]++;
+  unsigned int  c = 0U;
+  unsigned int  prvCnt = 0U;
+  for (size_t l = 1; l <= 16; l++)
+  {
+    c = (c + prvCnt) << 1;
+    prvCnt = nextCode[l];
+    nextCode[l] = c;
+  }
+  for (size_t i = 0; i < lenTblSize; i++)
+  {
+    unsigned int  l = lenTbl[i] & 15;
+    if (!l)
+      continue;
+    c = nextCode[l]++;
+    // codes that do not fit in the table, and invalid symbols or codes
+    // are left to huffmanDecodeLong()
+    if (l > tableBits || c >= (1U << l))
+      continue;
+    std::uint32_t e;
+    if (isDistanceTable)
+    {
+      if (i >= 30)
+        continue;
+      e = l | (zlibDistanceCodeTable[i] << 8);
+    }
+    else if (i < 256)
+    {
+      e = l | (1U << 8) | (std::uint32_t(i) << 16);
+    }
+    else if (i == 256)
+    {
+      e = l | (4U << 8);
+    }
+    else if (i < 286)
+    {
+      e = l | (3U << 8) | (std::uint32_t(zlibLengthCodeTable[i - 257]) << 16);
+    }
+    else
+    {
+      continue;
+    }
+    unsigned int  n = 0U;           // reverse the bits of the code
+    for (unsigned int j = 0; j < l; j++, c = c >> 1)
+      n = (n << 1) | (c & 1U);
+    for ( ; n < tableSize; n = n + (1U << l))
+      fastTable[n] = e;
+  }
+  if (isDistanceTable)
+    return;
+  // combine pairs of literals if the total length fits in the table,
+  // in reverse order so that the second element (n >> l) is not modified yet
+  for (size_t n = tableSize; n-- > 0; )
+  {
+    std::uint32_t e = fastTable[n];
+    if ((e & 0xFF00U) != 0x0100U)
+      continue;
+    unsigned int  l = e & 0xFFU;
+    std::uint32_t e2 = fastTable[n >> l];
+    if ((e2 & 0xFF00U) != 0x0100U || (l + (e2 & 0xFFU)) > tableBits)
+      continue;
+    fastTable[n] = (l + (e2 & 0xFFU)) | (2U << 8) | (e & 0x00FF0000U)
+                   | ((e2 & 0x00FF0000U) << 8);
+  }
+}
+
 // huffTable[N+256] = limit (last valid code + 1) for code length N+1
 // huffTable[N+288] = base index in huffTable for code length N+1
 
@@ -383,6 +436,206 @@ inline unsigned int ZLibDecompressor::huffmanDecode(
   return huffTable[b];
 }
 
+inline unsigned int ZLibDecompressor::huffmanDecodeLong(
+    std::uint64_t& bitBuf, unsigned int& bitCnt, const unsigned int *huffTable)
+{
+  unsigned int  b = huffTable[bitBuf & 0xFF];
+  unsigned int  nBits = b & 0xFF;
+  b = b >> 8;
+  if (nBits > 8) [[likely]]
+  {
+    if (nBits > 16)
+    {
+      errorMessage("invalid Huffman code in ZLib compressed data");
+    }
+    const unsigned int  *t = huffTable + (256 + 8 - 1);
+    nBits = 8;
+    do
+    {
+      t++;
+      b = (b << 1) | ((unsigned int) (bitBuf >> nBits) & 1U);
+      nBits++;
+    }
+    while (b >= *t);
+    b = b + t[32];
+    if (b & 0x80000000U)
+    {
+      errorMessage("invalid Huffman code in ZLib compressed data");
+    }
+    b = huffTable[b];
+  }
+  bitBuf = bitBuf >> nBits;
+  bitCnt = bitCnt - nBits;
+  return b;
+}
+
+unsigned char * ZLibDecompressor::flushOutput(unsigned char *wp,
+                                              unsigned char *buf)
+{
+  if (!outputFunc)
+    errorMessage("uncompressed ZLib data larger than output buffer");
+  size_t  n = size_t(wp - outputPtr);
+  if (n)
+  {
+    if ((outputSize + n) > outputSizeLimit)
+      errorMessage("uncompressed ZLib data larger than output buffer");
+    if (verifyChecksum)
+      outputChecksum = calculateAdler32(outputPtr, n, outputChecksum);
+    outputFunc(outputFuncData, outputPtr, n);
+    outputSize = outputSize + n;
+  }
+  // keep the last 32 KiB for LZ77 references
+  n = std::min(size_t(wp - buf), size_t(32768));
+  if ((wp - n) > buf)
+    std::memmove(buf, wp - n, n);
+  wp = buf + n;
+  outputPtr = wp;
+  return wp;
+}
+
+bool ZLibDecompressor::decompressZLibBlockFast(
+    unsigned long long& srRef, unsigned char*& wpRef,
+    unsigned char *buf, unsigned char *bufEnd)
+{
+  const unsigned int  *huffTableL = getHuffTable(2);
+  const unsigned int  *huffTableD = getHuffTable(1);
+  // convert the bit buffer from the format used by srLoad()
+  unsigned int  bitCnt = (unsigned int) std::bit_width(srRef) - 1U;
+  std::uint64_t bitBuf = srRef & ~(1ULL << bitCnt);
+  unsigned char *wp = wpRef;
+  // a match of up to 258 bytes may write 15 bytes past its end
+  unsigned char *wpEnd = bufEnd - (258 + 16);
+  const unsigned char *inEnd = inBufEnd - 8;
+  bool    endOfBlock = false;
+  while (wp <= wpEnd && inPtr <= inEnd) [[likely]]
+  {
+    // refill to at least 56 bits, which is enough for a length code and
+    // a distance code with the maximum number of extra bits (15 + 5 + 15 + 13)
+    bitBuf = bitBuf | (FileBuffer::readUInt64Fast(inPtr) << bitCnt);
+    inPtr = inPtr + ((63U - bitCnt) >> 3);
+    bitCnt = bitCnt | 56U;
+    std::uint32_t e = fastTableL[bitBuf & ((1U << fastTableBitsL) - 1U)];
+    unsigned int  nBits = e & 0xFFU;
+    unsigned int  lenInfo;
+    switch ((e >> 8) & 0xFFU)
+    {
+      case 1:                           // literal byte
+        *(wp++) = (unsigned char) (e >> 16);
+        bitBuf = bitBuf >> nBits;
+        bitCnt = bitCnt - nBits;
+        continue;
+      case 2:                           // two literal bytes
+        FileBuffer::writeUInt16Fast(wp, std::uint16_t(e >> 16));
+        wp = wp + 2;
+        bitBuf = bitBuf >> nBits;
+        bitCnt = bitCnt - nBits;
+        continue;
+      case 3:                           // length code
+        bitBuf = bitBuf >> nBits;
+        bitCnt = bitCnt - nBits;
+        lenInfo = e >> 16;
+        break;
+      case 4:                           // end of block
+        bitBuf = bitBuf >> nBits;
+        bitCnt = bitCnt - nBits;
+        endOfBlock = true;
+        break;
+      default:                          // long or invalid code
+        {
+          unsigned int  c = huffmanDecodeLong(bitBuf, bitCnt, huffTableL);
+          if (c < 256)
+          {
+            *(wp++) = (unsigned char) c;
+            continue;
+          }
+          if (c == 256)
+          {
+            endOfBlock = true;
+            break;
+          }
+          if (c > 285)
+            errorMessage("invalid or corrupt ZLib compressed data");
+          lenInfo = zlibLengthCodeTable[c - 257];
+        }
+        break;
+    }
+    if (endOfBlock)
+      break;
+    nBits = lenInfo >> 12;
+    size_t  lzLen = (lenInfo & 0x01FFU)
+                    + ((unsigned int) bitBuf & ((1U << nBits) - 1U));
+    bitBuf = bitBuf >> nBits;
+    bitCnt = bitCnt - nBits;
+    e = fastTableD[bitBuf & ((1U << fastTableBitsD) - 1U)];
+    nBits = e & 0xFFU;
+    if (nBits) [[likely]]
+    {
+      bitBuf = bitBuf >> nBits;
+      bitCnt = bitCnt - nBits;
+    }
+    else
+    {
+      unsigned int  c = huffmanDecodeLong(bitBuf, bitCnt, huffTableD);
+      if (c >= 30)
+        errorMessage("invalid or corrupt ZLib compressed data");
+      e = zlibDistanceCodeTable[c] << 8;
+    }
+    nBits = (e >> 8) & 0xFFU;
+    size_t  offs = (e >> 16) + ((unsigned int) bitBuf & ((1U << nBits) - 1U));
+    bitBuf = bitBuf >> nBits;
+    bitCnt = bitCnt - nBits;
+    if (offs > size_t(wp - buf)) [[unlikely]]
+    {
+      errorMessage("invalid LZ77 offset in ZLib compressed data");
+    }
+    // copy LZ77 sequence, possibly writing up to 15 bytes past the end
+    const unsigned char *rp = wp - offs;
+    unsigned char *lzEnd = wp + lzLen;
+    if (offs >= 16)
+    {
+      do
+      {
+        std::memcpy(wp, rp, 16);
+        wp = wp + 16;
+        rp = rp + 16;
+      }
+      while (wp < lzEnd);
+    }
+    else if (offs >= 8)
+    {
+      do
+      {
+        FileBuffer::writeUInt64Fast(wp, FileBuffer::readUInt64Fast(rp));
+        wp = wp + 8;
+        rp = rp + 8;
+      }
+      while (wp < lzEnd);
+    }
+    else if (offs == 1)
+    {
+      std::uint64_t tmp = *rp * 0x0101010101010101ULL;
+      do
+      {
+        FileBuffer::writeUInt64Fast(wp, tmp);
+        wp = wp + 8;
+      }
+      while (wp < lzEnd);
+    }
+    else
+    {
+      do
+      {
+        *(wp++) = *(rp++);
+      }
+      while (wp < lzEnd);
+    }
+    wp = lzEnd;
+  }
+  srRef = (bitBuf & ((1ULL << bitCnt) - 1ULL)) | (1ULL << bitCnt);
+  wpRef = wp;
+  return endOfBlock;
+}
+
 unsigned char * ZLibDecompressor::decompressZLibBlock(
     unsigned long long& srRef, unsigned char *wp,
     unsigned char *buf, unsigned char *bufEnd)
@@ -392,11 +645,18 @@ unsigned char * ZLibDecompressor::decompressZLibBlock(
   unsigned long long  sr = srRef;
   while (true)
   {
+    if (fastDecodeEnabled && (bufEnd - wp) >= (258 + 16) &&
+        (inBufEnd - inPtr) >= 8) [[likely]]
+    {
+      if (decompressZLibBlockFast(sr, wp, buf, bufEnd))
+        break;
+      continue;
+    }
     unsigned int  c = huffmanDecode(sr, huffTableL);
     if (c < 256)                    // literal byte
     {
-      if (wp >= bufEnd)
-        errorMessage("uncompressed ZLib data larger than output buffer");
+      if (wp >= bufEnd) [[unlikely]]
+        wp = flushOutput(wp, buf);
       *(wp++) = (unsigned char) c;
       continue;
     }
@@ -431,15 +691,13 @@ unsigned char * ZLibDecompressor::decompressZLibBlock(
       offs = readBitsRR(sr, nBits, (unsigned int) ((offs & 1) | 2));
     }
     offs++;
+    if ((wp + lzLen) > bufEnd) [[unlikely]]
+      wp = flushOutput(wp, buf);
     if (offs > size_t(wp - buf))
     {
       errorMessage("invalid LZ77 offset in ZLib compressed data");
     }
     const unsigned char *rp = wp - offs;
-    if ((wp + lzLen) > bufEnd)
-    {
-      errorMessage("uncompressed ZLib data larger than output buffer");
-    }
     // copy LZ77 sequence
     *(wp++) = *(rp++);
     *(wp++) = *(rp++);
@@ -492,13 +750,17 @@ size_t ZLibDecompressor::decompressZLib(unsigned char *buf,
       {
         errorMessage("invalid or corrupt ZLib compressed data");
       }
-      if ((wp + len) > bufEnd)
+      while (len)
       {
-        errorMessage("uncompressed ZLib data larger than output buffer");
-      }
-      for ( ; len; wp++, len--)
-      {
-        *wp = readU8();
+        if (wp >= bufEnd)
+          wp = flushOutput(wp, buf);
+        size_t  n = std::min(len, size_t(bufEnd - wp));
+        if (n > size_t(inBufEnd - inPtr))
+          errorMessage("end of ZLib compressed data");
+        std::memcpy(wp, inPtr, n);
+        len = len - n;
+        wp = wp + n;
+        inPtr = inPtr + n;
       }
     }
     else if ((bhdr & 6) == 6)           // reserved (invalid)
@@ -511,20 +773,28 @@ size_t ZLibDecompressor::decompressZLib(unsigned char *buf,
       wp = decompressZLibBlock(sr, wp, buf, bufEnd);
     }
     // update Adler-32 checksum
-    a = calculateAdler32(wpPrv, size_t(wp - wpPrv), a);
+    if (!outputFunc && verifyChecksum)
+      a = calculateAdler32(wpPrv, size_t(wp - wpPrv), a);
     if (bhdr & 1)
     {
       // final block
       break;
     }
   }
+  if (outputFunc)
+  {
+    (void) flushOutput(wp, buf);
+    a = outputChecksum;
+  }
   srReset(sr);
   // verify Adler-32 checksum
-  if (readU32BE() != a)
+  if (readU32BE() != a && verifyChecksum)
   {
     errorMessage("checksum error in ZLib compressed data");
   }
 
+  if (outputFunc)
+    return outputSize;
   return size_t(wp - buf);
 }
 
@@ -534,43 +804,101 @@ unsigned int ZLibDecompressor::calculateAdler32(
   unsigned int  s1 = a & 0xFFFFU;
   unsigned int  s2 = a >> 16;
   size_t  i = 0;
-#if ENABLE_X86_64_SIMD >= 2
+#if ENABLE_X86_64_SIMD >= 4
+  // process up to 5536 bytes (173 * 32) at a time, so that s2 cannot
+  // overflow before the modulo operation
+  while ((i + 32) <= bufSize)
+  {
+    static const YMM_UInt8  mulTbl =
+    {
+      32, 31, 30, 29, 28, 27, 26, 25, 24, 23, 22, 21, 20, 19, 18, 17,
+      16, 15, 14, 13, 12, 11, 10,  9,  8,  7,  6,  5,  4,  3,  2,  1
+    };
+    static const YMM_UInt16 onesTbl =
+    {
+      1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1
+    };
+    size_t  n = std::min((bufSize - i) >> 5, size_t(173));
+    std::uint64_t nBytes = n << 5;
+    // sum of bytes, sum of s1 at the start of each 32 byte block,
+    // and sum of bytes multiplied by (32 - offset in block)
+    YMM_UInt32  v1 = { 0U, 0U, 0U, 0U, 0U, 0U, 0U, 0U };
+    YMM_UInt32  v1Sum = v1;
+    YMM_UInt32  v2 = v1;
+    YMM_UInt32  zeroVec = v1;
+    do
+    {
+      YMM_UInt32  tmp1, tmp2;
+      const YMM_UInt8 *p = reinterpret_cast< const YMM_UInt8 * >(buf + i);
+      __asm__ ("vpaddd %1, %0, %0" : "+x" (v1Sum) : "x" (v1));
+      __asm__ ("vmovdqu %1, %0" : "=x" (tmp1) : "m" (*p));
+      __asm__ ("vpsadbw %2, %1, %0" : "=x" (tmp2) : "x" (tmp1), "x" (zeroVec));
+      __asm__ ("vpaddd %1, %0, %0" : "+x" (v1) : "x" (tmp2));
+      __asm__ ("vpmaddubsw %1, %0, %0" : "+x" (tmp1) : "xm" (mulTbl));
+      __asm__ ("vpmaddwd %1, %0, %0" : "+x" (tmp1) : "xm" (onesTbl));
+      __asm__ ("vpaddd %1, %0, %0" : "+x" (v2) : "x" (tmp1));
+      i = i + 32;
+    }
+    while (--n);
+    std::uint64_t tmp1 = 0U;
+    std::uint64_t tmp2 = std::uint64_t(s1) * nBytes + s2;
+    for (int j = 0; j < 8; j++)
+    {
+      tmp1 = tmp1 + v1[j];
+      tmp2 = tmp2 + (std::uint64_t(v1Sum[j]) << 5) + v2[j];
+    }
+    s1 = (unsigned int) ((tmp1 + s1) % 65521U);
+    s2 = (unsigned int) (tmp2 % 65521U);
+  }
+#elif ENABLE_X86_64_SIMD >= 1
+  // process up to 5552 bytes (347 * 16) at a time
   while ((i + 16) <= bufSize)
   {
-    static const XMM_UInt16 mulTbl1 = { 16, 15, 14, 13, 12, 11, 10, 9 };
-    static const XMM_UInt16 mulTbl2 = { 8, 7, 6, 5, 4, 3, 2, 1 };
-    XMM_UInt32  aTmp = { s1, 0U, s2, 0U };
-    size_t  n = std::min((bufSize - i) >> 4, size_t(256));
+    static const XMM_UInt8  mulTbl =
+    {
+      16, 15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1
+    };
+    static const XMM_UInt16 onesTbl = { 1, 1, 1, 1, 1, 1, 1, 1 };
+    size_t  n = std::min((bufSize - i) >> 4, size_t(347));
+    std::uint64_t nBytes = n << 4;
+    XMM_UInt32  v1 = { 0U, 0U, 0U, 0U };
+    XMM_UInt32  v1Sum = v1;
+    XMM_UInt32  v2 = v1;
+    XMM_UInt32  zeroVec = v1;
     do
     {
-      XMM_UInt16  tmp1, tmp2, tmp3;
-      const std::uint64_t *p =
-          reinterpret_cast< const std::uint64_t * >(buf + i);
-      __asm__ ("vpmovzxbw %1, %0" : "=x" (tmp1) : "m" (*p));
-      __asm__ ("vpmovzxbw %1, %0" : "=x" (tmp2) : "m" (p[1]));
-      __asm__ ("vpslldq $0x08, %1, %0" : "=x" (tmp3) : "x" (aTmp));
-      __asm__ ("vpslld $0x04, %0, %0" : "+x" (tmp3));
-      __asm__ ("vpaddd %1, %0, %0" : "+x" (aTmp) : "x" (tmp3));
-      __asm__ ("vpmullw %2, %1, %0" : "=x" (tmp3) : "x" (tmp1), "xm" (mulTbl1));
-      __asm__ ("vpaddw %1, %0, %0" : "+x" (tmp1) : "x" (tmp2));
-      __asm__ ("vpmullw %1, %0, %0" : "+x" (tmp2) : "xm" (mulTbl2));
-      __asm__ ("vpaddw %1, %0, %0" : "+x" (tmp2) : "x" (tmp3));
-      __asm__ ("vpshufd $0x4e, %1, %0" : "=x" (tmp3) : "x" (tmp1));
-      __asm__ ("vpaddw %1, %0, %0" : "+x" (tmp1) : "x" (tmp3));
-      __asm__ ("vpshufd $0x4e, %1, %0" : "=x" (tmp3) : "x" (tmp2));
-      __asm__ ("vpaddw %1, %0, %0" : "+x" (tmp2) : "x" (tmp3));
-      __asm__ ("vpblendw $0xf0, %1, %0, %0" : "+x" (tmp1) : "x" (tmp2));
-      __asm__ ("vpshufd $0xb1, %1, %0" : "=x" (tmp3) : "x" (tmp1));
-      __asm__ ("vpaddw %1, %0, %0" : "+x" (tmp1) : "x" (tmp3));
-      __asm__ ("vpslld $0x10, %1, %0" : "=x" (tmp3) : "x" (tmp1));
-      __asm__ ("vpaddd %1, %0, %0" : "+x" (tmp1) : "x" (tmp3));
-      __asm__ ("vpsrld $0x10, %0, %0" : "+x" (tmp1));
-      __asm__ ("vpaddd %1, %0, %0" : "+x" (aTmp) : "x" (tmp1));
+      XMM_UInt32  tmp1, tmp2;
+      const XMM_UInt8 *p = reinterpret_cast< const XMM_UInt8 * >(buf + i);
+#  if ENABLE_X86_64_SIMD >= 2
+      __asm__ ("vpaddd %1, %0, %0" : "+x" (v1Sum) : "x" (v1));
+      __asm__ ("vmovdqu %1, %0" : "=x" (tmp1) : "m" (*p));
+      __asm__ ("vpsadbw %2, %1, %0" : "=x" (tmp2) : "x" (tmp1), "x" (zeroVec));
+      __asm__ ("vpaddd %1, %0, %0" : "+x" (v1) : "x" (tmp2));
+      __asm__ ("vpmaddubsw %1, %0, %0" : "+x" (tmp1) : "xm" (mulTbl));
+      __asm__ ("vpmaddwd %1, %0, %0" : "+x" (tmp1) : "xm" (onesTbl));
+      __asm__ ("vpaddd %1, %0, %0" : "+x" (v2) : "x" (tmp1));
+#  else
+      __asm__ ("paddd %1, %0" : "+x" (v1Sum) : "x" (v1));
+      __asm__ ("movdqu %1, %0" : "=x" (tmp1) : "m" (*p));
+      tmp2 = tmp1;
+      __asm__ ("psadbw %1, %0" : "+x" (tmp2) : "x" (zeroVec));
+      __asm__ ("paddd %1, %0" : "+x" (v1) : "x" (tmp2));
+      __asm__ ("pmaddubsw %1, %0" : "+x" (tmp1) : "xm" (mulTbl));
+      __asm__ ("pmaddwd %1, %0" : "+x" (tmp1) : "xm" (onesTbl));
+      __asm__ ("paddd %1, %0" : "+x" (v2) : "x" (tmp1));
+#  endif
       i = i + 16;
     }
     while (--n);
-    s1 = aTmp[0] % 65521U;
-    s2 = aTmp[2] % 65521U;
+    std::uint64_t tmp1 = 0U;
+    std::uint64_t tmp2 = std::uint64_t(s1) * nBytes + s2;
+    for (int j = 0; j < 4; j++)
+    {
+      tmp1 = tmp1 + v1[j];
+      tmp2 = tmp2 + (std::uint64_t(v1Sum[j]) << 4) + v2[j];
+    }
+    s1 = (unsigned int) ((tmp1 + s1) % 65521U);
+    s2 = (unsigned int) (tmp2 % 65521U);
   }
 #else
   while ((i + 4) <= bufSize)
@@ -603,9 +931,12 @@ unsigned int ZLibDecompressor::calculateAdler32(
 
 size_t ZLibDecompressor::decompressData(
     unsigned char *buf, size_t uncompressedSize,
-    const unsigned char *inBuf, size_t compressedSize)
+    const unsigned char *inBuf, size_t compressedSize,
+    bool verifyChecksum, bool enableFastDecode)
 {
   ZLibDecompressor  zlibDecompressor(inBuf, compressedSize);
+  zlibDecompressor.fastDecodeEnabled = enableFastDecode;
+  zlibDecompressor.verifyChecksum = verifyChecksum;
   // CMF, FLG
   std::uint16_t h = zlibDecompressor.readU16BE();
   if (h == 0x0422)
@@ -615,13 +946,39 @@ size_t ZLibDecompressor::decompressData(
   return zlibDecompressor.decompressZLib(buf, uncompressedSize);
 }
 
-size_t ZLibDecompressor::decompressLZ4Raw(
-    unsigned char *buf, size_t uncompressedSize,
-    const unsigned char *inBuf, size_t compressedSize)
+size_t ZLibDecompressor::decompressData(
+    void (*outputFunc)(void *p, const unsigned char *buf, size_t nBytes),
+    void *outputFuncData, size_t uncompressedSize,
+    const unsigned char *inBuf, size_t compressedSize, bool verifyChecksum)
+{
+  ZLibDecompressor  zlibDecompressor(inBuf, compressedSize);
+  zlibDecompressor.verifyChecksum = verifyChecksum;
+  std::uint16_t h = zlibDecompressor.readU16BE();
+  if (h == 0x0422)
+  {
+    // LZ4 frames are decompressed to a temporary buffer
+    std::vector< unsigned char >  buf(uncompressedSize);
+    size_t  n = zlibDecompressor.decompressLZ4(buf.data(), uncompressedSize);
+    if (n)
+      outputFunc(outputFuncData, buf.data(), n);
+    return n;
+  }
+  if ((h & 0x8F20) != 0x0800 || (h % 31) != 0)
+    errorMessage("invalid or unsupported ZLib compression method");
+  std::vector< unsigned char >  buf(32768 + 262144);
+  zlibDecompressor.outputFunc = outputFunc;
+  zlibDecompressor.outputFuncData = outputFuncData;
+  zlibDecompressor.outputPtr = buf.data();
+  zlibDecompressor.outputSize = 0;
+  zlibDecompressor.outputSizeLimit = uncompressedSize;
+  zlibDecompressor.outputChecksum = 1U;
+  return zlibDecompressor.decompressZLib(buf.data(), buf.size());
+}
+
+unsigned char * ZLibDecompressor::decompressLZ4Block(
+    unsigned char *wp, unsigned char *buf, unsigned char *bufEnd,
+    const unsigned char *inBuf, const unsigned char *inBufEnd)
 {
-  unsigned char *wp = buf;
-  size_t  bytesLeft = uncompressedSize;
-  const unsigned char *inBufEnd = inBuf + compressedSize;
   while (inBuf < inBufEnd)
   {
     unsigned char t = *(inBuf++);       // token
@@ -638,19 +995,38 @@ size_t ZLibDecompressor::decompressLZ4Raw(
       }
       while (c == 0xFF);
     }
-    if ((inBuf + litLen) > inBufEnd)
+    if (litLen > size_t(inBufEnd - inBuf))
       errorMessage("invalid or corrupt LZ4 compressed data");
-    if (litLen > bytesLeft)
+    if (litLen > size_t(bufEnd - wp))
       errorMessage("uncompressed LZ4 data larger than output buffer");
-    bytesLeft = bytesLeft - litLen;
-    for ( ; litLen; wp++, litLen--)
-      *wp = *(inBuf++);
+    // copy literals, reading and writing up to 15 bytes past the end
+    // if there is enough space left in both buffers
+    if (size_t(inBufEnd - inBuf) >= (litLen + 16) &&
+        size_t(bufEnd - wp) >= (litLen + 16)) [[likely]]
+    {
+      const unsigned char *rp = inBuf;
+      unsigned char *litEnd = wp + litLen;
+      do
+      {
+        std::memcpy(wp, rp, 16);
+        wp = wp + 16;
+        rp = rp + 16;
+      }
+      while (wp < litEnd);
+      wp = litEnd;
+    }
+    else
+    {
+      std::memcpy(wp, inBuf, litLen);
+      wp = wp + litLen;
+    }
+    inBuf = inBuf + litLen;
     size_t  lzLen = t & 0x0F;
     if (inBuf >= inBufEnd && !lzLen)
       break;
     if ((inBuf + 2) > inBufEnd)
       errorMessage("invalid or corrupt LZ4 compressed data");
-    size_t  offs = size_t(inBuf[0]) | (size_t(inBuf[1]) << 8);
+    size_t  offs = FileBuffer::readUInt16Fast(inBuf);
     inBuf = inBuf + 2;
     if (offs < 1 || offs > size_t(wp - buf))
       errorMessage("invalid or corrupt LZ4 compressed data");
@@ -667,16 +1043,787 @@ size_t ZLibDecompressor::decompressLZ4Raw(
       while (c == 0xFF);
     }
     lzLen = lzLen + 4;
-    if (lzLen > bytesLeft)
+    if (lzLen > size_t(bufEnd - wp))
       errorMessage("uncompressed LZ4 data larger than output buffer");
-    bytesLeft = bytesLeft - lzLen;
     const unsigned char *rp = wp - offs;
-    for ( ; lzLen; rp++, wp++, lzLen--)
-      *wp = *rp;
+    unsigned char *lzEnd = wp + lzLen;
+    if (size_t(bufEnd - wp) < (lzLen + 16)) [[unlikely]]
+    {
+      // near the end of the output buffer
+      do
+      {
+        *(wp++) = *(rp++);
+      }
+      while (wp < lzEnd);
+    }
+    else if (offs >= 16)
+    {
+      do
+      {
+        std::memcpy(wp, rp, 16);
+        wp = wp + 16;
+        rp = rp + 16;
+      }
+      while (wp < lzEnd);
+    }
+    else if (offs >= 8)
+    {
+      do
+      {
+        FileBuffer::writeUInt64Fast(wp, FileBuffer::readUInt64Fast(rp));
+        wp = wp + 8;
+        rp = rp + 8;
+      }
+      while (wp < lzEnd);
+    }
+    else if (offs == 1)
+    {
+      std::uint64_t tmp = *rp * 0x0101010101010101ULL;
+      do
+      {
+        FileBuffer::writeUInt64Fast(wp, tmp);
+        wp = wp + 8;
+      }
+      while (wp < lzEnd);
+    }
+    else
+    {
+      // expand the pattern to 8 bytes, then copy 8 bytes at a time from
+      // the smallest multiple of the offset that is at least 8
+      static const unsigned char  patternOffsTable[8] =
+      {
+        0, 0, 8, 9, 8, 10, 12, 14
+      };
+      for (unsigned char *p = wp + 8; wp < p; wp++, rp++)
+        *wp = *rp;
+      rp = wp - patternOffsTable[offs];
+      while (wp < lzEnd)
+      {
+        FileBuffer::writeUInt64Fast(wp, FileBuffer::readUInt64Fast(rp));
+        wp = wp + 8;
+        rp = rp + 8;
+      }
+    }
+    wp = lzEnd;
   }
-  if (bytesLeft)
-    uncompressedSize = uncompressedSize - bytesLeft;
+  return wp;
+}
 
-  return uncompressedSize;
+size_t ZLibDecompressor::decompressLZ4Raw(
+    unsigned char *buf, size_t uncompressedSize,
+    const unsigned char *inBuf, size_t compressedSize)
+{
+  unsigned char *wp = decompressLZ4Block(buf, buf, buf + uncompressedSize,
+                                         inBuf, inBuf + compressedSize);
+  return size_t(wp - buf);
+}
+
+ZLibCompressor::ZLibCompressor(
+    std::vector< unsigned char >& buf,
+    const unsigned char *inBufPtr, size_t inBufLen,
+    int compressionLevel, unsigned int minLen)
+  : inBuf(inBufPtr),
+    inBufSize(inBufLen),
+    outBuf(buf),
+    bitBuf(0ULL),
+    bitCnt(0U),
+    minMatchLen(minLen),
+    blockStart(0),
+    blockEnd(0)
+{
+  static const unsigned short levelTable[10 * 2] =
+  {
+    // maximum hash chain length, nice match length
+       0,    0,      4,   16,      8,   32,     32,   32,     16,   32,
+      32,   64,    128,  128,    256,  128,   1024,  258,   4096,  258
+  };
+  compressionLevel = std::min(std::max(compressionLevel, 0), 9);
+  maxChainLen = levelTable[compressionLevel * 2];
+  niceMatchLen = levelTable[compressionLevel * 2 + 1];
+  lazyMatching = (compressionLevel >= 4);
+  // use smaller tables for small inputs
+  unsigned int  hashBits =
+      std::min(std::max((unsigned int) std::bit_width(inBufLen), 10U), 16U);
+  hashShift = 32U - hashBits;
+  if (maxChainLen)
+  {
+    hashTable.resize(size_t(1) << hashBits, -1);
+    prvTableMask = std::min(std::bit_ceil(inBufLen), size_t(65536)) - 1;
+    prvTable.resize(prvTableMask + 1, -1);
+  }
+  for (size_t i = 0; i < 286; i++)
+    litFreqs[i] = 0U;
+  for (size_t i = 0; i < 30; i++)
+    distFreqs[i] = 0U;
+}
+
+inline std::uint32_t ZLibCompressor::hashFunction(size_t pos) const
+{
+  std::uint32_t h;
+  if ((pos + 4) <= inBufSize) [[likely]]
+  {
+    h = FileBuffer::readUInt32Fast(inBuf + pos);
+  }
+  else
+  {
+    h = std::uint32_t(inBuf[pos]) | (std::uint32_t(inBuf[pos + 1]) << 8)
+        | (std::uint32_t(inBuf[pos + 2]) << 16);
+  }
+  if (minMatchLen < 4U)
+    h = h & 0x00FFFFFFU;
+  return ((h * 0x9E3779B1U) >> hashShift);
+}
+
+inline void ZLibCompressor::insertHash(size_t pos)
+{
+  std::int32_t& h = hashTable[hashFunction(pos)];
+  prvTable[pos & prvTableMask] = h;
+  h = std::int32_t(pos);
+}
+
+inline size_t ZLibCompressor::findMatch(
+    size_t& dist, size_t pos, size_t maxLen, size_t maxDist) const
+{
+  size_t  bestLen = minMatchLen - 1U;
+  const unsigned char *p1 = inBuf + pos;
+  std::int32_t  p = hashTable[hashFunction(pos)];
+  for (unsigned int n = maxChainLen; p >= 0 && n; n--)
+  {
+    size_t  d = pos - size_t(p);
+    if (d > maxDist)
+      break;
+    const unsigned char *p2 = inBuf + p;
+    if (p2[bestLen] == p1[bestLen] && p2[0] == p1[0])
+    {
+      size_t  len = 0;
+      while (true)
+      {
+        if ((len + 8) > maxLen)
+        {
+          while (len < maxLen && p1[len] == p2[len])
+            len++;
+          break;
+        }
+        std::uint64_t tmp = FileBuffer::readUInt64Fast(p1 + len)
+                            ^ FileBuffer::readUInt64Fast(p2 + len);
+        if (tmp)
+        {
+          len = len + size_t(std::countr_zero(tmp) >> 3);
+          break;
+        }
+        len = len + 8;
+      }
+      if (len > bestLen)
+      {
+        bestLen = len;
+        dist = d;
+        if (len >= niceMatchLen || len >= maxLen)
+          break;
+      }
+    }
+    std::int32_t  nextPos = prvTable[size_t(p) & prvTableMask];
+    if (nextPos >= p)
+      break;
+    p = nextPos;
+  }
+  return (bestLen >= minMatchLen ? bestLen : 0);
+}
+
+inline void ZLibCompressor::writeBits(unsigned int b, unsigned int nBits)
+{
+  bitBuf = bitBuf | ((unsigned long long) b << bitCnt);
+  bitCnt = bitCnt + nBits;
+  if (bitCnt >= 32U)
+  {
+    size_t  n = outBuf.size();
+    outBuf.resize(n + 4);
+    FileBuffer::writeUInt32Fast(outBuf.data() + n, std::uint32_t(bitBuf));
+    bitBuf = bitBuf >> 32;
+    bitCnt = bitCnt - 32U;
+  }
+}
+
+void ZLibCompressor::flushBits()
+{
+  for ( ; bitCnt > 0U; bitCnt = (bitCnt > 8U ? bitCnt - 8U : 0U))
+  {
+    outBuf.push_back((unsigned char) (bitBuf & 0xFFU));
+    bitBuf = bitBuf >> 8;
+  }
+  bitBuf = 0ULL;
+}
+
+void ZLibCompressor::huffmanBuildLengths(
+    unsigned char *lenTbl, const unsigned int *freqs, size_t n,
+    unsigned int maxLen)
+{
+  // symbols with non-zero frequency, sorted by frequency
+  std::vector< std::uint64_t >  symbols;
+  for (size_t i = 0; i < n; i++)
+  {
+    lenTbl[i] = 0;
+    if (freqs[i])
+      symbols.push_back((std::uint64_t(freqs[i]) << 16) | i);
+  }
+  // at least two symbols are needed for a complete code
+  for (size_t i = 0; symbols.size() < 2; i++)
+  {
+    if (!freqs[i])
+      symbols.push_back(i);
+  }
+  std::sort(symbols.begin(), symbols.end());
+  size_t  leafCnt = symbols.size();
+  // build the tree using two queues, nodeFreqs[0 to leafCnt - 1] are the
+  // leaves, internal nodes are appended in the order of creation
+  std::vector< std::uint64_t >  nodeFreqs(leafCnt * 2 - 1);
+  std::vector< unsigned int > parents(leafCnt * 2 - 1);
+  for (size_t i = 0; i < leafCnt; i++)
+    nodeFreqs[i] = symbols[i] >> 16;
+  size_t  l = 0;
+  size_t  m = leafCnt;
+  for (size_t i = leafCnt; i < (leafCnt * 2 - 1); i++)
+  {
+    for (int j = 0; j < 2; j++)
+    {
+      size_t  k;
+      if (l < leafCnt && (m >= i || nodeFreqs[l] <= nodeFreqs[m]))
+        k = l++;
+      else
+        k = m++;
+      nodeFreqs[i] = nodeFreqs[i] + nodeFreqs[k];
+      parents[k] = (unsigned int) i;
+    }
+  }
+  // calculate depths, and count the number of codes of each length
+  unsigned int  lenCnts[33];
+  for (size_t i = 0; i <= 32; i++)
+    lenCnts[i] = 0U;
+  std::vector< unsigned char >  depths(leafCnt * 2 - 1);
+  depths[leafCnt * 2 - 2] = 0;
+  unsigned int  maxDepth = 0U;
+  for (size_t i = leafCnt * 2 - 2; i-- > 0; )
+  {
+    depths[i] = (unsigned char) std::min(depths[parents[i]] + 1, 32);
+    if (i < leafCnt)
+    {
+      lenCnts[depths[i]]++;
+      maxDepth = std::max(maxDepth, (unsigned int) depths[i]);
+    }
+  }
+  if (maxDepth > maxLen)
+  {
+    // limit code lengths, and adjust the counts so that the code is complete
+    for (size_t i = maxLen + 1; i <= 32; i++)
+    {
+      lenCnts[maxLen] += lenCnts[i];
+      lenCnts[i] = 0U;
+    }
+    std::uint32_t total = 0U;
+    for (size_t i = 1; i <= maxLen; i++)
+      total += (lenCnts[i] << (maxLen - i));
+    for ( ; total > (1U << maxLen); total--)
+    {
+      lenCnts[maxLen]--;
+      for (size_t i = maxLen - 1; i > 0; i--)
+      {
+        if (lenCnts[i])
+        {
+          lenCnts[i]--;
+          lenCnts[i + 1] += 2U;
+          break;
+        }
+      }
+    }
+  }
+  // assign the longest codes to the least frequent symbols
+  size_t  j = 0;
+  for (unsigned int len = 32; len > 0; len--)
+  {
+    for (unsigned int k = lenCnts[len]; k; k--, j++)
+      lenTbl[symbols[j] & 0xFFFFU] = (unsigned char) len;
+  }
 }
 
+void ZLibCompressor::huffmanBuildCodes(
+    unsigned short *codeTbl, const unsigned char *lenTbl, size_t n)
+{
+  unsigned int  lenCnts[16];
+  unsigned int  nextCode[16];
+  for (size_t i = 0; i < 16; i++)
+    lenCnts[i] = 0U;
+  for (size_t i = 0; i < n; i++)
+    lenCnts[lenTbl[i]]++;
+  lenCnts[0] = 0U;
+  unsigned int  c = 0U;
+  for (size_t i = 1; i < 16; i++)
+  {
+    c = (c + lenCnts[i - 1]) << 1;
+    nextCode[i] = c;
+  }
+  for (size_t i = 0; i < n; i++)
+  {
+    unsigned int  len = lenTbl[i];
+    if (!len)
+    {
+      codeTbl[i] = 0;
+      continue;
+    }
+    // Deflate stores Huffman codes MSB first
+    c = nextCode[len]++;
+    unsigned int  r = 0U;
+    for (unsigned int j = 0U; j < len; j++, c = c >> 1)
+      r = (r << 1) | (c & 1U);
+    codeTbl[i] = (unsigned short) r;
+  }
+}
+
+inline unsigned int ZLibCompressor::getLengthCode(unsigned int len)
+{
+  // returns code - 257 | (extra bits << 8) | (extra bits value << 16)
+  unsigned int  x = len - 3U;
+  if (x < 8U)
+    return x;
+  if (x >= 255U)
+    return 28U;
+  unsigned int  nBits = (unsigned int) std::bit_width(x) - 3U;
+  unsigned int  c = (x >> nBits) & 3U;
+  return ((nBits * 4U + 4U + c) | (nBits << 8)
+          | ((x - ((c + 4U) << nBits)) << 16));
+}
+
+inline unsigned int ZLibCompressor::getDistanceCode(unsigned int dist)
+{
+  // returns code | (extra bits << 8) | (extra bits value << 16)
+  unsigned int  x = dist - 1U;
+  if (x < 4U)
+    return x;
+  unsigned int  nBits = (unsigned int) std::bit_width(x) - 2U;
+  unsigned int  c = (x >> nBits) & 1U;
+  return ((nBits * 2U + 2U + c) | (nBits << 8)
+          | ((x - ((c + 2U) << nBits)) << 16));
+}
+
+inline void ZLibCompressor::addSymbol(unsigned int len, unsigned int dist)
+{
+  LZ77Symbol  tmp;
+  tmp.len = std::uint16_t(len);
+  tmp.dist = std::uint16_t(dist);
+  symbolBuf.push_back(tmp);
+  if (!dist)
+  {
+    litFreqs[len]++;
+    blockEnd++;
+  }
+  else
+  {
+    litFreqs[(getLengthCode(len) & 0xFFU) + 257U]++;
+    distFreqs[getDistanceCode(dist) & 0xFFU]++;
+    blockEnd = blockEnd + len;
+  }
+  if (symbolBuf.size() >= 16384) [[unlikely]]
+    writeBlock(false);
+}
+
+void ZLibCompressor::writeStoredBlock(bool isLastBlock)
+{
+  do
+  {
+    size_t  n = std::min(blockEnd - blockStart, size_t(65535));
+    bool    isLast = (isLastBlock && (blockStart + n) >= blockEnd);
+    writeBits((unsigned int) isLast, 3);
+    flushBits();
+    outBuf.push_back((unsigned char) (n & 0xFF));
+    outBuf.push_back((unsigned char) (n >> 8));
+    outBuf.push_back((unsigned char) (~n & 0xFF));
+    outBuf.push_back((unsigned char) ((~n >> 8) & 0xFF));
+    outBuf.insert(outBuf.end(), inBuf + blockStart, inBuf + (blockStart + n));
+    blockStart = blockStart + n;
+  }
+  while (blockStart < blockEnd);
+}
+
+void ZLibCompressor::writeBlock(bool isLastBlock)
+{
+  static const unsigned char  codeLengthOrder[19] =
+  {
+    16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15
+  };
+  // the fixed code also includes the unused literal/length codes 286 and 287
+  unsigned char litLens[288];
+  unsigned char distLens[30];
+  unsigned short  litCodes[288];
+  unsigned short  distCodes[30];
+  litFreqs[256] = 1U;                   // end of block
+  huffmanBuildLengths(litLens, litFreqs, 286, 15);
+  huffmanBuildLengths(distLens, distFreqs, 30, 15);
+  size_t  litCnt = 286;
+  while (litCnt > 257 && !litLens[litCnt - 1])
+    litCnt--;
+  size_t  distCnt = 30;
+  while (distCnt > 1 && !distLens[distCnt - 1])
+    distCnt--;
+  // run length encode the code lengths
+  unsigned char lenTbl[316];
+  std::memcpy(lenTbl, litLens, litCnt);
+  std::memcpy(lenTbl + litCnt, distLens, distCnt);
+  size_t  lenCnt = litCnt + distCnt;
+  unsigned short  clSymbols[316];       // code | (extra bits value << 8)
+  size_t  clSymbolCnt = 0;
+  unsigned int  clFreqs[19];
+  for (size_t i = 0; i < 19; i++)
+    clFreqs[i] = 0U;
+  for (size_t i = 0; i < lenCnt; )
+  {
+    unsigned char l = lenTbl[i];
+    size_t  runLen = 1;
+    while ((i + runLen) < lenCnt && lenTbl[i + runLen] == l)
+      runLen++;
+    i = i + runLen;
+    if (l)
+    {
+      clSymbols[clSymbolCnt++] = l;
+      clFreqs[l]++;
+      runLen--;
+      for ( ; runLen >= 3; runLen = runLen - std::min(runLen, size_t(6)))
+      {
+        clSymbols[clSymbolCnt++] =
+            (unsigned short) (16 | ((std::min(runLen, size_t(6)) - 3) << 8));
+        clFreqs[16]++;
+      }
+    }
+    else
+    {
+      for ( ; runLen >= 11; runLen = runLen - std::min(runLen, size_t(138)))
+      {
+        clSymbols[clSymbolCnt++] =
+            (unsigned short) (18 | ((std::min(runLen, size_t(138)) - 11) << 8));
+        clFreqs[18]++;
+      }
+      if (runLen >= 3)
+      {
+        clSymbols[clSymbolCnt++] = (unsigned short) (17 | ((runLen - 3) << 8));
+        clFreqs[17]++;
+        runLen = 0;
+      }
+    }
+    for ( ; runLen; runLen--)
+    {
+      clSymbols[clSymbolCnt++] = l;
+      clFreqs[l]++;
+    }
+  }
+  unsigned char clLens[19];
+  unsigned short  clCodes[19];
+  huffmanBuildLengths(clLens, clFreqs, 19, 7);
+  size_t  clCnt = 19;
+  while (clCnt > 4 && !clLens[codeLengthOrder[clCnt - 1]])
+    clCnt--;
+
+  // compare the sizes of dynamic, fixed and stored blocks
+  size_t  extraBits = 0;
+  size_t  dynamicBits = 17 + (clCnt * 3);
+  size_t  fixedBits = 3;
+  for (size_t i = 0; i < 19; i++)
+    dynamicBits += (size_t(clFreqs[i]) * clLens[i]);
+  dynamicBits += (size_t(clFreqs[16]) * 2 + size_t(clFreqs[17]) * 3
+                  + size_t(clFreqs[18]) * 7);
+  for (size_t i = 0; i < 286; i++)
+  {
+    dynamicBits += (size_t(litFreqs[i]) * litLens[i]);
+    fixedBits += (size_t(litFreqs[i])
+                  * (i < 144 ? 8 : (i < 256 ? 9 : (i < 280 ? 7 : 8))));
+    if (i >= 265 && i < 285)
+      extraBits += (size_t(litFreqs[i]) * ((i - 261) >> 2));
+  }
+  for (size_t i = 0; i < 30; i++)
+  {
+    dynamicBits += (size_t(distFreqs[i]) * distLens[i]);
+    fixedBits += (size_t(distFreqs[i]) * 5);
+    if (i >= 4)
+      extraBits += (size_t(distFreqs[i]) * ((i - 2) >> 1));
+  }
+  size_t  storedBits = ((blockEnd - blockStart) + 4) * 8 + 3 + 7;
+  storedBits += (((blockEnd - blockStart) / 65535) * 40);
+  if (storedBits <= std::min(dynamicBits, fixedBits) + extraBits)
+  {
+    writeStoredBlock(isLastBlock);
+  }
+  else
+  {
+    size_t  litTableSize = 286;
+    if (fixedBits <= dynamicBits)
+    {
+      writeBits((unsigned int) isLastBlock | 2U, 3);
+      litTableSize = 288;
+      for (size_t i = 0; i < 288; i++)
+        litLens[i] = (i < 144 ? 8 : (i < 256 ? 9 : (i < 280 ? 7 : 8)));
+      for (size_t i = 0; i < 30; i++)
+        distLens[i] = 5;
+    }
+    else
+    {
+      writeBits((unsigned int) isLastBlock | 4U, 3);
+      writeBits((unsigned int) (litCnt - 257), 5);
+      writeBits((unsigned int) (distCnt - 1), 5);
+      writeBits((unsigned int) (clCnt - 4), 4);
+      for (size_t i = 0; i < clCnt; i++)
+        writeBits(clLens[codeLengthOrder[i]], 3);
+      huffmanBuildCodes(clCodes, clLens, 19);
+      for (size_t i = 0; i < clSymbolCnt; i++)
+      {
+        unsigned int  c = clSymbols[i] & 0xFFU;
+        writeBits(clCodes[c], clLens[c]);
+        if (c >= 16)
+          writeBits(clSymbols[i] >> 8, (c == 16 ? 2 : (c == 17 ? 3 : 7)));
+      }
+    }
+    huffmanBuildCodes(litCodes, litLens, litTableSize);
+    huffmanBuildCodes(distCodes, distLens, 30);
+    for (const LZ77Symbol& s : symbolBuf)
+    {
+      if (!s.dist)
+      {
+        writeBits(litCodes[s.len], litLens[s.len]);
+        continue;
+      }
+      unsigned int  c = getLengthCode(s.len);
+      unsigned int  nBits = (c >> 8) & 0xFFU;
+      writeBits(litCodes[(c & 0xFFU) + 257U], litLens[(c & 0xFFU) + 257U]);
+      if (nBits)
+        writeBits(c >> 16, nBits);
+      c = getDistanceCode(s.dist);
+      nBits = (c >> 8) & 0xFFU;
+      writeBits(distCodes[c & 0xFFU], distLens[c & 0xFFU]);
+      if (nBits)
+        writeBits(c >> 16, nBits);
+    }
+    writeBits(litCodes[256], litLens[256]);
+  }
+  symbolBuf.clear();
+  blockStart = blockEnd;
+  for (size_t i = 0; i < 286; i++)
+    litFreqs[i] = 0U;
+  for (size_t i = 0; i < 30; i++)
+    distFreqs[i] = 0U;
+}
+
+void ZLibCompressor::compressZLib()
+{
+  outBuf.push_back(0x78);               // CMF: Deflate, 32 KiB window
+  outBuf.push_back(!maxChainLen ? 0x01 : (!lazyMatching ? 0x5E : 0x9C));
+  if (!maxChainLen)
+  {
+    blockEnd = inBufSize;
+    writeStoredBlock(true);
+  }
+  else
+  {
+    symbolBuf.reserve(16384);
+    size_t  pos = 0;
+    size_t  prvLen = 0;                 // length of pending lazy match
+    size_t  prvDist = 0;
+    while (pos < inBufSize)
+    {
+      size_t  len = 0;
+      size_t  dist = 0;
+      if ((pos + 3) <= inBufSize)
+      {
+        len = findMatch(dist, pos, std::min(inBufSize - pos, size_t(258)),
+                        32768);
+        // short matches with a long distance are not worth encoding
+        if (len == 3 && dist > 4096)
+          len = 0;
+        insertHash(pos);
+      }
+      if (prvLen)
+      {
+        if (len > prvLen)
+        {
+          // the match at the next position is longer, output a literal
+          addSymbol(inBuf[pos - 1], 0);
+          prvLen = len;
+          prvDist = dist;
+          pos++;
+          continue;
+        }
+        addSymbol((unsigned int) prvLen, (unsigned int) prvDist);
+        size_t  endPos = pos - 1 + prvLen;
+        for (pos++; pos < endPos; pos++)
+        {
+          if ((pos + 3) <= inBufSize)
+            insertHash(pos);
+        }
+        prvLen = 0;
+        continue;
+      }
+      if (len)
+      {
+        if (lazyMatching && len < niceMatchLen)
+        {
+          prvLen = len;
+          prvDist = dist;
+          pos++;
+          continue;
+        }
+        addSymbol((unsigned int) len, (unsigned int) dist);
+        size_t  endPos = pos + len;
+        for (pos++; pos < endPos; pos++)
+        {
+          if ((pos + 3) <= inBufSize)
+            insertHash(pos);
+        }
+        continue;
+      }
+      addSymbol(inBuf[pos], 0);
+      pos++;
+    }
+    if (prvLen)
+      addSymbol((unsigned int) prvLen, (unsigned int) prvDist);
+    writeBlock(true);
+  }
+  flushBits();
+  std::uint32_t a = ZLibDecompressor::calculateAdler32(inBuf, inBufSize, 1U);
+  for (int i = 24; i >= 0; i = i - 8)
+    outBuf.push_back((unsigned char) ((a >> i) & 0xFFU));
+}
+
+void ZLibCompressor::compressLZ4Block()
+{
+  // the last 5 bytes are always literals, and the last match must start
+  // at least 12 bytes before the end of the block
+  size_t  litStart = 0;
+  size_t  pos = 0;
+  while (maxChainLen && (pos + 12) <= inBufSize)
+  {
+    size_t  dist = 0;
+    size_t  len = findMatch(dist, pos, inBufSize - 5 - pos, 65535);
+    insertHash(pos);
+    if (!len)
+    {
+      pos++;
+      continue;
+    }
+    size_t  litLen = pos - litStart;
+    outBuf.push_back((unsigned char) ((std::min(litLen, size_t(15)) << 4)
+                                      | std::min(len - 4, size_t(15))));
+    if (litLen >= 15)
+    {
+      for (size_t i = litLen - 15; true; i = i - 255)
+      {
+        outBuf.push_back((unsigned char) std::min(i, size_t(255)));
+        if (i < 255)
+          break;
+      }
+    }
+    outBuf.insert(outBuf.end(), inBuf + litStart, inBuf + pos);
+    outBuf.push_back((unsigned char) (dist & 0xFF));
+    outBuf.push_back((unsigned char) (dist >> 8));
+    if (len >= 19)
+    {
+      for (size_t i = len - 19; true; i = i - 255)
+      {
+        outBuf.push_back((unsigned char) std::min(i, size_t(255)));
+        if (i < 255)
+          break;
+      }
+    }
+    size_t  endPos = pos + len;
+    if (maxChainLen > 4U)
+    {
+      for (pos++; pos < endPos && (pos + 4) <= inBufSize; pos++)
+        insertHash(pos);
+    }
+    pos = endPos;
+    litStart = pos;
+  }
+  // final sequence with literals only
+  size_t  litLen = inBufSize - litStart;
+  outBuf.push_back((unsigned char) (std::min(litLen, size_t(15)) << 4));
+  if (litLen >= 15)
+  {
+    for (size_t i = litLen - 15; true; i = i - 255)
+    {
+      outBuf.push_back((unsigned char) std::min(i, size_t(255)));
+      if (i < 255)
+        break;
+    }
+  }
+  outBuf.insert(outBuf.end(), inBuf + litStart, inBuf + inBufSize);
+}
+
+void ZLibCompressor::compressData(
+    std::vector< unsigned char >& outBuf,
+    const unsigned char *inBuf, size_t inBufSize, int compressionLevel)
+{
+  if (inBufSize > 0x7FFFFFFF)
+    errorMessage("input data is too large for ZLib compression");
+  outBuf.reserve(outBuf.size() + inBufSize + (inBufSize >> 10) + 64);
+  ZLibCompressor  zlibCompressor(outBuf, inBuf, inBufSize,
+                                 compressionLevel, 3U);
+  zlibCompressor.compressZLib();
+}
+
+void ZLibCompressor::compressLZ4Raw(
+    std::vector< unsigned char >& outBuf,
+    const unsigned char *inBuf, size_t inBufSize, int compressionLevel)
+{
+  if (inBufSize > 0x7E000000)
+    errorMessage("input data is too large for LZ4 compression");
+  outBuf.reserve(outBuf.size() + inBufSize + (inBufSize / 255) + 16);
+  ZLibCompressor  zlibCompressor(outBuf, inBuf, inBufSize,
+                                 std::max(compressionLevel, 1), 4U);
+  zlibCompressor.compressLZ4Block();
+}
+
+static std::uint32_t calculateXXHash32(const unsigned char *buf, size_t n)
+{
+  // simplified version of XXH32 with seed = 0, for n < 16 only
+  std::uint32_t h = 0x165667B1U + std::uint32_t(n);
+  for ( ; n >= 4; buf = buf + 4, n = n - 4)
+  {
+    h = h + (FileBuffer::readUInt32Fast(buf) * 0xC2B2AE3DU);
+    h = std::rotl(h, 17) * 0x27D4EB2FU;
+  }
+  for ( ; n; buf++, n--)
+  {
+    h = h + (std::uint32_t(*buf) * 0x165667B1U);
+    h = std::rotl(h, 11) * 0x9E3779B1U;
+  }
+  h = (h ^ (h >> 15)) * 0x85EBCA77U;
+  h = (h ^ (h >> 13)) * 0xC2B2AE3DU;
+  return (h ^ (h >> 16));
+}
+
+void ZLibCompressor::compressLZ4(
+    std::vector< unsigned char >& outBuf,
+    const unsigned char *inBuf, size_t inBufSize, int compressionLevel)
+{
+  // magic number, FLG = version 1 with independent blocks, BD = 4 MiB blocks
+  static const unsigned char  frameHeader[6] =
+  {
+    0x04, 0x22, 0x4D, 0x18, 0x60, 0x70
+  };
+  outBuf.insert(outBuf.end(), frameHeader, frameHeader + 6);
+  // header checksum
+  outBuf.push_back((unsigned char) (calculateXXHash32(frameHeader + 4, 2)
+                                    >> 8));
+  for (size_t offs = 0; offs < inBufSize; )
+  {
+    size_t  blockSize = std::min(inBufSize - offs, size_t(0x00400000));
+    size_t  n = outBuf.size();
+    outBuf.resize(n + 4);
+    compressLZ4Raw(outBuf, inBuf + offs, blockSize, compressionLevel);
+    size_t  packedSize = outBuf.size() - (n + 4);
+    if (packedSize >= blockSize)
+    {
+      // store incompressible data uncompressed
+      outBuf.resize(n + 4);
+      outBuf.insert(outBuf.end(), inBuf + offs, inBuf + (offs + blockSize));
+      packedSize = blockSize | 0x80000000U;
+    }
+    FileBuffer::writeUInt32Fast(outBuf.data() + n, std::uint32_t(packedSize));
+    offs = offs + blockSize;
+  }
+  for (int i = 0; i < 4; i++)           // EndMark
+    outBuf.push_back(0);
+}
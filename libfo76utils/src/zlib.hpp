@@ -9,7 +9,32 @@ class ZLibDecompressor
  protected:
   const unsigned char *inPtr;
   const unsigned char *inBufEnd;
+  // for streaming decompression, uncompressed data is passed to outputFunc
+  // when the output buffer is full, keeping the last 32 KiB as LZ77 history
+  void    (*outputFunc)(void *p, const unsigned char *buf, size_t nBytes);
+  void    *outputFuncData;
+  unsigned char *outputPtr;     // start of data not yet passed to outputFunc
+  size_t  outputSize;           // total number of bytes passed to outputFunc
+  size_t  outputSizeLimit;
+  unsigned int  outputChecksum; // Adler-32 checksum of the data written
   unsigned int  tableBuf[1312];         // 320 * 3 + 32 + 32 + 288
+  bool    fastDecodeEnabled;
+  // if false, the Adler-32 checksum is neither calculated nor verified
+  bool    verifyChecksum;
+  // wide decode tables used by decompressZLibBlockFast(), indexed with the
+  // next fastTableBitsL or fastTableBitsD bits of input. Each element is
+  // nBits | (type << 8) | (data << 16), where nBits is the total number of
+  // code bits, and type is one of:
+  //     0: code is longer than the table index (nBits = 0), or invalid
+  //     1: one literal byte (data)
+  //     2: two literal bytes (data & 0xFF, data >> 8)
+  //     3: length code, data = base length | (extra bits << 12)
+  //     4: end of block
+  // fastTableD elements are nBits | (extra bits << 8) | (base distance << 16)
+  static constexpr unsigned int fastTableBitsL = 11;
+  static constexpr unsigned int fastTableBitsD = 10;
+  std::uint32_t fastTableL[1 << fastTableBitsL];
+  std::uint32_t fastTableD[1 << fastTableBitsD];
   // huffTable[N] (0 <= N <= 255):
   //     fast decode table for code lengths <= 8, contains length | (C << 8),
   //     where C is the decoded symbol, or N bit reversed if length > 8
@@ -52,31 +77,141 @@ class ZLibDecompressor
   inline unsigned int readBitsRR(unsigned long long& sr, unsigned char nBits,
                                  unsigned int prefix = 0U);
   size_t decompressLZ4(unsigned char *buf, size_t uncompressedSize);
+  // decompress LZ4 block data to wp, matches can refer to data from buf
+  // copies are done in blocks of 8 or 16 bytes while there is enough space
+  // left in the buffers, returns the new write pointer
+  static unsigned char *decompressLZ4Block(
+      unsigned char *wp, unsigned char *buf, unsigned char *bufEnd,
+      const unsigned char *inBuf, const unsigned char *inBufEnd);
   unsigned long long huffmanInit(unsigned long long sr, bool useFixedEncoding);
   // lenTbl[c] = length of symbol 'c' (0: not used)
   static void huffmanBuildDecodeTable(
       unsigned int *huffTable, const unsigned char *lenTbl, size_t lenTblSize);
   inline unsigned int huffmanDecode(unsigned long long& sr,
                                     const unsigned int *huffTable);
+  static void huffmanBuildFastTable(std::uint32_t *fastTable,
+                                    const unsigned char *lenTbl,
+                                    size_t lenTblSize, bool isDistanceTable);
+  // decode a symbol using huffTable from at least 16 bits in bitBuf
+  static inline unsigned int huffmanDecodeLong(
+      std::uint64_t& bitBuf, unsigned int& bitCnt,
+      const unsigned int *huffTable);
+  // write data up to wp to outputFunc, and return the new write pointer
+  // throws an exception if streaming is not enabled
+  unsigned char *flushOutput(unsigned char *wp, unsigned char *buf);
   unsigned char *decompressZLibBlock(unsigned long long& srRef,
                                      unsigned char *wp,
                                      unsigned char *buf, unsigned char *bufEnd);
+  // decode symbols while there are at least 8 bytes of input and 274 bytes
+  // of output buffer space left, and return true at the end of the block
+  bool decompressZLibBlockFast(unsigned long long& srRef, unsigned char*& wpRef,
+                               unsigned char *buf, unsigned char *bufEnd);
   size_t decompressZLib(unsigned char *buf, size_t uncompressedSize);
-  static unsigned int calculateAdler32(const unsigned char *buf, size_t bufSize,
-                                       unsigned int a);
   ZLibDecompressor(const unsigned char *inBuf, size_t compressedSize)
     : inPtr(inBuf),
-      inBufEnd(inBuf + compressedSize)
+      inBufEnd(inBuf + compressedSize),
+      outputFunc(nullptr),
+      fastDecodeEnabled(true),
+      verifyChecksum(true)
   {
   }
  public:
+  // verifyChecksum = false skips the Adler-32 checksum of ZLib streams,
+  // which is faster, but does not detect all errors in corrupt data
+  // enableFastDecode = false uses only the slower decoder that checks the
+  // end of the buffers for each symbol, for testing and benchmarking
   static size_t decompressData(unsigned char *buf, size_t uncompressedSize,
                                const unsigned char *inBuf,
-                               size_t compressedSize);
+                               size_t compressedSize,
+                               bool verifyChecksum = true,
+                               bool enableFastDecode = true);
+  // decompress data to outputFunc in blocks of up to 256 KiB, using a fixed
+  // size buffer for ZLib compressed data
+  // throws an exception if the uncompressed size exceeds uncompressedSize,
+  // otherwise the number of bytes written is returned
+  static size_t decompressData(
+      void (*outputFunc)(void *p, const unsigned char *buf, size_t nBytes),
+      void *outputFuncData, size_t uncompressedSize,
+      const unsigned char *inBuf, size_t compressedSize,
+      bool verifyChecksum = true);
   // decompress headerless LZ4 block data
   static size_t decompressLZ4Raw(unsigned char *buf, size_t uncompressedSize,
                                  const unsigned char *inBuf,
                                  size_t compressedSize);
+  // update Adler-32 checksum 'a' (1 at the start of the data)
+  static unsigned int calculateAdler32(const unsigned char *buf, size_t bufSize,
+                                       unsigned int a);
+};
+
+class ZLibCompressor
+{
+ protected:
+  struct LZ77Symbol
+  {
+    std::uint16_t len;                  // literal byte if dist is 0
+    std::uint16_t dist;
+  };
+  const unsigned char *inBuf;
+  size_t  inBufSize;
+  std::vector< unsigned char >& outBuf;
+  unsigned long long  bitBuf;
+  unsigned int  bitCnt;
+  // LZ77 match search parameters
+  unsigned int  minMatchLen;            // 3 for Deflate, 4 for LZ4
+  unsigned int  hashShift;
+  unsigned int  maxChainLen;
+  unsigned int  niceMatchLen;
+  bool    lazyMatching;
+  // hashTable[H] = last position with hash H, or -1,
+  // prvTable[P & prvTableMask] = previous position with the same hash as P
+  std::vector< std::int32_t > hashTable;
+  std::vector< std::int32_t > prvTable;
+  size_t  prvTableMask;
+  // Deflate block data
+  std::vector< LZ77Symbol > symbolBuf;
+  size_t  blockStart;
+  size_t  blockEnd;
+  unsigned int  litFreqs[286];
+  unsigned int  distFreqs[30];
+  ZLibCompressor(std::vector< unsigned char >& buf,
+                 const unsigned char *inBufPtr, size_t inBufLen,
+                 int compressionLevel, unsigned int minLen);
+  inline std::uint32_t hashFunction(size_t pos) const;
+  inline void insertHash(size_t pos);
+  // returns the length of the longest match found at pos, or 0
+  // dist is set to the distance of the match
+  inline size_t findMatch(size_t& dist, size_t pos, size_t maxLen,
+                          size_t maxDist) const;
+  inline void writeBits(unsigned int b, unsigned int nBits);
+  void flushBits();
+  // calculate length limited Huffman code lengths from symbol frequencies
+  static void huffmanBuildLengths(unsigned char *lenTbl,
+                                  const unsigned int *freqs, size_t n,
+                                  unsigned int maxLen);
+  // convert code lengths to bit reversed canonical codes
+  static void huffmanBuildCodes(unsigned short *codeTbl,
+                                const unsigned char *lenTbl, size_t n);
+  static inline unsigned int getLengthCode(unsigned int len);
+  static inline unsigned int getDistanceCode(unsigned int dist);
+  inline void addSymbol(unsigned int len, unsigned int dist);
+  void writeStoredBlock(bool isLastBlock);
+  void writeBlock(bool isLastBlock);
+  void compressZLib();
+  void compressLZ4Block();
+ public:
+  // compress data in ZLib format, and append it to outBuf
+  // compressionLevel can be 0 (no compression) to 9 (best compression)
+  static void compressData(std::vector< unsigned char >& outBuf,
+                           const unsigned char *inBuf, size_t inBufSize,
+                           int compressionLevel = 6);
+  // compress data to headerless LZ4 block format, and append it to outBuf
+  static void compressLZ4Raw(std::vector< unsigned char >& outBuf,
+                             const unsigned char *inBuf, size_t inBufSize,
+                             int compressionLevel = 6);
+  // compress data to LZ4 frame format with independent blocks
+  static void compressLZ4(std::vector< unsigned char >& outBuf,
+                          const unsigned char *inBuf, size_t inBufSize,
+                          int compressionLevel = 6);
 };
 
 #endif
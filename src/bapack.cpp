@@ -0,0 +1,204 @@
+
+#include "common.hpp"
+#include "filebuf.hpp"
+#include "ba2file.hpp"
+#include "ba2writer.hpp"
+
+struct BA2NameFilters
+{
+  std::vector< std::string >  includePatterns;
+  std::vector< std::string >  excludePatterns;
+};
+
+static inline char convertNameCharacter(unsigned char c)
+{
+  if (c >= 'A' && c <= 'Z')
+    return char(c + ('a' - 'A'));
+  if (c == '\\')
+    return '/';
+  if (c <= (unsigned char) ' ')
+    return ' ';
+  return char(c);
+}
+
+static inline bool checkNamePattern(
+    const std::string_view& fileName, const std::string_view& pattern)
+{
+  size_t  n = pattern.length() - 4;
+  if (!(n & ~(size_t(1))) && pattern[0] == '.')
+  {
+    if (fileName.length() < pattern.length()) [[unlikely]]
+      return false;
+    const char  *s1 = fileName.data() + (fileName.length() - 4);
+    const char  *s2 = pattern.data() + n;
+    if (FileBuffer::readUInt32Fast(s1) != FileBuffer::readUInt32Fast(s2))
+      return false;
+    if (!n)
+      return true;
+    return (*(s1 - 1) == '.');
+  }
+  return (fileName.find(pattern) != std::string_view::npos);
+}
+
+static bool archiveFilterFunction(void *p, const std::string_view& fileName)
+{
+  BA2NameFilters& nameFilters = *(reinterpret_cast< BA2NameFilters * >(p));
+  bool    nameMatches = nameFilters.includePatterns.empty();
+  for (const auto& i : nameFilters.includePatterns)
+  {
+    if (checkNamePattern(fileName, i))
+    {
+      nameMatches = true;
+      break;
+    }
+  }
+  if (!nameMatches)
+    return false;
+  for (const auto& i : nameFilters.excludePatterns)
+  {
+    if (checkNamePattern(fileName, i))
+      return false;
+  }
+  return true;
+}
+
+int main(int argc, char **argv)
+{
+  try
+  {
+    BA2NameFilters  nameFilters;
+    int     threadCnt = 0;
+    int     compressionType = BA2Writer::compressionZLib;
+    int     compressionLevel = 6;
+    int     archiveType = -1;           // -1: auto, 0: GNRL, 1: DX10
+    while (argc >= 2 && argv[1][0] == '-' && argv[1][1] != '-')
+    {
+      int     n = 1;
+      if (std::strcmp(argv[1], "-threads") == 0 ||
+          std::strcmp(argv[1], "-level") == 0)
+      {
+        if (argc < 3)
+          throw FO76UtilsError("missing argument for %s", argv[1]);
+        if (argv[1][1] == 't')
+          threadCnt = int(parseInteger(argv[2], 10, "invalid thread count",
+                                       1, 64));
+        else
+          compressionLevel = int(parseInteger(argv[2], 10,
+                                              "invalid compression level",
+                                              0, 9));
+        n = 2;
+      }
+      else if (std::strcmp(argv[1], "-zlib") == 0)
+      {
+        compressionType = BA2Writer::compressionZLib;
+      }
+      else if (std::strcmp(argv[1], "-lz4") == 0)
+      {
+        compressionType = BA2Writer::compressionLZ4;
+      }
+      else if (std::strcmp(argv[1], "-store") == 0)
+      {
+        compressionType = BA2Writer::compressionNone;
+      }
+      else if (std::strcmp(argv[1], "-gnrl") == 0)
+      {
+        archiveType = 0;
+      }
+      else if (std::strcmp(argv[1], "-dx10") == 0)
+      {
+        archiveType = 1;
+      }
+      else
+      {
+        throw FO76UtilsError("invalid option: %s", argv[1]);
+      }
+      argv[n] = argv[0];
+      argc = argc - n;
+      argv = argv + n;
+    }
+    int     inputCnt = argc - 2;
+    for (int i = 2; i < argc; i++)
+    {
+      if (std::strcmp(argv[i], "--") != 0)
+        continue;
+      inputCnt = i - 2;
+      while (++i < argc)
+      {
+        std::string s;
+        bool    isExclude =
+            (argv[i][0] == '-' && argv[i][1] == 'x' && argv[i][2] == ':');
+        for (size_t j = (!isExclude ? 0 : 3); argv[i][j] != '\0'; j++)
+          s += convertNameCharacter((unsigned char) argv[i][j]);
+        if (s.empty() || (s == "*" && !isExclude))
+          continue;
+        if (!isExclude)
+          nameFilters.includePatterns.push_back(s);
+        else
+          nameFilters.excludePatterns.push_back(s);
+      }
+      break;
+    }
+    if (inputCnt < 1)
+    {
+      std::fprintf(stderr, "Usage:\n\n");
+      std::fprintf(stderr, "%s [OPTIONS...] OUTFILE.BA2 INPUTS... "
+                           "[-- PATTERNS...]\n\n", argv[0]);
+      std::fprintf(stderr, "Create a BA2 archive from the files in INPUTS "
+                           "(archives, directories or\n");
+      std::fprintf(stderr, "loose files) with a name including any of "
+                           "the patterns. Inputs listed\n");
+      std::fprintf(stderr, "first have higher priority, "
+                           "patterns beginning with -x: exclude files.\n\n");
+      std::fprintf(stderr, "Options:\n");
+      std::fprintf(stderr, "    -threads N      number of threads to use "
+                           "for loading and compression\n");
+      std::fprintf(stderr, "    -zlib           use ZLib compression "
+                           "(default)\n");
+      std::fprintf(stderr, "    -lz4            use LZ4 compression "
+                           "(Starfield format)\n");
+      std::fprintf(stderr, "    -store          do not compress files\n");
+      std::fprintf(stderr, "    -level N        compression level, "
+                           "0 to 9 (default: 6)\n");
+      std::fprintf(stderr, "    -gnrl           create a general archive\n");
+      std::fprintf(stderr, "    -dx10           create a texture archive\n");
+      std::fprintf(stderr, "The default archive type is DX10 if all files "
+                           "are textures, and GNRL otherwise.\n");
+      return 1;
+    }
+
+    BA2File ba2File;
+    ba2File.setLoadThreadCount(threadCnt);
+    for (int i = 2; i < (inputCnt + 2); i++)
+      ba2File.loadArchivePath(argv[i], &archiveFilterFunction, &nameFilters);
+    const std::vector< const BA2File::FileInfo * >& fileList =
+        ba2File.getSortedFileList();
+    if (fileList.size() < 1)
+      errorMessage("no matching files found");
+    if (archiveType < 0)
+    {
+      archiveType = 1;
+      for (const BA2File::FileInfo *fd : fileList)
+      {
+        if (!fd->fileName.ends_with(".dds"))
+        {
+          archiveType = 0;
+          break;
+        }
+      }
+    }
+    BA2Writer ba2Writer(argv[1], bool(archiveType), compressionType,
+                        compressionLevel);
+    ba2Writer.setThreadCount(threadCnt);
+    for (const BA2File::FileInfo *fd : fileList)
+      ba2Writer.addFile(ba2File, fd->fileName);
+    ba2Writer.writeArchive();
+    std::printf("%s: %lu files\n", argv[1], (unsigned long) ba2Writer.size());
+  }
+  catch (std::exception& e)
+  {
+    std::fprintf(stderr, "bapack: %s\n", e.what());
+    return 1;
+  }
+  return 0;
+}
+
@@ -3,6 +3,8 @@
 #include "filebuf.hpp"
 #include "ba2file.hpp"
 
+#include <chrono>
+
 #if defined(_WIN32) || defined(_WIN64)
 #  include <direct.h>
 #else
@@ -68,13 +70,12 @@ static void loadFileList(BA2NameFilters& fileNames, const char *listFileName)
   }
 }
 
-static void writeFileWithPath(const char *fileName,
-                              const BA2File::UCharArray& buf)
+// create output file, and any missing directories in its path
+static OutputFile *createFileWithPath(const char *fileName)
 {
-  OutputFile  *f = (OutputFile *) 0;
   try
   {
-    f = new OutputFile(fileName, 0);
+    return new OutputFile(fileName, 0);
   }
   catch (...)
   {
@@ -94,8 +95,14 @@ static void writeFileWithPath(const char *fileName,
       (void) mkdir(pathName.c_str(), 0755);
 #endif
     }
-    f = new OutputFile(fileName, 0);
   }
+  return new OutputFile(fileName, 0);
+}
+
+static void writeFileWithPath(const char *fileName,
+                              const BA2File::UCharArray& buf)
+{
+  OutputFile  *f = createFileWithPath(fileName);
   try
   {
     f->writeData(buf.data, sizeof(unsigned char) * buf.size);
@@ -108,6 +115,40 @@ static void writeFileWithPath(const char *fileName,
   delete f;
 }
 
+static void extractFileWithPath(const BA2File& ba2File,
+                                const BA2File::FileInfo& fd)
+{
+  OutputFile  *f = createFileWithPath(fd.fileName.data());
+  try
+  {
+    ba2File.extractFile(*f, fd);
+  }
+  catch (...)
+  {
+    // do not leave incomplete output files
+    delete f;
+    (void) std::remove(fd.fileName.data());
+    throw;
+  }
+  delete f;
+}
+
+static void testFileFunction(void *p, const unsigned char *buf, size_t nBytes)
+{
+  (void) p;
+  (void) buf;
+  (void) nBytes;
+}
+
+// called from multiple threads by BA2File::extractFiles()
+static void extractFileFunction(void *p, const BA2File::FileInfo& fd,
+                                const BA2File::UCharArray& buf)
+{
+  std::printf("%s\t%8u bytes\n", fd.fileName.data(), (unsigned int) buf.size);
+  if (!*(reinterpret_cast< bool * >(p)))
+    writeFileWithPath(fd.fileName.data(), buf);
+}
+
 static inline bool checkNamePattern(
     const std::string_view& fileName, const std::string_view& pattern)
 {
@@ -164,11 +205,45 @@ static bool archiveFilterFunction(void *p, const std::string_view& fileName)
   return true;
 }
 
+static void printLoadStatistics(std::chrono::steady_clock::duration t,
+                                size_t fileCnt, size_t archiveCnt)
+{
+  std::fprintf(stderr, "Loaded %lu files from %lu archives in %.3f seconds\n",
+               (unsigned long) fileCnt, (unsigned long) archiveCnt,
+               std::chrono::duration< double >(t).count());
+}
+
 int main(int argc, char **argv)
 {
   try
   {
     BA2NameFilters  nameFilters;
+    int     threadCnt = 0;
+    bool    printLoadTime = false;
+    while (argc >= 2 && argv[1][0] == '-' && argv[1][1] != '-')
+    {
+      if (std::strcmp(argv[1], "-threads") == 0)
+      {
+        if (argc < 3)
+          throw FO76UtilsError("missing argument for %s", argv[1]);
+        threadCnt = int(parseInteger(argv[2], 10, "invalid thread count",
+                                     1, 64));
+        argv[2] = argv[0];
+        argc = argc - 2;
+        argv = argv + 2;
+      }
+      else if (std::strcmp(argv[1], "-time") == 0)
+      {
+        printLoadTime = true;
+        argv[1] = argv[0];
+        argc--;
+        argv++;
+      }
+      else
+      {
+        throw FO76UtilsError("invalid option: %s", argv[1]);
+      }
+    }
     int     archiveCnt = argc - 1;
     bool    extractingFiles = false;
     bool    listPackedSizes = false;
@@ -219,6 +294,16 @@ int main(int argc, char **argv)
     if (archiveCnt < 1)
     {
       std::fprintf(stderr, "Usage:\n\n");
+      std::fprintf(stderr, "%s [OPTIONS...] ARCHIVES... [MODE...]\n\n",
+                   argv[0]);
+      std::fprintf(stderr, "Options:\n");
+      std::fprintf(stderr, "    -threads N      number of threads to use "
+                           "for indexing archives,\n");
+      std::fprintf(stderr, "                    and for extracting files "
+                           "if N > 1\n");
+      std::fprintf(stderr, "    -time           print the time spent on "
+                           "loading archives\n\n");
+      std::fprintf(stderr, "Modes:\n");
       std::fprintf(stderr, "%s ARCHIVES...\n", argv[0]);
       std::fprintf(stderr, "    List the contents of .ba2 or .bsa files, "
                            "or archive directories\n");
@@ -249,11 +334,22 @@ int main(int argc, char **argv)
     }
 
     std::set< std::string_view >  namesFound;
+    std::chrono::steady_clock::duration loadTime(0);
+    size_t  loadFileCnt = 0;
+    size_t  loadArchiveCnt = 0;
     if (!extractingFiles)
     {
       for (int i = 1; i <= archiveCnt; i++)
       {
-        BA2File ba2File(argv[i], &archiveFilterFunction, &nameFilters);
+        BA2File ba2File;
+        ba2File.setLoadThreadCount(threadCnt);
+        ba2File.setIndexCachePath(BA2File::getDefaultIndexCachePath());
+        std::chrono::steady_clock::time_point t0 =
+            std::chrono::steady_clock::now();
+        ba2File.loadArchivePath(argv[i], &archiveFilterFunction, &nameFilters);
+        loadTime += (std::chrono::steady_clock::now() - t0);
+        loadFileCnt += ba2File.size();
+        loadArchiveCnt += ba2File.getArchiveFileCnt();
         std::vector< std::string_view > fileList;
         ba2File.getFileList(fileList);
         if (fileList.size() > 0)
@@ -271,22 +367,53 @@ int main(int argc, char **argv)
     else
     {
       BA2File ba2File;
+      ba2File.setLoadThreadCount(threadCnt);
+      ba2File.setIndexCachePath(BA2File::getDefaultIndexCachePath());
+      std::chrono::steady_clock::time_point t0 =
+          std::chrono::steady_clock::now();
       for (int i = 1; i <= archiveCnt; i++)
         ba2File.loadArchivePath(argv[i], &archiveFilterFunction, &nameFilters);
+      loadTime = std::chrono::steady_clock::now() - t0;
+      loadFileCnt = ba2File.size();
+      loadArchiveCnt = ba2File.getArchiveFileCnt();
+      if (printLoadTime)
+      {
+        printLoadStatistics(loadTime, loadFileCnt, loadArchiveCnt);
+        printLoadTime = false;
+      }
       std::vector< std::string_view > fileList;
       ba2File.getFileList(fileList);
-      BA2File::UCharArray outBuf;
-      for (const auto& i : fileList)
+      if (threadCnt > 1)
+      {
+        std::vector< const BA2File::FileInfo * >  extractList;
+        for (const auto& i : fileList)
+        {
+          if (nameFilters.fileNames.find(i) != nameFilters.fileNames.end())
+            namesFound.insert(i);
+          extractList.push_back(ba2File.findFile(i));
+        }
+        ba2File.extractFiles(extractList, &extractFileFunction,
+                             &testingFiles, threadCnt);
+      }
+      else
       {
-        if (nameFilters.fileNames.find(i) != nameFilters.fileNames.end())
-          namesFound.insert(i);
-        std::printf("%s\t%8u bytes\n",
-                    i.data(), (unsigned int) ba2File.getFileSize(i));
-        ba2File.extractFile(outBuf, i);
-        if (!testingFiles)
-          writeFileWithPath(i.data(), outBuf);
+        // files are extracted in blocks to limit memory usage
+        for (const auto& i : fileList)
+        {
+          if (nameFilters.fileNames.find(i) != nameFilters.fileNames.end())
+            namesFound.insert(i);
+          std::printf("%s\t%8u bytes\n",
+                      i.data(), (unsigned int) ba2File.getFileSize(i));
+          const BA2File::FileInfo&  fd = *(ba2File.findFile(i));
+          if (!testingFiles)
+            extractFileWithPath(ba2File, fd);
+          else
+            ba2File.extractFile(&testFileFunction, nullptr, fd);
+        }
       }
     }
+    if (printLoadTime)
+      printLoadStatistics(loadTime, loadFileCnt, loadArchiveCnt);
     if (namesFound.size() != nameFilters.fileNames.size())
     {
       std::fprintf(stderr, "\n%s: file(s) not found in archives:\n", argv[0]);
@@ -5,6 +5,358 @@
 #include "ddstxt.hpp"
 #include "sfcube.hpp"
 
+#include <chrono>
+
+// check that the _x8 sampling functions return the same results as the
+// single sample functions, 't2' is a texture of half size or nullptr
+static void compareBatchedSampling(const DDSTexture& t, const DDSTexture *t2,
+                                   float maxMip, size_t sampleCnt,
+                                   const char *modeName)
+{
+  static const char *functionNames[4] =
+  {
+    "getPixelT", "getPixelT_N", "getPixelT_2", "getPixelT_2"
+  };
+  const DDSTexture& tHalf = (!t2 ? t : *t2);
+  float   w = float(t.getWidth());
+  float   h = float(t.getHeight());
+  std::uint32_t seed = 1U;
+  for (size_t k = 0; k < sampleCnt; k = k + 8)
+  {
+    float   x[8];
+    float   y[8];
+    float   mipLevels[8];
+    for (int i = 0; i < 8; i++)
+    {
+      seed = (seed * 1664525U) + 1013904223U;
+      x[i] = float(int(seed >> 8)) * (1.0f / 16777216.0f);
+      seed = (seed * 1664525U) + 1013904223U;
+      y[i] = float(int(seed >> 8)) * (1.0f / 16777216.0f);
+      // every other batch uses the same mip level in all lanes
+      if (!i || (k & 8))
+      {
+        seed = (seed * 1664525U) + 1013904223U;
+        mipLevels[i] = float(int(seed >> 8)) * (1.0f / 16777216.0f) * maxMip;
+      }
+      else
+      {
+        mipLevels[i] = mipLevels[0];
+      }
+    }
+    FloatVector8  xv(&(x[0]));
+    FloatVector8  yv(&(y[0]));
+    FloatVector8  mipLevel(&(mipLevels[0]));
+    FloatVector8  mipLevel2(mipLevel - FloatVector8(1.0f));
+    mipLevel2.maxValues(FloatVector8(0.0f));
+    for (int j = 0; j < 4; j++)
+    {
+      FloatVector8  c[4];
+      if (j == 0)
+        t.getPixelT_x8(c, xv, yv, mipLevel);
+      else if (j == 1)
+        t.getPixelT_N_x8(c, xv * w, yv * h, mipLevel);
+      else if (j == 2)
+        t.getPixelT_2_x8(c, xv, yv, mipLevel, tHalf);
+      else
+        tHalf.getPixelT_2_x8(c, xv, yv, (!t2 ? mipLevel : mipLevel2), t);
+      for (int i = 0; i < 8; i++)
+      {
+        FloatVector4  tmp;
+        if (j == 0)
+          tmp = t.getPixelT(x[i], y[i], mipLevels[i]);
+        else if (j == 1)
+          tmp = t.getPixelT_N(x[i] * w, y[i] * h, mipLevels[i]);
+        else if (j == 2)
+          tmp = t.getPixelT_2(x[i], y[i], mipLevels[i], tHalf);
+        else
+        {
+          tmp = tHalf.getPixelT_2(x[i], y[i],
+                                  (!t2 ? mipLevel : mipLevel2)[i], t);
+        }
+        for (int l = 0; l < 4; l++)
+        {
+          if (c[l][i] != tmp[l])
+          {
+            throw FO76UtilsError("%s_x8 does not match %s in %s mode",
+                                 functionNames[j], functionNames[j],
+                                 modeName);
+          }
+        }
+      }
+    }
+  }
+}
+
+// compare the memory use, load time and sampling throughput of a texture
+// loaded with the blocks decoded, kept compressed (BCn-resident), and with
+// the mip levels decoded on demand
+static void compareResidentMode(const char *fileName, size_t sampleCnt)
+{
+  static const char *modeNames[4] =
+  {
+    "decoded", "resident", "lazy", "lazy+resident"
+  };
+  FileBuffer  inFile(fileName);
+  // textures[4] to textures[7] are loaded with a mip offset of 1, for
+  // testing getPixelT_2() with textures of different sizes
+  DDSTexture  *textures[8] =
+  {
+    nullptr, nullptr, nullptr, nullptr, nullptr, nullptr, nullptr, nullptr
+  };
+  try
+  {
+    double  loadTimes[4];
+    for (int i = 0; i < 4; i++)
+    {
+      std::chrono::steady_clock::time_point t0 =
+          std::chrono::steady_clock::now();
+      textures[i] = new DDSTexture(inFile, 0, i);
+      loadTimes[i] = std::chrono::duration< double >(
+                         std::chrono::steady_clock::now() - t0).count();
+    }
+    if (textures[0]->getMaxMipLevel() > 0)
+    {
+      for (int i = 0; i < 4; i++)
+        textures[i + 4] = new DDSTexture(inFile, 1, i);
+    }
+    if (!textures[1]->isBlockCompressed())
+    {
+      std::printf("warning: texture format or layout is not supported "
+                  "by BCn-resident mode\n");
+    }
+    if (!textures[2]->isDecodedOnDemand())
+    {
+      std::printf("warning: texture format or layout is not supported "
+                  "by lazy mip level decoding\n");
+    }
+    float   maxMip = float(textures[0]->getMaxMipLevel());
+    // the first test only samples mip level 2, and the memory used is
+    // printed both after loading the texture and after this test
+    int     m2 = std::min(textures[0]->getMaxMipLevel(), 2);
+    std::printf("%-13s  %9s  %10s  %10s  %10s  %11s  %11s\n",
+                "Mode", "Load (ms)", "KB loaded", "KB mip 2",
+                "Mip 2 MS/s", "Random MS/s", "Linear MS/s");
+    FloatVector4  checksums[4][3];
+    for (int i = 0; i < 4; i++)
+    {
+      const DDSTexture& t = *(textures[i]);
+      size_t  dataSizes[2];
+      dataSizes[0] = t.getDataSize();
+      double  sampleRates[3];
+      for (int j = 0; j < 3; j++)
+      {
+        FloatVector4  c(0.0f);
+        std::uint32_t seed = 1U;
+        int     m = (!j ? m2 : 0);
+        float   w = float(t.getWidth() >> m);
+        float   h = float(t.getHeight() >> m);
+        std::chrono::steady_clock::time_point t0 =
+            std::chrono::steady_clock::now();
+        for (size_t k = 0; k < sampleCnt; k++)
+        {
+          float   x, y;
+          float   mipLevel = float(m);
+          if (j == 1)
+          {
+            // random coordinates and trilinear filtering
+            seed = (seed * 1664525U) + 1013904223U;
+            x = float(int(seed >> 8)) * (1.0f / 16777216.0f);
+            seed = (seed * 1664525U) + 1013904223U;
+            y = float(int(seed >> 8)) * (1.0f / 16777216.0f);
+            seed = (seed * 1664525U) + 1013904223U;
+            mipLevel = float(int(seed >> 8)) * (1.0f / 16777216.0f) * maxMip;
+          }
+          else
+          {
+            // scan line order at mip level 2 or 0
+            x = (float(int(k % size_t(w))) + 0.25f) / w;
+            y = (float(int((k / size_t(w)) % size_t(h))) + 0.25f) / h;
+          }
+          c += t.getPixelT(x, y, mipLevel);
+        }
+        double  tmp = std::chrono::duration< double >(
+                          std::chrono::steady_clock::now() - t0).count();
+        sampleRates[j] = double(sampleCnt) / (tmp * 1000000.0);
+        checksums[i][j] = c;
+        if (!j)
+          dataSizes[1] = t.getDataSize();
+      }
+      std::printf("%-13s  %9.3f  %10.1f  %10.1f  %10.3f  %11.3f  %11.3f\n",
+                  modeNames[i], loadTimes[i] * 1000.0,
+                  double(dataSizes[0]) / 1024.0,
+                  double(dataSizes[1]) / 1024.0,
+                  sampleRates[0], sampleRates[1], sampleRates[2]);
+    }
+    // getPixelT_2() with a second texture of the same size, and of half
+    // and double the size if there are at least two mip levels
+    for (int i = 0; i < 4; i++)
+    {
+      const DDSTexture& t = *(textures[i]);
+      const DDSTexture  *t2 = textures[i + 4];
+      FloatVector4  c(0.0f);
+      std::uint32_t seed = 1U;
+      for (size_t k = 0; k < sampleCnt; k++)
+      {
+        seed = (seed * 1664525U) + 1013904223U;
+        float   x = float(int(seed >> 8)) * (1.0f / 16777216.0f);
+        seed = (seed * 1664525U) + 1013904223U;
+        float   y = float(int(seed >> 8)) * (1.0f / 16777216.0f);
+        seed = (seed * 1664525U) + 1013904223U;
+        float   mipLevel =
+            float(int(seed >> 8)) * (1.0f / 16777216.0f) * maxMip;
+        if (!t2)
+          c += t.getPixelT_2(x, y, mipLevel, t);
+        else if (k & 1)
+          c += t.getPixelT_2(x, y, mipLevel, *t2);
+        else
+          c += t2->getPixelT_2(x, y, std::max(mipLevel - 1.0f, 0.0f), t);
+      }
+      checksums[i][2] = checksums[i][2] + c;
+      compareBatchedSampling(t, t2, maxMip, sampleCnt, modeNames[i]);
+    }
+    for (int i = 1; i < 4; i++)
+    {
+      for (int j = 0; j < 3; j++)
+      {
+        for (int k = 0; k < 4; k++)
+        {
+          if (checksums[0][j][k] != checksums[i][j][k])
+          {
+            throw FO76UtilsError("sampled data does not match in %s mode",
+                                 modeNames[i]);
+          }
+        }
+      }
+    }
+  }
+  catch (...)
+  {
+    for (int i = 0; i < 8; i++)
+      delete textures[i];
+    throw;
+  }
+  for (int i = 0; i < 8; i++)
+    delete textures[i];
+}
+
+class DDSTextureBench : public DDSTexture
+{
+ protected:
+  // BC7 decoder without the mode 6 fast path
+  static size_t decodeBlock_BC7_detex(
+      std::uint32_t *dst, const unsigned char *src, unsigned int w);
+ public:
+  // decode a w * h texture using the single block (useRowDecoder = false)
+  // or the row decode function of the format, returns the time in seconds
+  static double decodeTexture(std::uint32_t *dst, const unsigned char *src,
+                              unsigned int w, unsigned int h,
+                              unsigned char dxgiFmt, bool useRowDecoder);
+};
+
+size_t DDSTextureBench::decodeBlock_BC7_detex(
+    std::uint32_t *dst, const unsigned char *src, unsigned int w)
+{
+  std::uint32_t tmp[16];
+  if (!detexDecompressBlockBPTC(
+           reinterpret_cast< const std::uint8_t * >(src), 0xFFFFFFFFU, 0U,
+           reinterpret_cast< std::uint8_t * >(&(tmp[0]))))
+  {
+    for (unsigned int i = 0; i < 16; i++)
+      tmp[i] = 0U;
+  }
+  for (unsigned int i = 0; i < 16; i++)
+    dst[(i >> 2) * w + (i & 3)] = tmp[i];
+  return 16;
+}
+
+double DDSTextureBench::decodeTexture(
+    std::uint32_t *dst, const unsigned char *src,
+    unsigned int w, unsigned int h, unsigned char dxgiFmt, bool useRowDecoder)
+{
+  const DXGIFormatInfo& fmtInfo = dxgiFormatInfoTable[dxgiFormatMap[dxgiFmt]];
+  size_t  (*decodeFunction)(std::uint32_t *, const unsigned char *,
+                            unsigned int) = fmtInfo.decodeFunction;
+  if (fmtInfo.decodeFunction == &decodeBlock_BC7)
+    decodeFunction = &decodeBlock_BC7_detex;
+  std::chrono::steady_clock::time_point t0 = std::chrono::steady_clock::now();
+  for (unsigned int y = 0; y < h; y = y + 4)
+  {
+    std::uint32_t *p = dst + (size_t(y) * w);
+    if (useRowDecoder)
+    {
+      src = src + fmtInfo.decodeRowFunction(p, src, w);
+      continue;
+    }
+    for (unsigned int x = 0; x < w; x = x + 4)
+      src = src + decodeFunction(p + x, src, w);
+  }
+  return std::chrono::duration< double >(
+             std::chrono::steady_clock::now() - t0).count();
+}
+
+// compare the speed of the single block and row BCn decoders
+// on random input data
+static void runDecodeBenchmark(size_t dataSize)
+{
+  static const unsigned char  formats[10] =
+  {
+    0x47, 0x4A, 0x4D, 0x50, 0x51, 0x53, 0x54, 0x5F, 0x62, 0x62
+  };
+  static const char *formatNames[10] =
+  {
+    "BC1", "BC2", "BC3", "BC4", "BC4S", "BC5", "BC5S", "BC6U",
+    "BC7 (mode 6)", "BC7 (all modes)"
+  };
+  const unsigned int  w = 1024;
+  std::vector< unsigned char >  srcBuf;
+  std::vector< std::uint32_t >  outBuf1;
+  std::vector< std::uint32_t >  outBuf2;
+  std::printf("%-16s  %12s  %12s  %8s\n",
+              "Format", "Block MB/s", "Row MB/s", "Speedup");
+  for (int i = 0; i < 10; i++)
+  {
+    size_t  blockSize = (formats[i] == 0x47 || formats[i] == 0x50 ||
+                         formats[i] == 0x51 ? 8 : 16);
+    unsigned int  h = (unsigned int) (dataSize / (size_t(w) * blockSize))
+                      & ~3U;
+    h = std::max(h, 4U);
+    size_t  n = size_t(w >> 2) * (h >> 2) * blockSize;
+    srcBuf.resize(n);
+    std::uint32_t seed = 1U;
+    for (size_t j = 0; j < n; j++)
+    {
+      seed = (seed * 1664525U) + 1013904223U;
+      srcBuf[j] = (unsigned char) (seed >> 24);
+    }
+    if (formats[i] == 0x62)
+    {
+      // set a valid mode in the first byte of each block
+      for (size_t j = 0; j < n; j = j + 16)
+      {
+        unsigned int  mode = 6;
+        if (i == 9)
+          mode = (srcBuf[j + 1] >> 1) & 7;
+        srcBuf[j] = (unsigned char) (((srcBuf[j] << 1) | 1U) << mode);
+      }
+    }
+    outBuf1.resize(size_t(w) * h);
+    outBuf2.resize(size_t(w) * h);
+    double  t1 = DDSTextureBench::decodeTexture(
+                     outBuf1.data(), srcBuf.data(), w, h, formats[i], false);
+    double  t2 = DDSTextureBench::decodeTexture(
+                     outBuf2.data(), srcBuf.data(), w, h, formats[i], true);
+    if (std::memcmp(outBuf1.data(), outBuf2.data(),
+                    outBuf1.size() * sizeof(std::uint32_t)) != 0)
+    {
+      throw FO76UtilsError("%s: decoded data does not match",
+                           formatNames[i]);
+    }
+    double  mbytes = double(n) / 1048576.0;
+    std::printf("%-16s  %12.1f  %12.1f  %8.2f\n",
+                formatNames[i], mbytes / t1, mbytes / t2, t1 / t2);
+  }
+}
+
 int main(int argc, char **argv)
 {
   if (argc < 2)
@@ -18,7 +370,10 @@ int main(int argc, char **argv)
                  "OUTFILE.DDS -cube_filter [WIDTH [ROUGHNESS...]]\n");
     std::fprintf(stderr,
                  "    bcdecode INFILE.HDR "
-                 "OUTFILE.DDS -cube [WIDTH [MAXLEVEL [DXGI_FMT]]]\n\n");
+                 "OUTFILE.DDS -cube [WIDTH [MAXLEVEL [DXGI_FMT]]]\n");
+    std::fprintf(stderr,
+                 "    bcdecode INFILE.DDS -resident [SAMPLES]\n");
+    std::fprintf(stderr, "    bcdecode --bench [MBYTES]\n\n");
     std::fprintf(stderr, "    FLAGS & 1 = ignore alpha channel\n");
     std::fprintf(stderr, "    FLAGS & 2 = calculate normal map blue channel\n");
     return 1;
@@ -26,6 +381,28 @@ int main(int argc, char **argv)
   OutputFile  *outFile = nullptr;
   try
   {
+    if (std::strcmp(argv[1], "--bench") == 0)
+    {
+      size_t  dataSize = 16;
+      if (argc > 2)
+      {
+        dataSize = size_t(parseInteger(argv[2], 10, "invalid data size",
+                                       1, 1024));
+      }
+      runDecodeBenchmark(dataSize << 20);
+      return 0;
+    }
+    if (argc > 2 && std::strcmp(argv[2], "-resident") == 0)
+    {
+      size_t  sampleCnt = 4000000;
+      if (argc > 3)
+      {
+        sampleCnt = size_t(parseInteger(argv[3], 10, "invalid sample count",
+                                        1, 0x7FFFFFFF));
+      }
+      compareResidentMode(argv[1], sampleCnt);
+      return 0;
+    }
     if (argc > 3 && std::strcmp(argv[3], "-cube") == 0)
     {
       int     w = 2048;
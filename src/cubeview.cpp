@@ -647,6 +647,8 @@ int main(int argc, char **argv)
     if (argc > 5)
       mipLevel = float(parseFloat(argv[5], "invalid mip level", 0.0, 15.0));
     BA2File ba2File(argv[3], &archiveFilterFunction, argv[4]);
+    ba2File.setTextureThreadCount(0);
+    ba2File.setVerifyChecksums(false);
     std::vector< std::string >  fileNames;
     {
       std::vector< std::string_view > tmpFileNames;
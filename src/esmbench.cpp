@@ -0,0 +1,149 @@
+
+#include "common.hpp"
+#include "esmfile.hpp"
+
+#include <chrono>
+#include <thread>
+
+class ESMBenchFile : public ESMFile
+{
+ public:
+  ESMBenchFile(const char *fileNames, int threadCnt)
+    : ESMFile(fileNames, threadCnt)
+  {
+  }
+  size_t getRecordCount() const
+  {
+    return recordBufSize;
+  }
+  // returns the memory used by the record tree and form ID map in bytes
+  size_t getIndexSize() const
+  {
+    return (recordBufSize * (sizeof(ESMRecord) + 4))
+           + ((formIDPageCnt + formIDMapSize) * 4);
+  }
+  // returns true if the record tree and form ID map are identical to r
+  bool compareRecords(const ESMBenchFile& r) const;
+};
+
+bool ESMBenchFile::compareRecords(const ESMBenchFile& r) const
+{
+  if (recordBufSize != r.recordBufSize || formIDPageCnt != r.formIDPageCnt ||
+      formIDMapSize != r.formIDMapSize)
+  {
+    return false;
+  }
+  for (size_t i = 0; i < 0x0300; i++)
+  {
+    if (pluginMap[i] != r.pluginMap[i])
+      return false;
+  }
+  for (size_t i = 0; i < formIDPageCnt; i++)
+  {
+    if (formIDPageTable[i] != r.formIDPageTable[i])
+      return false;
+  }
+  for (size_t i = 0; i < formIDMapSize; i++)
+  {
+    if (formIDMap[i] != r.formIDMap[i])
+      return false;
+  }
+  for (size_t i = 0; i < recordBufSize; i++)
+  {
+    const ESMRecord&  r1 = recordBuf[i];
+    const ESMRecord&  r2 = r.recordBuf[i];
+    if (r1.type != r2.type || r1.flags != r2.flags ||
+        r1.formID != r2.formID || r1.parent != r2.parent ||
+        r1.children != r2.children || r1.next != r2.next ||
+        recordDataOffs[i] != r.recordDataOffs[i])
+    {
+      return false;
+    }
+  }
+  return true;
+}
+
+// returns the average time in seconds needed to load the ESM files
+static double runBenchmark(const char *fileNames, int threadCnt, int n)
+{
+  std::chrono::steady_clock::duration t(0);
+  for (int i = 0; i < n; i++)
+  {
+    std::chrono::steady_clock::time_point t0 = std::chrono::steady_clock::now();
+    ESMFile esmFile(fileNames, threadCnt);
+    t += (std::chrono::steady_clock::now() - t0);
+  }
+  return std::chrono::duration< double >(t).count() / double(n);
+}
+
+int main(int argc, char **argv)
+{
+  try
+  {
+    int     iterationCnt = 5;
+    int     threadCnt = 0;
+    while (argc >= 3 && argv[1][0] == '-')
+    {
+      if (std::strcmp(argv[1], "-n") == 0)
+      {
+        iterationCnt = int(parseInteger(argv[2], 10,
+                                        "invalid iteration count", 1, 1000));
+      }
+      else if (std::strcmp(argv[1], "-threads") == 0)
+      {
+        threadCnt = int(parseInteger(argv[2], 10, "invalid thread count",
+                                     2, 64));
+      }
+      else
+      {
+        throw FO76UtilsError("invalid option: %s", argv[1]);
+      }
+      argv[2] = argv[0];
+      argc = argc - 2;
+      argv = argv + 2;
+    }
+    if (argc != 2)
+    {
+      std::fprintf(stderr, "Usage: %s [OPTIONS...] INFILE.ESM[,...]\n\n",
+                   argv[0]);
+      std::fprintf(stderr, "Compare the time needed to build the record "
+                           "tree of the ESM file(s)\n");
+      std::fprintf(stderr, "serially and in parallel, and verify that "
+                           "the results are identical.\n\n");
+      std::fprintf(stderr, "Options:\n");
+      std::fprintf(stderr, "    -n N            number of times to load "
+                           "the files (default: 5)\n");
+      std::fprintf(stderr, "    -threads N      number of threads to use "
+                           "(default: all hardware threads)\n");
+      return 1;
+    }
+    if (!threadCnt)
+    {
+      threadCnt = int(std::min< unsigned int >(
+                          std::max< unsigned int >(
+                              std::thread::hardware_concurrency(), 2U), 64U));
+    }
+
+    {
+      ESMBenchFile  esmFile1(argv[1], 1);
+      ESMBenchFile  esmFile2(argv[1], threadCnt);
+      if (!esmFile1.compareRecords(esmFile2))
+        errorMessage("parallel loading results in a different record tree");
+      std::printf("%lu records and groups, index size: %.2f MiB\n",
+                  (unsigned long) esmFile1.getRecordCount(),
+                  double(esmFile1.getIndexSize()) / 1048576.0);
+    }
+    double  t1 = runBenchmark(argv[1], 1, iterationCnt);
+    std::printf("serial:      %8.3f ms\n", t1 * 1000.0);
+    double  t2 = runBenchmark(argv[1], threadCnt, iterationCnt);
+    std::printf("%2d threads:  %8.3f ms (%.2fx)\n",
+                threadCnt, t2 * 1000.0, t1 / std::max(t2, 0.000000001));
+  }
+  catch (std::exception& e)
+  {
+    std::fprintf(stderr, "esmbench: %s\n", e.what());
+    return 1;
+  }
+  return 0;
+}
+
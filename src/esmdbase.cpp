@@ -2,17 +2,50 @@
 #include "common.hpp"
 #include "esmdbase.hpp"
 
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+#if defined(_WIN32) || defined(_WIN64)
+#  include <direct.h>
+#else
+#  include <sys/stat.h>
+#endif
+
 #include "ctdafunc.cpp"
 
-void ESMDump::updateStats(unsigned int recordType, unsigned int fieldType)
+struct ESMDump::DumpJob
+{
+  // range of items in DumpQueue::items
+  size_t  firstItem;
+  size_t  itemCnt;
+  std::string outBuf;
+  bool    isDone;
+};
+
+struct ESMDump::DumpQueue
+{
+  std::vector< DumpItem > items;
+  std::vector< DumpJob >  jobs;
+  size_t  nextJob;
+  size_t  jobsWritten;
+  // limit the number of formatted jobs kept in memory
+  size_t  maxJobsQueued;
+  bool    errorFlag;
+  // first job in output order that failed, and its error message
+  size_t  errorJob;
+  std::string errorMessage;
+  std::mutex  queueMutex;
+  std::condition_variable queueCondVar;
+};
+
+void ESMDump::updateStats(std::map< unsigned long long, int >& stats,
+                          unsigned int recordType, unsigned int fieldType)
 {
   unsigned long long  key =
       ((unsigned long long) FileBuffer::swapUInt32(recordType) << 32)
       | FileBuffer::swapUInt32(fieldType);
-  if (recordStats.find(key) == recordStats.end())
-    recordStats.insert(std::pair< unsigned long long, int >(key, 1));
-  else
-    recordStats[key]++;
+  stats[key]++;
 }
 
 void ESMDump::printStats()
@@ -33,32 +66,21 @@ void ESMDump::printStats()
   }
 }
 
-void ESMDump::findEDIDs(unsigned int formID)
+void ESMDump::findEDIDs()
 {
-  do
+  buildIndexes();
+  for (const auto& e : edidIndex)
   {
-    const ESMRecord&  r = getRecord(formID);
-    if (r.children)
-      findEDIDs(r.children);
-    if (!(r == "GRUP" || r == "LAND" || r == "NAVM"))
+    std::string s;
+    for (unsigned int i = 0; i < e.nameLen; i++)
     {
-      ESMField  f(*this, r);
-      if (f.next() && f == "EDID")
-      {
-        std::string s;
-        printZString(s, f);
-        if (s.empty())
-          continue;
-        std::map< unsigned int, std::string >::iterator i = edidDB.find(formID);
-        if (i != edidDB.end())
-          i->second = s;
-        else
-          edidDB.insert(std::pair< unsigned int, std::string >(formID, s));
-      }
+      char    c = edidNameBuf[e.nameOffs + i];
+      if ((unsigned char) c >= 0x20)
+        s += c;
     }
-    formID = r.next;
+    if (!s.empty())
+      edidDB.emplace_hint(edidDB.end(), e.formID, s);
   }
-  while (formID);
 }
 
 void ESMDump::loadFieldDefFile(const char *fileName)
@@ -190,6 +212,18 @@ void ESMDump::printID(unsigned int id)
   }
 }
 
+void ESMDump::printID(std::string& s, unsigned int id)
+{
+  for (int i = 0; i < 4; i++)
+  {
+    unsigned char c = (unsigned char) (id & 0x7F);
+    id = id >> 8;
+    if (c < 0x20 || c >= 0x7F)
+      c = 0x3F;
+    s += char(c);
+  }
+}
+
 void ESMDump::printInteger(std::string& s, long long n)
 {
   char    tmpBuf[32];
@@ -259,7 +293,7 @@ void ESMDump::printLString(std::string& s, FileBuffer& buf)
 {
   unsigned int  n = buf.readUInt32();
   if (n)
-    s += strings[n];
+    strings.appendString(s, n);
 }
 
 void ESMDump::printZString(std::string& s, FileBuffer& buf)
@@ -758,7 +792,8 @@ ESMDump::ESMDump(const char *fileName, std::FILE *outFile)
     tsvFormat(false),
     statsOnly(false),
     haveStrings(false),
-    verboseMode(false)
+    verboseMode(false),
+    threadCnt(1)
 {
   if (!outputFile)
     outputFile = stdout;
@@ -840,167 +875,713 @@ void ESMDump::loadStrings(const char *archivePath, const char *stringsPrefix)
   haveStrings = strings.loadFile(archivePath, stringsPrefix);
 }
 
-void ESMDump::dumpRecord(unsigned int formID, const ESMRecord *parentGroup)
+bool ESMDump::isRecordIncluded(const ESMRecord& r,
+                               const ESMRecord *parentGroup)
+{
+  unsigned int  parentGroupID = 0U;
+  if (parentGroup)
+    parentGroupID = parentGroup->flags;
+  unsigned int  flags = r.flags;
+  if ((flags & flagsExcluded) || (flagsIncluded && !(flags & flagsIncluded)))
+    return false;
+  if (recordsIncluded.begin() != recordsIncluded.end())
+  {
+    if (recordsIncluded.find(parentGroupID) == recordsIncluded.end() &&
+        recordsIncluded.find(r.type) == recordsIncluded.end())
+    {
+      return false;
+    }
+  }
+  if (recordsExcluded.begin() != recordsExcluded.end())
+  {
+    if (recordsExcluded.find(parentGroupID) != recordsExcluded.end() ||
+        recordsExcluded.find(r.type) != recordsExcluded.end())
+    {
+      return false;
+    }
+  }
+  return true;
+}
+
+void ESMDump::writeOutput(const std::string& s)
+{
+  if (s.empty())
+    return;
+  if (std::fwrite(s.c_str(), sizeof(char), s.length(), outputFile)
+      != s.length())
+  {
+    errorMessage("error writing output file");
+  }
+}
+
+void ESMDump::dumpGroup(std::string& s, const ESMRecord& r, bool isGroupEnd)
+{
+  if (!(verboseMode && r.formID <= 9 && !tsvFormat))
+    return;
+  if (isGroupEnd)
+  {
+    s += "}GRP:\n";
+    return;
+  }
+  char    tmpBuf[64];
+  std::snprintf(tmpBuf, 64, "GRP{:\t%u\t", r.formID);
+  s += tmpBuf;
+  switch (r.formID)
+  {
+    case 0:
+      printID(s, r.flags);
+      s += '\n';
+      return;
+    case 1:
+    case 6:
+    case 7:
+    case 8:
+    case 9:
+      std::snprintf(tmpBuf, 64, "0x%08X\n", r.flags);
+      break;
+    case 2:
+    case 3:
+      std::snprintf(tmpBuf, 64, "%d\n", uint32ToSigned(r.flags));
+      break;
+    case 4:
+    case 5:
+      std::snprintf(tmpBuf, 64, "%d\t%d\n",
+                    uint16ToSigned((unsigned short) (r.flags >> 16)),
+                    uint16ToSigned((unsigned short) (r.flags & 0xFFFF)));
+      break;
+  }
+  s += tmpBuf;
+}
+
+void ESMDump::dumpRecord(std::string& s,
+                         std::map< unsigned long long, int >& stats,
+                         unsigned int formID, const ESMRecord *parentGroup)
+{
+  const ESMRecord&  r = getRecord(formID);
+  if (!isRecordIncluded(r, parentGroup))
+    return;
+  unsigned int  recordType = r.type;
+  unsigned int  parentGroupID = 0U;
+  if (parentGroup)
+    parentGroupID = parentGroup->flags;
+  updateStats(stats, recordType, 0);
+
+  std::string edid;
+  std::vector< Field >  fields;
+  ESMField  f(*this, r);
+  while (f.next())
+  {
+    Field   tmpField;
+    tmpField.type = f.type;
+    updateStats(stats, recordType, f.type);
+    if (!statsOnly && fieldsExcluded.find(f.type) == fieldsExcluded.end())
+    {
+      if (f == "EDID")
+      {
+        convertField(edid, r, f);
+      }
+      else
+      {
+        convertField(tmpField.data, r, f);
+        if (!tmpField.data.empty())
+          fields.push_back(tmpField);
+      }
+    }
+  }
+  if (edid.empty() && fields.size() < 1)
+    return;
+
+  char    tmpBuf[32];
+  std::snprintf(tmpBuf, 32, "\t0x%08X", formID);
+  if (tsvFormat)
+  {
+    std::vector< std::string >  tsvFields(4, std::string("\t"));
+    if (!edid.empty())
+      tsvFields[0] = edid;
+    for (size_t i = 0; i < fields.size(); i++)
+    {
+      if (FileBuffer::checkType(fields[i].type, "FULL"))
+      {
+        if (tsvFields[1].length() < 2 || r == "NPC_")
+          tsvFields[1] = fields[i].data;
+      }
+      else if (FileBuffer::checkType(fields[i].type, "DESC"))
+      {
+        tsvFields[2] = fields[i].data;
+      }
+      else if (FileBuffer::checkType(fields[i].type, "RNAM"))
+      {
+        tsvFields[3] = fields[i].data;
+      }
+      else
+      {
+        tsvFields.push_back(fields[i].data);
+      }
+    }
+    if (parentGroup)
+      printID(s, parentGroupID);
+    s += '\t';
+    printID(s, recordType);
+    s += tmpBuf;
+    for (size_t i = 0; i < tsvFields.size(); i++)
+      s += tsvFields[i].c_str();
+    s += '\n';
+  }
+  else
+  {
+    if (parentGroup && parentGroupID != recordType)
+    {
+      printID(s, parentGroupID);
+      s += ':';
+    }
+    printID(s, recordType);
+    s += ':';
+    s += tmpBuf;
+    s += edid.c_str();
+    s += '\n';
+    for (size_t i = 0; i < fields.size(); i++)
+    {
+      s += ':';
+      printID(s, fields[i].type);
+      s += fields[i].data.c_str();
+      s += '\n';
+    }
+  }
+}
+
+void ESMDump::dumpRecords(std::string& s,
+                          unsigned int formID, const ESMRecord *parentGroup)
 {
   do
   {
     const ESMRecord&  r = getRecord(formID);
-    unsigned int  recordType = r.type;
     if (r == "GRUP")
     {
       if (r.children)
       {
-        if (verboseMode && r.formID <= 9 && !tsvFormat)
-        {
-          std::fprintf(outputFile, "GRP{:\t%u\t", r.formID);
-          switch (r.formID)
-          {
-            case 0:
-              printID(r.flags);
-              std::fputc('\n', outputFile);
-              break;
-            case 1:
-            case 6:
-            case 7:
-            case 8:
-            case 9:
-              std::fprintf(outputFile, "0x%08X\n", r.flags);
-              break;
-            case 2:
-            case 3:
-              std::fprintf(outputFile, "%d\n", uint32ToSigned(r.flags));
-              break;
-            case 4:
-            case 5:
-              std::fprintf(outputFile, "%d\t%d\n",
-                           uint16ToSigned((unsigned short) (r.flags >> 16)),
-                           uint16ToSigned((unsigned short) (r.flags & 0xFFFF)));
-              break;
-          }
-        }
-        dumpRecord(r.children, (r.formID ? parentGroup : &r));
-        if (verboseMode && r.formID <= 9 && !tsvFormat)
-          std::fprintf(outputFile, "}GRP:\n");
+        dumpGroup(s, r, false);
+        dumpRecords(s, r.children, (r.formID ? parentGroup : &r));
+        dumpGroup(s, r, true);
       }
-      formID = r.next;
-      continue;
     }
+    else
+    {
+      dumpRecord(s, recordStats, formID, parentGroup);
+    }
+    if (s.length() >= 65536)
+    {
+      writeOutput(s);
+      s.clear();
+    }
+    formID = r.next;
+  }
+  while (formID);
+}
 
-    unsigned int  parentGroupID = 0U;
-    if (parentGroup)
-      parentGroupID = parentGroup->flags;
-    unsigned int  flags = r.flags;
-    if ((flags & flagsExcluded) || (flagsIncluded && !(flags & flagsIncluded)))
+void ESMDump::findDumpItems(std::vector< DumpItem >& items,
+                            unsigned int formID, const ESMRecord *parentGroup)
+{
+  do
+  {
+    const ESMRecord&  r = getRecord(formID);
+    DumpItem  tmp;
+    tmp.formID = formID;
+    tmp.parentGroup = parentGroup;
+    if (r == "GRUP")
     {
-      formID = r.next;
-      continue;
+      if (r.children)
+      {
+        tmp.itemType = 1;
+        items.push_back(tmp);
+        findDumpItems(items, r.children, (r.formID ? parentGroup : &r));
+        tmp.itemType = 2;
+        items.push_back(tmp);
+      }
     }
-    if (recordsIncluded.begin() != recordsIncluded.end())
+    else
     {
-      if (recordsIncluded.find(parentGroupID) == recordsIncluded.end() &&
-          recordsIncluded.find(recordType) == recordsIncluded.end())
+      tmp.itemType = 0;
+      items.push_back(tmp);
+    }
+    formID = r.next;
+  }
+  while (formID);
+}
+
+void ESMDump::dumpThread(ESMDump *p, DumpQueue *q,
+                         std::map< unsigned long long, int > *stats)
+{
+  while (true)
+  {
+    DumpJob *job;
+    {
+      std::unique_lock< std::mutex >  tmpLock(q->queueMutex);
+      q->queueCondVar.wait(tmpLock,
+                           [q]
+                           {
+                             return (q->errorFlag
+                                     || q->nextJob >= q->jobs.size()
+                                     || q->nextJob < (q->jobsWritten
+                                                      + q->maxJobsQueued));
+                           });
+      if (q->errorFlag || q->nextJob >= q->jobs.size())
+        break;
+      job = &(q->jobs[q->nextJob]);
+      q->nextJob++;
+    }
+    try
+    {
+      for (size_t i = 0; i < job->itemCnt; i++)
       {
-        formID = r.next;
-        continue;
+        const DumpItem& item = q->items[job->firstItem + i];
+        if (item.itemType == 0)
+          p->dumpRecord(job->outBuf, *stats, item.formID, item.parentGroup);
+        else
+          p->dumpGroup(job->outBuf, p->getRecord(item.formID),
+                       bool(item.itemType == 2));
       }
     }
-    if (recordsExcluded.begin() != recordsExcluded.end())
+    catch (std::exception& e)
     {
-      if (recordsExcluded.find(parentGroupID) != recordsExcluded.end() ||
-          recordsExcluded.find(recordType) != recordsExcluded.end())
+      std::lock_guard< std::mutex > tmpLock(q->queueMutex);
+      size_t  jobNum = size_t(job - q->jobs.data());
+      q->errorFlag = true;
+      if (jobNum < q->errorJob)
       {
-        formID = r.next;
-        continue;
+        q->errorJob = jobNum;
+        q->errorMessage = e.what();
       }
     }
-    updateStats(recordType, 0);
+    {
+      std::lock_guard< std::mutex > tmpLock(q->queueMutex);
+      job->isDone = true;
+    }
+    q->queueCondVar.notify_all();
+  }
+}
 
-    std::string edid;
-    std::vector< Field >  fields;
-    ESMField  f(*this, r);
-    while (f.next())
+void ESMDump::dumpRecord(unsigned int formID, const ESMRecord *parentGroup)
+{
+  if (threadCnt <= 1)
+  {
+    std::string s;
+    try
+    {
+      dumpRecords(s, formID, parentGroup);
+    }
+    catch (...)
+    {
+      // write the records formatted before the error
+      writeOutput(s);
+      throw;
+    }
+    writeOutput(s);
+    return;
+  }
+
+  // records are formatted in parallel in jobs of up to 256 items, and the
+  // output of the jobs is written in the original order
+  DumpQueue q;
+  findDumpItems(q.items, formID, parentGroup);
+  q.jobs.resize((q.items.size() + 255) >> 8);
+  for (size_t i = 0; i < q.jobs.size(); i++)
+  {
+    q.jobs[i].firstItem = i << 8;
+    q.jobs[i].itemCnt = std::min< size_t >(q.items.size() - (i << 8), 256);
+    q.jobs[i].isDone = false;
+  }
+  q.nextJob = 0;
+  q.jobsWritten = 0;
+  q.errorFlag = false;
+  q.errorJob = q.jobs.size();
+  int     n = int(std::min(size_t(threadCnt), q.jobs.size()));
+  q.maxJobsQueued = size_t(n) * 4;
+  // record and field statistics are collected separately by each thread
+  std::vector< std::map< unsigned long long, int > >  threadStats(n);
+  std::vector< std::thread * >  threads;
+  try
+  {
+    for (int i = 0; i < n; i++)
     {
-      Field   tmpField;
-      tmpField.type = f.type;
-      updateStats(recordType, f.type);
-      if (!statsOnly && fieldsExcluded.find(f.type) == fieldsExcluded.end())
+      threads.push_back(new std::thread(dumpThread, this, &q,
+                                        threadStats.data() + i));
+    }
+    for (size_t i = 0; i < q.jobs.size(); i++)
+    {
+      DumpJob&  job = q.jobs[i];
       {
-        if (f == "EDID")
-        {
-          convertField(edid, r, f);
-        }
-        else
-        {
-          convertField(tmpField.data, r, f);
-          if (!tmpField.data.empty())
-            fields.push_back(tmpField);
-        }
+        // all jobs up to the first failed one have already been started,
+        // and are written including the items formatted before the error
+        std::unique_lock< std::mutex >  tmpLock(q.queueMutex);
+        q.queueCondVar.wait(tmpLock,
+                            [&q, &job]
+                            {
+                              return job.isDone;
+                            });
       }
+      writeOutput(job.outBuf);
+      std::string().swap(job.outBuf);
+      {
+        std::lock_guard< std::mutex > tmpLock(q.queueMutex);
+        q.jobsWritten++;
+        if (i >= q.errorJob)
+          throw FO76UtilsError("%s", q.errorMessage.c_str());
+      }
+      q.queueCondVar.notify_all();
     }
-    if (edid.empty() && fields.size() < 1)
+    for (size_t i = 0; i < threads.size(); i++)
     {
-      formID = r.next;
-      continue;
+      threads[i]->join();
+      delete threads[i];
+      threads[i] = nullptr;
+    }
+  }
+  catch (...)
+  {
+    {
+      std::lock_guard< std::mutex > tmpLock(q.queueMutex);
+      q.errorFlag = true;
     }
+    q.queueCondVar.notify_all();
+    for (size_t i = 0; i < threads.size(); i++)
+    {
+      if (threads[i])
+      {
+        threads[i]->join();
+        delete threads[i];
+      }
+    }
+    throw;
+  }
+  for (size_t i = 0; i < threadStats.size(); i++)
+  {
+    for (const auto& j : threadStats[i])
+      recordStats[j.first] += j.second;
+  }
+}
+
+void ESMDump::setThreadCount(int n)
+{
+  if (n < 1)
+    n = int(std::thread::hardware_concurrency());
+  threadCnt = std::min(std::max(n, 1), 64);
+}
 
-    if (tsvFormat)
+unsigned int ESMDump::ColumnarTable::addString(const std::string& s)
+{
+  if (s.empty())
+    return 0U;
+  std::map< std::string, unsigned int >::const_iterator i =
+      stringOffsets.find(s);
+  if (i != stringOffsets.end())
+    return i->second;
+  size_t  offs = stringHeap.size();
+  if ((offs + s.length()) >= 0xFFFFFFFFU)
+    errorMessage("string heap is too large in columnar export");
+  stringHeap.insert(stringHeap.end(), s.c_str(), s.c_str() + s.length() + 1);
+  stringOffsets.emplace(s, (unsigned int) offs);
+  return (unsigned int) offs;
+}
+
+unsigned int ESMDump::ColumnarTable::addArray(const unsigned char *p,
+                                              size_t n)
+{
+  if (!n)
+    return 0U;
+  size_t  offs = (stringHeap.size() + 3) & ~(size_t(3));
+  if ((offs + n + 4) >= 0xFFFFFFFFU)
+    errorMessage("string heap is too large in columnar export");
+  stringHeap.resize(offs + n + 4);
+  FileBuffer::writeUInt32Fast(stringHeap.data() + offs, std::uint32_t(n));
+  std::memcpy(stringHeap.data() + (offs + 4), p, n);
+  return (unsigned int) offs;
+}
+
+void ESMDump::ColumnarTable::addColumn(
+    unsigned int fieldType, const std::string& name,
+    unsigned char dataType, unsigned short elementNum)
+{
+  columns.emplace_back();
+  ColumnDef&  c = columns.back();
+  c.fieldType = fieldType;
+  c.nameOffs = addString(name);
+  c.dataType = dataType;
+  c.elementSize = 4;
+  if (dataType == 'b' || dataType == 'c')
+    c.elementSize = 1;
+  else if (dataType == 'h' || dataType == 's')
+    c.elementSize = 2;
+  c.elementNum = elementNum;
+}
+
+void ESMDump::initColumnarTable(ColumnarTable& t, unsigned int recordType)
+{
+  t.recordType = recordType;
+  t.rowCnt = 0;
+  t.stringHeap.resize(4, 0);
+  t.addColumn(0U, "FormID", 'd', 0);
+  t.addColumn(0U, "Flags", 'x', 0);
+  t.addColumn(0x44494445U, "EDID", 'z', 0);     // "EDID"
+  std::map< unsigned long long, std::string >::const_iterator i =
+      fieldDefDB.lower_bound((unsigned long long) recordType << 32);
+  for ( ; i != fieldDefDB.end() && (i->first >> 32) == recordType; i++)
+  {
+    unsigned int  fieldType = (unsigned int) (i->first & 0xFFFFFFFFU);
+    if (fieldType == 0x44494445U ||
+        fieldsExcluded.find(fieldType) != fieldsExcluded.end())
+    {
+      continue;
+    }
+    std::string name;
+    std::string dataTypes(i->second);
+    size_t  n = dataTypes.find('\t');
+    if (n != std::string::npos)
     {
-      std::vector< std::string >  tsvFields(4, std::string("\t"));
-      if (!edid.empty())
-        tsvFields[0] = edid;
-      for (size_t i = 0; i < fields.size(); i++)
+      name.assign(dataTypes, 0, n);
+      dataTypes.erase(0, n + 1);
+    }
+    if (name.empty())
+      printID(name, fieldType);
+    // the data before the first '<' is stored in separate columns, the
+    // rest of the field as raw array data in the string heap
+    size_t  columnCnt = 0;
+    for (size_t j = 0; j < dataTypes.length(); j++)
+    {
+      char    c = dataTypes[j];
+      if (c == '*')
       {
-        if (FileBuffer::checkType(fields[i].type, "FULL"))
-        {
-          if (tsvFields[1].length() < 2 || r == "NPC_")
-            tsvFields[1] = fields[i].data;
-        }
-        else if (FileBuffer::checkType(fields[i].type, "DESC"))
-        {
-          tsvFields[2] = fields[i].data;
-        }
-        else if (FileBuffer::checkType(fields[i].type, "RNAM"))
-        {
-          tsvFields[3] = fields[i].data;
-        }
-        else
-        {
-          tsvFields.push_back(fields[i].data);
-        }
+        dataTypes.resize(j);
+        break;
       }
-      if (parentGroup)
-        printID(parentGroupID);
-      std::fputc('\t', outputFile);
-      printID(recordType);
-      std::fprintf(outputFile, "\t0x%08X", formID);
-      for (size_t i = 0; i < tsvFields.size(); i++)
-        std::fprintf(outputFile, "%s", tsvFields[i].c_str());
-      std::fputc('\n', outputFile);
+      if (c == '<')
+      {
+        dataTypes.resize(j + 1);
+        columnCnt++;
+        break;
+      }
+      if (!std::strchr("bchsxuidflzn.", c))
+        errorMessage("invalid data type in field definition");
+      columnCnt = columnCnt + size_t(c != '.');
     }
-    else
+    if (!columnCnt)
+      continue;
+    ColumnarField&  f = t.fields[fieldType];
+    f.firstColumn = t.columns.size();
+    f.dataTypes = dataTypes;
+    f.lastRow = ~(size_t(0));
+    unsigned short  elementNum = 0;
+    for (char c : dataTypes)
     {
-      if (parentGroup && parentGroupID != recordType)
+      if (c == '.')
+        continue;
+      std::string columnName(name);
+      if (columnCnt > 1)
+        printToString(columnName, ".%u", (unsigned int) elementNum);
+      if (c == 'l' && !(esmFlags & 0x80))
+        c = 'z';
+      t.addColumn(fieldType, columnName, (unsigned char) c, elementNum);
+      elementNum++;
+    }
+  }
+}
+
+void ESMDump::addColumnarRow(ColumnarTable& t,
+                             unsigned int formID, const ESMRecord& r)
+{
+  size_t  rowNum = t.rowCnt;
+  t.rowCnt++;
+  for (size_t i = 0; i < t.columns.size(); i++)
+    t.columns[i].data.resize(t.rowCnt * t.columns[i].elementSize, 0);
+  FileBuffer::writeUInt32Fast(t.columns[0].data.data() + (rowNum * 4),
+                              formID);
+  FileBuffer::writeUInt32Fast(t.columns[1].data.data() + (rowNum * 4),
+                              r.flags);
+  bool    haveEDID = false;
+  std::string tmpBuf;
+  ESMField  f(*this, r);
+  while (f.next())
+  {
+    if (f == "EDID")
+    {
+      if (haveEDID)
+        continue;
+      haveEDID = true;
+      tmpBuf.clear();
+      printZString(tmpBuf, f);
+      FileBuffer::writeUInt32Fast(t.columns[2].data.data() + (rowNum * 4),
+                                  t.addString(tmpBuf));
+      continue;
+    }
+    std::map< unsigned int, ColumnarField >::iterator i =
+        t.fields.find(f.type);
+    if (i == t.fields.end() || i->second.lastRow == rowNum)
+      continue;
+    ColumnarField *fieldDef = &(i->second);
+    fieldDef->lastRow = rowNum;
+    ColumnDef *c = t.columns.data() + fieldDef->firstColumn;
+    for (char dataType : fieldDef->dataTypes)
+    {
+      if (dataType == '<')
       {
-        printID(parentGroupID);
-        std::fputc(':', outputFile);
+        FileBuffer::writeUInt32Fast(
+            c->data.data() + (rowNum * 4),
+            t.addArray(f.getReadPtr(), f.size() - f.getPosition()));
+        break;
       }
-      printID(recordType);
-      if (edid.empty())
-        std::fprintf(outputFile, ":\t0x%08X\n", formID);
-      else
-        std::fprintf(outputFile, ":\t0x%08X%s\n", formID, edid.c_str());
-      for (size_t i = 0; i < fields.size(); i++)
+      size_t  sizeRequired = 1;
+      if (dataType == 'h' || dataType == 's')
+        sizeRequired = 2;
+      else if (dataType == 'l' && !(esmFlags & 0x80))
+        dataType = 'z';
+      else if ((unsigned char) dataType > 'c' && dataType != 'z' &&
+               dataType != 'n')
+        sizeRequired = 4;
+      if ((f.getPosition() + sizeRequired) > f.size())
+        break;
+      unsigned char *p = c->data.data() + (rowNum * c->elementSize);
+      switch (dataType)
       {
-        std::fputc(':', outputFile);
-        printID(fields[i].type);
-        std::fprintf(outputFile, "%s\n", fields[i].data.c_str());
+        case 'b':
+        case 'c':
+          *p = f.readUInt8Fast();
+          break;
+        case 'h':
+        case 's':
+          FileBuffer::writeUInt16Fast(p, f.readUInt16Fast());
+          break;
+        case 'l':
+        case 'z':
+        case 'n':
+          tmpBuf.clear();
+          if (dataType == 'l')
+            printLString(tmpBuf, f);
+          else if (dataType == 'z')
+            printZString(tmpBuf, f);
+          else
+            printFileName(tmpBuf, f);
+          FileBuffer::writeUInt32Fast(p, t.addString(tmpBuf));
+          break;
+        case '.':
+          (void) f.readUInt8Fast();
+          continue;
+        default:
+          FileBuffer::writeUInt32Fast(p, f.readUInt32Fast());
+          break;
+      }
+      c++;
+    }
+  }
+}
+
+void ESMDump::exportColumnar(std::map< unsigned int, ColumnarTable >& tables,
+                             unsigned int formID, const ESMRecord *parentGroup)
+{
+  do
+  {
+    const ESMRecord&  r = getRecord(formID);
+    if (r == "GRUP")
+    {
+      if (r.children)
+        exportColumnar(tables, r.children, (r.formID ? parentGroup : &r));
+    }
+    else if (isRecordIncluded(r, parentGroup))
+    {
+      std::map< unsigned int, ColumnarTable >::iterator i =
+          tables.find(r.type);
+      if (i == tables.end())
+      {
+        i = tables.emplace(r.type, ColumnarTable()).first;
+        initColumnarTable(i->second, r.type);
       }
+      addColumnarRow(i->second, formID, r);
     }
     formID = r.next;
   }
   while (formID);
 }
 
+void ESMDump::writeColumnarTable(const ColumnarTable& t,
+                                 const char *fileName)
+{
+  // header (48 bytes):
+  //   0: "ESMC", 4: version (1), 8: record type, 12: number of columns,
+  //   16: number of rows (64-bit), 24: offset of the string heap (64-bit),
+  //   32: size of the string heap (64-bit), 40: reserved
+  // column table (32 bytes per column):
+  //   0: field type, 4: offset of the column name in the string heap,
+  //   8: data type, 9: element size, 10: element number in the field,
+  //   12: reserved, 16: offset of the column data (64-bit),
+  //   24: size of the column data (64-bit)
+  // column data and the string heap are aligned to 16 bytes
+  size_t  columnCnt = t.columns.size();
+  size_t  hdrSize = 48 + (columnCnt * 32);
+  std::vector< unsigned char >  hdrBuf(hdrSize, 0);
+  unsigned char *p = hdrBuf.data();
+  FileBuffer::writeUInt32Fast(p, 0x434D5345U);          // "ESMC"
+  FileBuffer::writeUInt32Fast(p + 4, 1U);
+  FileBuffer::writeUInt32Fast(p + 8, t.recordType);
+  FileBuffer::writeUInt32Fast(p + 12, std::uint32_t(columnCnt));
+  FileBuffer::writeUInt64Fast(p + 16, std::uint64_t(t.rowCnt));
+  std::uint64_t offs = (hdrSize + 15) & ~(std::uint64_t(15));
+  for (size_t i = 0; i < columnCnt; i++)
+  {
+    const ColumnDef&  c = t.columns[i];
+    unsigned char *q = p + (48 + (i * 32));
+    FileBuffer::writeUInt32Fast(q, c.fieldType);
+    FileBuffer::writeUInt32Fast(q + 4, c.nameOffs);
+    q[8] = c.dataType;
+    q[9] = c.elementSize;
+    FileBuffer::writeUInt16Fast(q + 10, c.elementNum);
+    FileBuffer::writeUInt64Fast(q + 16, offs);
+    FileBuffer::writeUInt64Fast(q + 24, std::uint64_t(c.data.size()));
+    offs = (offs + c.data.size() + 15) & ~(std::uint64_t(15));
+  }
+  FileBuffer::writeUInt64Fast(p + 24, offs);
+  FileBuffer::writeUInt64Fast(p + 32, std::uint64_t(t.stringHeap.size()));
+
+  static const unsigned char  zeroBytes[16] =
+  {
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0
+  };
+  OutputFile  f(fileName, 65536);
+  f.writeData(hdrBuf.data(), hdrSize);
+  f.writeData(zeroBytes, (16 - hdrSize) & 15);
+  for (size_t i = 0; i < columnCnt; i++)
+  {
+    const std::vector< unsigned char >& buf = t.columns[i].data;
+    f.writeData(buf.data(), buf.size());
+    f.writeData(zeroBytes, (16 - buf.size()) & 15);
+  }
+  f.writeData(t.stringHeap.data(), t.stringHeap.size());
+  f.flush();
+}
+
+void ESMDump::exportColumnar(const char *outputDir)
+{
+  std::map< unsigned int, ColumnarTable > tables;
+  exportColumnar(tables, 0U, nullptr);
+  std::string fileName(outputDir);
+  while (fileName.length() > 1 &&
+         (fileName.back() == '/' || fileName.back() == '\\'))
+  {
+    fileName.resize(fileName.length() - 1);
+  }
+#if defined(_WIN32) || defined(_WIN64)
+  (void) _mkdir(fileName.c_str());
+#else
+  (void) mkdir(fileName.c_str(), 0755);
+#endif
+  fileName += '/';
+  size_t  n = fileName.length();
+  for (const auto& i : tables)
+  {
+    fileName.resize(n);
+    printID(fileName, i.first);
+    fileName += ".esmc";
+    writeColumnarTable(i.second, fileName.c_str());
+  }
+}
+
 void ESMDump::dumpVersionInfo(unsigned int formID, const ESMRecord *parentGroup)
 {
   do
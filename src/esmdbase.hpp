@@ -15,6 +15,48 @@ class ESMDump : public ESMFile
     unsigned int  type;
     std::string   data;
   };
+  struct DumpItem
+  {
+    unsigned int  formID;
+    // 0: record, 1: start of group, 2: end of group
+    unsigned int  itemType;
+    const ESMRecord *parentGroup;
+  };
+  struct DumpJob;
+  struct DumpQueue;
+  // columnar export
+  struct ColumnDef
+  {
+    unsigned int  fieldType;            // 0 for form ID and flags
+    unsigned int  nameOffs;             // column name in the string heap
+    unsigned char dataType;             // field definition data type
+    unsigned char elementSize;          // 1, 2 or 4 bytes
+    unsigned short  elementNum;
+    std::vector< unsigned char >  data;
+  };
+  struct ColumnarField
+  {
+    size_t  firstColumn;
+    // data types from the field definition
+    std::string dataTypes;
+    // last row the field was stored to, only the first instance of a
+    // field in the record is used
+    size_t  lastRow;
+  };
+  struct ColumnarTable
+  {
+    unsigned int  recordType;
+    size_t  rowCnt;
+    std::vector< ColumnDef >  columns;
+    std::map< unsigned int, ColumnarField > fields;
+    // string heap, starts with 4 zero bytes (empty string or array)
+    std::vector< unsigned char >  stringHeap;
+    std::map< std::string, unsigned int > stringOffsets;
+    unsigned int addString(const std::string& s);
+    unsigned int addArray(const unsigned char *p, size_t n);
+    void addColumn(unsigned int fieldType, const std::string& name,
+                   unsigned char dataType, unsigned short elementNum);
+  };
   StringDB  strings;
   std::map< unsigned long long, int >   recordStats;
   std::FILE *outputFile;
@@ -27,6 +69,7 @@ class ESMDump : public ESMFile
   bool    statsOnly;
   bool    haveStrings;
   bool    verboseMode;
+  int     threadCnt;
   std::map< unsigned int, std::string > edidDB;
   // custom field definitions, key = (record << 32) | field
   // value format is name (optional) + "\t" + data types:
@@ -46,8 +89,10 @@ class ESMDump : public ESMFile
   //   .: ignore byte
   //   *: ignore any remaining data
   std::map< unsigned long long, std::string > fieldDefDB;
-  void updateStats(unsigned int recordType, unsigned int fieldType);
+  static void updateStats(std::map< unsigned long long, int >& stats,
+                          unsigned int recordType, unsigned int fieldType);
   void printID(unsigned int id);
+  static void printID(std::string& s, unsigned int id);
   static void printInteger(std::string& s, long long n);
   static void printHexValue(std::string& s, unsigned int n, unsigned int w);
   static void printBoolean(std::string& s, FileBuffer& buf);
@@ -59,6 +104,25 @@ class ESMDump : public ESMFile
   void printCTDA(std::string& s, FileBuffer& buf);
   void convertField(std::string& s, ESMField& f, const std::string& fldDef);
   bool convertField(std::string& s, const ESMRecord& r, ESMField& f);
+  void writeOutput(const std::string& s);
+  void dumpGroup(std::string& s, const ESMRecord& r, bool isGroupEnd);
+  // format a single record and append it to s
+  void dumpRecord(std::string& s, std::map< unsigned long long, int >& stats,
+                  unsigned int formID, const ESMRecord *parentGroup);
+  void dumpRecords(std::string& s,
+                   unsigned int formID, const ESMRecord *parentGroup);
+  void findDumpItems(std::vector< DumpItem >& items,
+                     unsigned int formID, const ESMRecord *parentGroup);
+  static void dumpThread(ESMDump *p, DumpQueue *q,
+                         std::map< unsigned long long, int > *stats);
+  bool isRecordIncluded(const ESMRecord& r, const ESMRecord *parentGroup);
+  void initColumnarTable(ColumnarTable& t, unsigned int recordType);
+  void addColumnarRow(ColumnarTable& t,
+                      unsigned int formID, const ESMRecord& r);
+  void exportColumnar(std::map< unsigned int, ColumnarTable >& tables,
+                      unsigned int formID, const ESMRecord *parentGroup);
+  static void writeColumnarTable(const ColumnarTable& t,
+                                 const char *fileName);
  public:
   ESMDump(const char *fileName, std::FILE *outFile = 0);
   virtual ~ESMDump();
@@ -74,6 +138,9 @@ class ESMDump : public ESMFile
   void dumpVersionInfo(unsigned int formID = 0U,
                        const ESMRecord *parentGroup = (ESMRecord *) 0);
   void printStats();
+  // write the records to one columnar binary file per record type in
+  // outputDir, using the field definitions as the schema
+  void exportColumnar(const char *outputDir);
   void setStatsOnlyMode(bool isEnabled)
   {
     statsOnly = isEnabled;
@@ -82,7 +149,11 @@ class ESMDump : public ESMFile
   {
     verboseMode = isEnabled;
   }
-  void findEDIDs(unsigned int formID = 0U);
+  // number of threads to use for formatting records in dumpRecord(),
+  // the output is identical to the single-threaded version,
+  // n <= 0 uses the number of hardware threads
+  void setThreadCount(int n);
+  void findEDIDs();
   void loadFieldDefFile(const char *fileName);
   void loadFieldDefFile(FileBuffer& inFile);
 };
@@ -11,6 +11,7 @@ static void printUsage()
   std::fprintf(stderr, "    -h      print usage\n");
   std::fprintf(stderr, "    --      remaining options are file names\n");
   std::fprintf(stderr, "    -o FN   set output file name to FN\n");
+  std::fprintf(stderr, "    -c DIR  write columnar binary files to DIR\n");
   std::fprintf(stderr, "    -F FILE read field definitions from FILE\n");
   std::fprintf(stderr, "    -f 0xN  only include records with flags&N != 0\n");
   std::fprintf(stderr, "    -i TYPE include groups and records of type TYPE\n");
@@ -21,6 +22,8 @@ static void printUsage()
   std::fprintf(stderr, "    -s      only print record and field stats\n");
   std::fprintf(stderr, "    -edid   print EDIDs of form ID fields\n");
   std::fprintf(stderr, "    -t      TSV format output\n");
+  std::fprintf(stderr, "    -threads N  format records using N threads "
+                       "(0: all CPU cores)\n");
   std::fprintf(stderr, "    -u      print TSV format version control info\n");
   std::fprintf(stderr, "    -v      verbose mode\n");
 }
@@ -40,6 +43,7 @@ int main(int argc, char **argv)
     const char  *stringsFileName = 0;
     const char  *stringsPrefix = 0;
     const char  *fldDefFileName = 0;
+    const char  *columnarDirName = 0;
     std::set< const char * >  fieldsExcluded;
     std::set< const char * >  recordsIncluded;
     std::set< const char * >  recordsExcluded;
@@ -52,6 +56,7 @@ int main(int argc, char **argv)
     bool    verboseMode = false;
     bool    printEDIDs = false;
     bool    vcFormat = false;
+    int     threadCnt = 1;
     for (int i = 1; i < argc; i++)
     {
       if (!noOptionsFlag && argv[i][0] == '-')
@@ -68,6 +73,11 @@ int main(int argc, char **argv)
             case '-':
               noOptionsFlag = true;
               continue;
+            case 'c':
+              if (++i >= argc)
+                errorMessage("-c: missing directory name");
+              columnarDirName = argv[i];
+              continue;
             case 'F':
               if (++i >= argc)
                 errorMessage("-F: missing file name");
@@ -139,6 +149,15 @@ int main(int argc, char **argv)
           printEDIDs = true;
           continue;
         }
+        if (std::strcmp(argv[i], "-threads") == 0)
+        {
+          if (++i >= argc)
+            errorMessage("-threads: missing thread count");
+          threadCnt = int(parseInteger(argv[i], 10,
+                                       "-threads: invalid thread count",
+                                       0, 64));
+          continue;
+        }
         printUsage();
         throw FO76UtilsError("\ninvalid option: %s", argv[i]);
       }
@@ -198,10 +217,17 @@ int main(int argc, char **argv)
     {
       esmFile.dumpVersionInfo();
     }
+    else if (columnarDirName)
+    {
+      if (fldDefFileName)
+        esmFile.loadFieldDefFile(fldDefFileName);
+      esmFile.exportColumnar(columnarDirName);
+    }
     else
     {
       esmFile.setTSVFormat(tsvFormat);
       esmFile.setStatsOnlyMode(statsOnly);
+      esmFile.setThreadCount(threadCnt);
       if (fldDefFileName)
         esmFile.loadFieldDefFile(fldDefFileName);
       esmFile.dumpRecord();
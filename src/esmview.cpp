@@ -76,25 +76,9 @@ const char * ESMView::parseFormID(
     return s;
   if (!(isHexValue || isDecValue))
   {
-    for (std::map< unsigned int, std::string >::const_iterator
-             i = edidDB.begin(); i != edidDB.end(); i++)
-    {
-      if (i->second.length() != tmp.length())
-        continue;
-      for (size_t j = 0; j < tmp.length(); j++)
-      {
-        char    c = i->second[j];
-        if (c >= 'A' && c <= 'Z')
-          c = c + ('a' - 'A');
-        if (c != tmp[j])
-          break;
-        if ((j + 1) >= tmp.length())
-        {
-          n = i->first;
-          return s;
-        }
-      }
-    }
+    unsigned int  formID = findEDID(tmp);
+    if (formID)
+      n = formID;
   }
   else
   {
@@ -1107,8 +1091,7 @@ int main(int argc, char **argv)
           r = esmFile.findRecord(formID);
           if (!r)
             continue;
-          size_t  fileOffs =
-              size_t(r->fileData - esmFile.findRecord(0U)->fileData);
+          size_t  fileOffs = esmFile.getRecordFileOffset(*r);
           ESMFile::ESMVCInfo  vcInfo;
           esmFile.getVersionControlInfo(vcInfo, *r);
           esmFile.consolePrint(
@@ -0,0 +1,177 @@
+
+#include "common.hpp"
+#include "esmfile.hpp"
+
+#include <chrono>
+
+// iterate all fields of each record with ESMField
+static std::uint64_t scanFieldsESMField(
+    const ESMFile& esmFile, const std::vector< unsigned int >& formIDs)
+{
+  std::uint64_t h = 0U;
+  for (unsigned int formID : formIDs)
+  {
+    ESMFile::ESMField f(esmFile, formID);
+    while (f.next())
+    {
+      h = h + f.type + f.size();
+      if (f.size() >= 4)
+        h = h + f.readUInt32Fast();
+    }
+  }
+  return h;
+}
+
+// iterate all fields of each record with FieldIterator
+static std::uint64_t scanFieldsIterator(
+    const ESMFile& esmFile, const std::vector< unsigned int >& formIDs)
+{
+  std::uint64_t h = 0U;
+  for (unsigned int formID : formIDs)
+  {
+    ESMFile::FieldIterator  f(esmFile, esmFile.getRecord(formID));
+    while (f.next())
+    {
+      h = h + f.type + f.size();
+      if (f.size() >= 4)
+        h = h + f.getUInt32(0);
+    }
+  }
+  return h;
+}
+
+// look up the bounds and model of each object, and of the base object
+// of each reference
+static std::uint64_t findFields(
+    const ESMFile& esmFile, const std::vector< unsigned int >& formIDs,
+    ESMFile::FieldOffsetCache *cache)
+{
+  std::uint64_t h = 0U;
+  for (unsigned int formID : formIDs)
+  {
+    const ESMFile::ESMRecord  *r = &(esmFile.getRecord(formID));
+    if (*r == "REFR")
+    {
+      ESMFile::FieldIterator  f(esmFile, *r, cache);
+      if (!(f.find("NAME") && f.size() >= 4))
+        continue;
+      r = esmFile.findRecord(f.getUInt32(0));
+      if (!r || *r == "GRUP")
+        continue;
+    }
+    ESMFile::FieldIterator  f(esmFile, *r, cache);
+    if (f.find("OBND") && f.size() >= 12)
+      h = h + f.getUInt32(0) + f.getUInt32(4) + f.getUInt32(8);
+    ESMFile::FieldIterator  f2(esmFile, *r, cache);
+    if (f2.find("MODL"))
+      h = h + f2.size();
+  }
+  return h;
+}
+
+// returns the average time in seconds
+static double runBenchmark(std::uint64_t& h, const ESMFile& esmFile,
+                           const std::vector< unsigned int >& formIDs,
+                           int benchType, int n)
+{
+  std::chrono::steady_clock::duration t(0);
+  h = 0U;
+  for (int i = 0; i < n; i++)
+  {
+    ESMFile::FieldOffsetCache cache(size_t(1) << 24);
+    std::chrono::steady_clock::time_point t0 = std::chrono::steady_clock::now();
+    switch (benchType)
+    {
+      case 0:
+        h = scanFieldsESMField(esmFile, formIDs);
+        break;
+      case 1:
+        h = scanFieldsIterator(esmFile, formIDs);
+        break;
+      case 2:
+        h = findFields(esmFile, formIDs, nullptr);
+        break;
+      default:
+        // the first pass fills the cache
+        h = findFields(esmFile, formIDs, &cache);
+        t0 = std::chrono::steady_clock::now();
+        h = findFields(esmFile, formIDs, &cache);
+        break;
+    }
+    t += (std::chrono::steady_clock::now() - t0);
+  }
+  return std::chrono::duration< double >(t).count() / double(n);
+}
+
+int main(int argc, char **argv)
+{
+  try
+  {
+    int     iterationCnt = 5;
+    while (argc >= 3 && argv[1][0] == '-')
+    {
+      if (std::strcmp(argv[1], "-n") == 0)
+      {
+        iterationCnt = int(parseInteger(argv[2], 10,
+                                        "invalid iteration count", 1, 1000));
+      }
+      else
+      {
+        throw FO76UtilsError("invalid option: %s", argv[1]);
+      }
+      argv[2] = argv[0];
+      argc = argc - 2;
+      argv = argv + 2;
+    }
+    if (argc != 2)
+    {
+      std::fprintf(stderr, "Usage: %s [OPTIONS...] INFILE.ESM[,...]\n\n",
+                   argv[0]);
+      std::fprintf(stderr, "Compare the time needed to read the fields of "
+                           "all STAT, SCOL and REFR\n");
+      std::fprintf(stderr, "records with ESMField and FieldIterator, "
+                           "and to look up fields by type\n");
+      std::fprintf(stderr, "with and without a FieldOffsetCache.\n\n");
+      std::fprintf(stderr, "Options:\n");
+      std::fprintf(stderr, "    -n N            number of times to run "
+                           "each test (default: 5)\n");
+      return 1;
+    }
+
+    ESMFile esmFile(argv[1]);
+    esmFile.buildIndexes();
+    std::vector< unsigned int > formIDs;
+    for (const char *t : { "STAT", "SCOL", "REFR" })
+    {
+      std::span< const unsigned int > tmp = esmFile.getRecordsByType(t);
+      formIDs.insert(formIDs.end(), tmp.begin(), tmp.end());
+    }
+    std::printf("%lu records\n", (unsigned long) formIDs.size());
+    std::uint64_t h[4];
+    double  t[4];
+    for (int i = 0; i < 4; i++)
+    {
+      static const char *benchNames[4] =
+      {
+        "ESMField:", "FieldIterator:", "find:", "find (cached):"
+      };
+      t[i] = runBenchmark(h[i], esmFile, formIDs, i, iterationCnt);
+      std::printf("%-15s %8.3f ms", benchNames[i], t[i] * 1000.0);
+      if (i & 1)
+      {
+        std::printf(" (%.2fx)",
+                    t[i - 1] / std::max(t[i], 0.000000001));
+      }
+      std::printf("\n");
+    }
+    if (h[0] != h[1] || h[2] != h[3])
+      errorMessage("the results of the field iterators are different");
+  }
+  catch (std::exception& e)
+  {
+    std::fprintf(stderr, "fieldbench: %s\n", e.what());
+    return 1;
+  }
+  return 0;
+}
+
@@ -0,0 +1,169 @@
+
+#include "common.hpp"
+#include "filebuf.hpp"
+#include "zlib.hpp"
+
+#include <chrono>
+
+struct LZ4BenchChunk
+{
+  const unsigned char *data;
+  size_t  packedSize;
+  size_t  unpackedSize;
+  bool    isFrame;                      // LZ4 frame format instead of raw
+};
+
+// find all LZ4 compressed files or texture chunks in a BA2 archive
+static void findLZ4Chunks(std::vector< LZ4BenchChunk >& chunkList,
+                          FileBuffer& buf)
+{
+  if (buf.readUInt32() != 0x58445442)   // "BTDX"
+    errorMessage("input file is not a BA2 archive");
+  unsigned int  version = buf.readUInt32();
+  bool    isTextures = false;
+  switch (buf.readUInt32())
+  {
+    case 0x4C524E47:                    // "GNRL"
+      break;
+    case 0x30315844:                    // "DX10"
+      isTextures = true;
+      break;
+    default:
+      errorMessage("unsupported BA2 archive type");
+      break;
+  }
+  size_t  fileCnt = buf.readUInt32();
+  (void) buf.readUInt64();              // name table offset
+  size_t  hdrSize = 24;
+  unsigned int  compressionMethod = 0;  // 3 = raw LZ4 (version 3)
+  if (version == 2 || version == 3)
+  {
+    hdrSize = 32;
+    if (version == 3)
+    {
+      buf.setPosition(32);
+      compressionMethod = buf.readUInt32();
+      hdrSize = 36;
+    }
+  }
+  buf.setPosition(hdrSize);
+  for (size_t i = 0; i < fileCnt; i++)
+  {
+    size_t  chunkCnt = 1;
+    if (isTextures)
+    {
+      buf.setPosition(buf.getPosition() + 13);
+      chunkCnt = buf.readUInt8();
+      buf.setPosition(buf.getPosition() + 10);
+    }
+    else
+    {
+      buf.setPosition(buf.getPosition() + 16);
+    }
+    for ( ; chunkCnt; chunkCnt--)
+    {
+      size_t  offs = size_t(buf.readUInt64());
+      size_t  packedSize = buf.readUInt32();
+      size_t  unpackedSize = buf.readUInt32();
+      buf.setPosition(buf.getPosition() + (isTextures ? 8 : 4));
+      if (!packedSize)
+        continue;
+      if (offs >= buf.size() || packedSize > (buf.size() - offs))
+        errorMessage("invalid packed data offset or size");
+      LZ4BenchChunk c;
+      c.data = buf.data() + offs;
+      c.packedSize = packedSize;
+      c.unpackedSize = unpackedSize;
+      c.isFrame = (packedSize >= 4 &&
+                   FileBuffer::readUInt32Fast(c.data) == 0x184D2204U);
+      // textures in version 3 archives are always raw LZ4, as in BA2File
+      if (c.isFrame ||
+          (hdrSize == 36 && (isTextures || compressionMethod == 3)))
+      {
+        chunkList.push_back(c);
+      }
+    }
+  }
+}
+
+int main(int argc, char **argv)
+{
+  try
+  {
+    int     iterationCnt = 5;
+    if (argc >= 3 && std::strcmp(argv[1], "-n") == 0)
+    {
+      iterationCnt = int(parseInteger(argv[2], 10,
+                                      "invalid iteration count", 1, 1000));
+      argv[2] = argv[0];
+      argc = argc - 2;
+      argv = argv + 2;
+    }
+    if (argc < 2)
+    {
+      std::fprintf(stderr, "Usage: %s [-n N] ARCHIVES...\n\n", argv[0]);
+      std::fprintf(stderr, "Decompress all LZ4 compressed files and "
+                           "texture chunks in the BA2 archives\n");
+      std::fprintf(stderr, "N times (default: 5), and print the "
+                           "decompression throughput.\n");
+      return 1;
+    }
+    std::vector< FileBuffer * > archiveFiles;
+    std::vector< LZ4BenchChunk >  chunkList;
+    for (int i = 1; i < argc; i++)
+    {
+      archiveFiles.push_back(new FileBuffer(argv[i]));
+      findLZ4Chunks(chunkList, *(archiveFiles.back()));
+    }
+    if (chunkList.size() < 1)
+      errorMessage("no LZ4 compressed data found");
+    size_t  packedSize = 0;
+    size_t  unpackedSize = 0;
+    size_t  maxUnpackedSize = 0;
+    for (const auto& c : chunkList)
+    {
+      packedSize = packedSize + c.packedSize;
+      unpackedSize = unpackedSize + c.unpackedSize;
+      maxUnpackedSize = std::max(maxUnpackedSize, c.unpackedSize);
+    }
+    std::vector< unsigned char >  buf(maxUnpackedSize);
+    std::chrono::steady_clock::time_point t0 = std::chrono::steady_clock::now();
+    for (int i = 0; i < iterationCnt; i++)
+    {
+      for (const auto& c : chunkList)
+      {
+        size_t  n;
+        if (c.isFrame)
+        {
+          n = ZLibDecompressor::decompressData(buf.data(), c.unpackedSize,
+                                               c.data, c.packedSize);
+        }
+        else
+        {
+          n = ZLibDecompressor::decompressLZ4Raw(buf.data(), c.unpackedSize,
+                                                 c.data, c.packedSize);
+        }
+        if (n != c.unpackedSize)
+          errorMessage("invalid or corrupt compressed data in archive");
+      }
+    }
+    double  t = std::chrono::duration< double >(
+                    std::chrono::steady_clock::now() - t0).count();
+    std::printf("%lu chunks, %.2f MiB compressed, %.2f MiB uncompressed\n",
+                (unsigned long) chunkList.size(),
+                double(packedSize) / 1048576.0,
+                double(unpackedSize) / 1048576.0);
+    std::printf("%.3f s, %.2f MiB/s\n",
+                t, double(unpackedSize) * double(iterationCnt)
+                   / (std::max(t, 0.000001) * 1048576.0));
+    for (size_t i = 0; i < archiveFiles.size(); i++)
+      delete archiveFiles[i];
+  }
+  catch (std::exception& e)
+  {
+    std::fprintf(stderr, "lz4bench: %s\n", e.what());
+    return 1;
+  }
+  return 0;
+}
+
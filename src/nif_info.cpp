@@ -852,7 +852,9 @@ int main(int argc, char **argv)
     }
     if (outFmt >= 5)
       fileNames.emplace_back(".dds");
-    BA2File ba2File(argv[1], &archiveFilterFunction, &fileNames);
+    BA2File ba2File;
+    ba2File.setIndexCachePath(BA2File::getDefaultIndexCachePath());
+    ba2File.loadArchivePath(argv[1], &archiveFilterFunction, &fileNames);
     fileNames.clear();
     {
       std::vector< std::string_view > tmpFileNames;
@@ -1011,23 +1011,24 @@ const Renderer::BaseObject * Renderer::readModelProperties(
       bool    isWater = (r == "PWAT");
       bool    isHDModel = false;
       stringBuf.clear();
-      ESMFile::ESMField f(esmFile, r);
+      ESMFile::FieldIterator  f(esmFile, r);
       while (f.next())
       {
         if (f == "OBND" && f.size() >= 12)
         {
-          tmp.obndX0 = (signed short) uint16ToSigned(f.readUInt16Fast());
-          tmp.obndY0 = (signed short) uint16ToSigned(f.readUInt16Fast());
-          tmp.obndZ0 = (signed short) uint16ToSigned(f.readUInt16Fast());
-          tmp.obndX1 = (signed short) uint16ToSigned(f.readUInt16Fast());
-          tmp.obndY1 = (signed short) uint16ToSigned(f.readUInt16Fast());
-          tmp.obndZ1 = (signed short) uint16ToSigned(f.readUInt16Fast());
+          tmp.obndX0 = (signed short) uint16ToSigned(f.getUInt16(0));
+          tmp.obndY0 = (signed short) uint16ToSigned(f.getUInt16(2));
+          tmp.obndZ0 = (signed short) uint16ToSigned(f.getUInt16(4));
+          tmp.obndX1 = (signed short) uint16ToSigned(f.getUInt16(6));
+          tmp.obndY1 = (signed short) uint16ToSigned(f.getUInt16(8));
+          tmp.obndZ1 = (signed short) uint16ToSigned(f.getUInt16(10));
           haveOBND = true;
         }
         else if ((f == "MODL" || (f == "MOD2" && r == "ARMO")) &&
                  f.size() > 4 && (!modelLOD || stringBuf.empty()))
         {
-          f.readPath(stringBuf, std::string::npos, "meshes/", ".nif");
+          FileBuffer  buf(f.data(), f.size(), 0);
+          buf.readPath(stringBuf, std::string::npos, "meshes/", ".nif");
           isHDModel = isHighQualityModel(stringBuf);
           if (r == "SCOL" && esmFile.getESMVersion() >= 0xC0)
           {
@@ -1045,10 +1046,10 @@ const Renderer::BaseObject * Renderer::readModelProperties(
         {
           for (int j = (modelLOD - 1) & 3; j >= 0; j--)
           {
-            f.setPosition(size_t(j * 260));
-            if (f[f.getPosition()] != 0)
+            if (f.getUInt8(size_t(j * 260)) != 0)
             {
-              f.readPath(stringBuf, std::string::npos, "meshes/", ".nif");
+              FileBuffer  buf(f.data(), f.size(), size_t(j * 260));
+              buf.readPath(stringBuf, std::string::npos, "meshes/", ".nif");
               if (!stringBuf.empty())
                 break;
             }
@@ -1056,11 +1057,11 @@ const Renderer::BaseObject * Renderer::readModelProperties(
         }
         else if (f == "MODS" && f.size() >= 4)
         {
-          tmp.mswpFormID = f.readUInt32Fast();
+          tmp.mswpFormID = f.getUInt32(0);
         }
         else if (f == "MODC" && f.size() >= 4)
         {
-          float   n = f.readFloat();
+          float   n = f.getFloat(0);
           n = std::min(std::max(n, 0.0f), 1.0f) * 65534.0f + 1.0f;
           tmp.gradientMapV = std::uint16_t(roundFloat(n));
         }
@@ -1212,154 +1213,157 @@ void Renderer::addSCOLObjects(
   }
 }
 
-void Renderer::findObjects(unsigned int formID, int type, bool isRecursive)
+void Renderer::addObject(const ESMFile::ESMRecord& r)
 {
-  const ESMFile::ESMRecord  *r = nullptr;
-  do
+  if (r.flags & (!noDisabledObjects ? 0x00000020 : 0x00000820))
+    return;                           // ignore deleted and disabled records
+  RenderObject  tmp;
+  tmp.flags = 0;
+  tmp.flags2 = 0;
+  tmp.z = 0;
+  tmp.model.o.mswpFormID = 0U;
+  tmp.model.o.mswpFormID2 = 0U;
+  tmp.formID = r.formID;
+  const ESMFile::ESMRecord  *r2 = nullptr;
+  const BaseObject  *o = nullptr;
+  float   scale = 1.0f;
+  float   decalScaleX = 1.0f;
+  float   decalScaleZ = 1.0f;
+  bool    objectVisible = false;
   {
-    r = esmFile.findRecord(formID);
-    if (!r) [[unlikely]]
-      break;
-    if (!(*r == "REFR")) [[unlikely]]
+    ESMFile::ESMField f(r, esmFile);
+    while (f.next())
     {
-      if (*r == "CELL")
-      {
-        const ESMFile::ESMRecord  *r2;
-        if (!(r->parent && bool(r2 = esmFile.findRecord(r->parent)) &&
-              r2->formID == 1U))        // ignore starting cell at 0, 0
-        {
-          if (type == 0)
-            addTerrainCell(*r);
-          else
-            addWaterCell(*r);
-        }
-      }
-      if (!(*r == "ACHR"))
+      switch (f.type)
       {
-        if (!isRecursive)
+        case 0x454D414EU:             // "NAME" (must be first)
+          if (f.size() >= 4 && !r2)
+          {
+            r2 = esmFile.findRecord(f.readUInt32Fast());
+            if (r2 && !(*r2 == "SCOL" && !enableSCOL))
+              o = readModelProperties(tmp, *r2);
+          }
           break;
-        if (*r == "GRUP" && r->children && r->formID < 10U)
-        {
-          // group types 1 to 5 for terrain, + 6, 8, 9 for objects
-          if ((1U << r->formID) & (!type ? 0x003EU : 0x037EU))
-            findObjects(r->children, type, true);
-        }
-        continue;
-      }
-    }
-    if ((r->flags & (!noDisabledObjects ? 0x00000020 : 0x00000820)) || !type)
-      continue;                         // ignore deleted and disabled records
-    RenderObject  tmp;
-    tmp.flags = 0;
-    tmp.flags2 = 0;
-    tmp.z = 0;
-    tmp.model.o.mswpFormID = 0U;
-    tmp.model.o.mswpFormID2 = 0U;
-    tmp.formID = r->formID;
-    const ESMFile::ESMRecord  *r2 = nullptr;
-    const BaseObject  *o = nullptr;
-    float   scale = 1.0f;
-    float   decalScaleX = 1.0f;
-    float   decalScaleZ = 1.0f;
-    bool    objectVisible = false;
-    {
-      ESMFile::ESMField f(*r, esmFile);
-      while (f.next())
-      {
-        switch (f.type)
-        {
-          case 0x454D414EU:             // "NAME" (must be first)
-            if (f.size() >= 4 && !r2)
+        case 0x4D525058U:             // "XPRM"
+          if (f.size() >= 29 && (tmp.flags & 0x10) && f[28] == 0x01)  // box
+          {
+            tmp.flags = tmp.flags | 0x0080;
+            float   decalWidth = float(o->obndX1) - float(o->obndX0);
+            float   decalDepth = float(o->obndY1) - float(o->obndY0);
+            float   decalHeight = float(o->obndZ1) - float(o->obndZ0);
+            decalWidth = std::max(decalWidth * 0.5f, 0.5f);
+            decalDepth = std::max(decalDepth * 0.5f, 0.5f);
+            decalHeight = std::max(decalHeight * 0.5f, 0.5f);
+            FloatVector4  b(f.readFloatVector4());
+            decalScaleX = b[0] / decalWidth;
+            scale = b[1] / decalDepth;
+            decalScaleZ = b[2] / decalHeight;
+          }
+          break;
+        case 0x50534D58U:             // "XMSP"
+          if (f.size() >= 4 && !(tmp.flags & 0x10))
+            tmp.model.o.mswpFormID = f.readUInt32Fast();
+          break;
+        case 0x44445058U:             // "XPDD"
+          if (f.size() >= 8 && (tmp.flags & 0x90) == 0x10)
+          {
+            decalScaleX = f.readFloat();
+            decalScaleZ = f.readFloat();
+          }
+          break;
+        case 0x4C435358U:             // "XSCL"
+          if (f.size() >= 4 && !(tmp.flags & 0x10))
+            scale = f.readFloat();
+          break;
+        case 0x41544144U:             // "DATA" (must be last)
+          if (f.size() >= 24 && r2)
+          {
+            FloatVector4  d1(f.readFloatVector4());   // X, Y, Z, RX
+            f.setPosition(f.getPosition() - 8);
+            FloatVector4  d2(f.readFloatVector4());   // Z, RX, RY, RZ
+            tmp.modelTransform =
+                NIFFile::NIFVertexTransform(
+                    scale, d2[1], d2[2], d2[3], d1[0], d1[1], d2[0]);
+            if (tmp.flags & 0x10) [[unlikely]]
             {
-              r2 = esmFile.findRecord(f.readUInt32Fast());
-              if (r2 && !(*r2 == "SCOL" && !enableSCOL))
-                o = readModelProperties(tmp, *r2);
+              tmp.model.d.scaleX =
+                  std::min(std::max(decalScaleX / scale, 0.0625f), 16.0f);
+              tmp.model.d.scaleZ =
+                  std::min(std::max(decalScaleZ / scale, 0.0625f), 16.0f);
             }
-            break;
-          case 0x4D525058U:             // "XPRM"
-            if (f.size() >= 29 && (tmp.flags & 0x10) && f[28] == 0x01)  // box
+            if (*r2 == "SCOL" && !enableSCOL)
             {
-              tmp.flags = tmp.flags | 0x0080;
-              float   decalWidth = float(o->obndX1) - float(o->obndX0);
-              float   decalDepth = float(o->obndY1) - float(o->obndY0);
-              float   decalHeight = float(o->obndZ1) - float(o->obndZ0);
-              decalWidth = std::max(decalWidth * 0.5f, 0.5f);
-              decalDepth = std::max(decalDepth * 0.5f, 0.5f);
-              decalHeight = std::max(decalHeight * 0.5f, 0.5f);
-              FloatVector4  b(f.readFloatVector4());
-              decalScaleX = b[0] / decalWidth;
-              scale = b[1] / decalDepth;
-              decalScaleZ = b[2] / decalHeight;
+              addSCOLObjects(*r2, tmp.modelTransform,
+                             r.formID, tmp.model.o.mswpFormID);
             }
-            break;
-          case 0x50534D58U:             // "XMSP"
-            if (f.size() >= 4 && !(tmp.flags & 0x10))
-              tmp.model.o.mswpFormID = f.readUInt32Fast();
-            break;
-          case 0x44445058U:             // "XPDD"
-            if (f.size() >= 8 && (tmp.flags & 0x90) == 0x10)
+            else if (o) [[likely]]
             {
-              decalScaleX = f.readFloat();
-              decalScaleZ = f.readFloat();
+              objectVisible = setScreenAreaUsed(tmp);
             }
-            break;
-          case 0x4C435358U:             // "XSCL"
-            if (f.size() >= 4 && !(tmp.flags & 0x10))
-              scale = f.readFloat();
-            break;
-          case 0x41544144U:             // "DATA" (must be last)
-            if (f.size() >= 24 && r2)
-            {
-              FloatVector4  d1(f.readFloatVector4());   // X, Y, Z, RX
-              f.setPosition(f.getPosition() - 8);
-              FloatVector4  d2(f.readFloatVector4());   // Z, RX, RY, RZ
-              tmp.modelTransform =
-                  NIFFile::NIFVertexTransform(
-                      scale, d2[1], d2[2], d2[3], d1[0], d1[1], d2[0]);
-              if (tmp.flags & 0x10) [[unlikely]]
-              {
-                tmp.model.d.scaleX =
-                    std::min(std::max(decalScaleX / scale, 0.0625f), 16.0f);
-                tmp.model.d.scaleZ =
-                    std::min(std::max(decalScaleZ / scale, 0.0625f), 16.0f);
-              }
-              if (*r2 == "SCOL" && !enableSCOL)
-              {
-                addSCOLObjects(*r2, tmp.modelTransform,
-                               r->formID, tmp.model.o.mswpFormID);
-              }
-              else if (o) [[likely]]
-              {
-                objectVisible = setScreenAreaUsed(tmp);
-              }
-            }
-            break;
-        }
+          }
+          break;
       }
     }
-    if (!objectVisible)
+  }
+  if (!objectVisible)
+    return;
+  if (tmp.flags & 0x14) [[unlikely]]
+  {
+    if (!(tmp.flags & 0x10))
+    {
+      if (waterRenderMode >= 0)
+        tmp.model.o.mswpFormID = 0U;
+      else
+        tmp.model.o.mswpFormID = getWaterMaterial(materials, esmFile, r2, 0U);
+    }
+  }
+  else if (tmp.model.o.mswpFormID && tmp.model.o.mswpFormID != o->mswpFormID)
+  {
+    tmp.model.o.mswpFormID =
+        materialSwaps.loadMaterialSwap(
+            ba2File, esmFile, tmp.model.o.mswpFormID);
+  }
+  else
+  {
+    tmp.model.o.mswpFormID = 0U;
+  }
+  objectList.push_back(tmp);
+}
+
+void Renderer::findObjects(unsigned int formID, int type, bool isRecursive)
+{
+  const ESMFile::ESMRecord  *r = nullptr;
+  do
+  {
+    r = esmFile.findRecord(formID);
+    if (!r) [[unlikely]]
+      break;
+    if (*r == "REFR" || *r == "ACHR") [[likely]]
+    {
+      if (type == 1)
+        addObject(*r);
       continue;
-    if (tmp.flags & 0x14) [[unlikely]]
+    }
+    if (*r == "CELL")
     {
-      if (!(tmp.flags & 0x10))
+      const ESMFile::ESMRecord  *r2;
+      if (!(r->parent && bool(r2 = esmFile.findRecord(r->parent)) &&
+            r2->formID == 1U))          // ignore starting cell at 0, 0
       {
-        if (waterRenderMode >= 0)
-          tmp.model.o.mswpFormID = 0U;
+        if (type == 0)
+          addTerrainCell(*r);
         else
-          tmp.model.o.mswpFormID = getWaterMaterial(materials, esmFile, r2, 0U);
+          addWaterCell(*r);
       }
     }
-    else if (tmp.model.o.mswpFormID && tmp.model.o.mswpFormID != o->mswpFormID)
-    {
-      tmp.model.o.mswpFormID =
-          materialSwaps.loadMaterialSwap(
-              ba2File, esmFile, tmp.model.o.mswpFormID);
-    }
-    else
+    if (!isRecursive)
+      break;
+    if (*r == "GRUP" && r->children && r->formID < 10U)
     {
-      tmp.model.o.mswpFormID = 0U;
+      // group types 1 to 5 for terrain, + 6, 8, 9 for objects
+      if ((1U << r->formID) & (type != 1 ? 0x003EU : 0x037EU))
+        findObjects(r->children, type, true);
     }
-    objectList.push_back(tmp);
   }
   while ((formID = r->next) != 0U && isRecursive);
 }
@@ -1373,6 +1377,8 @@ void Renderer::findObjects(unsigned int formID, int type)
     return;
   if (*r == "WRLD")
   {
+    bool    useSpatialIndex =
+        (type == 1 && enableSpatialIndex && !ignoreOBND);
     r = esmFile.findRecord(0U);
     while (r && r->next)
     {
@@ -1391,12 +1397,14 @@ void Renderer::findObjects(unsigned int formID, int type)
               r2->children)
           {
             // world children
-            findObjects(r2->children, type, true);
+            findObjects(r2->children, (!useSpatialIndex ? type : 2), true);
           }
           groupID = r2->next;
         }
       }
     }
+    if (useSpatialIndex)
+      findVisibleObjects(formID);
   }
   else if (*r == "CELL")
   {
@@ -1435,6 +1443,68 @@ void Renderer::findObjects(unsigned int formID, int type)
   }
 }
 
+void Renderer::findVisibleObjects(unsigned int worldFormID)
+{
+  esmFile.buildReferenceGrid(worldFormID, int(threadCnt));
+  const ESMFile::ReferenceBounds  *b =
+      esmFile.getReferenceGridBounds(worldFormID);
+  if (!b)
+    return;
+  // transform the corners of the view volume to world space
+  const NIFFile::NIFVertexTransform&  vt = viewTransform;
+  float   invScale = 1.0f / vt.scale;
+  FloatVector4  v[8];
+  for (int i = 0; i < 8; i++)
+  {
+    float   x = (!(i & 1) ? 0.0f : float(width)) - vt.offsX;
+    float   y = (!(i & 2) ? 0.0f : float(height)) - vt.offsY;
+    float   z = (!(i & 4) ? 0.0f : float(zRangeMax)) - vt.offsZ;
+    v[i] = FloatVector4(vt.rotateXX * x + vt.rotateYX * y + vt.rotateZX * z,
+                        vt.rotateXY * x + vt.rotateYY * y + vt.rotateZY * z,
+                        vt.rotateXZ * x + vt.rotateYZ * y + vt.rotateZZ * z,
+                        0.0f);
+    v[i] *= invScale;
+  }
+  // find the area on the XY plane where the view volume intersects with
+  // the range of Z coordinates of all references
+  NIFFile::NIFBounds  viewBounds;
+  for (int i = 0; i < 8; i++)
+  {
+    if (v[i][2] >= b->z0 && v[i][2] <= b->z1)
+      viewBounds += v[i];
+    for (int j = 1; j < 8; j = j << 1)
+    {
+      if (i & j)
+        continue;
+      // edge from v[i] to v[i | j]
+      float   z0 = v[i][2];
+      float   z1 = v[i | j][2];
+      if (!(std::fabs(z1 - z0) > 0.000001f))
+        continue;
+      for (int k = 0; k < 2; k++)
+      {
+        float   t = ((!k ? b->z0 : b->z1) - z0) / (z1 - z0);
+        if (t > 0.0f && t < 1.0f)
+          viewBounds += (v[i] + ((v[i | j] - v[i]) * t));
+      }
+    }
+  }
+  float   x0 = std::max(viewBounds.xMin(), b->x0);
+  float   y0 = std::max(viewBounds.yMin(), b->y0);
+  float   x1 = std::min(viewBounds.xMax(), b->x1);
+  float   y1 = std::min(viewBounds.yMax(), b->y1);
+  if (!(x0 <= x1 && y0 <= y1))
+    return;
+  std::vector< unsigned int > refs;
+  esmFile.findReferences(refs, worldFormID, x0, y0, x1, y1);
+  for (unsigned int formID : refs)
+  {
+    const ESMFile::ESMRecord  *r = esmFile.findRecord(formID);
+    if (r)
+      addObject(*r);
+  }
+}
+
 void Renderer::sortObjectList()
 {
   if (renderPass & 4)
@@ -2161,6 +2231,7 @@ Renderer::Renderer(int imageWidth, int imageHeight,
     debugMode(0),
     renderPass(0),
     ignoreOBND(false),
+    enableSpatialIndex(false),
     threadCnt(0),
     modelBatchCnt(16),
     landTextures(nullptr),
@@ -235,6 +235,7 @@ class Renderer : protected Renderer_Base
   // 1: terrain, 2: objects, 4: objects with alpha blending
   unsigned char renderPass;
   bool    ignoreOBND;
+  bool    enableSpatialIndex;
   unsigned char threadCnt;
   unsigned char modelBatchCnt;
   TextureCache  textureCache;
@@ -279,9 +280,13 @@ class Renderer : protected Renderer_Base
   void addSCOLObjects(const ESMFile::ESMRecord& r,      // SCOL
                       const NIFFile::NIFVertexTransform& vt,
                       unsigned int refrFormID, unsigned int refrMSWPFormID);
-  // type = 0: terrain, type = 1: objects
+  void addObject(const ESMFile::ESMRecord& r);         // REFR or ACHR
+  // type = 0: terrain, type = 1: objects, type = 2: water only
   void findObjects(unsigned int formID, int type, bool isRecursive);
   void findObjects(unsigned int formID, int type);
+  // add the references in the part of a world that is in the view area,
+  // using the spatial index of the ESM file
+  void findVisibleObjects(unsigned int worldFormID);
   void sortObjectList();
   // 0x0001: clear image data
   // 0x0002: clear Z buffer
@@ -309,6 +314,7 @@ class Renderer : protected Renderer_Base
   void renderThread(size_t threadNum);
   static void threadFunction(Renderer *p, size_t threadNum);
  public:
+  typedef TextureCache::CacheStats  TextureCacheStats;
   Renderer(int imageWidth, int imageHeight,
            const BA2File& archiveFiles, ESMFile& masterFiles,
            std::uint32_t *bufRGBA = 0, float *bufZ = 0, int zMax = 16777216);
@@ -345,6 +351,10 @@ class Renderer : protected Renderer_Base
   {
     textureCache.clear();
   }
+  inline TextureCacheStats getTextureCacheStats() const
+  {
+    return textureCache.getStats();
+  }
   inline void clearObjectPropertyCache()
   {
     baseObjects.clear();
@@ -380,6 +390,20 @@ class Renderer : protected Renderer_Base
       n = std::min(n, std::uint64_t(0xFFFFFFFFU));
     textureCache.textureCacheSize = size_t(n);
   }
+  // if enabled, BCn textures are decoded on demand when sampled
+  void setTextureBlocksResident(bool n)
+  {
+    textureCache.textureLoadFlags =
+        (textureCache.textureLoadFlags & ~DDSTexture::loadBlocksCompressed)
+        | (n ? DDSTexture::loadBlocksCompressed : 0);
+  }
+  // if enabled, texture mip levels are decoded when first sampled
+  void setTextureMipsOnDemand(bool n)
+  {
+    textureCache.textureLoadFlags =
+        (textureCache.textureLoadFlags & ~DDSTexture::loadMipsOnDemand)
+        | (n ? DDSTexture::loadMipsOnDemand : 0);
+  }
   // set the number of models to load at once (1 to 64)
   void setModelCacheSize(int n);
   void setTextureMipLevel(int n)
@@ -428,6 +452,12 @@ class Renderer : protected Renderer_Base
   {
     modelLOD = (unsigned char) n;       // 0 (maximum detail) to 4
   }
+  // if enabled, only references near the view area are checked when
+  // rendering a world, instead of all objects in the world
+  void setEnableSpatialIndex(bool n)
+  {
+    enableSpatialIndex = n;
+  }
   void setDistantObjectsOnly(bool n)
   {
     distantObjectsOnly = n;     // ignore if not visible from distance
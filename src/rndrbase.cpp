@@ -7,10 +7,28 @@ size_t Renderer_Base::TextureCache::getTextureDataSize(const DDSTexture *t)
 {
   if (!t)
     return 0;
+  // textures decoded on demand are counted as if all mip levels were used
+  if (t->isBlockCompressed() || t->isDecodedOnDemand())
+    return (t->getMaxDataSize() + 1024U);
   size_t  n = size_t(t->getWidth()) * size_t(t->getHeight());
   return (size_t((n * 1431655765ULL) >> 30) * sizeof(std::uint32_t) + 1024U);
 }
 
+Renderer_Base::TextureCache::TextureCache(size_t n)
+  : textureDataSize(0),
+    textureCacheSize(n),
+    textureLoadFlags(0),
+    evictionCnt(0),
+    bytesLoaded(0),
+    clockHand(0)
+{
+  for (size_t i = 0; i < shardCnt; i++)
+  {
+    shards[i].hitCnt = 0;
+    shards[i].missCnt = 0;
+  }
+}
+
 Renderer_Base::TextureCache::~TextureCache()
 {
   clear();
@@ -27,138 +45,202 @@ const DDSTexture * Renderer_Base::TextureCache::loadTexture(
   if (!k.fd)
     return nullptr;
   k.mipLevel = mipLevel;
-  textureCacheMutex.lock();
-  std::map< CachedTextureKey, CachedTexture >::iterator i =
-      textureCache.find(k);
-  if (i != textureCache.end())
+  size_t  h = k.hashFunction();
+  CacheShard& shard = shards[h & (shardCnt - 1)];
+  CachedTexture *cachedTexture = nullptr;
   {
-    CachedTexture *cachedTexture = &(i->second);
-    if (cachedTexture->nxt)
-    {
-      if (cachedTexture->prv)
-        cachedTexture->prv->nxt = cachedTexture->nxt;
-      else
-        firstTexture = cachedTexture->nxt;
-      cachedTexture->nxt->prv = cachedTexture->prv;
-      lastTexture->nxt = cachedTexture;
-      cachedTexture->prv = lastTexture;
-      cachedTexture->nxt = nullptr;
-      lastTexture = cachedTexture;
-    }
-    textureCacheMutex.unlock();
-    if (!waitFlag)
-      cachedTexture->textureLoadMutex->lock();
-    else if ((*waitFlag = !cachedTexture->textureLoadMutex->try_lock()) == true)
-      return nullptr;
-    const DDSTexture  *t = cachedTexture->texture;
-    cachedTexture->textureLoadMutex->unlock();
-    return t;
+    std::shared_lock< std::shared_mutex >  tmpLock(shard.m);
+    std::unordered_map< CachedTextureKey, CachedTexture *,
+                        CachedTextureKeyHash >::const_iterator i =
+        shard.textures.find(k);
+    if (i != shard.textures.end())
+      cachedTexture = i->second;
   }
-
-  CachedTexture *cachedTexture = nullptr;
-  std::mutex  *textureLoadMutex = new std::mutex();
-  try
+  if (!cachedTexture)
   {
+    std::unique_lock< std::shared_mutex >  tmpLock(shard.m);
+    std::unordered_map< CachedTextureKey, CachedTexture *,
+                        CachedTextureKeyHash >::iterator i =
+        shard.textures.find(k);
+    if (i != shard.textures.end())
     {
-      CachedTexture tmp;
-      tmp.texture = nullptr;
-      tmp.i = textureCache.end();
-      tmp.prv = nullptr;
-      tmp.nxt = nullptr;
-      tmp.textureLoadMutex = textureLoadMutex;
-      i = textureCache.insert(std::pair< CachedTextureKey, CachedTexture >(
-                                  k, tmp)).first;
+      // inserted by another thread after the first lookup
+      cachedTexture = i->second;
     }
-    textureLoadMutex = nullptr;
-    cachedTexture = &(i->second);
-    cachedTexture->i = i;
-    if (lastTexture)
-      lastTexture->nxt = cachedTexture;
     else
-      firstTexture = cachedTexture;
-    cachedTexture->prv = lastTexture;
-    cachedTexture->nxt = nullptr;
-    lastTexture = cachedTexture;
-  }
-  catch (...)
-  {
-    textureCacheMutex.unlock();
-    delete textureLoadMutex;
-    throw;
-  }
+    {
+      cachedTexture = new CachedTexture();
+      cachedTexture->key = k;
+      cachedTexture->texture = nullptr;
+      cachedTexture->dataSize = 0;
+      cachedTexture->isLoaded = false;
+      cachedTexture->isReferenced = true;
+      cachedTexture->loadFuture =
+          cachedTexture->loadPromise.get_future().share();
+      try
+      {
+        shard.textures.emplace(k, cachedTexture);
+      }
+      catch (...)
+      {
+        delete cachedTexture;
+        throw;
+      }
+      shard.missCnt.fetch_add(1U, std::memory_order_relaxed);
+      tmpLock.unlock();
 
-  DDSTexture  *t = nullptr;
-  cachedTexture->textureLoadMutex->lock();
-  textureCacheMutex.unlock();
-  try
-  {
-    mipLevel = ba2File.extractTexture(fileBuf, fileName, mipLevel);
+      DDSTexture  *t = nullptr;
+      try
+      {
+        {
+          // the texture is not evicted if this fails
+          std::lock_guard< std::mutex > clockLock(clockMutex);
+          clockList.push_back(cachedTexture);
+        }
+        mipLevel = ba2File.extractTexture(fileBuf, fileName, mipLevel);
 #if 0
-    size_t  fileBufSize = fileBuf.size;
-    if (fileBufSize >= 148 &&
-        (fileBuf[113] & 0x02) != 0 &&   // DDSCAPS2_CUBEMAP
-        (fileBuf[128] != 0x43 || fileBuf[28] < 2))
-    {           // not DXGI_FORMAT_R9G9B9E5_SHAREDEXP, or mipmap count < 2
-      SFCubeMapFilter cubeMapFilter(256);
-      size_t  bufCapacityRequired = 256 * 256 * 8 * sizeof(std::uint32_t) + 148;
-      fileBuf.reserve(bufCapacityRequired);
-      size_t  newSize =
-          cubeMapFilter.convertImage(fileBuf.data, fileBufSize, false,
-                                     bufCapacityRequired);
-      fileBuf.size = (newSize ? newSize : fileBufSize);
-    }
+        size_t  fileBufSize = fileBuf.size;
+        if (fileBufSize >= 148 &&
+            (fileBuf[113] & 0x02) != 0 &&       // DDSCAPS2_CUBEMAP
+            (fileBuf[128] != 0x43 || fileBuf[28] < 2))
+        {       // not DXGI_FORMAT_R9G9B9E5_SHAREDEXP, or mipmap count < 2
+          SFCubeMapFilter cubeMapFilter(256);
+          size_t  bufCapacityRequired =
+              256 * 256 * 8 * sizeof(std::uint32_t) + 148;
+          fileBuf.reserve(bufCapacityRequired);
+          size_t  newSize =
+              cubeMapFilter.convertImage(fileBuf.data, fileBufSize, false,
+                                         bufCapacityRequired);
+          fileBuf.size = (newSize ? newSize : fileBufSize);
+        }
 #endif
-    t = new DDSTexture(fileBuf.data, fileBuf.size, mipLevel);
-    cachedTexture->texture = t;
-    textureCacheMutex.lock();
-    textureDataSize = textureDataSize + getTextureDataSize(t);
-    textureCacheMutex.unlock();
-  }
-  catch (FO76UtilsError&)
-  {
+        t = new DDSTexture(fileBuf.data, fileBuf.size, mipLevel,
+                           textureLoadFlags);
+      }
+      catch (FO76UtilsError&)
+      {
+      }
+      catch (...)
+      {
+        cachedTexture->isLoaded.store(true, std::memory_order_release);
+        cachedTexture->loadPromise.set_value();
+        throw;
+      }
+      size_t  dataSize = getTextureDataSize(t);
+      cachedTexture->texture = t;
+      cachedTexture->dataSize = dataSize;
+      textureDataSize.fetch_add(dataSize, std::memory_order_relaxed);
+      bytesLoaded.fetch_add(dataSize, std::memory_order_relaxed);
+      cachedTexture->isLoaded.store(true, std::memory_order_release);
+      cachedTexture->loadPromise.set_value();
+      return t;
+    }
   }
-  catch (...)
+
+  shard.hitCnt.fetch_add(1U, std::memory_order_relaxed);
+  if (!cachedTexture->isReferenced.load(std::memory_order_relaxed))
+    cachedTexture->isReferenced.store(true, std::memory_order_relaxed);
+  if (!cachedTexture->isLoaded.load(std::memory_order_acquire))
   {
-    cachedTexture->textureLoadMutex->unlock();
-    throw;
+    if (waitFlag)
+    {
+      *waitFlag = true;
+      return nullptr;
+    }
+    cachedTexture->loadFuture.wait();
   }
-  cachedTexture->textureLoadMutex->unlock();
-  return t;
+  if (waitFlag)
+    *waitFlag = false;
+  return cachedTexture->texture;
 }
 
 void Renderer_Base::TextureCache::shrinkTextureCache()
 {
-  while (textureDataSize > textureCacheSize && firstTexture)
+  std::lock_guard< std::mutex > clockLock(clockMutex);
+  if (textureDataSize.load() <= textureCacheSize)
+    return;
+  // each texture is passed over once if its reference bit is set, so at
+  // most two full rotations of the clock hand are needed
+  size_t  n = clockList.size();
+  for (size_t j = n * 2; j > 0 && textureDataSize.load() > textureCacheSize;
+       j--)
   {
-    size_t  dataSize = getTextureDataSize(firstTexture->texture);
-    if (firstTexture->texture)
-      delete firstTexture->texture;
-    delete firstTexture->textureLoadMutex;
-    std::map< CachedTextureKey, CachedTexture >::iterator i = firstTexture->i;
-    if (firstTexture->nxt)
-      firstTexture->nxt->prv = nullptr;
-    else
-      lastTexture = nullptr;
-    firstTexture = firstTexture->nxt;
-    textureCache.erase(i);
-    textureDataSize = textureDataSize - dataSize;
+    if (clockHand >= n)
+      clockHand = 0;
+    CachedTexture *p = clockList[clockHand];
+    clockHand++;
+    if (!p)
+      continue;
+    if (!p->isLoaded.load(std::memory_order_acquire))
+      continue;                         // still being loaded by another thread
+    if (p->isReferenced.load(std::memory_order_relaxed))
+    {
+      p->isReferenced.store(false, std::memory_order_relaxed);
+      continue;
+    }
+    {
+      CacheShard& shard = shards[p->key.hashFunction() & (shardCnt - 1)];
+      std::lock_guard< std::shared_mutex >  tmpLock(shard.m);
+      shard.textures.erase(p->key);
+    }
+    clockList[clockHand - 1] = nullptr;
+    textureDataSize.fetch_sub(p->dataSize, std::memory_order_relaxed);
+    evictionCnt.fetch_add(1U, std::memory_order_relaxed);
+    if (p->texture)
+      delete p->texture;
+    delete p;
   }
-  if (!firstTexture)
-    textureDataSize = 0;
+  // remove the evicted textures from the list
+  size_t  j = 0;
+  size_t  newClockHand = 0;
+  for (size_t i = 0; i < n; i++)
+  {
+    if (i == clockHand)
+      newClockHand = j;
+    if (clockList[i])
+      clockList[j++] = clockList[i];
+  }
+  clockList.resize(j);
+  clockHand = newClockHand;
 }
 
 void Renderer_Base::TextureCache::clear()
 {
-  for (CachedTexture *p = firstTexture; p; p = p->nxt)
+  std::lock_guard< std::mutex > clockLock(clockMutex);
+  for (size_t i = 0; i < shardCnt; i++)
   {
-    if (p->texture)
-      delete p->texture;
-    delete p->textureLoadMutex;
+    std::lock_guard< std::shared_mutex >  tmpLock(shards[i].m);
+    for (const auto& j : shards[i].textures)
+    {
+      CachedTexture *p = j.second;
+      // wait for textures that are still being loaded
+      p->loadFuture.wait();
+      if (p->texture)
+        delete p->texture;
+      delete p;
+    }
+    shards[i].textures.clear();
   }
+  clockList.clear();
+  clockHand = 0;
   textureDataSize = 0;
-  firstTexture = nullptr;
-  lastTexture = nullptr;
-  textureCache.clear();
+}
+
+Renderer_Base::TextureCache::CacheStats
+    Renderer_Base::TextureCache::getStats() const
+{
+  CacheStats  tmp;
+  tmp.hitCnt = 0;
+  tmp.missCnt = 0;
+  for (size_t i = 0; i < shardCnt; i++)
+  {
+    tmp.hitCnt = tmp.hitCnt + shards[i].hitCnt.load();
+    tmp.missCnt = tmp.missCnt + shards[i].missCnt.load();
+  }
+  tmp.evictionCnt = evictionCnt.load();
+  tmp.bytesLoaded = bytesLoaded.load();
+  tmp.dataSize = textureDataSize.load();
+  return tmp;
 }
 
 unsigned int Renderer_Base::MaterialSwaps::loadMaterialSwap(
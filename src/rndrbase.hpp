@@ -13,46 +13,85 @@
 
 #include <thread>
 #include <mutex>
+#include <shared_mutex>
+#include <atomic>
+#include <future>
+#include <unordered_map>
 
 struct Renderer_Base
 {
+  // texture cache shared by the render threads, with the textures sharded
+  // by key into separately locked hash tables, and approximate LRU (CLOCK)
+  // eviction in shrinkTextureCache()
   struct TextureCache
   {
     struct CachedTextureKey
     {
       const BA2File::FileInfo *fd;      // pointer from BA2File
       int     mipLevel;
-      inline bool operator<(const CachedTextureKey& r) const
-      {
-        return (fd < r.fd || (fd == r.fd && mipLevel < r.mipLevel));
-      }
       inline bool operator==(const CachedTextureKey& r) const
       {
         return (fd == r.fd && mipLevel == r.mipLevel);
       }
+      inline size_t hashFunction() const
+      {
+        std::uint64_t h = std::uint64_t(reinterpret_cast< std::uintptr_t >(fd))
+                          ^ std::uint64_t(std::uint32_t(mipLevel));
+        return size_t((h * 0x9E3779B97F4A7C15ULL) >> 32);
+      }
+    };
+    struct CachedTextureKeyHash
+    {
+      inline size_t operator()(const CachedTextureKey& k) const
+      {
+        return k.hashFunction();
+      }
     };
     struct CachedTexture
     {
-      DDSTexture    *texture;
-      std::map< CachedTextureKey, CachedTexture >::iterator i;
-      CachedTexture *prv;
-      CachedTexture *nxt;
-      std::mutex    *textureLoadMutex;
+      CachedTextureKey  key;
+      DDSTexture    *texture;           // NULL if the texture failed to load
+      size_t  dataSize;
+      // set when texture and dataSize are valid
+      std::atomic< bool > isLoaded;
+      // CLOCK reference bit, set on every hit
+      std::atomic< bool > isReferenced;
+      // ready when the thread loading the texture is done
+      std::promise< void >  loadPromise;
+      std::shared_future< void >  loadFuture;
+    };
+    struct alignas(64) CacheShard
+    {
+      // hits take the lock shared, misses and evictions exclusive
+      std::shared_mutex m;
+      std::unordered_map< CachedTextureKey, CachedTexture *,
+                          CachedTextureKeyHash >  textures;
+      std::atomic< std::uint64_t >  hitCnt;
+      std::atomic< std::uint64_t >  missCnt;
     };
-    size_t  textureDataSize;
+    struct CacheStats
+    {
+      std::uint64_t hitCnt;
+      std::uint64_t missCnt;
+      std::uint64_t evictionCnt;
+      std::uint64_t bytesLoaded;        // total size of all textures loaded
+      size_t  dataSize;                 // size of the textures in the cache
+    };
+    static constexpr size_t shardCnt = 16;
+    CacheShard  shards[shardCnt];
+    std::atomic< size_t > textureDataSize;
     size_t  textureCacheSize;
-    CachedTexture *firstTexture;
-    CachedTexture *lastTexture;
-    std::mutex  textureCacheMutex;
-    std::map< CachedTextureKey, CachedTexture > textureCache;
+    // DDSTexture::loadBlocksCompressed, DDSTexture::loadMipsOnDemand
+    int     textureLoadFlags;
+    std::atomic< std::uint64_t >  evictionCnt;
+    std::atomic< std::uint64_t >  bytesLoaded;
+    // all cached textures in insertion order, and the position of the clock
+    // hand in the list, protected by clockMutex
+    std::mutex  clockMutex;
+    std::vector< CachedTexture * >  clockList;
+    size_t  clockHand;
     static size_t getTextureDataSize(const DDSTexture *t);
-    TextureCache(size_t n = 0x40000000)
-      : textureDataSize(0),
-        textureCacheSize(n),
-        firstTexture(nullptr),
-        lastTexture(nullptr)
-    {
-    }
+    TextureCache(size_t n = 0x40000000);
     ~TextureCache();
     // returns NULL on failure
     // *waitFlag is set to true if the texture is locked by another thread
@@ -60,8 +99,11 @@ struct Renderer_Base
                                   const std::string& fileName,
                                   BA2File::UCharArray& fileBuf,
                                   int mipLevel, bool *waitFlag = nullptr);
+    // evict textures until the total size is not greater than the limit,
+    // must not be called while any of the textures are in use
     void shrinkTextureCache();
     void clear();
+    CacheStats getStats() const;
   };
   struct MaterialSwaps
   {
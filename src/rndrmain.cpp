@@ -19,12 +19,16 @@ static const char *usageStrings[] =
   "    -a                  render all object types",
   "    -textures BOOL      make all diffuse textures white if false",
   "    -tc | -txtcache INT texture cache size in megabytes",
+  "    -txtthreads INT     number of threads for decompressing the chunks",
+  "                        of a texture (0: hardware threads, default: 1)",
+  "    -txtbc BOOL         keep BCn textures compressed in memory",
+  "    -txtlazy BOOL       decode texture mip levels when first sampled",
   "    -mc INT             number of models to load at once (1 to 64)",
   "    -ssaa INT           render at 2^N resolution and downsample",
   "    -f INT              output format, 0: RGB24, 1: A8R8G8B8, 2: RGB10A2",
   "    -rq INT             set render quality (0 - 2047, see doc/render.md)",
   "    -watermask BOOL     make non-water surfaces transparent or black",
-  "    -q                  do not print messages other than errors",
+  "    -q                  only print errors and texture cache statistics",
   "",
   "    -btd FILENAME.BTD   read terrain data from Fallout 76 .btd file",
   "    -w FORMID           form ID of world, cell, or object to render",
@@ -52,6 +56,7 @@ static const char *usageStrings[] =
   "    -mlod INT           set level of detail for models, 0 (best) to 4",
   "    -vis BOOL           render only objects visible from distance",
   "    -ndis BOOL          do not render initially disabled objects",
+  "    -spatial BOOL       use spatial index to find objects in view area",
   "    -hqm STRING         add high quality model path name pattern",
   "    -xm STRING          add excluded model path name pattern",
   "",
@@ -72,9 +77,13 @@ int main(int argc, char **argv)
     unsigned char threadCnt = 0;
     unsigned char modelBatchCnt = 16;
     unsigned int  textureCacheSize = 1024U;
+    int     textureThreadCnt = 1;
+    bool    textureBlocksResident = false;
+    bool    textureMipsOnDemand = false;
     bool    verboseMode = true;
     bool    distantObjectsOnly = false;
     bool    noDisabledObjects = true;
+    bool    enableSpatialIndex = false;
     unsigned char ssaaLevel = 0;
     bool    enableSCOL = false;
     bool    enableAllObjects = false;
@@ -148,6 +157,9 @@ int main(int argc, char **argv)
         std::printf("-scol %d\n", int(enableSCOL));
         std::printf("-textures %d\n", int(enableTextures));
         std::printf("-txtcache %u\n", textureCacheSize);
+        std::printf("-txtthreads %d\n", textureThreadCnt);
+        std::printf("-txtbc %d\n", int(textureBlocksResident));
+        std::printf("-txtlazy %d\n", int(textureMipsOnDemand));
         std::printf("-mc %u\n", (unsigned int) modelBatchCnt);
         std::printf("-ssaa %d\n", int(ssaaLevel));
         std::printf("-f %d\n", outputFormat);
@@ -201,6 +213,7 @@ int main(int argc, char **argv)
         std::printf("-mlod %d\n", modelLOD);
         std::printf("-vis %d\n", int(distantObjectsOnly));
         std::printf("-ndis %d\n", int(noDisabledObjects));
+        std::printf("-spatial %d\n", int(enableSpatialIndex));
         std::printf("-watercolor 0x%08X\n", (unsigned int) waterColor);
         std::printf("-wrefl %.3f\n", waterReflectionLevel);
         std::printf("-wscale %d\n", waterUVScale);
@@ -254,6 +267,29 @@ int main(int argc, char **argv)
                                         "invalid texture cache size",
                                         256, 65535);
       }
+      else if (std::strcmp(argv[i], "-txtthreads") == 0)
+      {
+        if (++i >= argc)
+          throw FO76UtilsError("missing argument for %s", argv[i - 1]);
+        textureThreadCnt =
+            int(parseInteger(argv[i], 10, "invalid number of threads", 0, 64));
+      }
+      else if (std::strcmp(argv[i], "-txtbc") == 0)
+      {
+        if (++i >= argc)
+          throw FO76UtilsError("missing argument for %s", argv[i - 1]);
+        textureBlocksResident =
+            bool(parseInteger(argv[i], 0, "invalid argument for -txtbc",
+                              0, 1));
+      }
+      else if (std::strcmp(argv[i], "-txtlazy") == 0)
+      {
+        if (++i >= argc)
+          throw FO76UtilsError("missing argument for %s", argv[i - 1]);
+        textureMipsOnDemand =
+            bool(parseInteger(argv[i], 0, "invalid argument for -txtlazy",
+                              0, 1));
+      }
       else if (std::strcmp(argv[i], "-mc") == 0)
       {
         if (++i >= argc)
@@ -487,6 +523,14 @@ int main(int argc, char **argv)
         noDisabledObjects =
             bool(parseInteger(argv[i], 0, "invalid argument for -ndis", 0, 1));
       }
+      else if (std::strcmp(argv[i], "-spatial") == 0)
+      {
+        if (++i >= argc)
+          throw FO76UtilsError("missing argument for %s", argv[i - 1]);
+        enableSpatialIndex =
+            bool(parseInteger(argv[i], 0, "invalid argument for -spatial",
+                              0, 1));
+      }
       else if (std::strcmp(argv[i], "-hqm") == 0)
       {
         if (++i >= argc)
@@ -556,6 +600,8 @@ int main(int argc, char **argv)
     zMax = zMax - zMin;
 
     BA2File ba2File(args[4]);
+    ba2File.setTextureThreadCount(textureThreadCnt);
+    ba2File.setVerifyChecksums(false);
     ESMFile esmFile(args[0]);
     if (!formID)
       formID = (esmFile.getESMVersion() < 0xC0U ? 0x0000003CU : 0x0025DA15U);
@@ -607,9 +653,12 @@ int main(int argc, char **argv)
                        (std::uint32_t *) 0, (float *) 0, zMax);
     renderer.setThreadCount(threadCnt);
     renderer.setTextureCacheSize(std::uint64_t(textureCacheSize) << 20);
+    renderer.setTextureBlocksResident(textureBlocksResident);
+    renderer.setTextureMipsOnDemand(textureMipsOnDemand);
     renderer.setModelCacheSize(modelBatchCnt);
     renderer.setDistantObjectsOnly(distantObjectsOnly);
     renderer.setNoDisabledObjects(noDisabledObjects);
+    renderer.setEnableSpatialIndex(enableSpatialIndex);
     renderer.setEnableSCOL(enableSCOL);
     renderer.setEnableAllObjects(enableAllObjects);
     renderer.setRenderQuality(renderQuality);
@@ -698,6 +747,18 @@ int main(int argc, char **argv)
                      b.xMax() * scale, b.yMax() * scale, b.zMax() * scale);
       }
     }
+    {
+      // the texture cache statistics are printed also in quiet mode
+      Renderer::TextureCacheStats c = renderer.getTextureCacheStats();
+      std::fprintf(stderr,
+                   "Texture cache: %llu hits, %llu misses, %llu evictions, "
+                   "%.1f MB loaded, %.1f MB in use\n",
+                   (unsigned long long) c.hitCnt,
+                   (unsigned long long) c.missCnt,
+                   (unsigned long long) c.evictionCnt,
+                   double(c.bytesLoaded) / 1048576.0,
+                   double(c.dataSize) / 1048576.0);
+    }
 
     width = width >> ssaaLevel;
     height = height >> ssaaLevel;
@@ -0,0 +1,172 @@
+
+#include "common.hpp"
+#include "filebuf.hpp"
+#include "zlib.hpp"
+#include "ba2file.hpp"
+
+#include <chrono>
+
+struct ZLibBenchFile
+{
+  std::vector< unsigned char >  uncompressedData;
+  std::vector< unsigned char >  compressedData;
+};
+
+static bool benchFilterFunction(void *p, const std::string_view& fileName)
+{
+  const std::vector< std::string >& patterns =
+      *(reinterpret_cast< const std::vector< std::string > * >(p));
+  if (patterns.empty())
+    return true;
+  for (const auto& i : patterns)
+  {
+    if (fileName.find(i) != std::string_view::npos)
+      return true;
+  }
+  return false;
+}
+
+// returns the time in seconds spent on decompressing all files n times
+static double runBenchmark(const std::vector< ZLibBenchFile >& fileList,
+                           int n, bool verifyChecksum,
+                           bool enableFastDecode)
+{
+  std::vector< unsigned char >  buf;
+  std::chrono::steady_clock::duration t(0);
+  for (const auto& i : fileList)
+  {
+    size_t  uncompressedSize = i.uncompressedData.size();
+    buf.resize(uncompressedSize);
+    std::chrono::steady_clock::time_point t0 = std::chrono::steady_clock::now();
+    for (int j = 0; j < n; j++)
+    {
+      if (ZLibDecompressor::decompressData(
+              buf.data(), uncompressedSize, i.compressedData.data(),
+              i.compressedData.size(), verifyChecksum, enableFastDecode)
+          != uncompressedSize)
+      {
+        errorMessage("invalid decompressed data size");
+      }
+    }
+    t += (std::chrono::steady_clock::now() - t0);
+    if (uncompressedSize &&
+        std::memcmp(buf.data(), i.uncompressedData.data(), uncompressedSize))
+    {
+      errorMessage("decompressed data does not match the original");
+    }
+  }
+  return std::chrono::duration< double >(t).count();
+}
+
+int main(int argc, char **argv)
+{
+  try
+  {
+    int     compressionLevel = 6;
+    int     iterationCnt = 5;
+    size_t  sizeLimit = 256;
+    while (argc >= 3 && argv[1][0] == '-' && argv[1][1] != '-')
+    {
+      if (std::strcmp(argv[1], "-level") == 0)
+      {
+        compressionLevel = int(parseInteger(argv[2], 10,
+                                            "invalid compression level",
+                                            0, 9));
+      }
+      else if (std::strcmp(argv[1], "-n") == 0)
+      {
+        iterationCnt = int(parseInteger(argv[2], 10,
+                                        "invalid iteration count", 1, 1000));
+      }
+      else if (std::strcmp(argv[1], "-limit") == 0)
+      {
+        sizeLimit = size_t(parseInteger(argv[2], 10,
+                                        "invalid size limit", 1, 4096));
+      }
+      else
+      {
+        throw FO76UtilsError("invalid option: %s", argv[1]);
+      }
+      argv[2] = argv[0];
+      argc = argc - 2;
+      argv = argv + 2;
+    }
+    int     inputCnt = argc - 1;
+    std::vector< std::string >  patterns;
+    for (int i = 1; i < argc; i++)
+    {
+      if (std::strcmp(argv[i], "--") != 0)
+        continue;
+      inputCnt = i - 1;
+      while (++i < argc)
+        patterns.push_back(argv[i]);
+      break;
+    }
+    if (inputCnt < 1)
+    {
+      std::fprintf(stderr, "Usage:\n\n");
+      std::fprintf(stderr, "%s [OPTIONS...] INPUTS... [-- PATTERNS...]\n\n",
+                   argv[0]);
+      std::fprintf(stderr, "Compress the files in INPUTS (archives, "
+                           "directories or loose files) with a\n");
+      std::fprintf(stderr, "name including any of the patterns, and "
+                           "compare the decompression\n");
+      std::fprintf(stderr, "throughput of the fast and careful "
+                           "ZLib decoders, and of the fast\n");
+      std::fprintf(stderr, "decoder without checksum verification.\n\n");
+      std::fprintf(stderr, "Options:\n");
+      std::fprintf(stderr, "    -level N        compression level, "
+                           "0 to 9 (default: 6)\n");
+      std::fprintf(stderr, "    -n N            number of times to "
+                           "decompress each file (default: 5)\n");
+      std::fprintf(stderr, "    -limit N        maximum total size of "
+                           "files to load in MiB (default: 256)\n");
+      return 1;
+    }
+
+    BA2File ba2File;
+    for (int i = 1; i <= inputCnt; i++)
+      ba2File.loadArchivePath(argv[i], &benchFilterFunction, &patterns);
+    std::vector< ZLibBenchFile >  fileList;
+    size_t  totalSize = 0;
+    size_t  compressedSize = 0;
+    BA2File::UCharArray buf;
+    for (const BA2File::FileInfo *fd : ba2File.getSortedFileList())
+    {
+      if (totalSize >= (sizeLimit << 20))
+        break;
+      ba2File.extractFile(buf, fd->fileName);
+      fileList.emplace_back();
+      ZLibBenchFile&  f = fileList.back();
+      f.uncompressedData.assign(buf.data, buf.data + buf.size);
+      ZLibCompressor::compressData(f.compressedData, buf.data, buf.size,
+                                   compressionLevel);
+      totalSize = totalSize + buf.size;
+      compressedSize = compressedSize + f.compressedData.size();
+    }
+    if (fileList.size() < 1)
+      errorMessage("no matching files found");
+    std::printf("%lu files, %.2f MiB, compressed to %.2f MiB at level %d\n",
+                (unsigned long) fileList.size(),
+                double(totalSize) / 1048576.0,
+                double(compressedSize) / 1048576.0, compressionLevel);
+    for (int i = 0; i < 3; i++)
+    {
+      static const char *benchNames[3] =
+      {
+        "careful:", "fast:", "no Adler-32:"
+      };
+      double  t = runBenchmark(fileList, iterationCnt, (i < 2), (i > 0));
+      std::printf("%-13s %8.3f s, %8.2f MiB/s\n", benchNames[i],
+                  t, double(totalSize) * double(iterationCnt)
+                     / (std::max(t, 0.000001) * 1048576.0));
+    }
+  }
+  catch (std::exception& e)
+  {
+    std::fprintf(stderr, "zlibbench: %s\n", e.what());
+    return 1;
+  }
+  return 0;
+}
+